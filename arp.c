@@ -0,0 +1,527 @@
+
+/*
+ * ARP prober for hosts on a directly attached subnet.
+ *
+ * ARP requests are sent straight onto the interface from an AF_PACKET
+ * socket, a batch at a time (sendmmsg), and the replies to us are
+ * taken from a packet ring (see ring.c).  A host answers ARP even when
+ * it firewalls ICMP, and the reply carries its MAC address as well.
+ */
+
+#define _GNU_SOURCE   /* for sendmmsg */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "ring.h"
+#include "arp.h"
+
+#if defined(linux) && defined(PACKET_MMAP)
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <net/if.h>
+#include <ifaddrs.h>
+#include <net/if_arp.h>
+#include <netinet/in.h>
+#include <netinet/if_ether.h>
+#include <arpa/inet.h>
+#include <linux/if_packet.h>
+
+#define ARP_BATCH        64    /* requests handed to the kernel at once */
+#define ARP_SNDBUF  (4 << 20)  /* room for a large sweep to queue up */
+#define ARP_ADDRS        16    /* addresses (subnets) of the interface */
+
+struct arp_port {
+  int                 fd;               /* AF_PACKET socket, send only */
+  PACKET_RING        *ring;             /* where the replies arrive */
+  struct sockaddr_ll  dest;             /* link layer broadcast */
+  unsigned char       mac[ETH_ALEN];    /* our own addresses */
+  struct in_addr      addr[ARP_ADDRS];
+  struct in_addr      mask[ARP_ADDRS];  /* netmask of each subnet */
+  int                 naddrs;
+  struct ether_arp    req[ARP_BATCH];   /* requests waiting to go */
+  struct iovec        iov[ARP_BATCH];
+  struct mmsghdr      msg[ARP_BATCH];
+  int                 queued;           /* number of requests waiting */
+  arp_handler         handler;          /* for arp_read */
+  void               *arg;
+};
+
+/****************************************************************************
+* Function Name      :   arp_open
+* Module ID          :   A(1)
+*
+* Purpose            :   To set up ARP probing on an ethernet interface.
+*
+* Method             :   Looks up the addresses and netmask of the
+*                        interface (all of its subnets), opens a packet socket to send on (which
+*                        receives nothing itself) and a packet ring for the
+*                        replies.
+*
+* Usage              :   main (M1)
+*
+* External References:   (none)
+*
+* Arguments          :   ifname: (data_in)
+*                                The interface to probe on.
+*
+* Return Value       :   ARP_PORT *
+*                                The prober, or NULL (with errno set).
+*
+* Input Assertions   :   Must be running with CAP_NET_RAW.
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   Linux only.
+\***************************************************************************/
+ARP_PORT *
+arp_open(ifname)
+char *ifname;
+{
+  ARP_PORT *a;
+  struct ifreq ifr;
+  struct ifaddrs *ifa, *p;
+  int ctl, size = ARP_SNDBUF, err;
+
+  a = (ARP_PORT *) calloc(1, sizeof(ARP_PORT));
+  if (!a) return NULL;
+  a->fd = -1;
+
+  /*
+   * Our own addresses, and the subnet they are on
+   */
+  if ((ctl = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+    goto fail;
+  memset(&ifr, 0, sizeof(ifr));
+  strncpy(ifr.ifr_name, ifname, IFNAMSIZ - 1);
+  if (ioctl(ctl, SIOCGIFHWADDR, &ifr) < 0) {
+    close(ctl);
+    goto fail;
+  }
+  if (ifr.ifr_hwaddr.sa_family != ARPHRD_ETHER) {
+    close(ctl);
+    errno = EPFNOSUPPORT;
+    goto fail;
+  }
+  memcpy(a->mac, ifr.ifr_hwaddr.sa_data, ETH_ALEN);
+  close(ctl);
+
+  if (getifaddrs(&ifa) < 0)
+    goto fail;
+  for (p = ifa; p && a->naddrs < ARP_ADDRS; p = p->ifa_next)
+    if (p->ifa_addr && p->ifa_netmask && p->ifa_addr->sa_family == AF_INET &&
+        strcmp(p->ifa_name, ifname) == 0) {
+      a->addr[a->naddrs] = ((struct sockaddr_in *) p->ifa_addr)->sin_addr;
+      a->mask[a->naddrs] = ((struct sockaddr_in *) p->ifa_netmask)->sin_addr;
+      a->naddrs++;
+    }
+  freeifaddrs(ifa);
+  if (!a->naddrs) {
+    errno = EADDRNOTAVAIL;
+    goto fail;
+  }
+
+  /*
+   * A protocol of 0 means the socket is never handed any packets
+   */
+  if ((a->fd = socket(AF_PACKET, SOCK_DGRAM, 0)) < 0)
+    goto fail;
+  if (setsockopt(a->fd, SOL_SOCKET, SO_SNDBUFFORCE, &size, sizeof(size)) < 0)
+    (void) setsockopt(a->fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+
+  a->dest.sll_family   = AF_PACKET;
+  a->dest.sll_protocol = htons(ETH_P_ARP);
+  a->dest.sll_ifindex  = if_nametoindex(ifname);
+  a->dest.sll_halen    = ETH_ALEN;
+  memset(a->dest.sll_addr, 0xff, ETH_ALEN);
+
+  if ((a->ring = ring_open_arp(ifname)) == NULL)
+    goto fail;
+
+  return a;
+
+fail:
+  err = errno;
+  arp_close(a);
+  errno = err;
+  return NULL;
+}
+
+/****************************************************************************
+* Function Name      :   arp_fd
+* Module ID          :   A(1)
+*
+* Purpose            :   To return the descriptor to wait on for replies.
+*
+* Method             :   The descriptor of the packet ring.
+*
+* Usage              :   wait_readable (M1)
+*
+* External References:   (none)
+*
+* Arguments          :   a: (data_in)
+*                                The prober.
+*
+* Return Value       :   int
+*                                The file descriptor.
+*
+* Input Assertions   :   a was returned by arp_open.
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   (none)
+\***************************************************************************/
+int
+arp_fd(a)
+ARP_PORT *a;
+{
+  return ring_fd(a->ring);
+}
+
+/*
+ * Which of our subnets an address is on (-1 for none, or if it is one
+ * of our own addresses)
+ */
+static int
+arp_subnet(a, addr)
+ARP_PORT *a; struct in_addr addr;
+{
+  int n;
+
+  for (n = 0; n < a->naddrs; n++)
+    if (addr.s_addr == a->addr[n].s_addr) return -1;
+  for (n = 0; n < a->naddrs; n++)
+    if ((addr.s_addr & a->mask[n].s_addr) == (a->addr[n].s_addr & a->mask[n].s_addr))
+      return n;
+  return -1;
+}
+
+/****************************************************************************
+* Function Name      :   arp_local
+* Module ID          :   A(1)
+*
+* Purpose            :   To tell whether an address can be probed by ARP.
+*
+* Method             :   Checks it is on one of the subnets of the
+*                        interface (and is not the interface itself).
+*
+* Usage              :   main (M1)
+*
+* External References:   (none)
+*
+* Arguments          :   a:    (data_in)
+*                                The prober.
+*                        addr: (data_in)
+*                                The address of a host.
+*
+* Return Value       :   int
+*                                1 if it is directly attached, otherwise 0.
+*
+* Input Assertions   :   a was returned by arp_open.
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   (none)
+\***************************************************************************/
+int
+arp_local(a, addr)
+ARP_PORT *a; struct in_addr addr;
+{
+  return arp_subnet(a, addr) >= 0;
+}
+
+/****************************************************************************
+* Function Name      :   arp_queue
+* Module ID          :   A(1)
+*
+* Purpose            :   To queue an ARP request for a host.
+*
+* Method             :   Fills in the next request of the batch, sending
+*                        the batch off once it is full.
+*
+* Usage              :   send_ping (M1)
+*
+* External References:   (none)
+*
+* Arguments          :   a:    (data_in)
+*                                The prober.
+*                        addr: (data_in)
+*                                The address of the host.
+*
+* Return Value       :   (none)
+*
+* Input Assertions   :   a was returned by arp_open.
+*
+* Output Assertions  :   The request is sent by the next arp_flush.
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   (none)
+\***************************************************************************/
+void
+arp_queue(a, addr)
+ARP_PORT *a; struct in_addr addr;
+{
+  struct ether_arp *req;
+  int n, sub;
+
+  if ((sub = arp_subnet(a, addr)) < 0) return;
+  if (a->queued == ARP_BATCH) (void) arp_flush(a);
+
+  n   = a->queued++;
+  req = &a->req[n];
+  memset(req, 0, sizeof(*req));
+  req->arp_hrd = htons(ARPHRD_ETHER);
+  req->arp_pro = htons(ETH_P_IP);
+  req->arp_hln = ETH_ALEN;
+  req->arp_pln = 4;
+  req->arp_op  = htons(ARPOP_REQUEST);
+  memcpy(req->arp_sha, a->mac, ETH_ALEN);
+  memcpy(req->arp_spa, &a->addr[sub], 4);  /* from our address on its subnet */
+  memcpy(req->arp_tpa, &addr, 4);
+
+  a->iov[n].iov_base           = req;
+  a->iov[n].iov_len            = sizeof(*req);
+  memset(&a->msg[n], 0, sizeof(a->msg[n]));
+  a->msg[n].msg_hdr.msg_name    = &a->dest;
+  a->msg[n].msg_hdr.msg_namelen = sizeof(a->dest);
+  a->msg[n].msg_hdr.msg_iov     = &a->iov[n];
+  a->msg[n].msg_hdr.msg_iovlen  = 1;
+}
+
+/****************************************************************************
+* Function Name      :   arp_flush
+* Module ID          :   A(1)
+*
+* Purpose            :   To send the queued ARP requests.
+*
+* Method             :   Hands the whole batch to the kernel in one go
+*                        (sendmmsg).
+*
+* Usage              :   arp_queue (A1), wait_readable (M1)
+*
+* External References:   (none)
+*
+* Arguments          :   a: (data_in)
+*                                The prober.
+*
+* Return Value       :   int
+*                                The number of requests sent, or -1 if the
+*                                send failed (with errno set).
+*
+* Input Assertions   :   a was returned by arp_open.
+*
+* Output Assertions  :   Nothing is left queued.
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   Requests that could not be sent are dropped, they
+*                        are treated as lost by the caller.
+\***************************************************************************/
+int
+arp_flush(a)
+ARP_PORT *a;
+{
+  int sent = 0, n = 0;
+
+  while (sent < a->queued) {
+    n = sendmmsg(a->fd, &a->msg[sent], a->queued - sent, 0);
+    if (n <= 0) break;
+    sent += n;
+  }
+  a->queued = 0;
+  return (n < 0 && sent == 0) ? -1 : sent;
+}
+
+/*
+ * Pick the sender out of each reply in the ring
+ */
+static void
+arp_reply(arg, pkt, len, mac, stamp)
+void *arg; unsigned char *pkt; int len; unsigned char *mac; struct timeval *stamp;
+{
+  ARP_PORT *a = (ARP_PORT *) arg;
+  struct ether_arp *rep = (struct ether_arp *) pkt;
+  unsigned char sha[14];
+  struct in_addr addr, target;
+  int n;
+
+  (void) mac;
+  if (len < (int) sizeof(*rep) ||
+      rep->arp_hrd != htons(ARPHRD_ETHER) || rep->arp_pro != htons(ETH_P_IP) ||
+      rep->arp_hln != ETH_ALEN || rep->arp_pln != 4) return;
+
+  /* Only replies to one of our own addresses */
+  memcpy(&target, rep->arp_tpa, 4);
+  for (n = 0; n < a->naddrs && target.s_addr != a->addr[n].s_addr; n++);
+  if (n == a->naddrs) return;
+
+  memset(sha, 0, sizeof(sha));
+  memcpy(sha, rep->arp_sha, ETH_ALEN);
+  memcpy(&addr, rep->arp_spa, 4);
+  a->handler(a->arg, addr, sha, stamp);
+}
+
+/****************************************************************************
+* Function Name      :   arp_read
+* Module ID          :   A(1)
+*
+* Purpose            :   To process all of the ARP replies waiting.
+*
+* Method             :   Reads the packet ring, calling the handler with the
+*                        sender of each reply.
+*
+* Usage              :   wait_readable (M1)
+*
+* External References:   (none)
+*
+* Arguments          :   a:       (data_in)
+*                                 The prober.
+*                        handler: (data_in)
+*                                 Called with the address, MAC and timestamp
+*                                 of each reply.
+*                        arg:     (data_in)
+*                                 Passed through to the handler.
+*
+* Return Value       :   int
+*                                The number of replies handled.
+*
+* Input Assertions   :   a was returned by arp_open.
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   (none)
+\***************************************************************************/
+int
+arp_read(a, handler, arg)
+ARP_PORT *a; arp_handler handler; void *arg;
+{
+  a->handler = handler;
+  a->arg     = arg;
+  return ring_read(a->ring, arp_reply, a);
+}
+
+/****************************************************************************
+* Function Name      :   arp_close
+* Module ID          :   A(1)
+*
+* Purpose            :   To release an ARP prober.
+*
+* Method             :   Closes the ring and the socket.
+*
+* Usage              :   arp_open (A1)
+*
+* External References:   (none)
+*
+* Arguments          :   a: (data_in)
+*                                The prober.
+*
+* Return Value       :   (none)
+*
+* Input Assertions   :   (none)
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   (none)
+\***************************************************************************/
+void
+arp_close(a)
+ARP_PORT *a;
+{
+  if (!a) return;
+  ring_close(a->ring);
+  if (a->fd >= 0) close(a->fd);
+  free(a);
+}
+
+#else
+
+/*
+ * Without packet sockets (and the ring) ARP probing can never be set
+ * up, and hosts are pinged as before.
+ */
+ARP_PORT *
+arp_open(ifname)
+char *ifname;
+{
+  (void) ifname;
+  errno = ENOSYS;
+  return NULL;
+}
+
+int
+arp_fd(a)
+ARP_PORT *a;
+{
+  (void) a;
+  return -1;
+}
+
+int
+arp_local(a, addr)
+ARP_PORT *a; struct in_addr addr;
+{
+  (void) a; (void) addr;
+  return 0;
+}
+
+void
+arp_queue(a, addr)
+ARP_PORT *a; struct in_addr addr;
+{
+  (void) a; (void) addr;
+}
+
+int
+arp_flush(a)
+ARP_PORT *a;
+{
+  (void) a;
+  return 0;
+}
+
+int
+arp_read(a, handler, arg)
+ARP_PORT *a; arp_handler handler; void *arg;
+{
+  (void) a; (void) handler; (void) arg;
+  return 0;
+}
+
+void
+arp_close(a)
+ARP_PORT *a;
+{
+  (void) a;
+}
+
+#endif
@@ -0,0 +1,18 @@
+
+#include <sys/time.h>
+#include <netinet/in.h>
+
+typedef struct arp_port ARP_PORT;
+
+/* called for each ARP reply: sender address, sender MAC (padded out to
+   14 bytes, as an ARP cache entry) and receive timestamp */
+typedef void (*arp_handler)(void *arg, struct in_addr addr,
+                            unsigned char *mac, struct timeval *stamp);
+
+extern ARP_PORT *arp_open(char *ifname);
+extern int arp_fd(ARP_PORT *a);
+extern int arp_local(ARP_PORT *a, struct in_addr addr);
+extern void arp_queue(ARP_PORT *a, struct in_addr addr);
+extern int arp_flush(ARP_PORT *a);
+extern int arp_read(ARP_PORT *a, arp_handler handler, void *arg);
+extern void arp_close(ARP_PORT *a);
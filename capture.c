@@ -0,0 +1,1056 @@
+/*
+ * Capture and replay of the probes (-capture, -replay).
+ *
+ * A capture is a pcap file (raw IPv4, microsecond timestamps) holding
+ * every echo request sent and every reply taken, stamped with the time
+ * it left and the time the kernel received it.  It can be read with
+ * tcpdump or wireshark as usual.
+ *
+ * A replay reads a capture (ours, or one taken by tcpdump) back in,
+ * pairs each request with its reply, and then stands in for the
+ * network and the clock: a probe the engine sends is answered if the
+ * host answered the request it was sent at that point in the capture,
+ * after the same round trip, and the clock jumps straight from one
+ * event to the next.  So the whole engine runs as it would have, with
+ * whatever timeout, retry and pacing it is given, in a fraction of the
+ * time.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+
+#include "capture.h"
+
+#define PCAP_MAGIC      0xa1b2c3d4   /* microsecond timestamps */
+#define PCAP_MAGIC_NS   0xa1b23c4d   /* nanosecond timestamps */
+#define LINK_ETHERNET   1
+#define LINK_RAW        101
+#define LINK_SLL        113          /* Linux "any" device */
+#define LINK_IPV4       228
+
+#define REPLAY_BUCKETS  4096         /* hash chains of the hosts */
+#define REPLAY_MATCH    64           /* requests looked back over for a reply */
+#define REPLY_MAX       64           /* longest reply made up */
+
+#define ICMP_REPLY      0
+#define ICMP_REQUEST    8
+
+struct pcap_file {
+  u_int32_t           magic;
+  u_int16_t           major;
+  u_int16_t           minor;
+  int32_t             zone;
+  u_int32_t           sigfigs;
+  u_int32_t           snaplen;
+  u_int32_t           link;
+};
+
+struct pcap_rec {
+  u_int32_t           sec;
+  u_int32_t           usec;             /* or nsec */
+  u_int32_t           incl;             /* bytes kept */
+  u_int32_t           orig;             /* bytes on the wire */
+};
+
+struct capture {
+  FILE               *fp;
+  struct in_addr      self;             /* our address, learnt from the replies */
+};
+
+/* an echo request in the capture */
+typedef struct replay_rec {
+  long                t;                /* usecs into the capture */
+  int                 rtt;              /* usecs, -1=not answered */
+  u_short             id;
+  u_short             seq;
+} REPLAY_REC;
+
+typedef struct replay_host {
+  struct in_addr      addr;
+  REPLAY_REC         *rec;              /* its requests, in time order */
+  int                 n;
+  int                 size;
+  struct replay_host *next;
+} REPLAY_HOST;
+
+/* a reply on its way back */
+typedef struct replay_reply {
+  struct timeval      when;
+  int                 len;
+  unsigned char       pkt[REPLY_MAX];
+} REPLAY_REPLY;
+
+struct replay {
+  REPLAY_HOST        *hash[REPLAY_BUCKETS];
+  struct timeval      base;             /* first packet */
+  struct timeval      end;              /* last packet */
+  struct timeval      now;              /* the clock */
+  struct timeval      wall;             /* when the replay started (system clock) */
+  REPLAY_REPLY       *heap;             /* replies due, soonest first */
+  int                 heap_n;
+  int                 heap_size;
+  REPLAY_STATS        stats;
+};
+
+static REPLAY *clock_from = NULL;       /* the capture the clock runs from */
+
+static u_short
+cksum(buf, len)
+unsigned char *buf; int len;
+{
+  u_int32_t sum = 0;
+  u_short word;
+
+  for (; len > 1; buf += 2, len -= 2) {
+    memcpy(&word, buf, 2);
+    sum += word;
+  }
+  if (len) {
+    word = 0;
+    memcpy(&word, buf, 1);
+    sum += word;
+  }
+  sum = (sum >> 16) + (sum & 0xffff);
+  sum += (sum >> 16);
+  return (u_short) ~sum;
+}
+
+static void
+ip_header(buf, src, dst, len)
+unsigned char *buf; struct in_addr src; struct in_addr dst; int len;
+{
+  u_short sum;
+
+  memset(buf, 0, 20);
+  buf[0] = 0x45;                        /* IPv4, 20 byte header */
+  buf[2] = (len >> 8) & 0xff;
+  buf[3] = len & 0xff;
+  buf[8] = 64;                          /* TTL */
+  buf[9] = IPPROTO_ICMP;
+  memcpy(buf + 12, &src, 4);
+  memcpy(buf + 16, &dst, 4);
+  sum = cksum(buf, 20);
+  memcpy(buf + 10, &sum, 2);
+}
+
+static void
+capture_write(c, when, pkt, len)
+CAPTURE *c; struct timeval *when; unsigned char *pkt; int len;
+{
+  struct pcap_rec rec;
+
+  rec.sec  = when->tv_sec;
+  rec.usec = when->tv_usec;
+  rec.orig = len;
+  rec.incl = len > CAPTURE_SNAP ? CAPTURE_SNAP : len;
+  (void) fwrite(&rec, sizeof(rec), 1, c->fp);
+  (void) fwrite(pkt, rec.incl, 1, c->fp);
+}
+
+/****************************************************************************
+* Function Name      :   capture_open
+* Module ID          :   P(1)
+*
+* Purpose            :   To start a capture of the probes and replies.
+*
+* Method             :   Creates the file and writes the pcap file header
+*                        (raw IPv4 packets, microsecond timestamps).
+*
+* Usage              :   ls_start (M1)
+*
+* External References:   (none)
+*
+* Arguments          :   path: (data_in)
+*                                The file to write.
+*
+* Return Value       :   CAPTURE *
+*                                The capture, or NULL (with errno set).
+*
+* Input Assertions   :   (none)
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   The packets are buffered, see capture_flush.
+\***************************************************************************/
+CAPTURE *
+capture_open(path)
+char *path;
+{
+  struct pcap_file hdr;
+  CAPTURE *c;
+  int err;
+
+  if ((c = (CAPTURE *) calloc(1, sizeof(CAPTURE))) == NULL) return NULL;
+  if ((c->fp = fopen(path, "w")) == NULL) {
+    err = errno;
+    free(c);
+    errno = err;
+    return NULL;
+  }
+  (void) setvbuf(c->fp, NULL, _IOFBF, 65536);
+
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.magic   = PCAP_MAGIC;
+  hdr.major   = 2;
+  hdr.minor   = 4;
+  hdr.snaplen = CAPTURE_SNAP;
+  hdr.link    = LINK_RAW;
+  if (fwrite(&hdr, sizeof(hdr), 1, c->fp) != 1 || fflush(c->fp) != 0) {
+    err = errno;
+    (void) fclose(c->fp);
+    free(c);
+    errno = err;
+    return NULL;
+  }
+  return c;
+}
+
+/****************************************************************************
+* Function Name      :   capture_probe
+* Module ID          :   P(1)
+*
+* Purpose            :   To capture an echo request as it is sent.
+*
+* Method             :   Puts an IP header in front of the ICMP message
+*                        (as the kernel would) and writes it out.
+*
+* Usage              :   send_ping, queue_ping (M1)
+*
+* External References:   (none)
+*
+* Arguments          :   c:    (data_in)
+*                                The capture.
+*                        when: (data_in)
+*                                The time it is sent.
+*                        to:   (data_in)
+*                                The host it is sent to.
+*                        icmp: (data_in)
+*                                The ICMP message.
+*                        len:  (data_in)
+*                                Its length.
+*
+* Return Value       :   (none)
+*
+* Input Assertions   :   (none)
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   The source address is ours as seen in the replies
+*                        so far (0.0.0.0 until the first).
+\***************************************************************************/
+void
+capture_probe(c, when, to, icmp, len)
+CAPTURE *c; struct timeval *when; struct in_addr to; unsigned char *icmp; int len;
+{
+  unsigned char pkt[CAPTURE_SNAP];
+
+  if (len > CAPTURE_SNAP - 20) len = CAPTURE_SNAP - 20;
+  ip_header(pkt, c->self, to, len + 20);
+  memcpy(pkt + 20, icmp, len);
+  capture_write(c, when, pkt, len + 20);
+}
+
+/****************************************************************************
+* Function Name      :   capture_reply
+* Module ID          :   P(1)
+*
+* Purpose            :   To capture a reply as it is taken.
+*
+* Method             :   Writes out the packet as received (from its IP
+*                        header), stamped with the time the kernel took it.
+*
+* Usage              :   process_reply (M1)
+*
+* External References:   (none)
+*
+* Arguments          :   c:    (data_in)
+*                                The capture.
+*                        when: (data_in)
+*                                The time it was received.
+*                        ip:   (data_in)
+*                                The packet.
+*                        len:  (data_in)
+*                                Its length.
+*
+* Return Value       :   (none)
+*
+* Input Assertions   :   len is at least an IP header.
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   (none)
+\***************************************************************************/
+void
+capture_reply(c, when, ip, len)
+CAPTURE *c; struct timeval *when; unsigned char *ip; int len;
+{
+  memcpy(&c->self, ip + 16, 4);  /* its destination is us */
+  capture_write(c, when, ip, len);
+}
+
+/****************************************************************************
+* Function Name      :   capture_flush
+* Module ID          :   P(1)
+*
+* Purpose            :   To write out the packets buffered so far.
+*
+* Method             :   Flushes the file.
+*
+* Usage              :   end_cycle (M1)
+*
+* External References:   (none)
+*
+* Arguments          :   c: (data_in)
+*                                The capture.
+*
+* Return Value       :   (none)
+*
+* Input Assertions   :   (none)
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   Done with each status message, so little is lost
+*                        if we are killed.
+\***************************************************************************/
+void
+capture_flush(c)
+CAPTURE *c;
+{
+  (void) fflush(c->fp);
+}
+
+/****************************************************************************
+* Function Name      :   capture_close
+* Module ID          :   P(1)
+*
+* Purpose            :   To finish a capture.
+*
+* Method             :   Closes the file, writing out what is buffered.
+*
+* Usage              :   ls_close (M1)
+*
+* External References:   (none)
+*
+* Arguments          :   c: (data_in)
+*                                The capture, or NULL.
+*
+* Return Value       :   (none)
+*
+* Input Assertions   :   (none)
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   (none)
+\***************************************************************************/
+void
+capture_close(c)
+CAPTURE *c;
+{
+  if (!c) return;
+  (void) fclose(c->fp);
+  free(c);
+}
+
+static REPLAY_HOST *
+find_host(r, addr, add)
+REPLAY *r; struct in_addr addr; int add;
+{
+  REPLAY_HOST *h;
+  u_int32_t b = ntohl(addr.s_addr);
+
+  b = (b ^ (b >> 12)) % REPLAY_BUCKETS;
+  for (h = r->hash[b]; h; h = h->next)
+    if (h->addr.s_addr == addr.s_addr) return h;
+  if (!add || (h = (REPLAY_HOST *) calloc(1, sizeof(REPLAY_HOST))) == NULL) return NULL;
+  h->addr = addr;
+  h->next = r->hash[b];
+  r->hash[b] = h;
+  r->stats.hosts++;
+  return h;
+}
+
+/* the IP header of a captured packet, NULL if it has none */
+static unsigned char *
+packet_ip(link, pkt, len, iplen)
+u_int32_t link; unsigned char *pkt; int len; int *iplen;
+{
+  int off = 0, type;
+
+  switch (link) {
+    case LINK_ETHERNET:
+      if (len < 14) return NULL;
+      type = pkt[12] << 8 | pkt[13];
+      off = 14;
+      if (type == 0x8100 && len >= 18) {  /* VLAN tagged */
+        type = pkt[16] << 8 | pkt[17];
+        off = 18;
+      }
+      if (type != 0x0800) return NULL;
+      break;
+    case LINK_SLL:
+      if (len < 16 || (pkt[14] << 8 | pkt[15]) != 0x0800) return NULL;
+      off = 16;
+      break;
+  }
+  if (len - off < 20 || (pkt[off] >> 4) != 4) return NULL;
+  *iplen = len - off;
+  return pkt + off;
+}
+
+/* take in an echo request or reply from the capture */
+static void
+replay_packet(r, t, ip, len)
+REPLAY *r; long t; unsigned char *ip; int len;
+{
+  struct in_addr addr;
+  REPLAY_HOST *h;
+  REPLAY_REC *rec;
+  u_short id, seq;
+  int hlen = (ip[0] & 15) * 4, i;
+
+  if (ip[9] != IPPROTO_ICMP || len < hlen + 8) return;
+  memcpy(&id,  ip + hlen + 4, 2);
+  memcpy(&seq, ip + hlen + 6, 2);
+
+  if (ip[hlen] == ICMP_REQUEST) {
+    memcpy(&addr, ip + 16, 4);
+    if ((h = find_host(r, addr, 1)) == NULL) return;
+    if (h->n == h->size) {
+      h->size = h->size ? h->size * 2 : 64;
+      if ((rec = (REPLAY_REC *) realloc(h->rec, h->size * sizeof(REPLAY_REC))) == NULL) {
+        h->size = h->n;
+        return;
+      }
+      h->rec = rec;
+    }
+    rec = &h->rec[h->n++];
+    rec->t   = t;
+    rec->rtt = -1;
+    rec->id  = id;
+    rec->seq = seq;
+    r->stats.packets++;
+
+  } else if (ip[hlen] == ICMP_REPLY) {
+    /* it answers the latest request to go unanswered with its id and seq */
+    memcpy(&addr, ip + 12, 4);
+    if ((h = find_host(r, addr, 0)) == NULL) return;
+    for (i = h->n - 1; i >= 0 && i >= h->n - REPLAY_MATCH; i--) {
+      rec = &h->rec[i];
+      if (rec->id != id || rec->seq != seq) continue;
+      if (rec->rtt < 0 && t >= rec->t && t - rec->t < 60 * 1000000L) {
+        rec->rtt = t - rec->t;
+        r->stats.answered++;
+      }
+      break;
+    }
+  }
+}
+
+static int
+by_time(a, b)
+const void *a; const void *b;
+{
+  long d = ((const REPLAY_REC *) a)->t - ((const REPLAY_REC *) b)->t;
+
+  return d < 0 ? -1 : (d > 0 ? 1 : 0);
+}
+
+/****************************************************************************
+* Function Name      :   replay_open
+* Module ID          :   P(1)
+*
+* Purpose            :   To read in a capture to be replayed, and start the
+*                        clock from it.
+*
+* Method             :   Reads each packet, keeping the echo requests of
+*                        each host in time order and pairing each reply
+*                        with the request it answers (by ICMP id and seq).
+*                        Ethernet, Linux cooked and raw IPv4 captures are
+*                        taken, with either byte order and micro or nano
+*                        second timestamps.
+*
+* Usage              :   process_command_line (M1)
+*
+* External References:   (none)
+*
+* Arguments          :   path: (data_in)
+*                                The pcap file.
+*
+* Return Value       :   REPLAY *
+*                                The replay, or NULL (with errno set).
+*
+* Input Assertions   :   (none)
+*
+* Output Assertions  :   From here on the clock (replay_gettimeofday and
+*                        replay_time) is that of the capture, starting
+*                        at its first packet.
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   Only the echo requests and replies are of use;
+*                        anything else in the capture is passed over.
+\***************************************************************************/
+REPLAY *
+replay_open(path)
+char *path;
+{
+  static unsigned char pkt[65536];
+  struct pcap_file hdr;
+  struct pcap_rec rec;
+  struct timeval when;
+  REPLAY_HOST *h;
+  REPLAY *r;
+  FILE *fp;
+  unsigned char *ip;
+  int swap, nsec, first = 1, len, b;
+
+  if ((fp = fopen(path, "r")) == NULL) return NULL;
+  if (fread(&hdr, sizeof(hdr), 1, fp) != 1) {
+    (void) fclose(fp);
+    errno = EINVAL;
+    return NULL;
+  }
+  swap = (hdr.magic == __builtin_bswap32(PCAP_MAGIC) || hdr.magic == __builtin_bswap32(PCAP_MAGIC_NS));
+  if (swap) {
+    hdr.magic = __builtin_bswap32(hdr.magic);
+    hdr.link  = __builtin_bswap32(hdr.link);
+  }
+  nsec = (hdr.magic == PCAP_MAGIC_NS);
+  if (hdr.magic != PCAP_MAGIC && !nsec) {
+    (void) fclose(fp);
+    errno = EINVAL;
+    return NULL;
+  }
+  hdr.link &= 0xffff;  /* the rest are flags */
+  if (hdr.link != LINK_RAW && hdr.link != LINK_IPV4 && hdr.link != LINK_ETHERNET && hdr.link != LINK_SLL) {
+    (void) fclose(fp);
+    errno = EPROTONOSUPPORT;
+    return NULL;
+  }
+  if ((r = (REPLAY *) calloc(1, sizeof(REPLAY))) == NULL) {
+    (void) fclose(fp);
+    return NULL;
+  }
+
+  while (fread(&rec, sizeof(rec), 1, fp) == 1) {
+    if (swap) {
+      rec.sec  = __builtin_bswap32(rec.sec);
+      rec.usec = __builtin_bswap32(rec.usec);
+      rec.incl = __builtin_bswap32(rec.incl);
+    }
+    if (rec.incl > sizeof(pkt) || fread(pkt, rec.incl, 1, fp) != 1) break;  /* cut short */
+
+    when.tv_sec  = rec.sec;
+    when.tv_usec = nsec ? rec.usec / 1000 : rec.usec;
+    if (first) {
+      r->base = when;
+      first = 0;
+    }
+    if (timercmp(&when, &r->end, >)) r->end = when;
+    if ((ip = packet_ip(hdr.link, pkt, (int) rec.incl, &len)) != NULL)
+      replay_packet(r, (when.tv_sec - r->base.tv_sec) * 1000000L + (when.tv_usec - r->base.tv_usec), ip, len);
+  }
+  (void) fclose(fp);
+
+  if (!r->stats.packets) {
+    free(r);
+    errno = ENODATA;  /* no echo requests in it */
+    return NULL;
+  }
+  for (b = 0; b < REPLAY_BUCKETS; b++)
+    for (h = r->hash[b]; h; h = h->next)
+      qsort(h->rec, h->n, sizeof(REPLAY_REC), by_time);
+  r->stats.span = r->end.tv_sec - r->base.tv_sec;
+
+  r->now = r->base;
+  (void) gettimeofday(&r->wall, NULL);
+  clock_from = r;
+  return r;
+}
+
+/****************************************************************************
+* Function Name      :   replay_known
+* Module ID          :   P(1)
+*
+* Purpose            :   To tell whether a host was probed in the capture.
+*
+* Method             :   Looks it up by address.
+*
+* Usage              :   ls_start (M1)
+*
+* External References:   (none)
+*
+* Arguments          :   r:    (data_in)
+*                                The replay.
+*                        host: (data_in)
+*                                Its address.
+*
+* Return Value       :   int
+*                                1 if it was, otherwise 0.
+*
+* Input Assertions   :   (none)
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   (none)
+\***************************************************************************/
+int
+replay_known(r, host)
+REPLAY *r; struct in_addr host;
+{
+  return find_host(r, host, 0) != NULL;
+}
+
+/* the last request sent at or before t, -1 if none */
+static int
+rec_at(h, t)
+REPLAY_HOST *h; long t;
+{
+  int lo = 0, hi = h->n - 1, mid;
+
+  while (lo <= hi) {
+    mid = (lo + hi) / 2;
+    if (h->rec[mid].t <= t) lo = mid + 1;
+    else hi = mid - 1;
+  }
+  return hi;
+}
+
+static long
+capture_usec(r, when)
+REPLAY *r; struct timeval *when;
+{
+  return (when->tv_sec - r->base.tv_sec) * 1000000L + (when->tv_usec - r->base.tv_usec);
+}
+
+/****************************************************************************
+* Function Name      :   replay_probe
+* Module ID          :   P(1)
+*
+* Purpose            :   To send a probe, when replaying.
+*
+* Method             :   Finds the request sent to the host at that point
+*                        in the capture (or its first), and if that was
+*                        answered, makes up the reply to this probe and
+*                        sets it to arrive after the same round trip.
+*
+* Usage              :   send_ping (M1)
+*
+* External References:   (none)
+*
+* Arguments          :   r:    (data_in)
+*                                The replay.
+*                        when: (data_in)
+*                                The time it is sent.
+*                        to:   (data_in)
+*                                The host it is sent to.
+*                        icmp: (data_in)
+*                                The ICMP echo request.
+*                        len:  (data_in)
+*                                Its length.
+*
+* Return Value       :   int
+*                                1 if it will be answered, 0 if not, -1 if
+*                                the host is not in the capture.
+*
+* Input Assertions   :   (none)
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   (none)
+\***************************************************************************/
+int
+replay_probe(r, when, to, icmp, len)
+REPLAY *r; struct timeval *when; struct in_addr to; unsigned char *icmp; int len;
+{
+  REPLAY_HOST *h;
+  REPLAY_REPLY *reply, tmp;
+  struct timeval rtt;
+  struct in_addr self;
+  u_short sum;
+  int i, up;
+
+  r->stats.probes++;
+  if ((h = find_host(r, to, 0)) == NULL) return -1;
+  if ((i = rec_at(h, capture_usec(r, when))) < 0) i = 0;
+  if (h->rec[i].rtt < 0) return 0;
+  if (len > REPLY_MAX - 20) return 0;
+
+  if (r->heap_n == r->heap_size) {
+    r->heap_size = r->heap_size ? r->heap_size * 2 : 256;
+    if ((reply = (REPLAY_REPLY *) realloc(r->heap, r->heap_size * sizeof(REPLAY_REPLY))) == NULL) {
+      r->heap_size = r->heap_n;
+      return 0;  /* as good as lost */
+    }
+    r->heap = reply;
+  }
+
+  reply = &r->heap[r->heap_n];
+  rtt.tv_sec  = h->rec[i].rtt / 1000000;
+  rtt.tv_usec = h->rec[i].rtt % 1000000;
+  timeradd(when, &rtt, &reply->when);
+  reply->len = len + 20;
+  self.s_addr = 0;
+  ip_header(reply->pkt, to, self, len + 20);
+  memcpy(reply->pkt + 20, icmp, len);
+  reply->pkt[20] = ICMP_REPLY;
+  reply->pkt[22] = reply->pkt[23] = 0;
+  sum = cksum(reply->pkt + 20, len);
+  memcpy(reply->pkt + 22, &sum, 2);
+
+  /* up the heap, by the time it arrives */
+  for (i = r->heap_n++; i > 0; i = up) {
+    up = (i - 1) / 2;
+    if (!timercmp(&r->heap[i].when, &r->heap[up].when, <)) break;
+    tmp = r->heap[i];
+    r->heap[i] = r->heap[up];
+    r->heap[up] = tmp;
+  }
+  return 1;
+}
+
+/****************************************************************************
+* Function Name      :   replay_next
+* Module ID          :   P(1)
+*
+* Purpose            :   To take the next reply due by a given time.
+*
+* Method             :   Pops the soonest reply off the heap, if it has
+*                        arrived by then.
+*
+* Usage              :   replay_wait (M1)
+*
+* External References:   (none)
+*
+* Arguments          :   r:     (data_in)
+*                                The replay.
+*                        until: (data_in)
+*                                The time to look up to.
+*                        buf:   (data_out)
+*                                The reply, from its IP header (REPLY_MAX
+*                                bytes at most).
+*                        stamp: (data_out)
+*                                The time it arrives.
+*
+* Return Value       :   int
+*                                Its length, or 0 if none is due.
+*
+* Input Assertions   :   (none)
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   (none)
+\***************************************************************************/
+int
+replay_next(r, until, buf, stamp)
+REPLAY *r; struct timeval *until; unsigned char *buf; struct timeval *stamp;
+{
+  REPLAY_REPLY tmp;
+  int i, down, len;
+
+  if (!r->heap_n || timercmp(&r->heap[0].when, until, >)) return 0;
+  len    = r->heap[0].len;
+  *stamp = r->heap[0].when;
+  memcpy(buf, r->heap[0].pkt, len);
+
+  /* and down the heap with the last one */
+  r->heap[0] = r->heap[--r->heap_n];
+  for (i = 0; (down = 2 * i + 1) < r->heap_n; i = down) {
+    if (down + 1 < r->heap_n && timercmp(&r->heap[down + 1].when, &r->heap[down].when, <))
+      down++;
+    if (!timercmp(&r->heap[down].when, &r->heap[i].when, <)) break;
+    tmp = r->heap[i];
+    r->heap[i] = r->heap[down];
+    r->heap[down] = tmp;
+  }
+  return len;
+}
+
+/****************************************************************************
+* Function Name      :   replay_advance
+* Module ID          :   P(1)
+*
+* Purpose            :   To move the clock on.
+*
+* Method             :   Sets it to the given time, unless it is already
+*                        past it.
+*
+* Usage              :   replay_wait (M1)
+*
+* External References:   (none)
+*
+* Arguments          :   r:  (data_in)
+*                                The replay.
+*                        to: (data_in)
+*                                The time to move to.
+*
+* Return Value       :   (none)
+*
+* Input Assertions   :   (none)
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   The clock never goes back.
+\***************************************************************************/
+void
+replay_advance(r, to)
+REPLAY *r; struct timeval *to;
+{
+  if (timercmp(to, &r->now, >)) r->now = *to;
+}
+
+/****************************************************************************
+* Function Name      :   replay_over
+* Module ID          :   P(1)
+*
+* Purpose            :   To tell whether the clock has run past the end of
+*                        the capture.
+*
+* Method             :   Compares it with the last packet.
+*
+* Usage              :   replay_wait (M1)
+*
+* External References:   (none)
+*
+* Arguments          :   r: (data_in)
+*                                The replay.
+*
+* Return Value       :   int
+*                                1 if it has, otherwise 0.
+*
+* Input Assertions   :   (none)
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   (none)
+\***************************************************************************/
+int
+replay_over(r)
+REPLAY *r;
+{
+  return timercmp(&r->now, &r->end, >);
+}
+
+/****************************************************************************
+* Function Name      :   replay_down
+* Module ID          :   P(1)
+*
+* Purpose            :   To score a host going down during the replay.
+*
+* Method             :   Looks back over the host's requests in the
+*                        capture from that point.  If the last of them was
+*                        answered, or the next one is, the host was only
+*                        lost for a moment (a false alarm).  Otherwise the
+*                        time since the first of the unanswered run is how
+*                        long it took to detect.
+*
+* Usage              :   mark_unreachable (M1)
+*
+* External References:   (none)
+*
+* Arguments          :   r:    (data_in)
+*                                The replay.
+*                        host: (data_in)
+*                                Its address.
+*                        when: (data_in)
+*                                The time it went down.
+*
+* Return Value       :   (none)
+*
+* Input Assertions   :   (none)
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   A host still down at the end of the capture is
+*                        taken as really down.
+\***************************************************************************/
+void
+replay_down(r, host, when)
+REPLAY *r; struct in_addr host; struct timeval *when;
+{
+  REPLAY_HOST *h;
+  long latency;
+  int i, j;
+
+  r->stats.downs++;
+  if ((h = find_host(r, host, 0)) == NULL) return;
+  if ((i = rec_at(h, capture_usec(r, when))) < 0 || h->rec[i].rtt >= 0 ||
+      (i + 1 < h->n && h->rec[i + 1].rtt >= 0)) {
+    r->stats.false_downs++;
+    return;
+  }
+  for (j = i; j > 0 && h->rec[j - 1].rtt < 0; j--) ;
+  latency = (capture_usec(r, when) - h->rec[j].t) / 1000;
+  r->stats.latency_total += latency;
+  if (latency > r->stats.latency_max) r->stats.latency_max = latency;
+}
+
+/****************************************************************************
+* Function Name      :   replay_stats
+* Module ID          :   P(1)
+*
+* Purpose            :   To report how the replay went.
+*
+* Method             :   Copies out the counts, with the time it has taken.
+*
+* Usage              :   replay_done (M1)
+*
+* External References:   (none)
+*
+* Arguments          :   r: (data_in)
+*                                The replay.
+*                        s: (data_out)
+*                                The counts.
+*
+* Return Value       :   (none)
+*
+* Input Assertions   :   (none)
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   (none)
+\***************************************************************************/
+void
+replay_stats(r, s)
+REPLAY *r; REPLAY_STATS *s;
+{
+  struct timeval now;
+
+  (void) gettimeofday(&now, NULL);
+  *s = r->stats;
+  s->wall = (now.tv_sec - r->wall.tv_sec) + (now.tv_usec - r->wall.tv_usec) / 1000000.0;
+}
+
+/****************************************************************************
+* Function Name      :   replay_gettimeofday
+* Module ID          :   P(1)
+*
+* Purpose            :   To tell the time, as gettimeofday.
+*
+* Method             :   Gives the replay clock once a capture is being
+*                        replayed, otherwise the system clock.
+*
+* Usage              :   linkstat (M1), in place of gettimeofday
+*
+* External References:   (none)
+*
+* Arguments          :   tv: (data_out)
+*                                The time.
+*                        tz: (data_out)
+*                                As for gettimeofday.
+*
+* Return Value       :   int
+*                                0, or -1 (with errno set).
+*
+* Input Assertions   :   (none)
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   (none)
+\***************************************************************************/
+int
+replay_gettimeofday(tv, tz)
+struct timeval *tv; struct timezone *tz;
+{
+  if (!clock_from) return gettimeofday(tv, tz);
+  *tv = clock_from->now;
+  return 0;
+}
+
+/****************************************************************************
+* Function Name      :   replay_time
+* Module ID          :   P(1)
+*
+* Purpose            :   To tell the time, as time.
+*
+* Method             :   As replay_gettimeofday, in seconds.
+*
+* Usage              :   linkstat (M1), in place of time
+*
+* External References:   (none)
+*
+* Arguments          :   t: (data_out)
+*                                Also set to the time, unless NULL.
+*
+* Return Value       :   time_t
+*                                The time.
+*
+* Input Assertions   :   (none)
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   (none)
+\***************************************************************************/
+time_t
+replay_time(t)
+time_t *t;
+{
+  if (!clock_from) return time(t);
+  if (t) *t = clock_from->now.tv_sec;
+  return clock_from->now.tv_sec;
+}
@@ -0,0 +1,42 @@
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+
+typedef struct capture CAPTURE;   /* pcap file the probes are written to */
+typedef struct replay  REPLAY;    /* capture being replayed */
+
+#define CAPTURE_SNAP    256   /* most of a packet kept */
+
+/* what came of a replay */
+typedef struct replay_stats {
+  long                packets;          /* echo requests in the capture */
+  long                answered;         /* and those answered */
+  int                 hosts;            /* hosts probed in it */
+  long                span;             /* secs it covers */
+  double              wall;             /* secs it took to replay */
+  long                probes;           /* probes sent by the replay */
+  int                 downs;            /* hosts going down */
+  int                 false_downs;      /* of them, answering again at once */
+  long                latency_total;    /* time to detect the real ones (msecs) */
+  long                latency_max;
+} REPLAY_STATS;
+
+extern CAPTURE *capture_open(char *path);
+extern void capture_probe(CAPTURE *c, struct timeval *when, struct in_addr to, unsigned char *icmp, int len);
+extern void capture_reply(CAPTURE *c, struct timeval *when, unsigned char *ip, int len);
+extern void capture_flush(CAPTURE *c);
+extern void capture_close(CAPTURE *c);
+
+extern REPLAY *replay_open(char *path);
+extern int replay_known(REPLAY *r, struct in_addr host);
+extern int replay_probe(REPLAY *r, struct timeval *when, struct in_addr to, unsigned char *icmp, int len);
+extern int replay_next(REPLAY *r, struct timeval *until, unsigned char *buf, struct timeval *stamp);
+extern void replay_advance(REPLAY *r, struct timeval *to);
+extern int replay_over(REPLAY *r);
+extern void replay_down(REPLAY *r, struct in_addr host, struct timeval *when);
+extern void replay_stats(REPLAY *r, REPLAY_STATS *s);
+
+/* the clock, that of the capture while one is being replayed */
+extern int replay_gettimeofday(struct timeval *tv, struct timezone *tz);
+extern time_t replay_time(time_t *t);
@@ -0,0 +1,1257 @@
+
+/*
+ * Cluster mode, for a fleet of hosts too big for one box.
+ *
+ * Several nodes share one hosts list.  Each sends a heartbeat to the
+ * aggregator, which answers with the nodes it has heard from lately.
+ * Every node places those nodes on the same hash ring (CLUSTER_VNODES
+ * points each) and probes only the hosts that land on its own points,
+ * so when a node comes or goes only that node's share of the hosts
+ * moves, spread over the others.  The nodes also send their state
+ * changes and SLA windows, which the aggregator merges into one view
+ * of the whole fleet.
+ *
+ * Messages are a line of text in a UDP datagram:
+ *   HELLO <node> <beat msecs> <hosts> <probed> <down>
+ *   STATE <node> <host> up|down <when>
+ *   SLA <node> <host> up|down (<down> <count> <period> for each window)
+ *   BYE <node>
+ *   MEMBERS <node>...                          (from the aggregator)
+ *
+ * With a shared key (cluster_key) each one is followed by " <seq>
+ * <mac>": the sender's clock in msecs (kept rising), and the HMAC-SHA256
+ * of everything before the mac, in hex.  Messages that fail the mac,
+ * are more than CLUSTER_SKEW secs adrift, or are not later than the
+ * last from the same sender are dropped, so they can be neither forged
+ * nor replayed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+
+#include "cluster.h"
+#include "sla.h"
+#include "version.h"
+
+#define AGG_BUCKETS   65536   /* hash chains of the hosts heard of */
+#define CLUSTER_KEY     256   /* longest shared key */
+#define CLUSTER_SKEW     30   /* secs a message's clock may be adrift */
+
+struct cluster_node {
+  int                 fd;               /* UDP socket, connected to the aggregator */
+  char                name[CLUSTER_NAME];
+  unsigned long long  agg_seq;          /* of the aggregator's last message */
+};
+
+struct cluster_ring {
+  int                 n;                /* points on the ring */
+  struct {
+    u_int32_t         point;
+    int               node;             /* index into names */
+  }                  *p;
+  char              **names;            /* the nodes */
+  int                 count;
+};
+
+/* a node, as seen by the aggregator */
+typedef struct agg_node {
+  char                name[CLUSTER_NAME];
+  struct sockaddr_in  addr;             /* where its heartbeats come from */
+  time_t              last;             /* time of its last heartbeat */
+  int                 beat;             /* msecs between its heartbeats */
+  int                 hosts;            /* hosts in the list */
+  int                 probed;           /* of them it is probing */
+  int                 down;             /* of those, unreachable */
+  unsigned long long  seq;              /* of its last message */
+} AGG_NODE;
+
+/* the SLA windows of a host, as one node last reported them */
+typedef struct agg_sla {
+  char                node[CLUSTER_NAME];
+  long                down[SLA_WINDOWS];
+  int                 count[SLA_WINDOWS];
+  long                period[SLA_WINDOWS];
+  struct agg_sla     *next;
+} AGG_SLA;
+
+/* a host heard of from the nodes (only those that have been down) */
+typedef struct agg_host {
+  char               *name;
+  int                 up;               /* 1=up, 0=down */
+  char                node[CLUSTER_NAME]; /* node that last reported it */
+  time_t              since;            /* time of its last change */
+  AGG_SLA            *sla;              /* from each node that has had it */
+  struct agg_host    *next;             /* hash chain */
+} AGG_HOST;
+
+static AGG_NODE      nodes[CLUSTER_NODES];
+static int           num_nodes = 0;
+static AGG_HOST    **hosts     = NULL;
+static int           num_known = 0;     /* hosts heard of */
+static CLUSTER_RING *members   = NULL;  /* ring of the live nodes */
+static time_t        agg_start;
+static volatile int  agg_report = 0;    /* SIGUSR2, report the windows */
+static volatile int  agg_quit   = 0;    /* SIGHUP, report and exit */
+static long          rejected   = 0;    /* messages dropped since the last status */
+
+static unsigned char key[CLUSTER_KEY];  /* shared key, none=not signed */
+static int           key_len    = 0;
+static unsigned long long sent_seq = 0; /* of our last message */
+
+static char *
+stamp()
+{
+  static char buf[25];
+  time_t now = time(NULL);
+  struct tm *the_time = localtime(&now);
+
+  /* FORMAT DDD MMM DD HH:MM:SS YYYY, as the daemon logs */
+  if (the_time == NULL || strftime(buf, 25, "%a %h %e %H:%M:%S %Y", the_time) == 0)
+    strcpy(buf, "n/a");
+  return buf;
+}
+
+/*
+ * Where a name (or node and point number) falls on the ring: FNV-1a
+ * with a final mix, as node names are often alike.
+ */
+static u_int32_t
+hash_key(key, v)
+char *key; u_int32_t v;
+{
+  u_int32_t h = 2166136261U;
+
+  while (*key) h = (h ^ (unsigned char) *key++) * 16777619U;
+  h = (h ^ v) * 16777619U;
+  h ^= h >> 16;
+  h *= 0x85ebca6bU;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35U;
+  h ^= h >> 16;
+  return h;
+}
+
+/*
+ * SHA-256 (FIPS 180-4), for the message macs
+ */
+typedef struct sha256 {
+  u_int32_t           h[8];
+  unsigned char       buf[64];
+  int                 n;                /* bytes in buf */
+  u_int64_t           len;              /* bytes added */
+} SHA256;
+
+static const u_int32_t sha_k[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROR(x, n)  (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void
+sha_block(s, p)
+SHA256 *s; unsigned char *p;
+{
+  u_int32_t w[64], a, b, c, d, e, f, g, h, t1, t2;
+  int i;
+
+  for (i = 0; i < 16; i++)
+    w[i] = (u_int32_t) p[4*i] << 24 | (u_int32_t) p[4*i+1] << 16 | (u_int32_t) p[4*i+2] << 8 | p[4*i+3];
+  for (; i < 64; i++)
+    w[i] = w[i-16] + (ROR(w[i-15], 7) ^ ROR(w[i-15], 18) ^ (w[i-15] >> 3)) +
+           w[i-7] + (ROR(w[i-2], 17) ^ ROR(w[i-2], 19) ^ (w[i-2] >> 10));
+
+  a = s->h[0]; b = s->h[1]; c = s->h[2]; d = s->h[3];
+  e = s->h[4]; f = s->h[5]; g = s->h[6]; h = s->h[7];
+  for (i = 0; i < 64; i++) {
+    t1 = h + (ROR(e, 6) ^ ROR(e, 11) ^ ROR(e, 25)) + ((e & f) ^ (~e & g)) + sha_k[i] + w[i];
+    t2 = (ROR(a, 2) ^ ROR(a, 13) ^ ROR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+    h = g; g = f; f = e; e = d + t1;
+    d = c; c = b; b = a; a = t1 + t2;
+  }
+  s->h[0] += a; s->h[1] += b; s->h[2] += c; s->h[3] += d;
+  s->h[4] += e; s->h[5] += f; s->h[6] += g; s->h[7] += h;
+}
+
+static void
+sha_init(s)
+SHA256 *s;
+{
+  static const u_int32_t h0[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+  };
+
+  memcpy(s->h, h0, sizeof(h0));
+  s->n   = 0;
+  s->len = 0;
+}
+
+static void
+sha_add(s, p, len)
+SHA256 *s; unsigned char *p; int len;
+{
+  s->len += len;
+  while (len > 0) {
+    s->buf[s->n++] = *p++;
+    len--;
+    if (s->n == 64) {
+      sha_block(s, s->buf);
+      s->n = 0;
+    }
+  }
+}
+
+static void
+sha_done(s, out)
+SHA256 *s; unsigned char *out;
+{
+  u_int64_t bits = s->len * 8;
+  unsigned char pad = 0x80;
+  int i;
+
+  sha_add(s, &pad, 1);
+  pad = 0;
+  while (s->n != 56) sha_add(s, &pad, 1);
+  for (i = 7; i >= 0; i--) {
+    pad = (unsigned char) (bits >> (8 * i));
+    sha_add(s, &pad, 1);
+  }
+  for (i = 0; i < 32; i++)
+    out[i] = (unsigned char) (s->h[i / 4] >> (24 - 8 * (i % 4)));
+}
+
+/*
+ * The mac of a message (RFC 2104 HMAC with the shared key), in hex
+ */
+static void
+mac(msg, len, hex)
+char *msg; int len; char *hex;
+{
+  unsigned char k[64], pad[64], sum[32];
+  SHA256 s;
+  int i;
+
+  memset(k, 0, sizeof(k));
+  if (key_len > 64) {
+    sha_init(&s);
+    sha_add(&s, key, key_len);
+    sha_done(&s, k);
+  } else
+    memcpy(k, key, key_len);
+
+  for (i = 0; i < 64; i++) pad[i] = k[i] ^ 0x36;
+  sha_init(&s);
+  sha_add(&s, pad, 64);
+  sha_add(&s, (unsigned char *) msg, len);
+  sha_done(&s, sum);
+  for (i = 0; i < 64; i++) pad[i] = k[i] ^ 0x5c;
+  sha_init(&s);
+  sha_add(&s, pad, 64);
+  sha_add(&s, sum, 32);
+  sha_done(&s, sum);
+
+  for (i = 0; i < 32; i++) sprintf(hex + 2 * i, "%02x", sum[i]);
+}
+
+static unsigned long long
+clock_msecs()
+{
+  struct timeval now;
+
+  gettimeofday(&now, NULL);
+  return (unsigned long long) now.tv_sec * 1000 + now.tv_usec / 1000;
+}
+
+/*
+ * Sign a message of len bytes in buf (of size), if there is a key.
+ * Returns its length now, or -1 if there is no room.
+ */
+static int
+sign(buf, len, size)
+char *buf; int len, size;
+{
+  unsigned long long seq = clock_msecs();
+
+  if (!key_len) return len;
+  if (seq <= sent_seq) seq = sent_seq + 1;  /* kept rising */
+  sent_seq = seq;
+  len += snprintf(buf + len, size - len, " %llu", seq);
+  if (len + 1 + 64 >= size) return -1;
+  buf[len] = ' ';
+  mac(buf, len, buf + len + 1);
+  return len + 1 + 64;
+}
+
+/*
+ * Check the mac and clock of a message, if there is a key, leaving
+ * just the message.  Returns 0 (with its seq, 0 if not signed), or -1
+ * if it is to be dropped.
+ */
+static int
+verify(msg, seq)
+char *msg; unsigned long long *seq;
+{
+  char want[65], *sp, *ep;
+  unsigned long long now;
+  int i, diff = 0;
+
+  *seq = 0;
+  if (!key_len) return 0;
+  if ((sp = strrchr(msg, ' ')) == NULL || strlen(sp + 1) != 64) return -1;
+  mac(msg, sp - msg, want);
+  for (i = 0; i < 64; i++) diff |= want[i] ^ sp[1 + i];  /* in constant time */
+  if (diff) return -1;
+
+  *sp = '\0';
+  if ((sp = strrchr(msg, ' ')) == NULL) return -1;
+  *seq = strtoull(sp + 1, &ep, 10);
+  if (*ep) return -1;
+  *sp = '\0';
+
+  now = clock_msecs();
+  if (*seq + CLUSTER_SKEW * 1000ULL < now || *seq > now + CLUSTER_SKEW * 1000ULL) return -1;
+  return 0;
+}
+
+/****************************************************************************
+* Function Name      :   cluster_key
+* Module ID          :   N(1)
+*
+* Purpose            :   To have the messages signed with a shared key.
+*
+* Method             :   Reads the key from a file (up to CLUSTER_KEY
+*                        bytes, without trailing white space).
+*
+* Usage              :   process_command_line (M1)
+*
+* External References:   (none)
+*
+* Arguments          :   path: (data_in)
+*                                The file holding the key.
+*
+* Return Value       :   int
+*                                0, or -1 (with errno set).
+*
+* Input Assertions   :   (none)
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   Every node and the aggregator need the same key.
+*                        It is kept in a file so it is not seen in ps.
+\***************************************************************************/
+int
+cluster_key(path)
+char *path;
+{
+  FILE *f;
+  int len;
+
+  if ((f = fopen(path, "r")) == NULL) return -1;
+  len = fread(key, 1, sizeof(key), f);
+  fclose(f);
+  while (len > 0 && (key[len-1] == '\n' || key[len-1] == '\r' || key[len-1] == ' ' || key[len-1] == '\t'))
+    len--;
+  if (len <= 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  key_len = len;
+  return 0;
+}
+
+static int
+by_point(a, b)
+const void *a, *b;
+{
+  u_int32_t pa = *(u_int32_t *) a, pb = *(u_int32_t *) b;
+
+  return pa < pb ? -1 : pa > pb;
+}
+
+/****************************************************************************
+* Function Name      :   cluster_join
+* Module ID          :   N(1)
+*
+* Purpose            :   To set up our end of the cluster, as a node.
+*
+* Method             :   Splits the spec into the node name and the address
+*                        of the aggregator, and connects a non-blocking
+*                        UDP socket to it.
+*
+* Usage              :   ls_start (M1)
+*
+* External References:   (none)
+*
+* Arguments          :   spec: (data_in)
+*                                "<node>@<host>:<port>".
+*
+* Return Value       :   CLUSTER_NODE *
+*                                Our end, or NULL (with errno set).
+*
+* Input Assertions   :   (none)
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   Nothing is sent until the first heartbeat.
+\***************************************************************************/
+CLUSTER_NODE *
+cluster_join(spec)
+char *spec;
+{
+  struct sockaddr_in addr;
+  struct hostent *he;
+  char host[256], *at, *colon;
+  CLUSTER_NODE *n;
+  int err;
+
+  at = strchr(spec, '@');
+  colon = strrchr(spec, ':');
+  if (!at || at == spec || at - spec >= CLUSTER_NAME || !colon || colon < at ||
+      colon - at - 1 >= (int) sizeof(host) || atoi(colon + 1) <= 0 || atoi(colon + 1) > 65535) {
+    errno = EINVAL;
+    return NULL;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port   = htons(atoi(colon + 1));
+  memcpy(host, at + 1, colon - at - 1);
+  host[colon - at - 1] = '\0';
+  if (inet_aton(host, &addr.sin_addr) == 0) {
+    if ((he = gethostbyname(host)) == NULL || !he->h_addr_list[0]) {
+      errno = EHOSTUNREACH;
+      return NULL;
+    }
+    memcpy(&addr.sin_addr, he->h_addr_list[0], sizeof(addr.sin_addr));
+  }
+
+  if ((n = (CLUSTER_NODE *) calloc(1, sizeof(CLUSTER_NODE))) == NULL) return NULL;
+  memcpy(n->name, spec, at - spec);
+  n->name[at - spec] = '\0';
+
+  if ((n->fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0 ||
+      connect(n->fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+    err = errno;
+    if (n->fd >= 0) close(n->fd);
+    free(n);
+    errno = err;
+    return NULL;
+  }
+  return n;
+}
+
+/****************************************************************************
+* Function Name      :   cluster_name
+* Module ID          :   N(1)
+*
+* Purpose            :   To give the name of this node.
+*
+* Method             :   Looks it up.
+*
+* Usage              :   rebalance (M1)
+*
+* External References:   (none)
+*
+* Arguments          :   n: (data_in)
+*                                Our end of the cluster.
+*
+* Return Value       :   char *
+*                                The node name.
+*
+* Input Assertions   :   (none)
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   (none)
+\***************************************************************************/
+char *
+cluster_name(n)
+CLUSTER_NODE *n;
+{
+  return n->name;
+}
+
+/****************************************************************************
+* Function Name      :   cluster_fd
+* Module ID          :   N(1)
+*
+* Purpose            :   To give the descriptor to select on for the
+*                        messages from the aggregator.
+*
+* Method             :   Looks it up.
+*
+* Usage              :   probe_fds (M1)
+*
+* External References:   (none)
+*
+* Arguments          :   n: (data_in)
+*                                Our end of the cluster.
+*
+* Return Value       :   int
+*                                The descriptor.
+*
+* Input Assertions   :   (none)
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   (none)
+\***************************************************************************/
+int
+cluster_fd(n)
+CLUSTER_NODE *n;
+{
+  return n->fd;
+}
+
+/****************************************************************************
+* Function Name      :   cluster_send
+* Module ID          :   N(1)
+*
+* Purpose            :   To send a message to the aggregator.
+*
+* Method             :   One datagram, without waiting, signed if there is
+*                        a key.
+*
+* Usage              :   cluster_beat, cluster_state, cluster_windows (M1)
+*
+* External References:   (none)
+*
+* Arguments          :   n:   (data_in)
+*                                Our end of the cluster.
+*                        msg: (data_in)
+*                                The message line (without a newline).
+*
+* Return Value       :   int
+*                                0, or -1 if it could not be sent.
+*
+* Input Assertions   :   (none)
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   While the aggregator is away the messages are
+*                        simply lost; the heartbeats and SLA windows are
+*                        sent again anyway.
+\***************************************************************************/
+int
+cluster_send(n, msg)
+CLUSTER_NODE *n; char *msg;
+{
+  char buf[CLUSTER_MSG];
+  int len;
+
+  if (!key_len) return send(n->fd, msg, strlen(msg), MSG_DONTWAIT) < 0 ? -1 : 0;
+  strncpy(buf, msg, sizeof(buf) - 1);
+  buf[sizeof(buf) - 1] = '\0';
+  if ((len = sign(buf, strlen(buf), sizeof(buf))) < 0) return -1;
+  return send(n->fd, buf, len, MSG_DONTWAIT) < 0 ? -1 : 0;
+}
+
+/****************************************************************************
+* Function Name      :   cluster_read
+* Module ID          :   N(1)
+*
+* Purpose            :   To take the messages from the aggregator.
+*
+* Method             :   Reads every datagram waiting, and hands the node
+*                        names of each MEMBERS message to the handler.
+*                        With a key, only those signed by the aggregator
+*                        and later than the last are taken.
+*
+* Usage              :   probe_fds_ready (M1)
+*
+* External References:   (none)
+*
+* Arguments          :   n:       (data_in)
+*                                Our end of the cluster.
+*                        handler: (data_in)
+*                                Called with the live nodes.
+*                        arg:     (data_in)
+*                                Passed on to the handler.
+*
+* Return Value       :   int
+*                                The number of messages read.
+*
+* Input Assertions   :   (none)
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   A refused datagram (no aggregator) shows up here as
+*                        an error, and is passed over.
+\***************************************************************************/
+int
+cluster_read(n, handler, arg)
+CLUSTER_NODE *n; cluster_handler handler; void *arg;
+{
+  char msg[CLUSTER_MSG], *names[CLUSTER_NODES], *tok;
+  unsigned long long seq;
+  int len, count, done = 0;
+
+  for (;;) {
+    if ((len = recv(n->fd, msg, sizeof(msg) - 1, MSG_DONTWAIT)) < 0) {
+      if (errno == ECONNREFUSED || errno == EINTR) continue;
+      break;  /* EAGAIN, nothing more */
+    }
+    msg[len] = '\0';
+    done++;
+    if (verify(msg, &seq) < 0 || (seq && seq <= n->agg_seq)) continue;  /* forged or replayed */
+    if (seq) n->agg_seq = seq;
+    if ((tok = strtok(msg, " \n")) == NULL || strcmp(tok, "MEMBERS")) continue;
+    for (count = 0; count < CLUSTER_NODES && (tok = strtok(NULL, " \n")) != NULL; )
+      names[count++] = tok;
+    (*handler)(arg, names, count);
+  }
+  return done;
+}
+
+/****************************************************************************
+* Function Name      :   cluster_leave
+* Module ID          :   N(1)
+*
+* Purpose            :   To leave the cluster.
+*
+* Method             :   Tells the aggregator, so that our hosts are taken
+*                        over straight away, then closes the socket.
+*
+* Usage              :   ls_close (M1)
+*
+* External References:   (none)
+*
+* Arguments          :   n: (data_in)
+*                                Our end of the cluster (may be NULL).
+*
+* Return Value       :   (none)
+*
+* Input Assertions   :   (none)
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   (none)
+\***************************************************************************/
+void
+cluster_leave(n)
+CLUSTER_NODE *n;
+{
+  char msg[CLUSTER_MSG];
+
+  if (!n) return;
+  snprintf(msg, sizeof(msg), "BYE %s", n->name);
+  (void) cluster_send(n, msg);
+  close(n->fd);
+  free(n);
+}
+
+/****************************************************************************
+* Function Name      :   cluster_ring
+* Module ID          :   N(1)
+*
+* Purpose            :   To place the live nodes on the hash ring.
+*
+* Method             :   Hashes CLUSTER_VNODES points for each node, and
+*                        sorts them around the ring.
+*
+* Usage              :   cluster_members (M1), aggregator
+*
+* External References:   (none)
+*
+* Arguments          :   names: (data_in)
+*                                The nodes.
+*                        count: (data_in)
+*                                How many there are.
+*
+* Return Value       :   CLUSTER_RING *
+*                                The ring, or NULL if out of memory.
+*
+* Input Assertions   :   (none)
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   Every node builds the same ring from the same
+*                        names, whatever order they come in.
+\***************************************************************************/
+CLUSTER_RING *
+cluster_ring(names, count)
+char **names; int count;
+{
+  CLUSTER_RING *r;
+  int i, v;
+
+  if ((r = (CLUSTER_RING *) calloc(1, sizeof(CLUSTER_RING))) == NULL) return NULL;
+  r->p     = malloc((count ? count : 1) * CLUSTER_VNODES * sizeof(r->p[0]));
+  r->names = (char **) calloc(count ? count : 1, sizeof(char *));
+  if (!r->p || !r->names) {
+    cluster_ring_free(r);
+    return NULL;
+  }
+  for (i = 0; i < count; i++) {
+    if ((r->names[i] = strdup(names[i])) == NULL) {
+      cluster_ring_free(r);
+      return NULL;
+    }
+    r->count++;
+    for (v = 0; v < CLUSTER_VNODES; v++) {
+      r->p[r->n].point = hash_key(names[i], (u_int32_t) v);
+      r->p[r->n].node  = i;
+      r->n++;
+    }
+  }
+  qsort(r->p, r->n, sizeof(r->p[0]), by_point);
+
+  /* Points that collide go to the lowest name, the same on every node */
+  for (i = 1; i < r->n; i++)
+    if (r->p[i].point == r->p[i-1].point &&
+        strcmp(r->names[r->p[i].node], r->names[r->p[i-1].node]) < 0)
+      r->p[i-1].node = r->p[i].node;
+  return r;
+}
+
+/****************************************************************************
+* Function Name      :   cluster_owner
+* Module ID          :   N(1)
+*
+* Purpose            :   To find the node that probes a host.
+*
+* Method             :   The first point on the ring at or after where the
+*                        host name falls (round to the first point).
+*
+* Usage              :   rebalance (M1), aggregator
+*
+* External References:   (none)
+*
+* Arguments          :   r:   (data_in)
+*                                The ring.
+*                        key: (data_in)
+*                                The host name.
+*
+* Return Value       :   char *
+*                                The node name, or NULL if there are none.
+*
+* Input Assertions   :   (none)
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   (none)
+\***************************************************************************/
+char *
+cluster_owner(r, key)
+CLUSTER_RING *r; char *key;
+{
+  u_int32_t h;
+  int lo, hi, mid;
+
+  if (!r || !r->n) return NULL;
+  h  = hash_key(key, 0);
+  lo = 0;
+  hi = r->n;
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    if (r->p[mid].point < h) lo = mid + 1;
+    else hi = mid;
+  }
+  return r->names[r->p[lo == r->n ? 0 : lo].node];
+}
+
+/****************************************************************************
+* Function Name      :   cluster_ring_free
+* Module ID          :   N(1)
+*
+* Purpose            :   To free a ring.
+*
+* Method             :   Frees its names and points.
+*
+* Usage              :   cluster_members (M1), aggregator
+*
+* External References:   (none)
+*
+* Arguments          :   r: (data_in)
+*                                The ring (may be NULL).
+*
+* Return Value       :   (none)
+*
+* Input Assertions   :   (none)
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   (none)
+\***************************************************************************/
+void
+cluster_ring_free(r)
+CLUSTER_RING *r;
+{
+  int i;
+
+  if (!r) return;
+  for (i = 0; i < r->count; i++) free(r->names[i]);
+  free(r->names);
+  free(r->p);
+  free(r);
+}
+
+/*
+ * The aggregator
+ */
+
+static void
+agg_hangup()
+{
+  agg_quit = 1;
+  signal(SIGHUP, agg_hangup);
+}
+
+static void
+agg_usr2()
+{
+  agg_report = 1;
+  signal(SIGUSR2, agg_usr2);
+}
+
+static AGG_NODE *
+find_node(name)
+char *name;
+{
+  int i;
+
+  for (i = 0; i < num_nodes; i++)
+    if (strcmp(nodes[i].name, name) == 0) return &nodes[i];
+  return NULL;
+}
+
+static void
+drop_node(n)
+AGG_NODE *n;
+{
+  *n = nodes[--num_nodes];
+}
+
+static AGG_HOST *
+find_agg_host(name)
+char *name;
+{
+  AGG_HOST *h;
+  unsigned int k = hash_key(name, 0) % AGG_BUCKETS;
+
+  for (h = hosts[k]; h; h = h->next)
+    if (strcmp(h->name, name) == 0) return h;
+  if ((h = (AGG_HOST *) calloc(1, sizeof(AGG_HOST))) == NULL ||
+      (h->name = strdup(name)) == NULL) {
+    free(h);
+    return NULL;
+  }
+  h->up    = 1;
+  h->since = time(NULL);
+  h->next  = hosts[k];
+  hosts[k] = h;
+  num_known++;
+  return h;
+}
+
+/*
+ * Tell the nodes who is alive, so they can each take their share
+ */
+static void
+send_members(fd, to)
+int fd; AGG_NODE *to;
+{
+  char msg[CLUSTER_MSG];
+  int i, len;
+
+  len = snprintf(msg, sizeof(msg), "MEMBERS");
+  for (i = 0; i < num_nodes && len < (int) sizeof(msg); i++)
+    len += snprintf(msg + len, sizeof(msg) - len, " %s", nodes[i].name);
+  if ((len = sign(msg, strlen(msg), sizeof(msg))) < 0) return;
+  for (i = 0; i < num_nodes; i++)
+    if (!to || to == &nodes[i])
+      (void) sendto(fd, msg, len, MSG_DONTWAIT, (struct sockaddr *) &nodes[i].addr, sizeof(nodes[i].addr));
+}
+
+static void
+new_members()
+{
+  char *names[CLUSTER_NODES];
+  int i;
+
+  for (i = 0; i < num_nodes; i++) names[i] = nodes[i].name;
+  cluster_ring_free(members);
+  members = cluster_ring(names, num_nodes);
+}
+
+/*
+ * A change of state of a host, from the node probing it
+ */
+static void
+host_state(h, up, node, when)
+AGG_HOST *h; int up; char *node; time_t when;
+{
+  strncpy(h->node, node, CLUSTER_NAME - 1);
+  if (h->up == up) return;
+  h->up    = up;
+  h->since = when;
+  printf("%s %s is %s (node %s)\n", stamp(), h->name, up ? "alive" : "unreachable", node);
+}
+
+/*
+ * Deal with a message from a node (with its seq, 0=not signed).
+ * Returns 1 if the nodes changed.
+ */
+static int
+agg_message(fd, msg, seq, from)
+int fd; char *msg; unsigned long long seq; struct sockaddr_in *from;
+{
+  char *tok[4 + 3 * SLA_WINDOWS];
+  AGG_NODE *n;
+  AGG_HOST *h;
+  AGG_SLA *s;
+  char *owner;
+  int count, w, changed = 0;
+
+  for (count = 0; count < (int) (sizeof(tok) / sizeof(tok[0])) &&
+       (tok[count] = strtok(count ? NULL : msg, " \n")) != NULL; count++);
+  if (count < 2 || strlen(tok[1]) >= CLUSTER_NAME) return 0;
+  if ((n = find_node(tok[1])) != NULL && seq) {
+    if (seq <= n->seq) {
+      rejected++;  /* replayed */
+      return 0;
+    }
+    n->seq = seq;
+  }
+
+  if (!strcmp(tok[0], "HELLO") && count >= 6) {
+    if (!n) {
+      if (num_nodes == CLUSTER_NODES) return 0;
+      n = &nodes[num_nodes++];
+      memset(n, 0, sizeof(*n));
+      strcpy(n->name, tok[1]);
+      n->seq = seq;
+      printf("%s Node %s joined from %s, %d node%s\n", stamp(), n->name, inet_ntoa(from->sin_addr), num_nodes, (num_nodes == 1 ? "" : "s"));
+      (void) fflush(stdout);
+      changed = 1;  /* everyone is told */
+    }
+    n->addr   = *from;
+    n->last   = time(NULL);
+    n->beat   = atoi(tok[2]);
+    n->hosts  = atoi(tok[3]);
+    n->probed = atoi(tok[4]);
+    n->down   = atoi(tok[5]);
+    if (!changed) send_members(fd, n);
+    return changed;
+  }
+
+  if (!strcmp(tok[0], "BYE")) {
+    if (!n) return 0;
+    printf("%s Node %s left, its hosts go to the other %d\n", stamp(), n->name, num_nodes - 1);
+    (void) fflush(stdout);
+    drop_node(n);
+    return 1;
+  }
+
+  if (!strcmp(tok[0], "STATE") && count >= 5) {
+    if ((h = find_agg_host(tok[2])) != NULL)
+      host_state(h, strcmp(tok[3], "up") == 0, tok[1], (time_t) atol(tok[4]));
+    (void) fflush(stdout);
+    return 0;
+  }
+
+  if (!strcmp(tok[0], "SLA") && count >= 4 + 3 * SLA_WINDOWS) {
+    if ((h = find_agg_host(tok[2])) == NULL) return 0;
+    for (s = h->sla; s && strcmp(s->node, tok[1]); s = s->next);
+    if (!s) {
+      if ((s = (AGG_SLA *) calloc(1, sizeof(AGG_SLA))) == NULL) return 0;
+      strcpy(s->node, tok[1]);
+      s->next = h->sla;
+      h->sla  = s;
+    }
+    for (w = 0; w < SLA_WINDOWS; w++) {
+      s->down[w]   = atol(tok[4 + 3*w]);
+      s->count[w]  = atoi(tok[5 + 3*w]);
+      s->period[w] = atol(tok[6 + 3*w]);
+    }
+
+    /* Only the node probing it now knows its state */
+    owner = cluster_owner(members, h->name);
+    if (owner && !strcmp(owner, tok[1]))
+      host_state(h, strcmp(tok[3], "up") == 0, tok[1], time(NULL));
+    (void) fflush(stdout);
+  }
+  return 0;
+}
+
+static int
+by_name(a, b)
+const void *a, *b;
+{
+  return strcmp((*(AGG_HOST **) a)->name, (*(AGG_HOST **) b)->name);
+}
+
+/*
+ * Report the rolling SLA windows of the fleet, as display_windows does
+ * for one node: each host that has been down (its downtime added up
+ * over the nodes that have probed it), then the fleet as a whole.
+ */
+static void
+agg_windows()
+{
+  static char line[512];
+  static SLA_ROLLUP clean;
+  long down[SLA_WINDOWS], period[SLA_WINDOWS], total_down[SLA_WINDOWS], total_period[SLA_WINDOWS], p;
+  int count[SLA_WINDOWS], i, j, w, c, len, fleet = 0, n = 0;
+  AGG_HOST **list, *h;
+  AGG_SLA *s;
+
+  for (i = 0; i < num_nodes; i++)
+    if (nodes[i].hosts > fleet) fleet = nodes[i].hosts;
+  if (fleet < num_known) fleet = num_known;
+
+  if ((list = (AGG_HOST **) malloc((num_known ? num_known : 1) * sizeof(AGG_HOST *))) == NULL) return;
+  for (i = 0; i < AGG_BUCKETS; i++)
+    for (h = hosts[i]; h; h = h->next)
+      if (h->sla) list[n++] = h;
+  qsort(list, n, sizeof(AGG_HOST *), by_name);
+
+  printf("%s SLA_WIN Rolling windows for %d host%s across %d node%s (%d have been down)\n", stamp(), fleet, (fleet == 1 ? "" : "s"), num_nodes, (num_nodes == 1 ? "" : "s"), n);
+  for (w = 0; w < SLA_WINDOWS; w++) {
+    (void) sla_get(&clean, w, time(NULL), agg_start, 0, &p, &c);
+    total_period[w] = p;  /* the longest any node has been at it */
+    total_down[w]   = 0;
+  }
+
+  for (j = 0; j < n; j++) {
+    for (w = 0; w < SLA_WINDOWS; w++) {
+      down[w] = period[w] = 0;
+      count[w] = 0;
+    }
+    for (s = list[j]->sla; s; s = s->next)
+      for (w = 0; w < SLA_WINDOWS; w++) {
+        down[w]  += s->down[w];
+        count[w] += s->count[w];
+        if (s->period[w] > period[w]) period[w] = s->period[w];
+      }
+    len = snprintf(line, sizeof(line), "%s SLA_WIN %s", stamp(), list[j]->name);
+    for (w = 0; w < SLA_WINDOWS; w++) {
+      if (down[w] > period[w]) down[w] = period[w];  /* probed by two at once */
+      total_down[w] += down[w];
+      if (period[w] > total_period[w]) total_period[w] = period[w];
+      if (len < (int) sizeof(line))
+        len += snprintf(line + len, sizeof(line) - len, " %s %ld/%d %01.4f", sla_name(w), down[w], count[w], period[w] ? (double)(down[w] * 100) / (double)period[w] : 0.0);
+    }
+    printf("%s\n", line);
+  }
+
+  len = snprintf(line, sizeof(line), "%s SLA_WIN all", stamp());
+  for (w = 0; w < SLA_WINDOWS; w++)
+    if (len < (int) sizeof(line))
+      len += snprintf(line + len, sizeof(line) - len, " %s %ld %01.4f", sla_name(w), total_down[w], total_period[w] ? (double)(total_down[w] * 100) / (double)(total_period[w] * fleet) : 0.0);
+  printf("%s\n", line);
+  (void) fflush(stdout);
+  free(list);
+}
+
+/****************************************************************************
+* Function Name      :   cluster_aggregate
+* Module ID          :   N(1)
+*
+* Purpose            :   To run the aggregator of a cluster.
+*
+* Method             :   Listens for the nodes on a UDP port.  Each node
+*                        heard from is added to the live nodes, and lost
+*                        again after CLUSTER_DEAD missed heartbeats (or
+*                        when it says BYE); the live nodes are sent to all
+*                        of them whenever they change, and to each in
+*                        answer to its heartbeat.  The state changes and
+*                        SLA windows of the hosts are merged and logged as
+*                        one fleet, with a status line every update secs.
+*
+* Usage              :   process_command_line (M1)
+*
+* External References:   (none)
+*
+* Arguments          :   bind:   (data_in)
+*                                The address to listen on.
+*                        port:   (data_in)
+*                                The UDP port to listen on.
+*                        update: (data_in)
+*                                Secs between status lines.
+*
+* Return Value       :   int
+*                                The exit status.
+*
+* Input Assertions   :   (none)
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   Runs until SIGHUP, when the fleet windows are
+*                        reported (also on SIGUSR2).  Without a key it
+*                        will only listen on a loopback address, as any
+*                        sender could then drive the fleet.
+\***************************************************************************/
+int
+cluster_aggregate(bind_addr, port, update)
+char *bind_addr; int port, update;
+{
+  struct sockaddr_in addr, from;
+  socklen_t fromlen;
+  struct timeval to;
+  char msg[CLUSTER_MSG];
+  unsigned long long seq;
+  time_t now, next_status;
+  fd_set set;
+  int fd, i, len, beat, changed, down, fleet;
+  AGG_HOST *h;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family      = AF_INET;
+  addr.sin_port        = htons(port);
+  if (!inet_aton(bind_addr, &addr.sin_addr)) {
+    fprintf(stderr, "cluster_aggregate: bad address %s\n", bind_addr);
+    return 1;
+  }
+  if (!key_len && (ntohl(addr.sin_addr.s_addr) >> 24) != 127) {
+    fprintf(stderr, "cluster_aggregate: %s is not a loopback address, a cluster key is needed\n", bind_addr);
+    return 1;
+  }
+  if ((hosts = (AGG_HOST **) calloc(AGG_BUCKETS, sizeof(AGG_HOST *))) == NULL) {
+    perror("cluster_aggregate: calloc");
+    return 1;
+  }
+  if ((fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0)) < 0 ||
+      bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+    perror("cluster_aggregate: bind");
+    return 1;
+  }
+
+  signal(SIGHUP, agg_hangup);
+  signal(SIGUSR2, agg_usr2);
+  agg_start   = time(NULL);
+  next_status = agg_start + update;
+  new_members();
+  printf("%s LinkStat v%s (%s)\n", stamp(), version_get_str(), version_get_rel_date());
+  printf("%s Aggregating cluster nodes on %s:%d, using %ds updates, %s\n", stamp(), bind_addr, port, update,
+         (key_len ? "signed messages only" : "messages not signed"));
+  (void) fflush(stdout);
+
+  while (!agg_quit) {
+    FD_ZERO(&set);
+    FD_SET(fd, &set);
+    to.tv_sec  = CLUSTER_BEAT;
+    to.tv_usec = 0;
+    changed = 0;
+    if (select(fd + 1, &set, NULL, NULL, &to) > 0)
+      for (;;) {
+        fromlen = sizeof(from);
+        if ((len = recvfrom(fd, msg, sizeof(msg) - 1, MSG_DONTWAIT, (struct sockaddr *) &from, &fromlen)) < 0)
+          break;
+        msg[len] = '\0';
+        if (verify(msg, &seq) < 0) {
+          rejected++;  /* forged or stale */
+          continue;
+        }
+        if (agg_message(fd, msg, seq, &from)) {
+          changed = 1;
+          new_members();  /* for the next SLA message */
+        }
+      }
+
+    /* Nodes that have gone quiet are lost, and their hosts move on */
+    now = time(NULL);
+    for (i = 0; i < num_nodes; i++) {
+      beat = nodes[i].beat > CLUSTER_BEAT * 1000 ? nodes[i].beat : CLUSTER_BEAT * 1000;
+      if ((now - nodes[i].last) * 1000 > (long) CLUSTER_DEAD * beat) {
+        printf("%s Node %s lost, its hosts go to the other %d\n", stamp(), nodes[i].name, num_nodes - 1);
+        drop_node(&nodes[i--]);
+        changed = 1;
+      }
+    }
+    if (changed) {
+      new_members();
+      send_members(fd, (AGG_NODE *) NULL);
+    }
+
+    if (now >= next_status) {
+      /* with each node's probed/unreachable hosts */
+      down = fleet = 0;
+      for (i = 0; i < AGG_BUCKETS; i++)
+        for (h = hosts[i]; h; h = h->next)
+          if (!h->up) down++;
+      for (i = 0, len = 0; i < num_nodes && len < (int) sizeof(msg); i++) {
+        if (nodes[i].hosts > fleet) fleet = nodes[i].hosts;
+        len += snprintf(msg + len, sizeof(msg) - len, " %s:%d/%d", nodes[i].name, nodes[i].probed, nodes[i].down);
+      }
+      msg[len < (int) sizeof(msg) ? len : (int) sizeof(msg) - 1] = '\0';
+      printf("%s Fleet: %d node%s, %d hosts, %d unreachable,%s\n", stamp(), num_nodes, (num_nodes == 1 ? "" : "s"), fleet, down, num_nodes ? msg : " no nodes");
+      if (rejected) {
+        printf("%s Dropped %ld unauthenticated message%s\n", stamp(), rejected, (rejected == 1 ? "" : "s"));
+        rejected = 0;
+      }
+      next_status = now + update;
+    }
+    if (agg_report) {
+      agg_report = 0;
+      agg_windows();
+    }
+    (void) fflush(stdout);
+  }
+
+  printf("%s SIGHUP received\n", stamp());
+  agg_windows();
+  close(fd);
+  return 0;
+}
@@ -0,0 +1,30 @@
+
+#include <sys/types.h>
+#include <sys/time.h>
+
+typedef struct cluster_node CLUSTER_NODE;   /* our end of the cluster, as a node */
+typedef struct cluster_ring CLUSTER_RING;   /* the hash ring of the live nodes */
+
+#define CLUSTER_BEAT      1   /* secs between heartbeats (at least) */
+#define CLUSTER_DEAD      3   /* heartbeats missed before a node is lost */
+#define CLUSTER_VNODES   64   /* points of each node on the ring */
+#define CLUSTER_NODES    64   /* most nodes the aggregator will take */
+#define CLUSTER_NAME     32   /* longest node name */
+#define CLUSTER_MSG    1024   /* longest message */
+
+/* called with the live nodes, each time they change */
+typedef void (*cluster_handler)(void *arg, char **names, int count);
+
+extern CLUSTER_NODE *cluster_join(char *spec);
+extern char *cluster_name(CLUSTER_NODE *n);
+extern int cluster_fd(CLUSTER_NODE *n);
+extern int cluster_send(CLUSTER_NODE *n, char *msg);
+extern int cluster_read(CLUSTER_NODE *n, cluster_handler handler, void *arg);
+extern void cluster_leave(CLUSTER_NODE *n);
+
+extern CLUSTER_RING *cluster_ring(char **names, int count);
+extern char *cluster_owner(CLUSTER_RING *r, char *key);
+extern void cluster_ring_free(CLUSTER_RING *r);
+
+extern int cluster_key(char *path);
+extern int cluster_aggregate(char *bind_addr, int port, int update);
@@ -0,0 +1,634 @@
+
+/*
+ * Control socket, for commands from an operator while we run.
+ *
+ * A Unix domain stream socket that clients connect to and send one
+ * command per line.  It is served from the same select loop as the
+ * probes (see probe_fds), so commands act on the host table directly
+ * and without locking.  Everything is non-blocking: a client that
+ * sends half a line is simply waited on, and one that will not take
+ * its replies is dropped, so an operator can never stall the prober.
+ *
+ * The listener itself, and the reading of lines from its clients, is
+ * kept apart (ctl_listen etc.), as the event stream (sub.c) takes its
+ * subscribers the same way.
+ */
+
+#define _GNU_SOURCE   /* for accept4 */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "ctl.h"
+
+#define CTL_CLIENTS      16    /* clients connected at once */
+#define CTL_BACKLOG       8    /* connections waiting to be accepted */
+
+struct ctl_port {
+  CTL_LISTENER        l;                /* the socket and its clients */
+  int                 next_id;          /* id of the next client */
+  int                 id[CTL_CLIENTS];  /* of each client, never reused, 0=none yet */
+  CTL_CONN            conn[CTL_CLIENTS];
+};
+
+/****************************************************************************
+* Function Name      :   ctl_listen
+* Module ID          :   C(1)
+*
+* Purpose            :   To set up a Unix domain listener.
+*
+* Method             :   Removes anything left at the path by an earlier
+*                        run, then binds and listens on a Unix domain
+*                        stream socket there, readable by its owner only.
+*
+* Usage              :   ctl_open, sub_open (C1, E1)
+*
+* External References:   (none)
+*
+* Arguments          :   l:       (data_out)
+*                                The listener.
+*                        path:    (data_in)
+*                                Where to put the socket.
+*                        conn:    (data_in)
+*                                The slots for its connections.
+*                        count:   (data_in)
+*                                How many there are.
+*                        backlog: (data_in)
+*                                Connections waiting to be accepted.
+*
+* Return Value       :   int
+*                                0, or -1 (with errno set).
+*
+* Input Assertions   :   (none)
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   Both sockets can change what is probed or see
+*                        what is, hence the permissions.
+\***************************************************************************/
+int
+ctl_listen(l, path, conn, count, backlog)
+CTL_LISTENER *l; char *path; CTL_CONN *conn; int count, backlog;
+{
+  struct sockaddr_un addr;
+  int i, err;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
+
+  memset(conn, 0, count * sizeof(CTL_CONN));
+  for (i = 0; i < count; i++) conn[i].fd = -1;
+  l->path  = path;
+  l->conn  = conn;
+  l->count = count;
+
+  if ((l->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0)
+    return -1;
+
+  (void) unlink(path);
+  if (bind(l->fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+      chmod(path, S_IRUSR | S_IWUSR) < 0 ||
+      listen(l->fd, backlog) < 0) {
+    err = errno;
+    close(l->fd);
+    errno = err;
+    return -1;
+  }
+  return 0;
+}
+
+/****************************************************************************
+* Function Name      :   ctl_listen_fds
+* Module ID          :   C(1)
+*
+* Purpose            :   To add a listener and its connections to a
+*                        select set.
+*
+* Method             :   Adds each descriptor in use.
+*
+* Usage              :   ctl_fds, sub_fds (C1, E1)
+*
+* External References:   (none)
+*
+* Arguments          :   l:     (data_in)
+*                                The listener.
+*                        set:   (data_in/out)
+*                                The select set.
+*                        maxfd: (data_in)
+*                                The highest descriptor in the set so far.
+*
+* Return Value       :   int
+*                                The highest descriptor in the set now.
+*
+* Input Assertions   :   (none)
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   (none)
+\***************************************************************************/
+int
+ctl_listen_fds(l, set, maxfd)
+CTL_LISTENER *l; fd_set *set; int maxfd;
+{
+  int i;
+
+  FD_SET(l->fd, set);
+  if (l->fd > maxfd) maxfd = l->fd;
+  for (i = 0; i < l->count; i++)
+    if (l->conn[i].fd >= 0) {
+      FD_SET(l->conn[i].fd, set);
+      if (l->conn[i].fd > maxfd) maxfd = l->conn[i].fd;
+    }
+  return maxfd;
+}
+
+/****************************************************************************
+* Function Name      :   ctl_accept
+* Module ID          :   C(1)
+*
+* Purpose            :   To take new connections to a listener.
+*
+* Method             :   Accepts any waiting, each into a free slot.  When
+*                        there is none the connection is told so and
+*                        closed.
+*
+* Usage              :   ctl_ready, sub_ready (C1, E1)
+*
+* External References:   (none)
+*
+* Arguments          :   l:    (data_in/out)
+*                                The listener.
+*                        set:  (data_in)
+*                                The select set, as returned by select.
+*                        full: (data_in)
+*                                What to tell those turned away.
+*
+* Return Value       :   (none)
+*
+* Input Assertions   :   (none)
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   (none)
+\***************************************************************************/
+void
+ctl_accept(l, set, full)
+CTL_LISTENER *l; fd_set *set; char *full;
+{
+  int i, fd;
+
+  if (!FD_ISSET(l->fd, set)) return;
+  while ((fd = accept4(l->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+    for (i = 0; i < l->count && l->conn[i].fd >= 0; i++);
+    if (i == l->count) {
+      (void) send(fd, full, strlen(full), MSG_NOSIGNAL | MSG_DONTWAIT);
+      close(fd);
+      continue;
+    }
+    l->conn[i].fd  = fd;
+    l->conn[i].len = 0;
+  }
+}
+
+/****************************************************************************
+* Function Name      :   ctl_recv
+* Module ID          :   C(1)
+*
+* Purpose            :   To read what a connection has sent.
+*
+* Method             :   Adds it to the partial line, without waiting.
+*
+* Usage              :   ctl_ready, sub_ready (C1, E1)
+*
+* External References:   (none)
+*
+* Arguments          :   c: (data_in/out)
+*                                The connection, ready to read.
+*
+* Return Value       :   int
+*                                The bytes read, 0 if there were none
+*                                after all, or -1 if it has hung up.
+*
+* Input Assertions   :   (none)
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   The lines are then taken with ctl_line, and what
+*                        is left kept with ctl_keep.
+\***************************************************************************/
+int
+ctl_recv(c)
+CTL_CONN *c;
+{
+  int n;
+
+  n = recv(c->fd, c->line + c->len, CTL_LINE - c->len, MSG_DONTWAIT);
+  if (n < 0 && (errno == EAGAIN || errno == EINTR)) return 0;
+  if (n <= 0) return -1;
+  c->len += n;
+  return n;
+}
+
+/****************************************************************************
+* Function Name      :   ctl_line
+* Module ID          :   C(1)
+*
+* Purpose            :   To take the next complete line from a connection.
+*
+* Method             :   Looks for the newline from *p on, and ends the
+*                        line there (and at a carriage return before it).
+*
+* Usage              :   ctl_ready, sub_ready (C1, E1)
+*
+* External References:   (none)
+*
+* Arguments          :   c: (data_in/out)
+*                                The connection.
+*                        p: (data_in/out)
+*                                Where to look from (c->line to start
+*                                with), moved on past the line.
+*
+* Return Value       :   char *
+*                                The line, or NULL if there are no more.
+*
+* Input Assertions   :   (none)
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   (none)
+\***************************************************************************/
+char *
+ctl_line(c, p)
+CTL_CONN *c; char **p;
+{
+  char *line = *p, *eol;
+
+  if ((eol = memchr(line, '\n', c->len - (line - c->line))) == NULL) return NULL;
+  *eol = '\0';
+  if (eol > line && eol[-1] == '\r') eol[-1] = '\0';
+  *p = eol + 1;
+  return line;
+}
+
+/****************************************************************************
+* Function Name      :   ctl_keep
+* Module ID          :   C(1)
+*
+* Purpose            :   To keep the partial line left on a connection.
+*
+* Method             :   Moves what is left from p to the start.
+*
+* Usage              :   ctl_ready, sub_ready (C1, E1)
+*
+* External References:   (none)
+*
+* Arguments          :   c: (data_in/out)
+*                                The connection.
+*                        p: (data_in)
+*                                Past the last line taken.
+*
+* Return Value       :   int
+*                                0, or -1 if it fills the buffer (no line
+*                                is that long, so it should be dropped).
+*
+* Input Assertions   :   (none)
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   (none)
+\***************************************************************************/
+int
+ctl_keep(c, p)
+CTL_CONN *c; char *p;
+{
+  c->len -= p - c->line;
+  memmove(c->line, p, c->len);
+  return c->len == CTL_LINE ? -1 : 0;
+}
+
+/*
+ * Disconnect a connection, freeing its slot
+ */
+void
+ctl_hangup(c)
+CTL_CONN *c;
+{
+  if (c->fd >= 0) close(c->fd);
+  c->fd  = -1;
+  c->len = 0;
+}
+
+/*
+ * Disconnect the connections still open, close the listener and remove it
+ */
+void
+ctl_unlisten(l)
+CTL_LISTENER *l;
+{
+  int i;
+
+  for (i = 0; i < l->count; i++)
+    ctl_hangup(&l->conn[i]);
+  close(l->fd);
+  (void) unlink(l->path);
+}
+
+/*
+ * Disconnect a client
+ */
+static void
+drop(c, n)
+CTL_PORT *c; int n;
+{
+  ctl_hangup(&c->conn[n]);
+  c->id[n] = 0;
+}
+
+/****************************************************************************
+* Function Name      :   ctl_open
+* Module ID          :   C(1)
+*
+* Purpose            :   To set up the control socket.
+*
+* Method             :   Listens on a Unix domain stream socket there
+*                        (ctl_listen), readable by its owner only.
+*
+* Usage              :   main (M1)
+*
+* External References:   (none)
+*
+* Arguments          :   path: (data_in)
+*                                Where to put the socket.
+*
+* Return Value       :   CTL_PORT *
+*                                The control socket, or NULL (with errno set).
+*
+* Input Assertions   :   (none)
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   The commands can change what is probed, hence the
+*                        permissions.
+\***************************************************************************/
+CTL_PORT *
+ctl_open(path)
+char *path;
+{
+  CTL_PORT *c;
+  int err;
+
+  if ((c = (CTL_PORT *) calloc(1, sizeof(CTL_PORT))) == NULL) return NULL;
+  c->next_id = 1;
+  if (ctl_listen(&c->l, path, c->conn, CTL_CLIENTS, CTL_BACKLOG) < 0) {
+    err = errno;
+    free(c);
+    errno = err;
+    return NULL;
+  }
+  return c;
+}
+
+/****************************************************************************
+* Function Name      :   ctl_fds
+* Module ID          :   C(1)
+*
+* Purpose            :   To add the control socket and its clients to a
+*                        select set.
+*
+* Method             :   Adds each descriptor in use.
+*
+* Usage              :   probe_fds (M1)
+*
+* External References:   (none)
+*
+* Arguments          :   c:     (data_in)
+*                                The control socket.
+*                        set:   (data_in/out)
+*                                The select set.
+*                        maxfd: (data_in)
+*                                The highest descriptor in the set so far.
+*
+* Return Value       :   int
+*                                The highest descriptor in the set now.
+*
+* Input Assertions   :   (none)
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   (none)
+\***************************************************************************/
+int
+ctl_fds(c, set, maxfd)
+CTL_PORT *c; fd_set *set; int maxfd;
+{
+  return ctl_listen_fds(&c->l, set, maxfd);
+}
+
+/****************************************************************************
+* Function Name      :   ctl_ready
+* Module ID          :   C(1)
+*
+* Purpose            :   To take new clients and their commands.
+*
+* Method             :   Accepts any waiting connections, then reads what
+*                        each ready client has sent and hands each complete
+*                        line to the handler.  Clients that hang up, or
+*                        send a line that is too long, are dropped.
+*
+* Usage              :   probe_fds_ready (M1)
+*
+* External References:   (none)
+*
+* Arguments          :   c:       (data_in/out)
+*                                The control socket.
+*                        set:     (data_in)
+*                                The select set, as returned by select.
+*                        handler: (data_in)
+*                                Called for each command.
+*                        arg:     (data_in)
+*                                Passed on to the handler.
+*
+* Return Value       :   int
+*                                The number of commands handled.
+*
+* Input Assertions   :   (none)
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   The handler may reply (ctl_send) straight away, or
+*                        later on through the client id it was given.
+\***************************************************************************/
+int
+ctl_ready(c, set, handler, arg)
+CTL_PORT *c; fd_set *set; ctl_handler handler; void *arg;
+{
+  char *p, *line;
+  int i, id, n, handled = 0;
+
+  ctl_accept(&c->l, set, "too many clients\n");
+
+  for (i = 0; i < CTL_CLIENTS; i++) {
+    if (c->conn[i].fd < 0) continue;
+    if (!c->id[i]) {
+      /* just accepted */
+      c->id[i] = c->next_id++;
+      if (c->next_id <= 0) c->next_id = 1;
+    }
+    if (!FD_ISSET(c->conn[i].fd, set)) continue;
+
+    if ((n = ctl_recv(&c->conn[i])) == 0) continue;
+    if (n < 0) {
+      drop(c, i);  /* hung up */
+      continue;
+    }
+
+    /* Hand over each complete line */
+    id = c->id[i];
+    p  = c->conn[i].line;
+    while (c->id[i] == id && (line = ctl_line(&c->conn[i], &p)) != NULL) {
+      handler(arg, id, line);
+      handled++;
+    }
+    if (c->id[i] != id) continue;  /* dropped while replying */
+
+    if (ctl_keep(&c->conn[i], p) < 0) drop(c, i);  /* not a command */
+  }
+  return handled;
+}
+
+/****************************************************************************
+* Function Name      :   ctl_send
+* Module ID          :   C(1)
+*
+* Purpose            :   To reply to a client.
+*
+* Method             :   Looks the client up by its id, and writes the text
+*                        without waiting.  A client that has gone, or
+*                        can't take the whole reply, is dropped.
+*
+* Usage              :   control_command, control_result (M1)
+*
+* External References:   (none)
+*
+* Arguments          :   c:      (data_in/out)
+*                                The control socket.
+*                        client: (data_in)
+*                                The id the handler was given.
+*                        text:   (data_in)
+*                                The reply, one or more lines.
+*
+* Return Value       :   int
+*                                0 if sent, -1 if the client is gone.
+*
+* Input Assertions   :   (none)
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   Ids are never reused, so a late reply can't reach
+*                        a different client.
+\***************************************************************************/
+int
+ctl_send(c, client, text)
+CTL_PORT *c; int client; char *text;
+{
+  int i, len = strlen(text);
+
+  for (i = 0; i < CTL_CLIENTS; i++)
+    if (c->conn[i].fd >= 0 && c->id[i] == client) {
+      if (send(c->conn[i].fd, text, len, MSG_NOSIGNAL | MSG_DONTWAIT) == len)
+        return 0;
+      drop(c, i);
+      return -1;
+    }
+  return -1;
+}
+
+/****************************************************************************
+* Function Name      :   ctl_close
+* Module ID          :   C(1)
+*
+* Purpose            :   To shut down the control socket.
+*
+* Method             :   Disconnects the clients, closes the socket and
+*                        removes it.
+*
+* Usage              :   ls_close (M1)
+*
+* External References:   (none)
+*
+* Arguments          :   c: (data_in)
+*                                The control socket (may be NULL).
+*
+* Return Value       :   (none)
+*
+* Input Assertions   :   (none)
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   (none)
+\***************************************************************************/
+void
+ctl_close(c)
+CTL_PORT *c;
+{
+  if (!c) return;
+  ctl_unlisten(&c->l);
+  free(c);
+}
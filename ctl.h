@@ -0,0 +1,40 @@
+
+#include <sys/types.h>
+#include <sys/time.h>
+
+#define CTL_LINE        512    /* longest line from a client */
+
+/* a connection to a listener, read a line at a time */
+typedef struct ctl_conn {
+  int                 fd;               /* connection, -1=slot free */
+  int                 len;              /* bytes of a partial line */
+  char                line[CTL_LINE];
+} CTL_CONN;
+
+/* a Unix domain listener and its connections (the control socket, the event stream) */
+typedef struct ctl_listener {
+  int                 fd;               /* listening socket */
+  char               *path;             /* where it is, to remove it */
+  int                 count;            /* connection slots */
+  CTL_CONN           *conn;             /* the slots */
+} CTL_LISTENER;
+
+extern int ctl_listen(CTL_LISTENER *l, char *path, CTL_CONN *conn, int count, int backlog);
+extern int ctl_listen_fds(CTL_LISTENER *l, fd_set *set, int maxfd);
+extern void ctl_accept(CTL_LISTENER *l, fd_set *set, char *full);
+extern int ctl_recv(CTL_CONN *c);
+extern char *ctl_line(CTL_CONN *c, char **p);
+extern int ctl_keep(CTL_CONN *c, char *p);
+extern void ctl_hangup(CTL_CONN *c);
+extern void ctl_unlisten(CTL_LISTENER *l);
+
+typedef struct ctl_port CTL_PORT;
+
+/* called for each command line from a client (without the newline) */
+typedef void (*ctl_handler)(void *arg, int client, char *line);
+
+extern CTL_PORT *ctl_open(char *path);
+extern int ctl_fds(CTL_PORT *c, fd_set *set, int maxfd);
+extern int ctl_ready(CTL_PORT *c, fd_set *set, ctl_handler handler, void *arg);
+extern int ctl_send(CTL_PORT *c, int client, char *text);
+extern void ctl_close(CTL_PORT *c);
@@ -0,0 +1,704 @@
+
+/*
+ * Append-only store of host state changes and RTT/loss summaries.
+ *
+ * Records are queued by the probe loop (which never waits on the
+ * disk) and written by a background thread.  Each host has its own
+ * chunk of records, delta encoded as varints, which is written out as
+ * a block once it fills up, every HIST_FLUSH seconds, or at the end
+ * of the (UTC) day.  There is a data file and an index file per day:
+ *
+ *      <dir>/YYYYMMDD.dat  - the blocks, one after another
+ *      <dir>/YYYYMMDD.idx  - host, time range and offset of each block
+ *
+ * so a query for one host reads only the index and its own blocks,
+ * and a query for the whole fleet over a day reads just that day.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "history.h"
+
+#define HIST_MAGIC    0x4c534831  /* "LSH1", start of each block */
+#define HIST_QUEUE   (1 << 17)    /* records waiting for the writer */
+#define HIST_BLOCK        256     /* bytes of records in a block */
+#define HIST_MAXREC        51     /* longest encoded record */
+#define HIST_FLUSH        900     /* secs before a part block is written */
+#define HIST_DAY        86400
+
+typedef struct hist_block_hdr {
+  u_int32_t           magic;            /* HIST_MAGIC */
+  u_int32_t           addr;             /* the host */
+  u_int32_t           start;            /* time of the first record (secs) */
+  u_int16_t           count;            /* number of records */
+  u_int16_t           len;              /* bytes of records that follow */
+} HIST_BLOCK_HDR;
+
+typedef struct hist_index {
+  u_int32_t           addr;             /* the host */
+  u_int32_t           start;            /* time of the first record (secs) */
+  u_int32_t           end;              /* time of the last record (secs) */
+  u_int32_t           offset;           /* of the block in the data file */
+  u_int16_t           count;            /* number of records */
+  u_int16_t           len;              /* bytes of records */
+} HIST_INDEX;
+
+typedef struct hist_chunk {
+  struct in_addr      addr;             /* the host, 0=free slot */
+  unsigned char      *buf;              /* records, NULL=none yet */
+  int                 len;              /* bytes used in buf */
+  int                 count;            /* records in buf */
+  long                day;              /* day of the records */
+  time_t              start;            /* time of the first record */
+  time_t              opened;           /* when the first was added */
+  long long           last;             /* time of the last record (msecs) */
+  long                prev_avg;         /* last summary, for the deltas */
+  long                prev_max;
+} HIST_CHUNK;
+
+struct hist_store {
+  char               *dir;              /* where the files live */
+  pthread_t           thread;           /* the writer */
+  pthread_mutex_t     lock;             /* protects the queue */
+  pthread_cond_t      ready;            /* queue is no longer empty */
+  HIST_RECORD        *queue;            /* records waiting to be written */
+  unsigned int        head, tail;       /* queue[head..tail) */
+  int                 stop;             /* writer to finish up */
+  long                dropped;          /* records lost to a full queue */
+
+  /* only used by the writer thread */
+  HIST_CHUNK         *chunks;           /* open hash of chunks by host */
+  unsigned int        nchunks;
+  unsigned int        used;             /* slots taken */
+  long                day;              /* day of the open files */
+  int                 dat_fd, idx_fd;   /* its data and index files */
+};
+
+/*
+ * Varints: 7 bits a byte, low bits first, top bit set on all but the
+ * last.  Signed deltas are zigzag encoded first.
+ */
+static int
+put_varint(p, v)
+unsigned char *p; unsigned long v;
+{
+  int n = 0;
+
+  while (v >= 0x80) {
+    p[n++] = (unsigned char) (v | 0x80);
+    v >>= 7;
+  }
+  p[n++] = (unsigned char) v;
+  return n;
+}
+
+static int
+get_varint(p, end, v)
+unsigned char *p, *end; unsigned long *v;
+{
+  int n = 0, shift = 0;
+
+  *v = 0;
+  while (p + n < end && shift < 64) {
+    *v |= (unsigned long) (p[n] & 0x7f) << shift;
+    if (!(p[n++] & 0x80)) return n;
+    shift += 7;
+  }
+  return -1;  /* truncated */
+}
+
+#define ZIGZAG(v)    (((unsigned long) (v) << 1) ^ ((v) < 0 ? ~0UL : 0UL))
+#define UNZIGZAG(v)  ((long) ((v) >> 1) ^ -((long) ((v) & 1)))
+
+/*
+ * Open the files for a day (if they are not open already)
+ */
+static int
+day_files(h, day)
+HIST_STORE *h; long day;
+{
+  char name[1024], stamp[16];
+  time_t t = (time_t) day * HIST_DAY;
+
+  if (h->day == day && h->dat_fd >= 0) return 0;
+  if (h->dat_fd >= 0) close(h->dat_fd);
+  if (h->idx_fd >= 0) close(h->idx_fd);
+  h->idx_fd = -1;
+
+  strftime(stamp, sizeof(stamp), "%Y%m%d", gmtime(&t));
+  snprintf(name, sizeof(name), "%s/%s.dat", h->dir, stamp);
+  h->dat_fd = open(name, O_WRONLY | O_CREAT | O_APPEND, 0644);
+  snprintf(name, sizeof(name), "%s/%s.idx", h->dir, stamp);
+  if (h->dat_fd >= 0)
+    h->idx_fd = open(name, O_WRONLY | O_CREAT | O_APPEND, 0644);
+  if (h->idx_fd < 0) {
+    fprintf(stderr, "history: can't open %s - %s\n", name, strerror(errno));
+    if (h->dat_fd >= 0) close(h->dat_fd);
+    h->dat_fd = -1;
+    return -1;
+  }
+  h->day = day;
+  return 0;
+}
+
+/*
+ * Write out the records of a host as a block, then its index entry
+ * (so the index never points at a block that is not there).
+ */
+static void
+flush_chunk(h, c)
+HIST_STORE *h; HIST_CHUNK *c;
+{
+  HIST_BLOCK_HDR hdr;
+  HIST_INDEX idx;
+  off_t offset;
+
+  if (!c->count) return;
+  if (day_files(h, c->day) == 0 &&
+      (offset = lseek(h->dat_fd, 0, SEEK_END)) >= 0) {
+    hdr.magic = htonl(HIST_MAGIC);
+    hdr.addr  = c->addr.s_addr;
+    hdr.start = htonl((u_int32_t) c->start);
+    hdr.count = htons((u_int16_t) c->count);
+    hdr.len   = htons((u_int16_t) c->len);
+    if (write(h->dat_fd, &hdr, sizeof(hdr)) == sizeof(hdr) &&
+        write(h->dat_fd, c->buf, c->len) == c->len) {
+      idx.addr   = c->addr.s_addr;
+      idx.start  = hdr.start;
+      idx.end    = htonl((u_int32_t) (c->last / 1000));
+      idx.offset = htonl((u_int32_t) offset);
+      idx.count  = hdr.count;
+      idx.len    = hdr.len;
+      if (write(h->idx_fd, &idx, sizeof(idx)) != sizeof(idx))
+        fprintf(stderr, "history: index write - %s\n", strerror(errno));
+    } else
+      fprintf(stderr, "history: data write - %s\n", strerror(errno));
+  }
+  c->len = c->count = 0;
+}
+
+/*
+ * The slot of a host in a hash of nchunks, or the free one it would take
+ */
+static HIST_CHUNK *
+chunk_slot(chunks, nchunks, addr)
+HIST_CHUNK *chunks; unsigned int nchunks; struct in_addr addr;
+{
+  unsigned int k, n;
+
+  k = ntohl(addr.s_addr) * 2654435761U;
+  for (n = 0; n < nchunks; n++, k++) {
+    HIST_CHUNK *c = &chunks[k & (nchunks - 1)];
+    if (c->addr.s_addr == addr.s_addr || !c->addr.s_addr) return c;
+  }
+  return NULL;
+}
+
+/*
+ * Double the hash of chunks, as hosts are added after we were opened
+ */
+static int
+grow_chunks(h)
+HIST_STORE *h;
+{
+  HIST_CHUNK *chunks;
+  unsigned int i;
+
+  if ((chunks = (HIST_CHUNK *) calloc(h->nchunks * 2, sizeof(HIST_CHUNK))) == NULL)
+    return -1;
+  for (i = 0; i < h->nchunks; i++)
+    if (h->chunks[i].addr.s_addr)
+      *chunk_slot(chunks, h->nchunks * 2, h->chunks[i].addr) = h->chunks[i];
+  free(h->chunks);
+  h->chunks   = chunks;
+  h->nchunks *= 2;
+  return 0;
+}
+
+/*
+ * Find the chunk of a host, taking a free slot for a new one (and
+ * growing the hash to keep it at most half full)
+ */
+static HIST_CHUNK *
+find_chunk(h, addr)
+HIST_STORE *h; struct in_addr addr;
+{
+  HIST_CHUNK *c;
+
+  if ((c = chunk_slot(h->chunks, h->nchunks, addr)) != NULL && c->addr.s_addr)
+    return c;
+  if ((h->used + 1) * 2 > h->nchunks) {
+    if (grow_chunks(h) < 0 && !c) return NULL;
+    c = chunk_slot(h->chunks, h->nchunks, addr);
+  }
+  c->addr = addr;
+  h->used++;
+  return c;
+}
+
+/*
+ * Add a record to the chunk of its host
+ */
+static void
+encode(h, r)
+HIST_STORE *h; HIST_RECORD *r;
+{
+  HIST_CHUNK *c;
+  unsigned char *p;
+  long long delta;
+  long day = (long) (r->when / 1000 / HIST_DAY);
+
+  if ((c = find_chunk(h, r->addr)) == NULL ||
+      (!c->buf && (c->buf = (unsigned char *) malloc(HIST_BLOCK)) == NULL)) {
+    pthread_mutex_lock(&h->lock);
+    h->dropped++;
+    pthread_mutex_unlock(&h->lock);
+    return;
+  }
+
+  /* Blocks never span a day */
+  if (c->count && (c->day != day || c->len + HIST_MAXREC > HIST_BLOCK))
+    flush_chunk(h, c);
+
+  if (!c->count) {
+    c->day      = day;
+    c->start    = (time_t) (r->when / 1000);
+    c->opened   = time(NULL);
+    c->last     = (long long) c->start * 1000;
+    c->prev_avg = c->prev_max = 0;
+  }
+
+  delta = r->when - c->last;
+  if (delta < 0) delta = 0;  /* clock stepped back */
+  c->last = c->last + delta;
+
+  p = c->buf + c->len;
+  *p++ = (unsigned char) r->type;
+  p += put_varint(p, (unsigned long) delta);
+  if (r->type == HIST_SUMMARY) {
+    p += put_varint(p, r->sent);
+    p += put_varint(p, r->recv);
+    p += put_varint(p, ZIGZAG((long) r->rtt_avg - c->prev_avg));
+    p += put_varint(p, ZIGZAG((long) r->rtt_max - c->prev_max));
+    c->prev_avg = (long) r->rtt_avg;
+    c->prev_max = (long) r->rtt_max;
+  }
+  c->len = p - c->buf;
+  c->count++;
+}
+
+/*
+ * The writer: take records off the queue and encode them, writing
+ * blocks out as they fill (or get old).
+ */
+static void *
+writer(arg)
+void *arg;
+{
+  HIST_STORE *h = (HIST_STORE *) arg;
+  HIST_RECORD batch[256];
+  struct timespec wake;
+  time_t now, flushed = time(NULL);
+  unsigned int i, n;
+  int stop;
+
+  for (;;) {
+    pthread_mutex_lock(&h->lock);
+    if (h->head == h->tail && !h->stop) {
+      clock_gettime(CLOCK_REALTIME, &wake);
+      wake.tv_sec++;
+      pthread_cond_timedwait(&h->ready, &h->lock, &wake);
+    }
+    for (n = 0; n < 256 && h->head != h->tail; n++, h->head++)
+      batch[n] = h->queue[h->head & (HIST_QUEUE - 1)];
+    stop = h->stop && h->head == h->tail;
+    pthread_mutex_unlock(&h->lock);
+
+    for (i = 0; i < n; i++) encode(h, &batch[i]);
+
+    now = time(NULL);
+    if (stop || now - flushed >= 60) {
+      /* Part blocks are written once they are HIST_FLUSH secs old */
+      for (i = 0; i < h->nchunks; i++)
+        if (h->chunks[i].count && (stop || now - h->chunks[i].opened >= HIST_FLUSH))
+          flush_chunk(h, &h->chunks[i]);
+      flushed = now;
+    }
+    if (stop) break;
+  }
+  return NULL;
+}
+
+/****************************************************************************
+* Function Name      :   hist_open
+* Module ID          :   H(1)
+*
+* Purpose            :   To start recording history.
+*
+* Method             :   Creates the directory if need be, sets up the
+*                        queue and the chunk of each host, and starts the
+*                        writer thread.  The chunks are grown as hosts
+*                        beyond those counted here are recorded.
+*
+* Usage              :   main (M1)
+*
+* External References:   (none)
+*
+* Arguments          :   dir:   (data_in)
+*                                The directory to keep the history in.
+*                        hosts: (data_in)
+*                                The number of hosts to be recorded (to
+*                                start with).
+*
+* Return Value       :   HIST_STORE *
+*                                The store, or NULL (with errno set).
+*
+* Input Assertions   :   (none)
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   (none)
+\***************************************************************************/
+HIST_STORE *
+hist_open(dir, hosts)
+char *dir; int hosts;
+{
+  HIST_STORE *h;
+  struct stat st;
+  int err;
+
+  if (mkdir(dir, 0755) < 0 && errno != EEXIST) return NULL;
+  if (stat(dir, &st) < 0) return NULL;
+  if (!S_ISDIR(st.st_mode)) {
+    errno = ENOTDIR;
+    return NULL;
+  }
+
+  h = (HIST_STORE *) calloc(1, sizeof(HIST_STORE));
+  if (!h) return NULL;
+  h->dat_fd = h->idx_fd = -1;
+  h->day    = -1;
+
+  for (h->nchunks = 64; h->nchunks < (unsigned int) hosts * 2; h->nchunks <<= 1);
+  h->dir    = strdup(dir);
+  h->queue  = (HIST_RECORD *) malloc(HIST_QUEUE * sizeof(HIST_RECORD));
+  h->chunks = (HIST_CHUNK *) calloc(h->nchunks, sizeof(HIST_CHUNK));
+  if (!h->dir || !h->queue || !h->chunks) {
+    err = ENOMEM;
+    goto fail;
+  }
+
+  pthread_mutex_init(&h->lock, NULL);
+  pthread_cond_init(&h->ready, NULL);
+  if ((err = pthread_create(&h->thread, NULL, writer, h)) != 0)
+    goto fail;
+  return h;
+
+fail:
+  free(h->dir);
+  free(h->queue);
+  free(h->chunks);
+  free(h);
+  errno = err;
+  return NULL;
+}
+
+/****************************************************************************
+* Function Name      :   hist_event
+* Module ID          :   H(1)
+*
+* Purpose            :   To record a state change or summary of a host.
+*
+* Method             :   Adds it to the queue for the writer thread.
+*
+* Usage              :   mark_unreachable (M1), host_answered (M1),
+*                        history_summary (M1)
+*
+* External References:   (none)
+*
+* Arguments          :   h:   (data_in)
+*                                The store.
+*                        rec: (data_in)
+*                                The record.
+*
+* Return Value       :   (none)
+*
+* Input Assertions   :   h was returned by hist_open.
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   Never waits for the disk.  If the writer has
+*                        fallen too far behind the record is dropped (and
+*                        counted).
+\***************************************************************************/
+void
+hist_event(h, rec)
+HIST_STORE *h; HIST_RECORD *rec;
+{
+  int wake;
+
+  pthread_mutex_lock(&h->lock);
+  if (h->tail - h->head >= HIST_QUEUE)
+    h->dropped++;
+  else {
+    wake = h->head == h->tail;
+    h->queue[h->tail++ & (HIST_QUEUE - 1)] = *rec;
+    if (wake) pthread_cond_signal(&h->ready);
+  }
+  pthread_mutex_unlock(&h->lock);
+}
+
+/****************************************************************************
+* Function Name      :   hist_dropped
+* Module ID          :   H(1)
+*
+* Purpose            :   To report how many records have been lost.
+*
+* Method             :   Returns the count kept by hist_event (and the
+*                        writer, when it had no memory for a host).
+*
+* Usage              :   main (M1)
+*
+* External References:   (none)
+*
+* Arguments          :   h: (data_in)
+*                                The store.
+*
+* Return Value       :   long
+*                                The number of records dropped so far.
+*
+* Input Assertions   :   h was returned by hist_open.
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   (none)
+\***************************************************************************/
+long
+hist_dropped(h)
+HIST_STORE *h;
+{
+  long n;
+
+  pthread_mutex_lock(&h->lock);
+  n = h->dropped;
+  pthread_mutex_unlock(&h->lock);
+  return n;
+}
+
+/****************************************************************************
+* Function Name      :   hist_close
+* Module ID          :   H(1)
+*
+* Purpose            :   To stop recording history.
+*
+* Method             :   Has the writer drain the queue and write out every
+*                        part block, waits for it, then frees the store.
+*
+* Usage              :   ls_close (M1)
+*
+* External References:   (none)
+*
+* Arguments          :   h: (data_in)
+*                                The store.
+*
+* Return Value       :   (none)
+*
+* Input Assertions   :   h was returned by hist_open.
+*
+* Output Assertions  :   Everything recorded is on disk.
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   (none)
+\***************************************************************************/
+void
+hist_close(h)
+HIST_STORE *h;
+{
+  unsigned int i;
+
+  if (!h) return;
+  pthread_mutex_lock(&h->lock);
+  h->stop = 1;
+  pthread_cond_signal(&h->ready);
+  pthread_mutex_unlock(&h->lock);
+  pthread_join(h->thread, NULL);
+
+  if (h->dat_fd >= 0) close(h->dat_fd);
+  if (h->idx_fd >= 0) close(h->idx_fd);
+  for (i = 0; i < h->nchunks; i++) free(h->chunks[i].buf);
+  free(h->chunks);
+  free(h->queue);
+  free(h->dir);
+  free(h);
+}
+
+/*
+ * Decode a block of len bytes, passing each record in the time range
+ * to the handler
+ */
+static int
+decode(hdr, buf, len, from, until, handler, arg)
+HIST_BLOCK_HDR *hdr; unsigned char *buf; int len; long long from, until;
+hist_handler handler; void *arg;
+{
+  unsigned char *p = buf, *end = buf + len;
+  unsigned long v;
+  long avg = 0, max = 0;
+  int i, n, found = 0;
+  HIST_RECORD r;
+
+  memset(&r, 0, sizeof(r));
+  r.addr.s_addr = hdr->addr;
+  r.when = (long long) ntohl(hdr->start) * 1000;
+
+  for (i = 0; i < ntohs(hdr->count) && p < end; i++) {
+    r.type = *p++;
+    if ((n = get_varint(p, end, &v)) < 0) break;
+    p += n;
+    r.when += (long long) v;
+    if (r.type == HIST_SUMMARY) {
+      if ((n = get_varint(p, end, &r.sent)) < 0) break;
+      p += n;
+      if ((n = get_varint(p, end, &r.recv)) < 0) break;
+      p += n;
+      if ((n = get_varint(p, end, &v)) < 0) break;
+      p += n;
+      avg += UNZIGZAG(v);
+      if ((n = get_varint(p, end, &v)) < 0) break;
+      p += n;
+      max += UNZIGZAG(v);
+      r.rtt_avg = (unsigned long) avg;
+      r.rtt_max = (unsigned long) max;
+    } else
+      r.sent = r.recv = r.rtt_avg = r.rtt_max = 0;
+
+    if (r.when >= from && r.when < until) {
+      handler(arg, &r);
+      found++;
+    }
+  }
+  return found;
+}
+
+/****************************************************************************
+* Function Name      :   hist_query
+* Module ID          :   H(1)
+*
+* Purpose            :   To read back the history of a host (or every host)
+*                        over a range of time.
+*
+* Method             :   For each day in the range: for one host, reads the
+*                        index and then only the blocks of that host which
+*                        overlap the range; for every host, reads the data
+*                        file of the day straight through.
+*
+* Usage              :   main (M1)
+*
+* External References:   (none)
+*
+* Arguments          :   dir:     (data_in)
+*                                 The directory the history is kept in.
+*                        addr:    (data_in)
+*                                 The host, or INADDR_ANY for every host.
+*                        from:    (data_in)
+*                                 Start of the range.
+*                        until:   (data_in)
+*                                 End of the range.
+*                        handler: (data_in)
+*                                 Called with each record in the range.
+*                        arg:     (data_in)
+*                                 Passed through to the handler.
+*
+* Return Value       :   int
+*                                The number of records found.
+*
+* Input Assertions   :   (none)
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   Records still waiting in a running linkstat (up to
+*                        HIST_FLUSH secs worth) are not seen.  Within a day
+*                        the records of each host are in time order, but
+*                        the hosts are interleaved.
+\***************************************************************************/
+int
+hist_query(dir, addr, from, until, handler, arg)
+char *dir; struct in_addr addr; time_t from, until;
+hist_handler handler; void *arg;
+{
+  char name[1024], stamp[16];
+  unsigned char buf[HIST_BLOCK + HIST_MAXREC];
+  HIST_BLOCK_HDR hdr;
+  HIST_INDEX idx;
+  FILE *dat, *ix;
+  time_t t;
+  long day;
+  int found = 0, len;
+
+  for (day = from / HIST_DAY; day <= until / HIST_DAY; day++) {
+    t = (time_t) day * HIST_DAY;
+    strftime(stamp, sizeof(stamp), "%Y%m%d", gmtime(&t));
+    snprintf(name, sizeof(name), "%s/%s.dat", dir, stamp);
+    if ((dat = fopen(name, "rb")) == NULL) continue;
+
+    if (addr.s_addr == INADDR_ANY) {
+      while (fread(&hdr, sizeof(hdr), 1, dat) == 1 && ntohl(hdr.magic) == HIST_MAGIC) {
+        len = ntohs(hdr.len);
+        if (len > (int) sizeof(buf) || fread(buf, len, 1, dat) != 1) break;
+        found += decode(&hdr, buf, len, (long long) from * 1000, (long long) until * 1000, handler, arg);
+      }
+    } else {
+      snprintf(name, sizeof(name), "%s/%s.idx", dir, stamp);
+      if ((ix = fopen(name, "rb")) != NULL) {
+        while (fread(&idx, sizeof(idx), 1, ix) == 1) {
+          if (idx.addr != addr.s_addr ||
+              (time_t) ntohl(idx.end) < from || (time_t) ntohl(idx.start) >= until)
+            continue;
+          /* The block must be the one indexed, in case the file is damaged */
+          len = ntohs(idx.len);
+          if (len > (int) sizeof(buf) ||
+              fseek(dat, (long) ntohl(idx.offset), SEEK_SET) < 0 ||
+              fread(&hdr, sizeof(hdr), 1, dat) != 1 || ntohl(hdr.magic) != HIST_MAGIC ||
+              hdr.len != idx.len || hdr.addr != idx.addr ||
+              fread(buf, len, 1, dat) != 1)
+            continue;
+          found += decode(&hdr, buf, len, (long long) from * 1000, (long long) until * 1000, handler, arg);
+        }
+        fclose(ix);
+      }
+    }
+    fclose(dat);
+  }
+  return found;
+}
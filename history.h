@@ -0,0 +1,29 @@
+
+#include <sys/types.h>
+#include <netinet/in.h>
+
+typedef struct hist_store HIST_STORE;
+
+#define HIST_UP       1   /* host came up */
+#define HIST_DOWN     2   /* host went down */
+#define HIST_SUMMARY  3   /* RTT/loss summary for an update interval */
+
+typedef struct hist_record {
+  struct in_addr      addr;             /* the host */
+  int                 type;             /* HIST_UP etc. */
+  long long           when;             /* msecs since the epoch */
+  unsigned long       sent;             /* HIST_SUMMARY only: probes sent, */
+  unsigned long       recv;             /* answered, */
+  unsigned long       rtt_avg;          /* and their RTT (usecs) */
+  unsigned long       rtt_max;
+} HIST_RECORD;
+
+/* called for each record found by hist_query */
+typedef void (*hist_handler)(void *arg, HIST_RECORD *rec);
+
+extern HIST_STORE *hist_open(char *dir, int hosts);
+extern void hist_event(HIST_STORE *h, HIST_RECORD *rec);
+extern long hist_dropped(HIST_STORE *h);
+extern void hist_close(HIST_STORE *h);
+extern int hist_query(char *dir, struct in_addr addr, time_t from, time_t until,
+                      hist_handler handler, void *arg);
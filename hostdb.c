@@ -0,0 +1,666 @@
+
+/*
+ * Compiled host database, so a large fleet starts in milliseconds.
+ *
+ * "linkstat -compile hosts -output hosts.db" parses and resolves the
+ * hosts file once, and writes an image that the daemon maps straight
+ * in with "-file hosts.db".  The image is laid out as
+ *
+ *      header   - magic, version, counts and the offsets below
+ *      groups   - HOSTDB_GROUP, one per group line ("default" first)
+ *      hosts    - HOSTDB_HOST, in hosts file order
+ *      by addr  - open addressed hash of the hosts by address
+ *      by name  - and by name (host index + 1 per slot, 0=empty)
+ *      strings  - host, parent, group names and commands, each once
+ *
+ * in the byte order of the machine that compiled it (any other will
+ * see the wrong version).  The hosts file it came from, and the time
+ * that was last changed, are recorded, so a stale image can be seen.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <netinet/in.h>
+
+#include "hostdb.h"
+
+#define HOSTDB_MAGIC    "LSDB"
+#define HOSTDB_VERSION       1    /* changes with any of the records */
+#define HOSTDB_ALIGN         8    /* of each section */
+
+typedef struct hostdb_header {
+  char                magic[4];         /* HOSTDB_MAGIC */
+  u_int32_t           version;          /* HOSTDB_VERSION */
+  u_int32_t           size;             /* of the whole image */
+  u_int32_t           num_hosts;
+  u_int32_t           num_groups;
+  u_int32_t           hash_size;        /* slots in each hash, a power of 2 */
+  u_int32_t           source;           /* hosts file compiled (string) */
+  u_int32_t           unused;
+  int64_t             source_mtime;     /* when it was last changed */
+  u_int32_t           groups;           /* offsets of the sections */
+  u_int32_t           hosts;
+  u_int32_t           by_addr;
+  u_int32_t           by_name;
+  u_int32_t           strings;
+  u_int32_t           strings_len;
+} HOSTDB_HEADER;
+
+struct host_db {
+  char               *base;             /* the mapping */
+  size_t              size;
+  HOSTDB_HEADER      *hdr;
+  HOSTDB_GROUP       *groups;
+  HOSTDB_HOST        *hosts;
+  u_int32_t          *by_addr;
+  u_int32_t          *by_name;
+  char               *strings;
+};
+
+struct host_db_build {
+  char               *source;           /* hosts file, absolute path */
+  time_t              source_mtime;
+  int                 err;              /* first error, 0=none */
+  HOSTDB_GROUP       *groups;
+  int                 num_groups, max_groups;
+  HOSTDB_HOST        *hosts;
+  int                 num_hosts, max_hosts;
+  char               *strings;          /* interned strings */
+  u_int32_t           strings_len, strings_max;
+  u_int32_t          *interned;         /* hash of them (offset + 1) */
+  u_int32_t           interned_size, num_interned;
+};
+
+static unsigned int
+hash_name(name)
+char *name;
+{
+  unsigned int h = 5381;
+
+  while (*name) h = h * 33 + (unsigned char) *name++;
+  return h;
+}
+
+static unsigned int
+hash_addr(addr)
+in_addr_t addr;
+{
+  return (unsigned int) addr * 2654435761U;
+}
+
+/*
+ * Make room for another entry in an array of the build
+ */
+static void *
+grow(b, array, num, max, size)
+HOST_DB_BUILD *b; void *array; int num, *max; size_t size;
+{
+  void *p;
+
+  if (num < *max) return array;
+  if ((p = realloc(array, (*max ? *max * 2 : 256) * size)) == NULL) {
+    if (!b->err) b->err = ENOMEM;
+    return NULL;
+  }
+  *max = *max ? *max * 2 : 256;
+  return p;
+}
+
+/*
+ * Find a string in the string table, adding it the first time
+ */
+static u_int32_t
+intern(b, s)
+HOST_DB_BUILD *b; char *s;
+{
+  u_int32_t *old, old_size, k, off, len;
+  char *p;
+
+  if (!s) return HOSTDB_NONE;
+
+  /* Kept at most half full */
+  if (b->num_interned * 2 >= b->interned_size) {
+    old      = b->interned;
+    old_size = b->interned_size;
+    b->interned_size = old_size ? old_size * 2 : 1024;
+    if ((b->interned = (u_int32_t *) calloc(b->interned_size, sizeof(u_int32_t))) == NULL) {
+      b->interned = old;
+      b->interned_size = old_size;
+      if (!b->err) b->err = ENOMEM;
+      return HOSTDB_NONE;
+    }
+    for (k = 0; k < old_size; k++)
+      if (old[k]) {
+        for (off = hash_name(b->strings + old[k] - 1); b->interned[off & (b->interned_size-1)]; off++);
+        b->interned[off & (b->interned_size-1)] = old[k];
+      }
+    free(old);
+  }
+
+  for (k = hash_name(s); b->interned[k & (b->interned_size-1)]; k++)
+    if (strcmp(b->strings + b->interned[k & (b->interned_size-1)] - 1, s) == 0)
+      return b->interned[k & (b->interned_size-1)] - 1;
+
+  len = strlen(s) + 1;
+  if (b->strings_len + len > b->strings_max) {
+    off = b->strings_max ? b->strings_max : 65536;
+    while (b->strings_len + len > off) off *= 2;
+    if ((p = (char *) realloc(b->strings, off)) == NULL) {
+      if (!b->err) b->err = ENOMEM;
+      return HOSTDB_NONE;
+    }
+    b->strings     = p;
+    b->strings_max = off;
+  }
+  off = b->strings_len;
+  memcpy(b->strings + off, s, len);
+  b->strings_len += len;
+  b->interned[k & (b->interned_size-1)] = off + 1;
+  b->num_interned++;
+  return off;
+}
+
+/****************************************************************************
+* Function Name      :   hostdb_begin
+* Module ID          :   D(1)
+*
+* Purpose            :   To start compiling a host image.
+*
+* Method             :   Notes where the hosts file is, and when it was
+*                        last changed, for the header.
+*
+* Usage              :   compile_host_db (M1)
+*
+* External References:   (none)
+*
+* Arguments          :   source: (data_in)
+*                                The hosts file being compiled.
+*
+* Return Value       :   HOST_DB_BUILD *
+*                                The image being built, or NULL (with errno
+*                                set).
+*
+* Input Assertions   :   (none)
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   The groups and hosts are then added in order, and
+*                        any error is kept until hostdb_write.
+\***************************************************************************/
+HOST_DB_BUILD *
+hostdb_begin(source)
+char *source;
+{
+  HOST_DB_BUILD *b;
+  char path[PATH_MAX];
+  struct stat st;
+
+  if (stat(source, &st) < 0) return NULL;
+  if (realpath(source, path) == NULL) return NULL;
+  if ((b = (HOST_DB_BUILD *) calloc(1, sizeof(HOST_DB_BUILD))) == NULL) return NULL;
+  if ((b->source = strdup(path)) == NULL) {
+    free(b);
+    errno = ENOMEM;
+    return NULL;
+  }
+  b->source_mtime = st.st_mtime;
+  return b;
+}
+
+/*
+ * Add the next group to an image
+ */
+void
+hostdb_add_group(b, g, name, command)
+HOST_DB_BUILD *b; HOSTDB_GROUP *g; char *name, *command;
+{
+  HOSTDB_GROUP *p;
+
+  if (b->num_groups > 0xffff) {
+    if (!b->err) b->err = E2BIG;
+    return;
+  }
+  if ((p = (HOSTDB_GROUP *) grow(b, b->groups, b->num_groups, &b->max_groups, sizeof(HOSTDB_GROUP))) == NULL)
+    return;
+  b->groups = p;
+  p[b->num_groups] = *g;
+  p[b->num_groups].name    = intern(b, name);
+  p[b->num_groups].command = intern(b, command);
+  b->num_groups++;
+}
+
+/****************************************************************************
+* Function Name      :   hostdb_add_host
+* Module ID          :   D(1)
+*
+* Purpose            :   To add the next host to an image.
+*
+* Method             :   Copies the record, with its name and parent put
+*                        in the string table.
+*
+* Usage              :   compile_host_db (M1)
+*
+* External References:   (none)
+*
+* Arguments          :   b:    (data_in/out)
+*                                The image being built.
+*                        h:    (data_in)
+*                                The host (name and dep are filled in).
+*                        name: (data_in)
+*                                Its name.
+*                        dep:  (data_in)
+*                                Its dep= parent, or NULL.
+*
+* Return Value       :   (none)
+*
+* Input Assertions   :   Its group has been added.
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   (none)
+\***************************************************************************/
+void
+hostdb_add_host(b, h, name, dep)
+HOST_DB_BUILD *b; HOSTDB_HOST *h; char *name, *dep;
+{
+  HOSTDB_HOST *p;
+
+  if ((p = (HOSTDB_HOST *) grow(b, b->hosts, b->num_hosts, &b->max_hosts, sizeof(HOSTDB_HOST))) == NULL)
+    return;
+  b->hosts = p;
+  p[b->num_hosts] = *h;
+  p[b->num_hosts].name = intern(b, name);
+  p[b->num_hosts].dep  = intern(b, dep);
+  b->num_hosts++;
+}
+
+/****************************************************************************
+* Function Name      :   hostdb_write
+* Module ID          :   D(1)
+*
+* Purpose            :   To write out a compiled host image.
+*
+* Method             :   Builds the hashes of the hosts by address and by
+*                        name, lays out the sections after the header,
+*                        and writes it all to a temporary file that is then
+*                        renamed over the image.
+*
+* Usage              :   compile_host_db (M1)
+*
+* External References:   (none)
+*
+* Arguments          :   b:    (data_in)
+*                                The image being built (freed).
+*                        path: (data_in)
+*                                Where to put the image.
+*
+* Return Value       :   int
+*                                0 if written, -1 (with errno set) if not.
+*
+* Input Assertions   :   (none)
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   A daemon with the old image mapped carries on with
+*                        it undisturbed.  The first host wins on duplicates,
+*                        as with the index of a parsed hosts file.
+\***************************************************************************/
+int
+hostdb_write(b, path)
+HOST_DB_BUILD *b; char *path;
+{
+  HOSTDB_HEADER hdr;
+  u_int32_t *by_addr = NULL, *by_name = NULL, k, off;
+  char tmp[PATH_MAX], real[PATH_MAX];
+  char *image = NULL;
+  int i, fd, err;
+
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.source = intern(b, b->source);
+  if ((err = b->err) != 0) goto done;
+
+  /* Never over the hosts file itself */
+  if (realpath(path, real) != NULL && strcmp(real, b->source) == 0) {
+    err = EEXIST;
+    goto done;
+  }
+
+  memcpy(hdr.magic, HOSTDB_MAGIC, sizeof(hdr.magic));
+  hdr.version      = HOSTDB_VERSION;
+  hdr.num_hosts    = b->num_hosts;
+  hdr.num_groups   = b->num_groups;
+  hdr.source_mtime = b->source_mtime;
+  for (hdr.hash_size = 64; hdr.hash_size < (u_int32_t) b->num_hosts * 2; hdr.hash_size *= 2);
+
+#define ALIGNED(n)  (((n) + HOSTDB_ALIGN - 1) & ~(HOSTDB_ALIGN - 1))
+  off = ALIGNED(sizeof(hdr));
+  hdr.groups   = off;  off = ALIGNED(off + b->num_groups * sizeof(HOSTDB_GROUP));
+  hdr.hosts    = off;  off = ALIGNED(off + b->num_hosts * sizeof(HOSTDB_HOST));
+  hdr.by_addr  = off;  off = ALIGNED(off + hdr.hash_size * sizeof(u_int32_t));
+  hdr.by_name  = off;  off = ALIGNED(off + hdr.hash_size * sizeof(u_int32_t));
+  hdr.strings  = off;  off = off + b->strings_len;
+  hdr.strings_len = b->strings_len;
+  hdr.size     = off;
+#undef ALIGNED
+
+  if ((image = (char *) calloc(1, hdr.size)) == NULL) {
+    err = ENOMEM;
+    goto done;
+  }
+  by_addr = (u_int32_t *) (image + hdr.by_addr);
+  by_name = (u_int32_t *) (image + hdr.by_name);
+  for (i = 0; i < b->num_hosts; i++) {
+    for (k = hash_addr(b->hosts[i].addr); by_addr[k & (hdr.hash_size-1)]; k++)
+      if (b->hosts[by_addr[k & (hdr.hash_size-1)] - 1].addr == b->hosts[i].addr) break;
+    if (!by_addr[k & (hdr.hash_size-1)]) by_addr[k & (hdr.hash_size-1)] = i + 1;
+
+    for (k = hash_name(b->strings + b->hosts[i].name); by_name[k & (hdr.hash_size-1)]; k++)
+      if (b->hosts[by_name[k & (hdr.hash_size-1)] - 1].name == b->hosts[i].name) break;
+    if (!by_name[k & (hdr.hash_size-1)]) by_name[k & (hdr.hash_size-1)] = i + 1;
+  }
+  memcpy(image, &hdr, sizeof(hdr));
+  if (b->num_groups) memcpy(image + hdr.groups, b->groups, b->num_groups * sizeof(HOSTDB_GROUP));
+  if (b->num_hosts)  memcpy(image + hdr.hosts, b->hosts, b->num_hosts * sizeof(HOSTDB_HOST));
+  memcpy(image + hdr.strings, b->strings, b->strings_len);
+
+  snprintf(tmp, sizeof(tmp), "%s.%d", path, (int) getpid());
+  if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+    err = errno;
+    goto done;
+  }
+  if (write(fd, image, hdr.size) != (ssize_t) hdr.size || fsync(fd) < 0) {
+    err = errno ? errno : EIO;
+    close(fd);
+    (void) unlink(tmp);
+    goto done;
+  }
+  close(fd);
+  if (rename(tmp, path) < 0) {
+    err = errno;
+    (void) unlink(tmp);
+  }
+
+done:
+  free(image);
+  free(b->source);
+  free(b->groups);
+  free(b->hosts);
+  free(b->strings);
+  free(b->interned);
+  free(b);
+  errno = err;
+  return err ? -1 : 0;
+}
+
+/*
+ * Whether a file is a host image (rather than a hosts file)
+ */
+int
+hostdb_is_image(path)
+char *path;
+{
+  char magic[4];
+  int fd, n;
+
+  if ((fd = open(path, O_RDONLY)) < 0) return 0;
+  n = read(fd, magic, sizeof(magic));
+  close(fd);
+  return n == sizeof(magic) && memcmp(magic, HOSTDB_MAGIC, sizeof(magic)) == 0;
+}
+
+/****************************************************************************
+* Function Name      :   hostdb_open
+* Module ID          :   D(1)
+*
+* Purpose            :   To map in a compiled host image.
+*
+* Method             :   Maps the file read only, and checks the header,
+*                        that every section is inside it, and that every
+*                        string and group a record refers to is there.
+*
+* Usage              :   load_host_db (M1)
+*
+* External References:   (none)
+*
+* Arguments          :   path: (data_in)
+*                                The image.
+*
+* Return Value       :   HOST_DB *
+*                                The image, or NULL (with errno set, EINVAL
+*                                if it is not one we can use).
+*
+* Input Assertions   :   (none)
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   The records are used where they are, so the
+*                        mapping is kept for as long as they are.
+\***************************************************************************/
+HOST_DB *
+hostdb_open(path)
+char *path;
+{
+  HOSTDB_HEADER *hdr;
+  HOST_DB *db;
+  struct stat st;
+  u_int32_t i, used_addr, used_name;
+  int fd, err;
+
+  if ((fd = open(path, O_RDONLY)) < 0) return NULL;
+  if (fstat(fd, &st) < 0) {
+    err = errno;
+    close(fd);
+    errno = err;
+    return NULL;
+  }
+  if (st.st_size < (off_t) sizeof(HOSTDB_HEADER)) {
+    close(fd);
+    errno = EINVAL;
+    return NULL;
+  }
+  if ((db = (HOST_DB *) calloc(1, sizeof(HOST_DB))) == NULL) {
+    close(fd);
+    errno = ENOMEM;
+    return NULL;
+  }
+  db->size = st.st_size;
+  db->base = mmap(NULL, db->size, PROT_READ, MAP_PRIVATE, fd, 0);
+  err = errno;
+  close(fd);
+  if (db->base == MAP_FAILED) {
+    free(db);
+    errno = err;
+    return NULL;
+  }
+
+  hdr = db->hdr = (HOSTDB_HEADER *) db->base;
+#define INSIDE(off, len)  ((off) % HOSTDB_ALIGN == 0 && (off) <= db->size && (len) <= db->size - (off))
+  if (memcmp(hdr->magic, HOSTDB_MAGIC, sizeof(hdr->magic)) != 0 ||
+      hdr->version != HOSTDB_VERSION || hdr->size != db->size ||
+      hdr->num_groups < 1 || hdr->num_groups > 0x10000 ||
+      hdr->num_hosts > db->size / sizeof(HOSTDB_HOST) ||
+      hdr->hash_size < 2 * hdr->num_hosts || hdr->hash_size == 0 ||
+      (hdr->hash_size & (hdr->hash_size - 1)) ||
+      hdr->hash_size > db->size / sizeof(u_int32_t) ||
+      !INSIDE(hdr->groups, (size_t) hdr->num_groups * sizeof(HOSTDB_GROUP)) ||
+      !INSIDE(hdr->hosts, (size_t) hdr->num_hosts * sizeof(HOSTDB_HOST)) ||
+      !INSIDE(hdr->by_addr, (size_t) hdr->hash_size * sizeof(u_int32_t)) ||
+      !INSIDE(hdr->by_name, (size_t) hdr->hash_size * sizeof(u_int32_t)) ||
+      hdr->strings > db->size || hdr->strings_len != db->size - hdr->strings ||
+      hdr->strings_len == 0 || db->base[db->size - 1] != '\0')
+    goto invalid;
+#undef INSIDE
+
+  db->groups  = (HOSTDB_GROUP *) (db->base + hdr->groups);
+  db->hosts   = (HOSTDB_HOST *) (db->base + hdr->hosts);
+  db->by_addr = (u_int32_t *) (db->base + hdr->by_addr);
+  db->by_name = (u_int32_t *) (db->base + hdr->by_name);
+  db->strings = db->base + hdr->strings;
+
+  /* So that nothing read from it can point outside of it */
+  if (hdr->source >= hdr->strings_len) goto invalid;
+  for (i = 0; i < hdr->num_groups; i++)
+    if (db->groups[i].name >= hdr->strings_len ||
+        (db->groups[i].command != HOSTDB_NONE && db->groups[i].command >= hdr->strings_len))
+      goto invalid;
+  for (i = 0; i < hdr->num_hosts; i++)
+    if (db->hosts[i].name >= hdr->strings_len || db->hosts[i].group >= hdr->num_groups ||
+        (db->hosts[i].dep != HOSTDB_NONE && db->hosts[i].dep >= hdr->strings_len))
+      goto invalid;
+  for (i = used_addr = used_name = 0; i < hdr->hash_size; i++) {
+    if (db->by_addr[i] > hdr->num_hosts || db->by_name[i] > hdr->num_hosts)
+      goto invalid;
+    if (db->by_addr[i]) used_addr++;
+    if (db->by_name[i]) used_name++;
+  }
+  if (used_addr > hdr->num_hosts || used_name > hdr->num_hosts) goto invalid;
+  return db;
+
+invalid:
+  hostdb_close(db);
+  errno = EINVAL;
+  return NULL;
+}
+
+/*
+ * The hosts file an image was compiled from, and when it was changed
+ */
+char *
+hostdb_source(db, mtime)
+HOST_DB *db; time_t *mtime;
+{
+  *mtime = (time_t) db->hdr->source_mtime;
+  return db->strings + db->hdr->source;
+}
+
+int
+hostdb_hosts(db)
+HOST_DB *db;
+{
+  return db->hdr->num_hosts;
+}
+
+HOSTDB_HOST *
+hostdb_host(db, i)
+HOST_DB *db; int i;
+{
+  return &db->hosts[i];
+}
+
+int
+hostdb_groups(db)
+HOST_DB *db;
+{
+  return db->hdr->num_groups;
+}
+
+HOSTDB_GROUP *
+hostdb_group(db, i)
+HOST_DB *db; int i;
+{
+  return &db->groups[i];
+}
+
+/*
+ * A string of the image, NULL for HOSTDB_NONE
+ */
+char *
+hostdb_string(db, s)
+HOST_DB *db; u_int32_t s;
+{
+  return s == HOSTDB_NONE ? NULL : db->strings + s;
+}
+
+/****************************************************************************
+* Function Name      :   hostdb_find_addr
+* Module ID          :   D(1)
+*
+* Purpose            :   To find a host of an image by its address.
+*
+* Method             :   Looks it up in the hash compiled into the image.
+*
+* Usage              :   find_host_by_addr (M1)
+*
+* External References:   (none)
+*
+* Arguments          :   db:   (data_in)
+*                                The image.
+*                        addr: (data_in)
+*                                The address (network order).
+*
+* Return Value       :   int
+*                                The index of the host, or -1 if none.
+*
+* Input Assertions   :   (none)
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   The hash is at most half full (hostdb_open makes
+*                        sure of it), so this stops.
+\***************************************************************************/
+int
+hostdb_find_addr(db, addr)
+HOST_DB *db; in_addr_t addr;
+{
+  u_int32_t k, mask = db->hdr->hash_size - 1;
+
+  for (k = hash_addr(addr); db->by_addr[k & mask]; k++)
+    if (db->hosts[db->by_addr[k & mask] - 1].addr == addr)
+      return db->by_addr[k & mask] - 1;
+  return -1;
+}
+
+/*
+ * Find a host of an image by its name, as above
+ */
+int
+hostdb_find_name(db, name)
+HOST_DB *db; char *name;
+{
+  u_int32_t k, mask = db->hdr->hash_size - 1;
+
+  for (k = hash_name(name); db->by_name[k & mask]; k++)
+    if (strcmp(db->strings + db->hosts[db->by_name[k & mask] - 1].name, name) == 0)
+      return db->by_name[k & mask] - 1;
+  return -1;
+}
+
+/*
+ * Unmap an image, once nothing refers to it
+ */
+void
+hostdb_close(db)
+HOST_DB *db;
+{
+  if (!db) return;
+  (void) munmap(db->base, db->size);
+  free(db);
+}
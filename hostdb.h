@@ -0,0 +1,49 @@
+
+#include <sys/types.h>
+#include <netinet/in.h>
+
+typedef struct host_db HOST_DB;              /* a mapped image */
+typedef struct host_db_build HOST_DB_BUILD;  /* an image being compiled */
+
+#define HOSTDB_NONE   0xffffffffU  /* no string (or inherited option) */
+
+/* a host as compiled, its name resolved and options parsed */
+typedef struct hostdb_host {
+  in_addr_t           addr;             /* address (network order) */
+  u_int32_t           name;             /* host name (string) */
+  u_int32_t           dep;              /* dep=, HOSTDB_NONE=none */
+  int32_t             schedule;         /* int=, secs between packets */
+  int16_t             retry;            /* ret=, -1=the group's */
+  int16_t             from;             /* mon=, monitor from this time */
+  int16_t             until;            /* mon=, monitor until this time */
+  u_int16_t           group;            /* index of its group */
+  u_int16_t           port;             /* probe=, port for TCP probes */
+  u_int8_t            probe;            /* probe=, probe type */
+  u_int8_t            pri;              /* pri=, priority class */
+} HOSTDB_HOST;
+
+/* a group line, -1 or HOSTDB_NONE where the command line applies */
+typedef struct hostdb_group {
+  u_int32_t           name;             /* group name (string) */
+  int32_t             timeout;          /* timeout=, maximum RTO (msec) */
+  int32_t             retry;            /* retry=, retries of its hosts */
+  u_int32_t           command;          /* notify= (string), ""=none */
+  int32_t             report;           /* report=, HHMM, -1=default */
+} HOSTDB_GROUP;
+
+extern HOST_DB_BUILD *hostdb_begin(char *source);
+extern void hostdb_add_group(HOST_DB_BUILD *b, HOSTDB_GROUP *g, char *name, char *command);
+extern void hostdb_add_host(HOST_DB_BUILD *b, HOSTDB_HOST *h, char *name, char *dep);
+extern int hostdb_write(HOST_DB_BUILD *b, char *path);
+
+extern int hostdb_is_image(char *path);
+extern HOST_DB *hostdb_open(char *path);
+extern char *hostdb_source(HOST_DB *db, time_t *mtime);
+extern int hostdb_hosts(HOST_DB *db);
+extern HOSTDB_HOST *hostdb_host(HOST_DB *db, int i);
+extern int hostdb_groups(HOST_DB *db);
+extern HOSTDB_GROUP *hostdb_group(HOST_DB *db, int i);
+extern char *hostdb_string(HOST_DB *db, u_int32_t s);
+extern int hostdb_find_addr(HOST_DB *db, in_addr_t addr);
+extern int hostdb_find_name(HOST_DB *db, char *name);
+extern void hostdb_close(HOST_DB *db);
@@ -0,0 +1,81 @@
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+
+/*
+ * The probe engine of linkstat, for use from another program
+ * (liblinkstat.a).  Each ls_open gives an engine of its own, with its
+ * own hosts, sockets and callbacks; a program can run several of them
+ * from one thread.
+ */
+
+typedef struct ls_engine LS_ENGINE;
+
+#define LS_WINDOWS    4   /* rolling SLA windows: 1h, 24h, 7d and 30d */
+
+/* called as hosts change state, answer and lose probes (may be NULL) */
+typedef struct ls_callbacks {
+  void              (*state)(void *arg, int host, int up);
+  void              (*rtt)(void *arg, int host, long usecs);   /* -1=not known */
+  void              (*loss)(void *arg, int host, int retries_left);
+  void               *arg;
+} LS_CALLBACKS;
+
+/* the main parameters, 0 for the default (or the command line) */
+typedef struct ls_params {
+  int                 timeout;          /* maximum RTO, pause between cycles (msec) */
+  int                 interval;         /* delay between packets (msec) */
+  int                 retry;            /* retries before a host is down */
+  int                 rto_min;          /* minimum RTO (msec) */
+  int                 confirm_rate;     /* re-probes of suspect hosts per sec */
+  int                 cycle;            /* planned cycle time (msec) */
+  int                 max_detect;       /* adaptive probing within it (secs), 0=off */
+  int                 prefix;           /* roll hosts up by prefix length, 0=off */
+} LS_PARAMS;
+
+/* what is known of a host */
+typedef struct ls_host_info {
+  char               *name;
+  struct in_addr      addr;
+  int                 up;               /* 1=up, 0=down */
+  int                 suspect;          /* re-probes sent while suspect */
+  int                 paused;           /* not being probed, 1=yes */
+  long                srtt;             /* smoothed RTT (usec), 0=none yet */
+  long                rttvar;           /* RTT variance (usec) */
+  long                rto;              /* retransmission timeout (usec) */
+  time_t              last_answer;      /* 0=never */
+  long                downtime;         /* secs down, since started */
+  int                 down_count;       /* times down */
+  long                window_down[LS_WINDOWS];   /* secs down in each window */
+  long                window_period[LS_WINDOWS]; /* secs monitored of it */
+  int                 window_count[LS_WINDOWS];  /* times down in it */
+} LS_HOST_INFO;
+
+/*
+ * Open the engine, then add the hosts (options as in the hosts file,
+ * such as "(ret=5, probe=tcp:80)") and start it.  Hosts can be added
+ * and removed after it has started.  Each host is known by the number
+ * ls_add_host returns.
+ */
+extern LS_ENGINE *ls_open(LS_PARAMS *params, LS_CALLBACKS *cb);
+extern int ls_add_host(LS_ENGINE *e, char *name, char *addr, char *options);
+extern int ls_remove_host(LS_ENGINE *e, int host);
+extern int ls_find_host(LS_ENGINE *e, char *name);
+extern int ls_host_info(LS_ENGINE *e, int host, LS_HOST_INFO *info);
+extern int ls_start(LS_ENGINE *e);
+
+/*
+ * Run it from an event loop: wait on the descriptors from ls_fds for
+ * up to ls_timeout msecs, then call ls_step(e, 0).  Or hand it the
+ * thread with ls_step(e, -1).
+ */
+extern int ls_fds(LS_ENGINE *e, fd_set *set, int maxfd);
+extern long ls_timeout(LS_ENGINE *e);
+extern void ls_step(LS_ENGINE *e, int msecs);
+
+/*
+ * Stop it, closing everything it opened, and free it.
+ */
+extern void ls_close(LS_ENGINE *e);
@@ -2,14 +2,14 @@
 /****************************************************************************\
 |*                                                                          *|
 |* File          : linkstat.c  --  link status daemon                       *|
-|* Version       : 2.0.0                                                    *|
+|* Version       : 2.25.0                                                   *|
 |*                                                                          *|
 |* Created On    : Sat Feb 21 11:12:32 NZDT 1998                            *|
 |* Author        : Kevin Clark                                              *|
 |*                                                                          *|
 |* Last Modifier : Kevin Clark                                              *|
-|* Modified On   : Sat Aug  7 13:11:44 NZDT 2010                            *|
-|* Mod Count     : 17                                                       *|
+|* Modified On   : Sun Oct 18 14:20:00 NZDT 2026                            *|
+|* Mod Count     : 43                                                       *|
 |* Status        : TESTED                                                   *|
 |*                                                                          *|
 |*                                                                          *|
@@ -41,14 +41,76 @@
 |*     "timeout" parameter) for any outstanding packets.  This also has     *|
 |*     effect of pausing for at lease a second between cycles.              *|
 |*                                                                          *|
-|*     If a packet is not received from a host after 3 consecutive cycles   *|
-|*     (configured through the "retry" parameter) then the host is          *|
-|*     considered to be "down".  A host is considered to be "up" as soon    *|
+|*     Each packet carries the time it was sent, and the round trip time    *|
+|*     of every reply is used to keep a smoothed RTT and RTT variance for   *|
+|*     each host (the same estimator TCP uses, see RFC 6298).  From these   *|
+|*     a per-host retransmission timeout (RTO) of SRTT + 4 x RTTVAR is      *|
+|*     derived, bounded by 20ms (configured through the "rto_min"           *|
+|*     parameter) and the "timeout" parameter.  A packet is considered      *|
+|*     lost as soon as its own RTO expires, and is then retransmitted       *|
+|*     straight away.  If 3 consecutive packets (configured through the     *|
+|*     "retry" parameter) are lost then the host is considered to be        *|
+|*     "down".  A host on the local LAN is therefore detected as down       *|
+|*     within milliseconds, while remote hosts are automatically given      *|
+|*     proportionally longer.  A host is considered to be "up" as soon      *|
 |*     as any packet is received from it.                                   *|
 |*                                                                          *|
+|*     After its first lost packet a live host is "suspect", and is         *|
+|*     re-probed outside of the normal cycle (and its int= schedule) with   *|
+|*     an exponential backoff: RTO, 2 x RTO, 4 x RTO, ... (each at most     *|
+|*     the "timeout" parameter).  A suspect host is therefore confirmed     *|
+|*     up or down within "retry" x "timeout", however rarely it is          *|
+|*     normally probed.  Re-probes are limited to 100 per second            *|
+|*     (configured through the "confirm_rate" parameter) so that a large    *|
+|*     outage does not flood the network.                                   *|
+|*                                                                          *|
+|*     A destination unreachable (network, host or admin prohibited) for    *|
+|*     a probe, from a router on the way or our own kernel, is matched      *|
+|*     back to the host by the probe it holds (our ident and the address    *|
+|*     probed) and taken as final: the host is down there and then, with    *|
+|*     no retries, rather than after "retry" x "timeout" of silence.  The   *|
+|*     errors are counted per host ("show") and per router ("routers").     *|
+|*                                                                          *|
+|*     With "-detect <secs>" hosts that have been stable for a while are    *|
+|*     probed less often.  A host's interval (its int= schedule, or one     *|
+|*     second for a local host) doubles each time it has been up for 8      *|
+|*     times the new interval, for as long as a failure straight after a    *|
+|*     probe would still be found and confirmed (retry x timeout, plus a    *|
+|*     cycle) within the detection time, which is the worst case.  A miss,  *|
+|*     a change of state or an outage of its parent or subnet puts it back  *|
+|*     on its own schedule (due at once) until it has settled again.  A     *|
+|*     host up for an hour with "-detect 300" is probed every 256 seconds.  *|
+|*     Hosts probed less often are never shed (pri=), so the bound holds    *|
+|*     when the cycles overrun.                                             *|
+|*                                                                          *|
+|*     Flapping hosts are damped, as BGP routes are.  Each time a host      *|
+|*     goes down it takes a penalty of 1000, which halves every 5 minutes.  *|
+|*     Past 3000 its state changes are held: the "is unreachable" and "is   *|
+|*     alive" lines and notifications give way to a single "is flapping",   *|
+|*     until the penalty has decayed under 750, when its state is given     *|
+|*     again.  So one host on a bad port can't use up the notifications     *|
+|*     meant for the rest.  Its downtime, SLA windows and history are kept  *|
+|*     as usual throughout, and "show" gives its penalty.                   *|
+|*                                                                          *|
+|*     The hosts are rolled up by group (when there is more than one) and   *|
+|*     by prefix (configured through the "prefix" parameter, a prefix       *|
+|*     length): how many are up, down and degraded (suspect or flapping),   *|
+|*     their average RTT and the host-seconds down.  The counts are moved   *|
+|*     as each host changes state, not worked out from the hosts, so the    *|
+|*     status message gives every group or prefix with hosts down (or       *|
+|*     downtime since the last message) at the cost of one line each, and   *|
+|*     a wide outage shows up as one line rather than hundreds.  The SLA    *|
+|*     report gives their downtime too, and "rollup" any of them at once.   *|
+|*                                                                          *|
 |*                                                                          *|
 |* Command Line Options:                                                    *|
 |*                                                                          *|
+|*     An option may be shortened to any part of it that is unambiguous.    *|
+|*     -t -i -r -u -s -d -f -l -n -m -h and -v are single letters as        *|
+|*     before, but with the options added since, a first letter alone may   *|
+|*     no longer do (-c could be -confirm_rate, -control, -cycle, ...).     *|
+|*     Numeric options must be given a number.                              *|
+|*                                                                          *|
 |*     -help            display information                                 *|
 |*     -version         display version information                         *|
 |*     -timeout #       delay between polls (default 1000 msecs)            *|
@@ -60,6 +122,38 @@
 |*     -file file       file to read list of hosts                          *|
 |*     -log file        file to log output when detached from terminal      *|
 |*     -mac_check       check the MAC address of the returned packets       *|
+|*     -rto_min #       minimum retransmission timeout (default 20 msecs)   *|
+|*     -confirm_rate #  max re-probes of suspect hosts (default 100/sec)    *|
+|*     -subnet #        group hosts by subnet prefix length (default off)   *|
+|*     -dep_interval #  probe interval during an outage (default 60 secs)   *|
+|*     -prefix #        roll the hosts up by prefix length for the status   *|
+|*                      (default off)                                       *|
+|*     -ring interface  receive replies through a packet ring (TPACKET_V3)  *|
+|*     -xdp interface   send and receive through an AF_XDP socket           *|
+|*     -txtime qdisc    pace probes in the kernel (qdisc is fq or etf)      *|
+|*     -busy_poll #     spin for replies before sleeping (usecs)            *|
+|*     -cpu #           run on this CPU (for use with busy_poll)            *|
+|*     -arp interface   probe local hosts on its subnets by ARP             *|
+|*     -history dir     record state changes and RTT/loss summaries         *|
+|*     -query host      report the history of a host (or all) and exit      *|
+|*     -control socket  take commands on this Unix domain socket            *|
+|*     -stream socket   stream state changes to subscribers on this socket  *|
+|*     -cycle #         planned cycle time, lower pri= classes shed beyond  *|
+|*                      it (msecs)                                          *|
+|*     -detect #        probe stable hosts less often, detecting failures   *|
+|*                      within it (secs, default off)                       *|
+|*     -compile file    compile a hosts file into an image, and exit        *|
+|*     -output image    where to write the image (with -compile)            *|
+|*     -cluster node@host:port  probe this node's slice of the hosts,       *|
+|*                      reporting to the aggregator at host:port            *|
+|*     -aggregate [addr:]#  merge the reports of the cluster nodes on this  *|
+|*                      UDP port, instead of probing (addr default          *|
+|*                      127.0.0.1)                                          *|
+|*     -key file        sign and check the cluster messages with the shared *|
+|*                      key in it                                           *|
+|*     -capture pcap    capture the probes and replies in a pcap file       *|
+|*     -replay pcap     replay a capture through the engine at full speed,  *|
+|*                      and exit                                            *|
 |*                                                                          *|
 |*                                                                          *|
 |* Notes:                                                                   *|
@@ -84,9 +178,139 @@
 |*     current state and a message description (detailing time, host and    *|
 |*     state change).                                                       *|
 |*                                                                          *|
+|*     A host may depend on another host (such as the router or switch      *|
+|*     it sits behind) through the dep= option, and hosts may also be       *|
+|*     grouped automatically by subnet (configured through the "subnet"     *|
+|*     parameter, a prefix length).  When a parent host goes down, or at    *|
+|*     least half of a subnet group (of 4 or more hosts) is unreachable,    *|
+|*     a single OUTAGE is logged (and notified) and the state changes of    *|
+|*     the dependent hosts are rolled into it rather than being logged      *|
+|*     one by one.  While the outage lasts the dependent hosts are only     *|
+|*     probed every 60 seconds (configured through the "dep_interval"       *|
+|*     parameter).  When the parent recovers, all of its dependents are     *|
+|*     probed straight away, and the outage is closed with a summary.       *|
+|*                                                                          *|
+|*     Packet deadlines are kept in a priority queue, so that only the      *|
+|*     hosts whose deadline has actually passed are looked at, and the      *|
+|*     hosts that are currently unreachable (or have been at some point)    *|
+|*     are indexed separately.  Idle work therefore does not grow with      *|
+|*     the number of hosts, and the host table grows as required.           *|
+|*                                                                          *|
+|*     On Linux, replies can be received through a memory mapped packet     *|
+|*     ring (TPACKET_V3) on an ethernet interface (configured through the   *|
+|*     "ring" parameter, "any" for all interfaces).  A BPF filter passes    *|
+|*     only our own echo replies into the ring, where they are processed    *|
+|*     in place a block at a time, rather than copied out by one system     *|
+|*     call each.  Round trip times are then taken from the kernel receive  *|
+|*     timestamps, and the source MAC address of each reply comes with it   *|
+|*     (so the mac_check parameter no longer needs ARP cache lookups).      *|
+|*                                                                          *|
+|*     Alternatively, probes can be sent and received through an AF_XDP     *|
+|*     socket on an ethernet interface (configured through the "xdp"        *|
+|*     parameter).  Echo requests to live hosts whose MAC address is in     *|
+|*     the ARP cache of the interface are built directly in shared memory   *|
+|*     and queued on its transmit ring, while a small XDP program (run in   *|
+|*     generic mode, so any interface will do) redirects only our echo      *|
+|*     replies into its receive ring.  Other hosts, and replies arriving    *|
+|*     on other receive queues, use the raw socket as before, as does       *|
+|*     everything if the AF_XDP socket cannot be set up.                    *|
+|*                                                                          *|
+|*     On Linux, the spacing between probes can be left to the kernel       *|
+|*     (configured through the "txtime" parameter).  Each probe of a        *|
+|*     cycle is stamped with its transmit time (SO_TXTIME), "interval"      *|
+|*     apart, and handed over 64 at a time (sendmmsg).  The fq qdisc (or    *|
+|*     etf, which uses the TAI clock) on the outgoing interface then        *|
+|*     releases each one at its time, while we just process the replies.    *|
+|*     Without one of these qdiscs the probes are sent in bursts.           *|
+|*                                                                          *|
+|*     Replies are timed from the moment the kernel received them, and      *|
+|*     the delay between that and us getting round to them (the wakeup      *|
+|*     latency) is shown in the status message.  For latency sensitive      *|
+|*     networks a busy poll mode can be turned on (configured through the   *|
+|*     "busy_poll" parameter, in microseconds).  Rather than going          *|
+|*     straight to sleep while waiting for replies, we spin checking for    *|
+|*     them for up to that long, and the socket is set to busy poll the     *|
+|*     device (SO_BUSY_POLL, SO_PREFER_BUSY_POLL).  This trades a CPU for   *|
+|*     lower and steadier latency, and the process can be tied to an        *|
+|*     isolated CPU (configured through the "cpu" parameter).               *|
+|*                                                                          *|
+|*     Hosts that do not answer pings (or where it is a service that        *|
+|*     matters) can be probed over TCP instead, through the probe=          *|
+|*     option.  With probe=tcp:<port> a non-blocking connect is made to     *|
+|*     the port, and the host is only counted as answering if the           *|
+|*     connection is established (it is then reset straight away).  With    *|
+|*     probe=syn:<port> a bare SYN is sent from a raw socket (from a port   *|
+|*     held bound for it), and either a SYN-ACK or a RST counts, as both    *|
+|*     show the host is alive.  The scheduling, retries, RTO and SLA        *|
+|*     reporting are the same as for ICMP probes.                           *|
+|*                                                                          *|
+|*     Local hosts (those without an int= schedule) on a directly           *|
+|*     attached subnet can be probed at layer 2 instead (configured         *|
+|*     through the "arp" parameter, an ethernet interface).  An ARP         *|
+|*     request is broadcast for each of them from a packet socket, 64 at    *|
+|*     a time (sendmmsg) and without the usual spacing, and the replies     *|
+|*     are taken from a packet ring, so even a /16 is swept in well under   *|
+|*     a second.  A host answers ARP even if it firewalls ICMP, and the     *|
+|*     reply carries its MAC address, which is used by the "mac_check"      *|
+|*     parameter.  Hosts on other subnets are pinged as before.             *|
+|*                                                                          *|
+|*     The history of every host can be recorded on disk (configured        *|
+|*     through the "history" parameter, a directory): each time it goes     *|
+|*     up or down, and a summary of its probes, losses and RTT at each      *|
+|*     status message.  The records are handed to a background thread, so   *|
+|*     the probing never waits on the disk, which keeps a chunk for each    *|
+|*     host (delta encoded varints) and appends it as a block to the data   *|
+|*     file of the day once full, or after 15 minutes.  An index of the     *|
+|*     blocks is kept alongside, so "linkstat -history <dir> -query         *|
+|*     <host>[:days]" reads only the blocks of that host, and "-query all"  *|
+|*     reads only the days asked for.                                       *|
+|*                                                                          *|
+|*     Each host that has been down keeps rolling SLA windows of the last   *|
+|*     hour, day, week and 30 days, as rings of buckets (12 x 5 minutes,    *|
+|*     24 x 1 hour, 28 x 6 hours and 30 x 1 day) of downtime and down       *|
+|*     counts.  They are updated as the host goes down and comes back, a    *|
+|*     bounded amount of work whatever the history, so a report of them     *|
+|*     is immediate and can be asked for at any time with SIGUSR2 (the      *|
+|*     process carries on).  The SLA report (SIGHUP, or the "slarep" time)  *|
+|*     includes them, and is now produced at that time every day.           *|
+|*                                                                          *|
+|*     Commands can be sent while we run through a Unix domain socket       *|
+|*     (configured through the "control" parameter, a path), one per        *|
+|*     line, for example with "socat - UNIX-CONNECT:<path>":                *|
+|*        probe <host>  - Probe the host now, ahead of the cycle, and       *|
+|*                        reply when it answers (or its RTO runs out)       *|
+|*        show <host>   - Its state, probe type, RTT, RTO and downtime      *|
+|*        down          - List the hosts that are unreachable               *|
+|*        routers       - List who has sent ICMP errors for our probes      *|
+|*        pause <host>  - Stop probing the host (it keeps its state)        *|
+|*        resume <host> - Start probing it again                            *|
+|*        trace [n]     - Dump the flight recorder, with the last n (100)   *|
+|*                        events                                            *|
+|*        rollup [name] - The counts of a group or prefix (or all of them)  *|
+|*     The socket is served from the same loop as the replies, so a         *|
+|*     command is dealt with within one packet's time, and a client that    *|
+|*     stops reading is dropped rather than holding us up.                  *|
+|*                                                                          *|
+|*     State changes are streamed to subscribers on a second Unix domain    *|
+|*     socket (configured through the "stream" parameter, a path).  A       *|
+|*     subscriber sends one line:                                           *|
+|*        subscribe [json|binary] [events=a,b] [hosts=a,b] [groups=a,b]     *|
+|*     and is sent each event it asked for (down, up, rtt, outage,          *|
+|*     restored, flapping, settled, all by default) as a JSON line or a     *|
+|*     fixed size record (SUB_EVENT in sub.h).  Sending another line        *|
+|*     changes the filter.  Events are queued for each subscriber and       *|
+|*     sent before each wait, and one that falls behind has the oldest      *|
+|*     kept and is sent a "dropped" event with the count lost, rather       *|
+|*     than holding us up.  Names in a filter must fit the event (63        *|
+|*     characters for a host, 31 for a group); a longer host or group       *|
+|*     name is cut short in the event and flagged (host_cut, group_cut),    *|
+|*     and is never matched by a filter.                                    *|
+|*                                                                          *|
 |*     Many of the parameters are configurable on the command line.         *|
-|*     The minimum value for the interval parameter is 5ms, and 500ms for   *|
-|*     the timeout parameter.                                               *|
+|*     The minimum value for the interval parameter is 5ms, 500ms for the   *|
+|*     timeout parameter and 1ms for the rto_min parameter.  The timeout    *|
+|*     parameter is also the initial RTO of a host (before any round trip   *|
+|*     time has been measured) and its upper bound.                         *|
 |*                                                                          *|
 |*     While other methods of listing the hosts to check are available,     *|
 |*     such as command line and standard input, the only one that has full  *|
@@ -96,10 +320,109 @@
 |*        <IP Address> <Hostname> # (int=<freq>,ret=<num>,mon=<HHMM:hhmm>)  *|
 |*                                                                          *|
 |*     While the items after the "#" are optional, the currently supported  *|
-|*     options are as follows:                                              *|
+|*     options are as follows (in any order, separated by commas):          *|
 |*        int=<frequency> - Specifies how often to check the host (secs)    *|
 |*        ret=<number>    - Specifies the max number of packet retransmits  *|
 |*        mon=<HHMM:hhmm> - Monitor between the hours of HHMM and hhmm      *|
+|*        dep=<host>      - The host (name or address) this one depends on  *|
+|*        probe=<type>    - How to probe it: icmp (default), tcp:<port> or  *|
+|*                          syn:<port>                                      *|
+|*        pri=<class>     - Priority class, 1 (highest) to 3 (default 2)    *|
+|*     Anything after the "#" that does not start with "(" is a comment.    *|
+|*                                                                          *|
+|*     Several policies can share the one process (and its one socket       *|
+|*     and receive path), by splitting the hosts file into groups.  A       *|
+|*     line of the form                                                     *|
+|*                                                                          *|
+|*        group <name> # (timeout=<msecs>,retry=<num>,notify=<command>,     *|
+|*                        report=<HHMM>)                                    *|
+|*                                                                          *|
+|*     puts the hosts that follow it under that group, and any of the       *|
+|*     options given replace the "timeout", "retry" and "notify"            *|
+|*     parameters (notify=none for no command, which can't contain spaces   *|
+|*     or commas) and the time of the SLA report for its hosts alone        *|
+|*     (which is headed with the name of the group).                        *|
+|*     Hosts before the first group line are in the "default" group, with   *|
+|*     the parameters of the command line.  The timeout of a group bounds   *|
+|*     the RTO of its hosts, while the "timeout" parameter still sets the   *|
+|*     pause between cycles.                                                *|
+|*                                                                          *|
+|*     Each host is in a priority class (the pri= option), from 1 (core     *|
+|*     infrastructure) to 3 (the lab printer), 2 by default.  The probes    *|
+|*     of a cycle are planned to take the spacing of the local hosts plus   *|
+|*     a quarter (or the "cycle" parameter, less the "timeout" pause).      *|
+|*     When they take longer, class 1 hosts are still probed every cycle,   *|
+|*     while class 2 hosts are probed every N cycles and class 3 every 2N,  *|
+|*     N being the smallest factor that would bring the cycle back within   *|
+|*     its plan at the smoothed cost of a probe.  Deferred hosts stay due,  *|
+|*     spread over the cycles, and N comes back down once there is room.    *|
+|*                                                                          *|
+|*     A large hosts file can be compiled ahead of time with "linkstat      *|
+|*     -compile <file> -output <image>", which resolves every host and      *|
+|*     parses its options once, and writes them (with each name stored      *|
+|*     once, and hashes of the hosts by address and by name) to a binary    *|
+|*     image.  Given the image with -file, the daemon maps it in and sets   *|
+|*     up all of its hosts in one allocation, with their names left in      *|
+|*     the image, so even 200,000 hosts start in well under a second.  The  *|
+|*     image records the hosts file it came from, and if that has changed   *|
+|*     since, it is read instead and the image compiled again.  The group   *|
+|*     options that were not given still come from the command line.        *|
+|*                                                                          *|
+|*     The probe engine can also be built into another program ("make       *|
+|*     lib" builds liblinkstat.a, see liblinkstat.h).  Hosts are added and  *|
+|*     removed as it runs, and it is driven from the program's own event    *|
+|*     loop through its descriptors, the time until it next needs a step    *|
+|*     and the step itself.  State changes, RTTs and losses are handed to   *|
+|*     callbacks as numbers, with no formatting.  The daemon is a thin      *|
+|*     wrapper around the same engine.  A program can open several          *|
+|*     engines, each with hosts, sockets and callbacks of its own, and run  *|
+|*     them from one thread.  They log to stdout as the daemon does.        *|
+|*                                                                          *|
+|*     Several nodes can share the hosts of one file with "-cluster         *|
+|*     <node>@<host>:<port>", each reporting to an aggregator ("linkstat    *|
+|*     -aggregate <port>" on that host).  The aggregator tells the nodes    *|
+|*     which of them are alive, and each probes the hosts that land on it   *|
+|*     on a consistent hash ring of their names (64 points per node), so    *|
+|*     when a node joins or is lost (3 missed heartbeats) only its share    *|
+|*     of the hosts moves.  Until a node hears from the aggregator it       *|
+|*     probes every host.  The nodes pass their state changes and, with     *|
+|*     each status message, the SLA windows of the hosts that have been     *|
+|*     down up to the aggregator, which keeps the state of each host as     *|
+|*     its owner reports it, logs a fleet status every "update" secs and    *|
+|*     reports the SLA windows merged across the nodes on SIGUSR2 (and      *|
+|*     SIGHUP, before it exits).  The messages are single UDP datagrams.    *|
+|*     With "-key <file>" (the same on every node and the aggregator) each  *|
+|*     is signed with an HMAC-SHA256 of the key and the sender's clock, and *|
+|*     those that are forged, replayed or more than 30 secs adrift are      *|
+|*     dropped.  The aggregator listens on 127.0.0.1 unless given an        *|
+|*     address, and only on loopback without a key.                         *|
+|*                                                                          *|
+|*     With "-capture <pcap>" every echo request is written to a pcap file  *|
+|*     (raw IPv4) as it is sent, and every reply as it is taken, stamped    *|
+|*     by the kernel.  "-replay <pcap>" runs the engine from such a file    *|
+|*     (or one taken by tcpdump) with no sockets: a probe is answered if    *|
+|*     the host answered the request sent to it at that point in the        *|
+|*     capture, after the same round trip, and the clock jumps from one     *|
+|*     event to the next, so a day of probes is replayed in seconds with    *|
+|*     whatever timeout, retry and interval are given.  The log lines       *|
+|*     carry the times of the capture, nothing is notified, and hosts it    *|
+|*     has no requests for are left out.  At the end it reports how long    *|
+|*     each host going down took to pick up (from its first unanswered      *|
+|*     request) and how many were false alarms (answering the next          *|
+|*     request again), then the SLA report.                                 *|
+|*                                                                          *|
+|*     A flight recorder is always running.  The time spent in each phase   *|
+|*     of the main loop (going through the schedule, sending, taking        *|
+|*     replies, waiting between sends, the pause at the end, the sweep      *|
+|*     for unanswered probes and the reports) is added up from the TSC      *|
+|*     for each of the last 256 cycles, and the last 4096 events (hosts     *|
+|*     going down and coming back, shedding, a phase running on for more    *|
+|*     than 100ms, the probes of a cycle running over the plan) are kept,   *|
+|*     in rings that are written over without locks.  SIGUSR1 dumps it to   *|
+|*     the log there and then, even with the loop stuck: the average and    *|
+|*     worst of each phase, the five slowest cycles phase by phase, and     *|
+|*     the events ("TRACE" lines, times in secs before the dump).  The      *|
+|*     "trace" command sends it to a control client.                        *|
 |*                                                                          *|
 |*     A description of the lines recorded in the logfile are as follows:   *|
 |*     1/ <host> is unreachable, after <time>                               *|
@@ -110,31 +433,83 @@
 |*          This reports that the host is now responding.  There may also   *|
 |*          be displayed the time that the host was previously unavailable  *|
 |*          (ie downtime)                                                   *|
-|*     3/ Waiting on <x> (<y> unreachable), I:<i> R:<r> C:<c> M:<m>         *|
+|*     3/ Waiting on <x> (<y> unreachable), I:<i> R:<r> C:<c> S:<s> F:<f>   *|
+|*          O:<o> D:<d>/<f> L:<avg>/<max>us E:<e> A:<a> X:<x> M:<m>         *|
 |*          This is a status message showing that we are currently waiting  *|
 |*          on X number of local hosts to respond with Y local hosts        *|
 |*          currently unreachable.  It also reports the current Interval    *|
 |*          value.  The R value is the optimal retry count (this will be at *|
 |*          its maximum when a host has gone down).  The C parameter shows  *|
 |*          how many cycles the process has gone through since last         *|
-|*          displaying this message.  The M parameter indicates how many    *|
-|*          hardware (MAC) addresses are being checked.                     *|
+|*          displaying this message.  The S parameter is the number of      *|
+|*          hosts currently suspect, and F is the number of suspect hosts   *|
+|*          that answered a re-probe (false alarms) since the last message. *|
+|*          The O parameter is the number of outages currently in progress. *|
+|*          The D parameter is the number of probes deferred by load        *|
+|*          shedding since the last message, and the current shed factor.   *|
+|*          The L parameter is the average and worst wakeup latency of the  *|
+|*          replies (time from the kernel receiving them to us processing   *|
+|*          them) since the last message.                                   *|
+|*          The E parameter is the number of ICMP errors taken for our      *|
+|*          probes since the last message.                                  *|
+|*          The A parameter is the number of hosts being probed less often  *|
+|*          as they have been stable (-detect).                             *|
+|*          The X parameter is the number of hosts whose state changes are  *|
+|*          held as they are flapping.                                      *|
+|*          The M parameter indicates how many hardware (MAC) addresses     *|
+|*          are being checked.                                              *|
+|*     4/ <host> is suspect / <host> is no longer suspect                   *|
+|*          Logged when the "debug" parameter is set, these report each     *|
+|*          host entering and leaving the suspect state, along with         *|
+|*          "<host> refused, <error> from <router>" for each ICMP error.    *|
+|*     5/ OUTAGE <parent> ... / OUTAGE <parent> is over, after <time> ...   *|
+|*          These report the start and end of an outage of a parent host    *|
+|*          or a subnet group.  The end of the outage reports how many      *|
+|*          state changes of dependent hosts were rolled into it, and how   *|
+|*          many dependent hosts are still unreachable.                     *|
+|*     6/ SLA_WIN <host> 1h <d>/<c> <p> 24h ... 7d ... 30d ...              *|
+|*          The rolling SLA windows of a host that has been down: seconds   *|
+|*          down, times down and percentage down in each window (over the   *|
+|*          part of the window since monitoring started).  The SLA_WIN all  *|
+|*          line gives the downtime and percentage over all of the hosts.   *|
+|*     7/ Cluster of <n> nodes, probing <x> of <y> hosts (took <t>, gave    *|
+|*          up <g>)                                                         *|
+|*          A cluster node's slice of the hosts after the live nodes have   *|
+|*          changed, with how many hosts came to it and went elsewhere.     *|
+|*     8/ Fleet: <n> nodes, <h> hosts, <d> unreachable, <node>:<x>/<y> ...  *|
+|*          The aggregator's status message, with each node's slice and     *|
+|*          how many of it are unreachable.  It also logs nodes joining,    *|
+|*          leaving and being lost, and "<host> is alive|unreachable (node  *|
+|*          <node>)" as the owners of the hosts report them.                *|
+|*     9/ Replayed <s>s of probes in <w>s (<x>x), sending <n>               *|
+|*          Hosts went down <d> times, <f> false alarms, detected in <a>ms  *|
+|*          on average (<m>ms at worst)                                     *|
+|*          The end of a replay (-replay), before the SLA report.           *|
+|*    10/ <host> is flapping (down <n> times), holding its state changes    *|
+|*        <host> has stopped flapping, <state> (<n> state changes held)     *|
+|*          A host's state changes are held while its flap penalty is       *|
+|*          high, and given again (with the state it is now in) once it     *|
+|*          has decayed.  Both are notified, as "flapping" and "up" or      *|
+|*          "down".                                                         *|
+|*    11/ Rollup <name>: <n> hosts, <u> up, <d> down, <g> degraded, avg     *|
+|*          RTT <r>us, <s> host-secs down                                   *|
+|*          After the status message, each group or prefix with hosts down  *|
+|*          or degraded, or downtime since the last message.  The SLA       *|
+|*          report has a "SLA_AGG <name> hosts <n> down(host-sec) <s>       *|
+|*          percentage <p>" line for each that has had downtime.            *|
+|*    12/ Stream subscribers falling behind, <n> events dropped (<s>        *|
+|*        subscribed)                                                       *|
+|*          At the status message, when events have been dropped for        *|
+|*          subscribers of the stream since the last one.                   *|
 |*                                                                          *|
 |*                                                                          *|
 |* Possible Improvements:                                                   *|
 |*                                                                          *|
 |*     Currently there is no maximum value for the interval value.          *|
-|*     Currently there is no formal structure for the input hosts file.     *|
 |*     Configuration file reload support has been removed/replaced with     *|
-|*     a SLA report and exit.  Should be re-enabled in the future, problems *|
-|*     with structure re-initialization while still keeping the current     *|
-|*     statistics.                                                          *|
-|*     The program has a predefined maximum number of hosts (MAX_HOSTS).    *|
-|*     This could be changed to be a runtime malloc so as to be a little    *|
-|*     more efficient on memory resources, as well as handling much larger  *|
-|*     lists.                                                               *|
-|*     Need to get a little smarter in the parsing of the input hosts       *|
-|*     file as it is currently fixed format (eg int=x,ret=x,mon=x).         *|
+|*     a SLA report and exit (SIGUSR2 reports without exiting).  Should be  *|
+|*     re-enabled in the future, problems with structure re-initialization  *|
+|*     while still keeping the current statistics.                          *|
 |*                                                                          *|
 |*                                                                          *|
 |* Caveats                                                                  *|
@@ -175,9 +550,36 @@
 |*   1.9.0  10-Jan-06  Added support for time filtering (mon= option)       *|
 |*   1.9.1  27-Feb-09  Clean up some compiler warnings                      *|
 |*   2.0.0  07-Aug-10  Support for System/390 (s390x)                       *|
+|*   2.1.0  18-Oct-26  Added per-host adaptive timeouts (RTO estimation)    *|
+|*   2.2.0  18-Oct-26  Added suspect state with fast-confirm re-probes      *|
+|*   2.3.0  18-Oct-26  Deadline queue and down index, no MAX_HOSTS          *|
+|*   2.4.0  18-Oct-26  Added dependencies and outage suppression (dep=)     *|
+|*   2.5.0  18-Oct-26  Added packet ring (TPACKET_V3) receive path          *|
+|*   2.6.0  18-Oct-26  Added AF_XDP probe engine (-xdp option)              *|
+|*   2.7.0  18-Oct-26  Added kernel-paced transmission (SO_TXTIME)          *|
+|*   2.8.0  18-Oct-26  Added busy poll mode and wakeup latency stats        *|
+|*   2.9.0  18-Oct-26  Added TCP connect and SYN probe types (probe=)       *|
+|*   2.10.0 18-Oct-26  Added ARP probing of local subnets (-arp)            *|
+|*   2.11.0 18-Oct-26  Added on-disk history store (-history, -query)       *|
+|*   2.12.0 18-Oct-26  Added rolling SLA windows (SLA_WIN, SIGUSR2)         *|
+|*   2.13.0 18-Oct-26  Added control socket for live commands (-control)    *|
+|*   2.14.0 18-Oct-26  Added host groups with their own policies (group)    *|
+|*   2.15.0 18-Oct-26  Added priority classes and load shedding (pri=)      *|
+|*   2.16.0 18-Oct-26  Added compiled host images (-compile, -output)       *|
+|*   2.17.0 18-Oct-26  Added liblinkstat engine with a callback API         *|
+|*   2.18.0 18-Oct-26  Added cluster sharding and a merging aggregator      *|
+|*   2.19.0 18-Oct-26  Added pcap capture and replay (-capture, -replay)    *|
+|*   2.20.0 18-Oct-26  Added the flight recorder (SIGUSR1, trace)           *|
+|*   2.21.0 18-Oct-26  ICMP unreachables fail hosts at once (routers)       *|
+|*   2.22.0 18-Oct-26  Adaptive probing of stable hosts (-detect)           *|
+|*   2.23.0 18-Oct-26  Added flap damping of state changes                  *|
+|*   2.24.0 18-Oct-26  Added group and prefix rollups (-prefix)             *|
+|*   2.25.0 18-Oct-26  Added subscription event stream (-stream)            *|
 |*                                                                          *|
 \****************************************************************************/
 
+#define _GNU_SOURCE   /* for sendmmsg */
+
 #include <signal.h>
 #include <stdio.h>
 #include <errno.h>
@@ -199,6 +601,24 @@
 #include <netdb.h>
 #include <time.h>
 
+#if defined(linux) && defined(SO_TXTIME)
+/* Stuff for kernel pacing */
+#include <linux/net_tstamp.h>
+#endif
+
+#ifdef linux
+/* Stuff for CPU pinning */
+#include <sched.h>
+#endif
+
+#if defined(linux) && defined(TCP_PROBES)
+/* Stuff for TCP probes */
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <linux/filter.h>
+#endif
+
 #ifdef CHECK_MAC_ADDR
 /* Stuff for ARP Requests */
 #include <sys/ioctl.h>
@@ -208,6 +628,25 @@
 
 #include <getopt.h>
 #include "version.h"
+#include "ring.h"
+#include "xdp.h"
+#include "arp.h"
+#include "history.h"
+#include "sla.h"
+#include "ctl.h"
+#include "hostdb.h"
+#include "cluster.h"
+#include "capture.h"
+#include "trace.h"
+#include "sub.h"
+
+/*
+ * The clock.  While a capture is replayed (-replay) it is the time in
+ * the capture, moved on as the engine waits, otherwise the system's.
+ */
+#define gettimeofday(tv, tz)  replay_gettimeofday(tv, tz)
+#define time(t)               replay_time(t)
+#include "liblinkstat.h"
 
 /* externals */
 
@@ -218,52 +657,125 @@ extern char *sys_errlist[];
 extern int sys_nerr;
 #endif
 
-int ident; 
-int sock;
-
-int adjusting=0;
-int queue_len=0;
-
-time_t start_time;
-time_t baseline;
-time_t report_time;
-
 /* constants */
 
 #define DEFAULT_INTERVAL  10  /* default time between packets (msec) */
 #define DEFAULT_TIMEOUT 1000  /* individual host timeouts (msec) */
 #define DEFAULT_RETRY      3  /* number of times to retry a host */
 #define DEFAULT_UPDATE   300  /* update stats every 5 minutes */
-
-#define MAX_HOSTS       1000  /* maximum number of hosts */
+#define DEFAULT_RTO_MIN   20  /* minimum retransmission timeout (msec) */
+#define DEFAULT_CONFIRM  100  /* re-probes of suspect hosts per second */
+#define DEFAULT_DEP_INT   60  /* probe interval of dependents in outage */
+#define DEFAULT_PRI        2  /* priority class of hosts without pri= */
+
+#define TABLE_CHUNK     1024  /* host table growth increment */
+#define SUBNET_MIN         4  /* smallest subnet group with outages */
+#define RECOVERY_CYCLES    2  /* cycles for dependents to recover */
+#define XDP_RESOLVE       10  /* secs between next hop lookups (XDP) */
+#define TXTIME_BATCH      64  /* paced probes handed over at once */
+#define TXTIME_LEAD     2000  /* usecs ahead the first paced probe is due */
+#define MAX_BUSY_POLL 100000  /* longest spin for replies (usecs) */
+#define PRI_CLASSES        3  /* pri= classes, 1 (never shed) to 3 */
+#define MAX_SHED          64  /* most cycles between lower class probes */
+#define TRACE_CTL_EVENTS 100  /* events in a trace for the control socket */
+#define ROUTER_CHUNK      16  /* router table growth increment */
+#define STABLE_RATIO       8  /* probe intervals up before the interval doubles */
+#define FLAP_PENALTY    1000  /* flap penalty each time a host goes down */
+#define FLAP_SUPPRESS   3000  /* penalty at which its state changes are held */
+#define FLAP_REUSE       750  /* and under which they are given again */
+#define FLAP_MAX       12000  /* most penalty a host can build up */
+#define FLAP_HALF_LIFE   300  /* secs for the penalty to decay by half */
+#define ROLLUP_CHUNK      64  /* rollup table growth increment */
+
+#define ROLL_UP            0  /* rollup counts, hosts up and answering */
+#define ROLL_DOWN          1  /* unreachable */
+#define ROLL_DEGRADED      2  /* up, but suspect or flapping */
+#define ROLL_STATES        3
+
+#define PROBE_ICMP         0  /* probe= types, ICMP echo (default) */
+#define PROBE_TCP          1  /* TCP connect */
+#define PROBE_SYN          2  /* TCP SYN, answered by SYN-ACK or RST */
+#define PROBE_ARP          3  /* ARP request (local hosts, -arp) */
+
+#define SLICE_MINE         0  /* ours to probe (-cluster) */
+#define SLICE_OTHER        1  /* probed by another node */
+#define SLICE_TAKEN        2  /* just taken over, state not yet sent */
 
 #define NOTIFY_LIMIT      10  /* limit notifications within 30s */
 
 #define MIN_INTERVAL       5
 #define MIN_TIMEOUT      500
+#define MIN_RTO            1
+
+/* the daemon's command line, and its signals */
+
+char        *query    = NULL;  /* host (or "all") to report history of */
+char        *compile_src = NULL; /* hosts file to compile, and exit */
+char        *compile_out = NULL; /* image to compile it into */
+int          aggregate_port = 0; /* run as the aggregator on it, 0=don't */
+char        *aggregate_addr = "127.0.0.1"; /* and listen on this address */
+char        *cluster_keyfile = NULL; /* shared key to sign messages, NULL=none */
+volatile int report_now = 0;   /* SIGUSR2, report the SLA windows */
+volatile int hangup_now = 0;   /* SIGHUP, report the SLAs and exit */
 
-/* global variables/flags */
-
-int  retry         = DEFAULT_RETRY;
-int  timeout       = DEFAULT_TIMEOUT;
-int  interval      = DEFAULT_INTERVAL;
-int  min_interval  = DEFAULT_INTERVAL;
-int  update        = DEFAULT_UPDATE;
-int  check_hw      = 0;
-long slarep        = 0;
-int  debug         = 0; 
-int  optimal_retry = 0;
-int  macs_checked  = 0;
-
-char  *command;               /* command to run during state changes */
-struct timeval current_time;  /* current time (pseudo) */
 struct timezone tz;
 
+struct dep_entry;
+struct group_entry;
+
+/*
+ * Counts of the hosts of a group or prefix, kept up to date as each
+ * one changes state (see rollup_update), so none of the reporting on
+ * them has to go through the hosts.
+ */
+typedef struct rollup_entry {
+  char               *name;             /* group name, or prefix (a.b.c.d/n) */
+  struct group_entry *group;            /* group rolled up, NULL=a prefix */
+  in_addr_t           net;              /* prefix address */
+  int                 count[ROLL_STATES]; /* hosts up, down and degraded */
+  long                rtt_total;        /* RTT of answers since the last message (usecs) */
+  long                rtt_count;        /* and how many */
+  long                down_secs;        /* host-secs down since the last message */
+  long                downtime;         /* host-secs down since we started */
+  time_t              since;            /* the time they are counted up to */
+} ROLLUP_ENTRY;
+
+/* a group of hosts sharing a policy (group lines in the hosts file) */
+typedef struct group_entry {
+  char               *name;             /* group name, "default" for the first */
+  int                 timeout;          /* timeout=, maximum RTO (msec) */
+  int                 retry;            /* retry=, retries of its hosts */
+  char               *command;          /* notify=, command to run, NULL=none */
+  short               report;           /* report=, HHMM of its SLA report, -1=default */
+  time_t              report_time;      /* time of its next SLA report, 0=none */
+  int                 num_hosts;        /* hosts in the group */
+  int                 num_other;        /* of them, probed by another node */
+  ROLLUP_ENTRY       *rollup;           /* its counts, NULL=not kept */
+} GROUP_ENTRY;
+
 /* entry used to keep track of each host we are pinging */
 typedef struct host_entry {
   char               *host;             /* text description of host */
   struct sockaddr_in  saddr;            /* internet address */
   unsigned char      *mac_addr;         /* hardware address */
+  unsigned char       hw_dest[6];       /* next hop MAC (XDP transmit) */
+  short               hw_dest_ok;       /* hw_dest is known, 1=yes */
+  time_t              hw_dest_retry;    /* time to look hw_dest up again */
+  short               probe;            /* probe type, PROBE_ICMP etc. */
+  u_short             port;             /* port for TCP probes */
+  int                 conn_fd;          /* TCP connect in progress, -1=none */
+  struct in_addr      syn_src;          /* our address towards it (SYN probes), 0=not known */
+  unsigned long       hist_sent;        /* probes sent since last summary */
+  unsigned long       hist_recv;        /* and answered */
+  unsigned long       hist_rtt;         /* their total RTT (usecs) */
+  unsigned long       hist_rtt_max;     /* and the worst of them */
+  SLA_ROLLUP         *sla;              /* rolling SLA windows, NULL=never down */
+  short               paused;           /* not probed (control socket), 1=yes */
+  short               removed;          /* taken out (ls_remove_host), 1=yes */
+  short               slice;            /* SLICE_MINE, SLICE_OTHER or SLICE_TAKEN */
+  short               pri;              /* priority class (pri=), 1=highest */
+  GROUP_ENTRY        *group;            /* policy the host comes under */
+  int                 ctl_client;       /* control client waiting on a probe, 0=none */
   int                 retry;            /* maximum retries allowed */
   int                 response;         /* host has responded / retry count */
   short               alive;            /* host state, 1=up, 0=down */
@@ -274,18 +786,248 @@ typedef struct host_entry {
   struct timeval      last_time;        /* time of last packet received */
   struct timeval      next_time;        /* time to send next packet */
 
+  struct timeval      sent_time;        /* time the last packet was sent */
+  struct timeval      deadline;         /* time the last packet is lost */
+  short               outstanding;      /* waiting on a reply, 1=yes */
+  short               reprobe;          /* re-probe due at deadline, 1=yes */
+  short               suspect;          /* re-probes sent while suspect */
+  int                 heap_pos;         /* position in deadline heap */
+  int                 down_pos;         /* position in down list */
+  long                srtt;             /* smoothed round trip time (usec) */
+  long                rttvar;           /* round trip time variance (usec) */
+  long                rto;              /* retransmission timeout (usec) */
+  time_t              stable_since;     /* last miss, state change or outage */
+  int                 every;            /* secs between its probes now (adaptive) */
+  long                flap_penalty;     /* flap damping penalty... */
+  time_t              flap_time;        /* ...as of this time */
+  int                 flap_pos;         /* position in flap list, -1=not flapping */
+  int                 flaps_held;       /* state changes held while flapping */
+  long                icmp_errors;      /* ICMP errors for its probes */
+  struct in_addr      error_from;       /* who sent the last of them */
+  short               error_code;       /* and its code, ICMP_UNREACH_* */
+  ROLLUP_ENTRY       *by_group;         /* rollup of its group, NULL=none */
+  ROLLUP_ENTRY       *by_prefix;        /* and of its prefix, NULL=none */
+  short               rolled;           /* state counted in them, ROLL_*, -1=none */
+
   short               monitor_from;     /* monitor this host from this time */
   short               monitor_until;    /* monitor this host until this time */
 
   long int            downtime;         /* seconds spent unavailable */
   int                 downtime_cnt;     /* number of times unavailable */
+
+  char               *dep_name;         /* parent host (dep= option) */
+  struct dep_entry   *dep;              /* parent host, or subnet group */
+  struct dep_entry   *children;         /* hosts that depend on this one */
 } HOST_ENTRY;
 
-HOST_ENTRY *table[MAX_HOSTS];
+/* a group of hosts that depend on a parent host, or share a subnet */
+typedef struct dep_entry {
+  char               *name;             /* parent host name, or subnet */
+  HOST_ENTRY         *parent;           /* parent host, NULL=subnet */
+  in_addr_t           net;              /* subnet address */
+  HOST_ENTRY        **members;          /* dependent hosts */
+  int                 num_members;      /* number of dependent hosts */
+  int                 down;             /* dependents unreachable */
+  int                 affected;         /* state changes rolled up */
+  time_t              outage_start;     /* time outage started, 0=none */
+  int                 recovering;       /* cycles left to recover, 0=no */
+  struct dep_entry   *next;             /* next outage in progress */
+} DEP_ENTRY;
+
+/* options that can be given to a host in the hosts file */
+typedef struct host_opts {
+  int                 schedule;         /* int=, secs between packets */
+  int                 retry;            /* ret=, maximum retries */
+  short               from;             /* mon=, monitor from this time */
+  short               until;            /* mon=, monitor until this time */
+  char                dep[132];         /* dep=, parent host */
+  short               probe;            /* probe=, probe type */
+  u_short             port;             /* probe=, port for TCP probes */
+  short               pri;              /* pri=, priority class */
+} HOST_OPTS;
+
+/* data carried in each packet, and echoed back in the reply */
+typedef struct probe_data {
+  struct timeval      sent;             /* time the packet was sent */
+  int                 i;                /* index into array */
+} PROBE_DATA;
+
+/* a router (or host) that has sent ICMP errors for our probes */
+typedef struct router_entry {
+  struct in_addr      addr;             /* where they came from */
+  long                errors;           /* how many */
+  short               code;             /* the last one's code, ICMP_UNREACH_* */
+  time_t              last;             /* and when */
+} ROUTER_ENTRY;
+
+/* a control client a trace is sent to (trace_client) */
+typedef struct trace_to {
+  CTL_PORT           *ctl;              /* the control socket */
+  int                 client;           /* and the client on it */
+} TRACE_TO;
+
+#if defined(linux) && defined(SO_TXTIME)
+/* probes paced by the kernel, a batch of them and the cycle's timing */
+typedef struct pace {
+  struct mmsghdr      msg[TXTIME_BATCH];
+  struct iovec        iov[TXTIME_BATCH];
+  char                pkt[TXTIME_BATCH][32];
+  char                ctl[TXTIME_BATCH][CMSG_SPACE(sizeof(__u64))];
+  int                 queued;           /* probes in the batch */
+  struct timeval      start;            /* start of the cycle (time of day) */
+  __u64               clock;            /* start of the cycle (qdisc clock, nsecs) */
+  long                offset;           /* when the next probe is due (usecs) */
+} PACE;
+#endif
 
-int num_hosts=0;
-int num_local_hosts=0;
-int num_local_unreachable=0;
+/* where the main loop is up to in a cycle (see advance_cycle) */
+#define CYCLE_START   0   /* about to start the next cycle */
+#define CYCLE_SEND    1   /* sending to the hosts that are due */
+#define CYCLE_PAUSE   2   /* pausing for the stragglers */
+
+#define SEND_SPACED   1   /* wait (interval) for a reply to the send */
+#define SEND_DRAIN    2   /* clear any replies queued up */
+
+/* the engine, as seen through liblinkstat.h (ls_open makes each one) */
+struct ls_engine {
+  LS_CALLBACKS        cb;               /* callbacks, NULL where not wanted */
+  int                 started;          /* probing, 1=yes */
+  int                 ident;            /* ICMP id of our probes */
+  int                 sock;             /* raw ICMP socket, -1=none */
+  int                 adjusting;        /* replies on time, towards a shorter interval */
+  int                 queue_len;        /* probes unanswered since the last message */
+  time_t              start_time;       /* time we started */
+  time_t              baseline;         /* time of the last status message */
+
+  /* parameters (LS_PARAMS, or the command line) */
+  int                 retry;            /* retries before a host is down */
+  int                 timeout;          /* maximum RTO, pause between cycles (msec) */
+  int                 interval;         /* delay between packets (msec) */
+  int                 rto_min;          /* minimum RTO (msec) */
+  int                 confirm_rate;     /* re-probes of suspect hosts per second */
+  int                 subnet;           /* prefix length hosts are grouped by, 0=don't */
+  int                 dep_interval;     /* probe interval of dependents in outage (secs) */
+  int                 min_interval;     /* interval can be brought down to (msec) */
+  int                 update;           /* secs between status messages */
+  int                 check_hw;         /* check MAC addresses, 1=yes */
+  long                slarep;           /* delay (sec) before the SLA report, 0=none */
+  int                 debug;            /* debug messages, 1=yes */
+  int                 cycle_plan;       /* planned cycle time (msec), 0=work it out */
+  int                 cycle_auto;       /* cycle_plan worked out, 1=yes */
+  int                 max_detect;       /* detection time adaptive probing keeps to (secs), 0=off */
+  int                 prefix_bits;      /* prefix length hosts are rolled up by, 0=don't */
+  char               *command;          /* command to run during state changes */
+
+  /* kept as it runs, since the last status message unless said otherwise */
+  int                 optimal_retry;    /* most retries a host needed to answer */
+  int                 macs_checked;     /* MAC addresses checked */
+  int                 num_suspect;      /* hosts suspect now */
+  int                 false_suspect;    /* suspect hosts that answered */
+  int                 num_outages_active; /* outages in progress */
+  int                 shed_factor;      /* lower classes probed every (pri-1) x this */
+  long                shed_cost;        /* smoothed usecs per probe (shed_load) */
+  int                 num_stretched;    /* hosts probed less often (-detect) */
+  long                shed_count;       /* probes deferred since the last message */
+  unsigned long       cycle_no;         /* cycles since we started */
+  long                wake_count;       /* replies timed by the kernel */
+  long                wake_total;       /* their total wakeup latency (usecs) */
+  long                wake_max;         /* and the worst of them */
+  long                icmp_errors;      /* ICMP errors since the last message */
+  time_t              notify_last;      /* time of the last notification */
+  int                 notify_count;     /* within 30s of each other (NOTIFY_LIMIT) */
+  int                 send_glitch;      /* last send failed, 1=yes (send_ping) */
+  int                 flush_glitch;     /* and of paced batches (flush_pings) */
+  struct timeval      confirm_tat;      /* theoretical arrival time of re-probes */
+
+  /* what probes and listens besides the socket */
+  char               *ring_if;          /* interface to receive replies on */
+  PACKET_RING        *ring;             /* packet ring, NULL=use the socket */
+  char               *xdp_if;           /* interface to send and receive on */
+  XDP_PORT           *xdp;              /* AF_XDP port, NULL=use the socket */
+  char               *arp_if;           /* interface to probe by ARP on */
+  ARP_PORT           *arp;              /* ARP prober, NULL=ping everything */
+  int                 num_arp;          /* hosts probed by ARP */
+  char               *hist_dir;         /* directory to record history in */
+  HIST_STORE         *hist;             /* history store, NULL=not recording */
+  long                hist_lost;        /* history records lost (last reported) */
+  char               *ctl_path;         /* where to put the control socket */
+  CTL_PORT           *ctl;              /* control socket, NULL=none */
+  char               *sub_path;         /* where to put the event stream socket */
+  SUB_PORT           *subs;             /* event stream, NULL=none */
+  HOST_DB            *host_db;          /* image the hosts came from, NULL=parsed */
+  HOST_DB            *host_image;       /* and kept mapped for their names, NULL=none */
+  int                 num_mapped;       /* hosts from it (table[0..], in one block) */
+  char               *cluster_spec;     /* <node>@<host>:<port> to join, NULL=none */
+  CLUSTER_NODE       *cluster;          /* our end of the cluster, NULL=on our own */
+  CLUSTER_RING       *slice_ring;       /* ring of the live nodes, NULL=not known */
+  char               *cluster_last;     /* the nodes last time (cluster_members) */
+  time_t              cluster_beat;     /* time of the next heartbeat */
+  int                 num_slice;        /* hosts in our slice of the cluster */
+  char               *capture_file;     /* pcap file to capture the probes in */
+  CAPTURE            *capture;          /* the capture, NULL=none */
+  char               *replay_file;      /* pcap file to replay, NULL=probe for real */
+  REPLAY             *replaying;        /* the replay, NULL=none */
+  TRACE              *trace;            /* the flight recorder (always on) */
+  char               *txtime;           /* qdisc pacing the probes, NULL=none */
+  int                 txtime_clock;     /* its clock, -1=pace in userspace */
+  struct pace        *pace;             /* the probes it paces, NULL=none */
+  int                 busy_poll;        /* usecs to spin for replies, 0=don't */
+  int                 cpu;              /* CPU to run on, -1=any */
+  int                 conn_poll;        /* epoll of TCP connects in progress */
+  int                 syn_sock;         /* raw TCP socket for SYN probes */
+  int                 syn_port;         /* source port of SYN probes */
+  int                 syn_hold;         /* TCP socket holding syn_port */
+  unsigned int        syn_secret;       /* mixed into SYN sequence numbers */
+  int                 num_tcp;          /* hosts with TCP probes */
+  int                 num_syn;          /* hosts with SYN probes */
+  struct timeval      current_time;     /* current time (pseudo) */
+
+  /* the hosts and what is kept on them */
+  ROUTER_ENTRY       *routers;          /* in the order first heard from */
+  int                 num_routers;
+  int                 max_routers;
+  ROLLUP_ENTRY      **rollups;          /* groups (by table order), then prefixes */
+  ROLLUP_ENTRY      **prefix_hash;      /* prefix rollups by address */
+  int                 num_rollups;
+  int                 max_rollups;
+  int                 prefix_size;      /* size of prefix_hash */
+  HOST_ENTRY        **table;            /* all hosts, in file order */
+  GROUP_ENTRY       **groups;           /* all groups, default first */
+  HOST_ENTRY        **deadline_heap;    /* outstanding, by deadline */
+  HOST_ENTRY        **down_list;        /* hosts currently unreachable */
+  HOST_ENTRY        **outage_list;      /* hosts unreachable at some point */
+  HOST_ENTRY        **flap_list;        /* hosts whose state changes are held */
+  HOST_ENTRY        **sent_list;        /* hosts probed since the last summary */
+  HOST_ENTRY        **name_hash;        /* hosts by name */
+  HOST_ENTRY        **addr_hash;        /* hosts by address */
+  DEP_ENTRY          *outages;          /* outages in progress */
+  int                 table_size;
+  int                 num_deadlines;
+  int                 num_down;
+  int                 num_flapping;
+  int                 num_sent;
+  int                 num_outages;
+  int                 hash_size;
+  int                 num_hosts;
+  int                 num_released;     /* of them, removed or another node's */
+  int                 num_groups;
+  int                 num_local_hosts;
+  int                 num_local_unreachable;
+
+  /* the cycle in progress */
+  int                 cycles;           /* cycles since the last status message */
+  int                 cycle_phase;      /* CYCLE_* */
+  int                 cycle_pos;        /* next host to send to */
+  int                 cycle_wait;       /* what is being waited on, SEND_* */
+  int                 cycle_due[PRI_CLASSES+1]; /* hosts due this cycle, by class */
+  int                 cycle_sent;       /* and probes sent to them */
+  short               cycle_time;       /* time of day the cycle started (HHMM) */
+  struct timeval      cycle_start;      /* time the cycle started */
+  struct timeval      cycle_until;      /* end of the wait, or of the pause */
+};
+
+
+#ifndef LIBLINKSTAT
 
 static void
 detachFromTTY(log_file)
@@ -319,6 +1061,8 @@ char *log_file;
   (void) setsid();
 }
 
+#endif /* LIBLINKSTAT */
+
 static char *
 curr_time()
 {
@@ -384,6 +1128,14 @@ struct timeval stamp, current;
   return (char *)buf;
 }
 
+long
+timeval_usec(stamp,current)
+struct timeval stamp, current;
+{
+  return (current.tv_sec - stamp.tv_sec) * 1000000L +
+         (current.tv_usec - stamp.tv_usec);
+}
+
 void errno_crash_and_burn(message)
 char *message;
 {
@@ -406,6 +1158,92 @@ char *message;
   exit(4);
 }
 
+/*
+ * Set up a host, read from the hosts file or mapped from an image
+ */
+void
+init_host_entry(p,host,addr,packet_schedule,uniq_retry,from,until)
+HOST_ENTRY *p;
+char *host;
+struct in_addr addr;
+int packet_schedule, uniq_retry;
+short from, until;
+{
+  p->host=host;
+
+  /* Interval between pkts to this host (in seconds), 0=every cycle */
+  p->packet_schedule    = packet_schedule;
+
+  /* Set the number of retries for this particular host */
+  p->retry    = uniq_retry;
+
+  p->first_time.tv_sec  =0;    /* Used to determine uptime */
+  p->first_time.tv_usec =0;
+
+  p->last_time.tv_sec   =0;    /* Used to determine downtime */
+  p->last_time.tv_usec  =0;
+
+  p->next_time.tv_sec   =0;    /* Used to alter packet frequency */
+  p->next_time.tv_usec  =0;
+
+  timerclear(&p->sent_time);   /* Used for retransmission timeouts */
+  timerclear(&p->deadline);
+  p->outstanding =0;
+  p->reprobe     =0;
+  p->suspect     =0;
+  p->heap_pos    =-1;          /* Not waiting on a deadline */
+  p->down_pos    =-1;          /* Not unreachable */
+
+  p->dep_name = NULL;          /* Used for outage suppression */
+  p->dep      = NULL;
+  p->children = NULL;
+  p->srtt   =0;                /* 0=no round trip time measured yet */
+  p->rttvar =0;
+  p->rto    =0;
+  p->flap_penalty = 0;         /* Used for flap damping */
+  p->flap_time    = 0;
+  p->flap_pos     = -1;
+  p->flaps_held   = 0;
+  p->stable_since = 0;         /* Used for adaptive probing */
+  p->every       = packet_schedule;
+  p->icmp_errors = 0;          /* Used for fast failure (ICMP errors) */
+  p->error_from.s_addr = 0;
+  p->error_code  = 0;
+  p->by_group    = NULL;       /* Used for the rollups */
+  p->by_prefix   = NULL;
+  p->rolled      = -1;
+
+  p->downtime =0;              /* Used for reporting SLA's */
+  p->downtime_cnt =0;
+
+  memset((char*) &p->saddr, 0, sizeof(p->saddr));
+  p->saddr.sin_family      = AF_INET;
+
+  p->saddr.sin_addr = addr;
+
+  p->mac_addr = NULL;
+  p->hw_dest_ok    =0;         /* Used for AF_XDP transmit */
+  p->hw_dest_retry =0;
+
+  p->probe   = PROBE_ICMP;     /* Set from the probe= option */
+  p->port    = 0;
+  p->conn_fd = -1;
+  p->syn_src.s_addr = 0;
+
+  p->hist_sent = p->hist_recv = 0;  /* Used for the history summaries */
+  p->hist_rtt  = p->hist_rtt_max = 0;
+  p->sla       = NULL;         /* Set up when it first goes down */
+
+  p->paused     =0;            /* Used by the control socket */
+  p->removed    =0;            /* Used by liblinkstat */
+  p->slice      =SLICE_MINE;   /* Used by -cluster */
+  p->pri        =DEFAULT_PRI;  /* Used for load shedding */
+  p->ctl_client =0;
+
+  p->monitor_from = from;
+  p->monitor_until = until;
+}
+
 HOST_ENTRY *
 create_host_entry(host,ip_addr,packet_schedule,uniq_retry,from,until)
 char *host, *ip_addr;
@@ -413,7 +1251,7 @@ int packet_schedule, uniq_retry;
 short from, until;
 {
   HOST_ENTRY *p;
-  struct hostent *host_ent;
+  struct hostent *host_ent = NULL;
   struct in_addr *host_add;
 
   host_add = (struct in_addr *) malloc(sizeof(struct in_addr));
@@ -449,37 +1287,226 @@ short from, until;
   p = (HOST_ENTRY *) malloc(sizeof(HOST_ENTRY));
   if (!p) crash_and_burn("create_host_entry: can't allocate HOST_ENTRY");
 
-  p->host=host;
+  init_host_entry(p,host,*host_add,packet_schedule,uniq_retry,from,until);
+  if (!host_ent) free(host_add);  /* ours, not that of gethostbyname */
+  return p;
+}
 
-  /* Interval between pkts to this host (in seconds), 0=every cycle */
-  p->packet_schedule    = packet_schedule;
+void
+grow_table(e, need)
+LS_ENGINE *e; int need;
+{
+  /*
+   * Make room for more hosts.  The supporting indexes can never
+   * hold more than the table, so they simply grow alongside it.
+   */
+  while (e->table_size < need) e->table_size += TABLE_CHUNK;
+  e->table         = (HOST_ENTRY **) realloc(e->table, e->table_size * sizeof(HOST_ENTRY *));
+  e->deadline_heap = (HOST_ENTRY **) realloc(e->deadline_heap, e->table_size * sizeof(HOST_ENTRY *));
+  e->down_list     = (HOST_ENTRY **) realloc(e->down_list, e->table_size * sizeof(HOST_ENTRY *));
+  e->outage_list   = (HOST_ENTRY **) realloc(e->outage_list, e->table_size * sizeof(HOST_ENTRY *));
+  e->flap_list     = (HOST_ENTRY **) realloc(e->flap_list, e->table_size * sizeof(HOST_ENTRY *));
+  e->sent_list     = (HOST_ENTRY **) realloc(e->sent_list, e->table_size * sizeof(HOST_ENTRY *));
+  if (!e->table || !e->deadline_heap || !e->down_list || !e->outage_list || !e->flap_list || !e->sent_list)
+    crash_and_burn("grow_table: can't allocate host table");
+}
 
-  /* Set the number of retries for this particular host */
-  p->retry    = uniq_retry;
+static unsigned int
+hash_name(name)
+char *name;
+{
+  unsigned int h = 5381;
 
-  p->first_time.tv_sec  =0;    /* Used to determine uptime */
-  p->first_time.tv_usec =0;
+  while (*name) h = h * 33 + (unsigned char) *name++;
+  return h;
+}
 
-  p->last_time.tv_sec   =0;    /* Used to determine downtime */
-  p->last_time.tv_usec  =0;
+static unsigned int
+hash_addr(addr)
+in_addr_t addr;
+{
+  return (unsigned int) addr * 2654435761U;
+}
 
-  p->next_time.tv_sec   =0;    /* Used to alter packet frequency */
-  p->next_time.tv_usec  =0;
+static void
+index_host(e, h)
+LS_ENGINE *e; HOST_ENTRY *h;
+{
+  unsigned int k;
 
-  p->downtime =0;              /* Used for reporting SLA's */
-  p->downtime_cnt =0;
+  for (k = hash_name(h->host); e->name_hash[k & (e->hash_size-1)]; k++)
+    if (strcmp(e->name_hash[k & (e->hash_size-1)]->host, h->host) == 0) break;
+  if (!e->name_hash[k & (e->hash_size-1)]) e->name_hash[k & (e->hash_size-1)] = h;
 
-  memset((char*) &p->saddr, 0, sizeof(p->saddr));
-  p->saddr.sin_family      = AF_INET;
+  for (k = hash_addr(h->saddr.sin_addr.s_addr); e->addr_hash[k & (e->hash_size-1)]; k++)
+    if (e->addr_hash[k & (e->hash_size-1)]->saddr.sin_addr.s_addr == h->saddr.sin_addr.s_addr) break;
+  if (!e->addr_hash[k & (e->hash_size-1)]) e->addr_hash[k & (e->hash_size-1)] = h;
+}
 
-  p->saddr.sin_addr = *host_add; 
+void
+build_host_index(e)
+LS_ENGINE *e;
+{
+  int i;
 
-  p->mac_addr = NULL;
+  if (e->host_db) return;  /* compiled into the image */
 
-  p->monitor_from = from;
-  p->monitor_until = until;
+  /*
+   * Open addressed hash tables of the hosts by name and by address,
+   * kept at most half full.  The first host wins on duplicates.
+   */
+  for (e->hash_size = 64; e->hash_size < e->num_hosts * 2; e->hash_size *= 2);
+  free(e->name_hash);
+  free(e->addr_hash);
+  e->name_hash = (HOST_ENTRY **) calloc(e->hash_size, sizeof(HOST_ENTRY *));
+  e->addr_hash = (HOST_ENTRY **) calloc(e->hash_size, sizeof(HOST_ENTRY *));
+  if (!e->name_hash || !e->addr_hash)
+    crash_and_burn("build_host_index: can't allocate hash tables");
+
+  for (i=0; i<e->num_hosts; i++)
+    if (!e->table[i]->removed) index_host(e, e->table[i]);
+}
 
-  return p;
+HOST_ENTRY *
+find_host_by_addr(e, addr)
+LS_ENGINE *e; in_addr_t addr;
+{
+  unsigned int k;
+  int i;
+
+  if (e->host_db) {
+    i = hostdb_find_addr(e->host_db, addr);
+    return i < 0 ? NULL : e->table[i];
+  }
+  if (!e->hash_size) return NULL;
+  for (k = hash_addr(addr); e->addr_hash[k & (e->hash_size-1)]; k++)
+    if (e->addr_hash[k & (e->hash_size-1)]->saddr.sin_addr.s_addr == addr)
+      return e->addr_hash[k & (e->hash_size-1)];
+  return NULL;
+}
+
+HOST_ENTRY *
+find_host(e, name)
+LS_ENGINE *e; char *name;
+{
+  struct in_addr addr;
+  unsigned int k;
+  int i;
+
+  if (e->host_db) {
+    if ((i = hostdb_find_name(e->host_db, name)) >= 0) return e->table[i];
+  } else {
+    if (!e->hash_size) return NULL;
+    for (k = hash_name(name); e->name_hash[k & (e->hash_size-1)]; k++)
+      if (strcmp(e->name_hash[k & (e->hash_size-1)]->host, name) == 0)
+        return e->name_hash[k & (e->hash_size-1)];
+  }
+  if (inet_aton(name, &addr))
+    return find_host_by_addr(e, addr.s_addr);
+  return NULL;
+}
+
+static DEP_ENTRY *
+create_dep_entry(name, parent)
+char *name; HOST_ENTRY *parent;
+{
+  DEP_ENTRY *d;
+
+  d = (DEP_ENTRY *) calloc(1, sizeof(DEP_ENTRY));
+  if (!d) crash_and_burn("create_dep_entry: can't allocate DEP_ENTRY");
+  d->name   = name;
+  d->parent = parent;
+  return d;
+}
+
+void
+build_dependencies(e)
+LS_ENGINE *e;
+{
+  DEP_ENTRY **subnets, *d;
+  struct in_addr in;
+  in_addr_t mask;
+  HOST_ENTRY *h, *p;
+  unsigned int k;
+  int i, n, size, num_deps = 0, num_subnets = 0;
+  char buf[32];
+
+  /*
+   * Explicit parents (dep= option) first.
+   */
+  for (i=0; i<e->num_hosts; i++) {
+    h = e->table[i];
+    if (!h->dep_name) continue;
+    if ((p = find_host(e, h->dep_name)) == NULL || p == h) {
+      printf("%s Warning: %s depends on unknown host %s\n", curr_time(), h->host, h->dep_name);
+      continue;
+    }
+    if (!p->children) p->children = create_dep_entry(p->host, p);
+    h->dep = p->children;
+    h->dep->num_members++;
+    num_deps++;
+  }
+
+  /*
+   * Chains of parents are fine, but a loop would leave the hosts in
+   * it suppressing each other, so break any loops found.
+   */
+  for (i=0; i<e->num_hosts; i++) {
+    h = e->table[i];
+    for (p = h->dep ? h->dep->parent : NULL, n = 0; p && n < e->num_hosts; n++) {
+      if (p == h) {
+        printf("%s Warning: %s is in a dependency loop, ignoring dep=%s\n", curr_time(), h->host, h->dep_name);
+        h->dep->num_members--;
+        h->dep = NULL;
+        num_deps--;
+        break;
+      }
+      p = p->dep ? p->dep->parent : NULL;
+    }
+  }
+
+  /*
+   * Then group the remaining hosts by subnet.
+   */
+  if (e->subnet) {
+    mask = htonl(0xFFFFFFFFUL << (32 - e->subnet));
+    for (size = 64; size < e->num_hosts * 2; size *= 2);  /* no host index with an image */
+    subnets = (DEP_ENTRY **) calloc(size, sizeof(DEP_ENTRY *));
+    if (!subnets) crash_and_burn("build_dependencies: can't allocate subnets");
+
+    for (i=0; i<e->num_hosts; i++) {
+      h = e->table[i];
+      if (h->dep) continue;
+      in.s_addr = h->saddr.sin_addr.s_addr & mask;
+      for (k = hash_addr(in.s_addr); (d = subnets[k & (size-1)]) != NULL; k++)
+        if (d->net == in.s_addr) break;
+      if (!d) {
+        snprintf(buf, 32, "%s/%d", inet_ntoa(in), e->subnet);
+        d = subnets[k & (size-1)] = create_dep_entry(strdup(buf), NULL);
+        d->net = in.s_addr;
+        num_subnets++;
+      }
+      h->dep = d;
+      d->num_members++;
+    }
+    free(subnets);
+  }
+
+  /*
+   * Finally fill in the members of each group.
+   */
+  for (i=0; i<e->num_hosts; i++) {
+    if (!(d = e->table[i]->dep)) continue;
+    if (!d->members) {
+      d->members = (HOST_ENTRY **) malloc(d->num_members * sizeof(HOST_ENTRY *));
+      if (!d->members) crash_and_burn("build_dependencies: can't allocate members");
+      d->num_members = 0;
+    }
+    d->members[d->num_members++] = e->table[i];
+  }
+
+  if (num_deps || num_subnets)
+    printf("%s Dependencies: %d hosts with parents, %d subnet groups\n", curr_time(), num_deps, num_subnets);
 }
 
 u_short in_cksum(p,n)
@@ -503,122 +1530,2081 @@ u_short *p; int n;
   return (answer);
 }
 
-void notify_command(host, state, msg)
-char *host,*state,*msg;
+void notify_command(e, command, host, state, msg)
+LS_ENGINE *e; char *command,*host,*state,*msg;
 {
     static char   cmd[1024];
 
-    static time_t last  = 0;  /* Check that we do not flood a whole */
-    static int    count = 0;  /* heap of messages onto the network  */
+    if (e->replaying) return;    /* nobody to tell, it is all in the past */
 
-    if ((time(NULL) - last) > 30) {
-        if (count > NOTIFY_LIMIT) {
+    if ((time(NULL) - e->notify_last) > 30) {
+        if (e->notify_count > NOTIFY_LIMIT) {
 	    printf("%s Overload reset... Notifications enabled\n",curr_time());
             (void) fflush(stdout);
         }
-	count = 0; /* reset */
+	e->notify_count = 0; /* reset */
     }
 
-    count++;
+    e->notify_count++;
 
-    if (count <= NOTIFY_LIMIT) {
+    if (e->notify_count <= NOTIFY_LIMIT) {
         /* create command string */
         snprintf(cmd,1024,"%s \"%s\" \"%s\" \"%s\">/dev/null 2>&1 &",command,host,state,msg);
         (void) system(cmd);
-    } else if (count == (NOTIFY_LIMIT+1)) {
+    } else if (e->notify_count == (NOTIFY_LIMIT+1)) {
 	/* We received more than "NOTIFY_LIMIT" notifications less than 30s apart */
         printf("%s Overload... Notifications disabled\n",curr_time()); (void) fflush(stdout);
         snprintf(cmd,1024,"%s \"OVERLOAD\" \"n/a\" \"Too many state changes being logged\">/dev/null 2>&1 &",command);
         (void) system(cmd);
     }
 
-    last = time(NULL);
+    e->notify_last = time(NULL);
 }
 
-void send_ping(s,h)
-int s; HOST_ENTRY *h;
+/*
+ * The deadline heap is a binary min-heap of the hosts that are waiting
+ * on a deadline (a reply, or a delayed re-probe), ordered by deadline.
+ */
+static void
+heap_place(e, h, pos)
+LS_ENGINE *e; HOST_ENTRY *h; int pos;
 {
-  static char  buffer[32];
-  static int   glitch = 0;
-  struct icmp *icp = (struct icmp *) buffer;
-  int n;
+  e->deadline_heap[pos] = h;
+  h->heap_pos = pos;
+}
 
-  icp->icmp_type = ICMP_ECHO;
-  icp->icmp_code = 0;
-  icp->icmp_cksum = 0;
-  icp->icmp_seq = h->i;
-  icp->icmp_id = ident;
-  icp->icmp_cksum = in_cksum( (u_short *)icp, 32 );
+static void
+heap_sift(e, h)
+LS_ENGINE *e; HOST_ENTRY *h;
+{
+  int pos = h->heap_pos, child;
 
-  n = sendto( s, buffer, 32, 0, (struct sockaddr *)&h->saddr, sizeof(struct sockaddr_in) );
+  /* Towards the root while earlier than the parent */
+  while (pos > 0 &&
+         timercmp(&h->deadline, &e->deadline_heap[(pos-1)/2]->deadline, <)) {
+    heap_place(e, e->deadline_heap[(pos-1)/2], pos);
+    pos = (pos-1)/2;
+  }
 
-  if ( n < 0 || n != 32 ) {
-    /* Might be a little nicer here an allow the occasional glitch
-     * due to periods where firewall/iptable rules are being updated
-     * or reloaded
-     */
-    if (glitch++) errno_crash_and_burn("send_ping: sendto");
+  /* Towards the leaves while later than a child */
+  while ((child = 2*pos + 1) < e->num_deadlines) {
+    if (child+1 < e->num_deadlines &&
+        timercmp(&e->deadline_heap[child+1]->deadline, &e->deadline_heap[child]->deadline, <))
+      child++;
+    if (!timercmp(&e->deadline_heap[child]->deadline, &h->deadline, <))
+      break;
+    heap_place(e, e->deadline_heap[child], pos);
+    pos = child;
+  }
+  heap_place(e, h, pos);
+}
 
-    fprintf(stderr,"%s Glitch? : send_ping: sendto - %s\n",curr_time(),strerror(errno));
-    sleep(1);
-  } else
-    glitch=0; 
+void deadline_set(e, h)
+LS_ENGINE *e; HOST_ENTRY *h;
+{
+  if (h->heap_pos < 0)
+    heap_place(e, h, e->num_deadlines++);
+  heap_sift(e, h);
 }
 
-int recvfrom_wto (s,buf,len, saddr, timo)
-int s; char *buf; int len; struct sockaddr *saddr; int timo;
+void deadline_clear(e, h)
+LS_ENGINE *e; HOST_ENTRY *h;
 {
-  int nfound,n;
-  socklen_t slen;
-  struct timeval to;
-  fd_set readset,writeset;
+  int pos = h->heap_pos;
 
-  to.tv_sec  = timo/1000;
-  to.tv_usec = (timo - (to.tv_sec*1000))*1000;
+  if (pos < 0) return;
+  h->heap_pos = -1;
+  if (pos == --e->num_deadlines) return;
 
-  FD_ZERO(&readset);
-  FD_ZERO(&writeset);
-  FD_SET(s,&readset);
-  nfound = select(s+1,&readset,&writeset,NULL,&to);
-  if (nfound<0) errno_crash_and_burn("send_ping: select");
-  if (nfound==0) return -1;  /* timeout */
-  slen=sizeof(struct sockaddr);
-  n=recvfrom(s,buf,len,0,saddr,&slen);
-  if (n<0) errno_crash_and_burn("send_ping: recvfrom");
-  return n;
+  /* Fill the hole with the last entry */
+  heap_place(e, e->deadline_heap[e->num_deadlines], pos);
+  heap_sift(e, e->deadline_heap[pos]);
 }
 
-#ifdef X_WIP_ALLOW_STATUS_FILE
+struct timeval *
+first_deadline(e)
+LS_ENGINE *e;
+{
+  return e->num_deadlines ? &e->deadline_heap[0]->deadline : NULL;
+}
 
-int provide_status ()
+/*
+ * Work out whether a probe can go out through the XDP port, which
+ * needs the MAC address of the host.  It is only looked up now and
+ * again, as most misses are hosts that are not directly connected.
+ */
+int xdp_next_hop(e, h, now)
+LS_ENGINE *e; HOST_ENTRY *h; time_t now;
 {
-  int fd;
-  char buf[30];
+  if (h->hw_dest_ok) return 1;
+  if (now < h->hw_dest_retry) return 0;
 
-  snprintf(buf, 30, "testCCCCCC\n");
+  if (xdp_resolve(e->xdp, h->saddr.sin_addr, h->hw_dest) < 0) {
+    h->hw_dest_retry = now + XDP_RESOLVE;
+    return 0;
+  }
+  h->hw_dest_ok = 1;
+  return 1;
+}
 
-  if ((fd = open("/tmp/pipe", O_NONBLOCK | O_WRONLY)) == -1)
-    return -1;
+/*
+ * The wait for the answer to a probe (usecs): the retransmission
+ * timeout of the host, doubled for each re-probe of a suspect host,
+ * up to its group's timeout.  Saturates rather than shifting too far.
+ */
+long probe_wait(h)
+HOST_ENTRY *h;
+{
+  long cap = h->group->timeout * 1000L;
+
+  if (h->rto >= cap) return h->rto;
+  if (h->suspect > 16 || h->rto > (cap >> h->suspect)) return cap;
+  return h->rto << h->suspect;
+}
+
+/*
+ * Start the clock on the answer to a probe sent at "now".
+ */
+void start_probe(e, h, now)
+LS_ENGINE *e; HOST_ENTRY *h; struct timeval *now;
+{
+  struct timeval rto;
+  long wait;
 
   /*
-     If here then the fifo exists and somebody is wanting
-     to read from it...  or it is a regular file, which we
-     should check for before running this, or use mkfifo
-     to create the requested status pipe.
-  */
-  if (write(fd, buf, strlen(buf)) < 1)
-    return -1;
-  close(fd);
-  return 0;
+   * The packet is considered lost if no reply arrives within the
+   * retransmission timeout of the host (even if the send fails).
+   * Each re-probe of a suspect host doubles the timeout.
+   */
+  wait = probe_wait(h);
+  rto.tv_sec  = wait / 1000000;
+  rto.tv_usec = wait % 1000000;
+  h->sent_time = *now;
+  timeradd(now, &rto, &h->deadline);
+  h->outstanding = 1;
+  if (!h->hist_sent++) e->sent_list[e->num_sent++] = h;  /* for the next summary */
+  deadline_set(e, h);
 }
-#else
-#define provide_status()        ((void)0)
-#endif
 
-#ifdef CHECK_MAC_ADDR
+/*
+ * Fill in an echo request to a host, that will be sent at "now",
+ * and start the clock on its reply.
+ */
+void build_ping(e, h, buffer, now)
+LS_ENGINE *e; HOST_ENTRY *h; char *buffer; struct timeval *now;
+{
+  struct icmp *icp = (struct icmp *) buffer;
+  PROBE_DATA data;
 
-char *get_ip_from_long(ipaddress)
-u_long ipaddress;
+  /*
+   * The transmit time travels in the packet data and is echoed back,
+   * so each reply can be timed even when packets are retransmitted.
+   * The full index is carried too, as the sequence field only holds
+   * the bottom 16 bits of it.
+   */
+  data.sent = *now;
+  data.i    = h->i;
+  memcpy(icp->icmp_data, &data, sizeof(data));
+
+  icp->icmp_type = ICMP_ECHO;
+  icp->icmp_code = 0;
+  icp->icmp_cksum = 0;
+  icp->icmp_seq = h->i & 0xFFFF;
+  icp->icmp_id = e->ident;
+  icp->icmp_cksum = in_cksum( (u_short *)icp, 32 );
+
+  start_probe(e, h, now);
+}
+
+#if defined(linux) && defined(TCP_PROBES)
+
+/*
+ * Start a non-blocking connect to the port of a host (probe=tcp),
+ * which is finished off by tcp_complete.
+ */
+void tcp_probe(e, h)
+LS_ENGINE *e; HOST_ENTRY *h;
+{
+  struct epoll_event ev;
+  struct sockaddr_in addr;
+  int fd;
+
+  /* A connect still in progress is given up on */
+  if (h->conn_fd >= 0) {
+    close(h->conn_fd);
+    h->conn_fd = -1;
+  }
+
+  if ((fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0)) < 0) {
+    fprintf(stderr,"%s Glitch? : tcp_probe: socket - %s\n",curr_time(),strerror(errno));
+    return;  /* lost, as far as the deadline is concerned */
+  }
+
+  addr = h->saddr;
+  addr.sin_port = htons(h->port);
+  if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 && errno != EINPROGRESS) {
+    close(fd);  /* refused straight away */
+    return;
+  }
+
+  ev.events   = EPOLLOUT;
+  ev.data.ptr = h;
+  if (epoll_ctl(e->conn_poll, EPOLL_CTL_ADD, fd, &ev) < 0) {
+    close(fd);
+    return;
+  }
+  h->conn_fd = fd;
+}
+
+/*
+ * Send a SYN to the port of a host (probe=syn).  The kernel will
+ * reset the connection for us if it is answered with a SYN-ACK.
+ */
+void syn_probe(e, h)
+LS_ENGINE *e; HOST_ENTRY *h;
+{
+  struct {
+    struct in_addr src, dst;
+    u_char zero, proto;
+    u_short len;
+    struct tcphdr th;
+  } pkt;
+  struct sockaddr_in local;
+  socklen_t len;
+  int s;
+
+  memset(&pkt, 0, sizeof(pkt));
+
+  /*
+   * The checksum covers our source address, so find out what it is.
+   * It is kept until the host goes down, as it may then be reached
+   * by a different route.
+   */
+  if (!h->syn_src.s_addr && (s = socket(AF_INET, SOCK_DGRAM, 0)) >= 0) {
+    len = sizeof(local);
+    if (connect(s, (struct sockaddr *) &h->saddr, sizeof(h->saddr)) == 0 &&
+        getsockname(s, (struct sockaddr *) &local, &len) == 0)
+      h->syn_src = local.sin_addr;
+    close(s);
+  }
+  pkt.src   = h->syn_src;
+  pkt.dst   = h->saddr.sin_addr;
+  pkt.proto = IPPROTO_TCP;
+  pkt.len   = htons(sizeof(struct tcphdr));
+
+  pkt.th.th_sport = htons(e->syn_port);
+  pkt.th.th_dport = htons(h->port);
+  pkt.th.th_seq   = htonl(h->i ^ e->syn_secret);
+  pkt.th.th_off   = sizeof(struct tcphdr) >> 2;
+  pkt.th.th_flags = TH_SYN;
+  pkt.th.th_win   = htons(1024);
+  pkt.th.th_sum   = in_cksum((u_short *) &pkt, sizeof(pkt));
+
+  if (sendto(e->syn_sock, &pkt.th, sizeof(struct tcphdr), 0,
+             (struct sockaddr *) &h->saddr, sizeof(h->saddr)) < 0)
+    fprintf(stderr,"%s Glitch? : syn_probe: sendto - %s\n",curr_time(),strerror(errno));
+}
+
+#else
+#define tcp_probe(e, h)    ((void)0)
+#define syn_probe(e, h)    ((void)0)
+#endif
+
+void send_ping(e, s,h)
+LS_ENGINE *e; int s; HOST_ENTRY *h;
+{
+  static char  buffer[32];
+  struct timeval now;
+  int n;
+
+  gettimeofday(&now,&tz);
+  if (h->probe != PROBE_ICMP) {
+    start_probe(e, h, &now);
+    if (h->probe == PROBE_ARP)
+      arp_queue(e->arp, h->saddr.sin_addr);  /* sent before the next wait */
+    else if (h->probe == PROBE_TCP)
+      tcp_probe(e, h);
+    else
+      syn_probe(e, h);
+    return;
+  }
+  build_ping(e, h, buffer, &now);
+  if (e->capture) capture_probe(e->capture, &now, h->saddr.sin_addr, (unsigned char *) buffer, 32);
+  if (e->replaying) {
+    /* answered (or not) as the host was at this point in the capture */
+    (void) replay_probe(e->replaying, &now, h->saddr.sin_addr, (unsigned char *) buffer, 32);
+    return;
+  }
+
+  /*
+   * Hosts that are down always go through the socket, so the kernel
+   * will ARP for them again.
+   */
+  if (e->xdp && h->alive && xdp_next_hop(e, h, now.tv_sec) &&
+      xdp_send(e->xdp, h->hw_dest, h->saddr.sin_addr, (unsigned char *) buffer, 32) == 0)
+    n = 32;
+  else
+    n = sendto( s, buffer, 32, 0, (struct sockaddr *)&h->saddr, sizeof(struct sockaddr_in) );
+
+  if ( n < 0 || n != 32 ) {
+    /* Might be a little nicer here an allow the occasional glitch
+     * due to periods where firewall/iptable rules are being updated
+     * or reloaded
+     */
+    if (e->send_glitch++) errno_crash_and_burn("send_ping: sendto");
+
+    fprintf(stderr,"%s Glitch? : send_ping: sendto - %s\n",curr_time(),strerror(errno));
+    sleep(1);
+  } else
+    e->send_glitch=0; 
+}
+
+void update_rto(e, h, rtt)
+LS_ENGINE *e; HOST_ENTRY *h; long rtt;
+{
+  long delta;
+
+  if (rtt < 1) rtt = 1;
+
+  if (h->srtt == 0) {
+    /* First measurement */
+    h->srtt   = rtt;
+    h->rttvar = rtt / 2;
+  } else {
+    delta = h->srtt - rtt;
+    if (delta < 0) delta = -delta;
+    h->rttvar = (3 * h->rttvar + delta) / 4;
+    h->srtt   = (7 * h->srtt + rtt) / 8;
+  }
+
+  h->rto = h->srtt + 4 * h->rttvar;
+  if (h->rto < e->rto_min * 1000L) h->rto = e->rto_min * 1000L;
+  if (h->rto > h->group->timeout * 1000L) h->rto = h->group->timeout * 1000L;
+}
+
+int in_outage(h)
+HOST_ENTRY *h;
+{
+  return h->dep && h->dep->outage_start && !h->dep->recovering;
+}
+
+/*
+ * Set the secs between a host's probes, keeping count of the hosts
+ * probed less often than their own schedule.
+ */
+void set_every(e, h, every)
+LS_ENGINE *e; HOST_ENTRY *h; int every;
+{
+  if (h->every > h->packet_schedule) e->num_stretched--;
+  h->every = every;
+  if (h->every > h->packet_schedule) e->num_stretched++;
+}
+
+/*
+ * With -detect, a host that has been stable for a while is probed less
+ * often: its interval doubles (from its int= schedule, or one second)
+ * each time it has been up for STABLE_RATIO of the new interval, as
+ * long as a failure just after a probe would still be picked up and
+ * confirmed within the detection time.  Gives the secs to its next.
+ * Such a host is not shed (see send_cycle), so no deferral is added.
+ */
+int probe_every(e, h, now)
+LS_ENGINE *e; HOST_ENTRY *h; time_t now;
+{
+  long most, every, base;
+
+  if (!e->max_detect || !h->alive || h->suspect || in_outage(h))
+    return h->packet_schedule;
+
+  /* the wait for the next cycle to start, then the re-probes */
+  most = e->max_detect - (h->retry * h->group->timeout + e->cycle_plan + 999) / 1000;
+  base = every = h->packet_schedule ? h->packet_schedule : 1;
+  while (every * 2 <= most && every * 2 * STABLE_RATIO <= now - h->stable_since)
+    every *= 2;
+  return every > base ? (int) every : h->packet_schedule;
+}
+
+/*
+ * A miss, a change of state or an outage around the host: it goes back
+ * to its own schedule (and is due now if it was off it) until it has
+ * been stable for a while again.
+ */
+void unsettle(e, h, now)
+LS_ENGINE *e; HOST_ENTRY *h; time_t now;
+{
+  h->stable_since = now;
+  if (h->every > h->packet_schedule && h->next_time.tv_sec > now)
+    h->next_time.tv_sec = now;
+  set_every(e, h, h->packet_schedule);
+}
+
+/*
+ * Rollups of the hosts by group (when there is more than the one) and
+ * by prefix (-prefix).  Each host is counted in the state it is in and
+ * moved from one count to another as it changes, and downtime is added
+ * up (in host-secs) each time the number down changes, so keeping them
+ * is O(1) a change and reporting on them O(1) a rollup.
+ */
+ROLLUP_ENTRY *
+create_rollup(e, name, group, net)
+LS_ENGINE *e; char *name; GROUP_ENTRY *group; in_addr_t net;
+{
+  ROLLUP_ENTRY *r;
+
+  if (e->num_rollups == e->max_rollups) {
+    e->max_rollups += ROLLUP_CHUNK;
+    e->rollups = (ROLLUP_ENTRY **) realloc(e->rollups, e->max_rollups * sizeof(ROLLUP_ENTRY *));
+    if (!e->rollups) crash_and_burn("create_rollup: can't grow rollup table");
+  }
+  r = (ROLLUP_ENTRY *) calloc(1, sizeof(ROLLUP_ENTRY));
+  if (!r) crash_and_burn("create_rollup: can't allocate ROLLUP_ENTRY");
+  r->name  = name;
+  r->group = group;
+  r->net   = net;
+  r->since = time(NULL);
+  e->rollups[e->num_rollups++] = r;
+  return r;
+}
+
+static void
+hash_prefix(e, r)
+LS_ENGINE *e; ROLLUP_ENTRY *r;
+{
+  unsigned int k;
+
+  for (k = hash_addr(r->net); e->prefix_hash[k & (e->prefix_size-1)]; k++);
+  e->prefix_hash[k & (e->prefix_size-1)] = r;
+}
+
+/*
+ * The rollup of the prefix an address is in, made if need be.  They
+ * are hashed by address, at most half full as the host index is.
+ */
+ROLLUP_ENTRY *
+prefix_rollup(e, addr)
+LS_ENGINE *e; in_addr_t addr;
+{
+  ROLLUP_ENTRY *r;
+  struct in_addr in;
+  unsigned int k;
+  int i;
+  char buf[32];
+
+  in.s_addr = addr & htonl(0xFFFFFFFFUL << (32 - e->prefix_bits));
+  for (k = hash_addr(in.s_addr); e->prefix_size && (r = e->prefix_hash[k & (e->prefix_size-1)]) != NULL; k++)
+    if (r->net == in.s_addr) return r;
+
+  snprintf(buf, 32, "%s/%d", inet_ntoa(in), e->prefix_bits);
+  r = create_rollup(e, strdup(buf), (GROUP_ENTRY *) NULL, in.s_addr);
+  if (e->num_rollups * 2 <= e->prefix_size) {
+    hash_prefix(e, r);
+    return r;
+  }
+  for (e->prefix_size = e->prefix_size ? e->prefix_size : 64; e->prefix_size < e->num_rollups * 2; e->prefix_size *= 2);
+  free(e->prefix_hash);
+  e->prefix_hash = (ROLLUP_ENTRY **) calloc(e->prefix_size, sizeof(ROLLUP_ENTRY *));
+  if (!e->prefix_hash) crash_and_burn("prefix_rollup: can't allocate prefix hash");
+  for (i=0; i<e->num_rollups; i++)
+    if (!e->rollups[i]->group) hash_prefix(e, e->rollups[i]);
+  return r;
+}
+
+int rollup_state(h)
+HOST_ENTRY *h;
+{
+  if (!h->alive) return ROLL_DOWN;
+  if (h->suspect || h->reprobe || h->flap_pos >= 0) return ROLL_DEGRADED;
+  return ROLL_UP;
+}
+
+/*
+ * Add up the host-secs down until now
+ */
+void rollup_tick(r, now)
+ROLLUP_ENTRY *r; time_t now;
+{
+  long secs = now - r->since;
+
+  if (secs > 0) {
+    r->down_secs += r->count[ROLL_DOWN] * secs;
+    r->downtime  += r->count[ROLL_DOWN] * secs;
+  }
+  r->since = now;
+}
+
+static void
+rollup_count(r, state, n, secs)
+ROLLUP_ENTRY *r; int state, n; long secs;
+{
+  if (!r) return;
+  if (state == ROLL_DOWN) rollup_tick(r, time(NULL));
+  r->count[state] += n;
+  r->down_secs += secs;
+  r->downtime  += secs;
+}
+
+/*
+ * Called after anything that may change the state of a host (up, down,
+ * suspect or flapping), to move it to the right count.
+ */
+void rollup_update(e, h)
+LS_ENGINE *e; HOST_ENTRY *h;
+{
+  int state;
+  long secs = 0;
+
+  if (h->rolled < 0) return;  /* not rolled up */
+  if ((state = rollup_state(h)) == h->rolled) return;
+  if (state == ROLL_DOWN)  /* down since its last answer, as in the SLA report */
+    secs = time(NULL) - (h->last_time.tv_sec ? h->last_time.tv_sec : e->start_time);
+  rollup_count(h->by_group, h->rolled, -1, 0L);
+  rollup_count(h->by_prefix, h->rolled, -1, 0L);
+  rollup_count(h->by_group, state, 1, secs);
+  rollup_count(h->by_prefix, state, 1, secs);
+  h->rolled = state;
+}
+
+void rollup_join(e, h)
+LS_ENGINE *e; HOST_ENTRY *h;
+{
+  if (h->rolled >= 0 || (!h->group->rollup && !e->prefix_bits)) return;
+
+  h->by_group  = h->group->rollup;
+  h->by_prefix = e->prefix_bits ? prefix_rollup(e, h->saddr.sin_addr.s_addr) : NULL;
+  h->rolled    = rollup_state(h);
+  rollup_count(h->by_group, h->rolled, 1, 0L);
+  rollup_count(h->by_prefix, h->rolled, 1, 0L);
+}
+
+void rollup_leave(h)
+HOST_ENTRY *h;
+{
+  if (h->rolled < 0) return;
+
+  rollup_count(h->by_group, h->rolled, -1, 0L);
+  rollup_count(h->by_prefix, h->rolled, -1, 0L);
+  h->rolled = -1;
+}
+
+void rollup_rtt(h, rtt)
+HOST_ENTRY *h; long rtt;
+{
+  if (h->by_group) {
+    h->by_group->rtt_total += rtt;
+    h->by_group->rtt_count++;
+  }
+  if (h->by_prefix) {
+    h->by_prefix->rtt_total += rtt;
+    h->by_prefix->rtt_count++;
+  }
+}
+
+int rollup_hosts(r)
+ROLLUP_ENTRY *r;
+{
+  return r->count[ROLL_UP] + r->count[ROLL_DOWN] + r->count[ROLL_DEGRADED];
+}
+
+/*
+ * A rollup as a line of text (up to date as of its last tick)
+ */
+int rollup_line(r, msg, len)
+ROLLUP_ENTRY *r; char *msg; int len;
+{
+  return snprintf(msg, len, "%s: %d hosts, %d up, %d down, %d degraded, avg RTT %ldus, %ld host-secs down",
+                  r->name, rollup_hosts(r), r->count[ROLL_UP], r->count[ROLL_DOWN], r->count[ROLL_DEGRADED],
+                  r->rtt_count ? r->rtt_total / r->rtt_count : 0L, r->down_secs);
+}
+
+void build_rollups(e)
+LS_ENGINE *e;
+{
+  int i;
+
+  if (e->num_groups > 1)
+    for (i=0; i<e->num_groups; i++)
+      e->groups[i]->rollup = create_rollup(e, e->groups[i]->name, e->groups[i], (in_addr_t) 0);
+  for (i=0; i<e->num_hosts; i++)
+    if (!e->table[i]->removed) rollup_join(e, e->table[i]);
+  if (e->prefix_bits)
+    printf("%s Rolling the hosts up into %d /%d prefixes\n", curr_time(), e->num_rollups - (e->num_groups > 1 ? e->num_groups : 0), e->prefix_bits);
+}
+
+/*
+ * For the status message: the rollups with hosts down or degraded, or
+ * some downtime since the last message.  Their RTT and downtime then
+ * start again.
+ */
+void rollup_status(e, now)
+LS_ENGINE *e; time_t now;
+{
+  static char msg[255];
+  ROLLUP_ENTRY *r;
+  int i;
+
+  for (i=0; i<e->num_rollups; i++) {
+    r = e->rollups[i];
+    rollup_tick(r, now);
+    if (r->count[ROLL_DOWN] || r->count[ROLL_DEGRADED] || r->down_secs) {
+      (void) rollup_line(r, msg, 255);
+      printf("%s Rollup %s\n", curr_time(), msg);
+    }
+    r->rtt_total = r->rtt_count = 0;
+    r->down_secs = 0;
+  }
+}
+
+/*
+ * Start an event for the stream subscribers (-stream), of host h or
+ * of the outage of the subnet named.  Names too long for the event are
+ * cut short and flagged, so no filter matches them by their start.
+ * Returns 0 if no one wants it.
+ */
+int event_start(e, ev, type, h, name)
+LS_ENGINE *e; SUB_EVENT *ev; int type; HOST_ENTRY *h; char *name;
+{
+  struct timeval now;
+
+  if (!sub_wanted(e->subs, type)) return 0;
+  memset(ev, 0, sizeof(SUB_EVENT));
+  ev->type = type;
+  gettimeofday(&now, &tz);
+  ev->sec  = now.tv_sec;
+  ev->usec = now.tv_usec;
+  if (h) {
+    ev->addr = h->saddr.sin_addr.s_addr;
+    name = h->host;
+    strncpy(ev->group, h->group->name, sizeof(ev->group) - 1);
+    if (strlen(h->group->name) >= sizeof(ev->group)) ev->flags |= SUB_F_GROUP_CUT;
+  }
+  strncpy(ev->host, name, sizeof(ev->host) - 1);
+  if (strlen(name) >= sizeof(ev->host)) ev->flags |= SUB_F_HOST_CUT;
+  return 1;
+}
+
+static int
+nested_outage(d)
+DEP_ENTRY *d;
+{
+  /* An outage of a parent that is itself part of a wider outage */
+  return d->parent && d->parent->dep && d->parent->dep->outage_start;
+}
+
+/*
+ * The notify command of an outage is that of the group of its parent
+ * host, a subnet outage uses the default one.
+ */
+char *
+outage_command(e, d)
+LS_ENGINE *e; DEP_ENTRY *d;
+{
+  return d->parent ? d->parent->group->command : e->groups[0]->command;
+}
+
+void start_outage(e, d)
+LS_ENGINE *e; DEP_ENTRY *d;
+{
+  static char msg[255];
+  SUB_EVENT ev;
+  int i;
+
+  if (d->outage_start) {
+    /* Back down again before the dependents had recovered */
+    d->recovering = 0;
+    return;
+  }
+
+  d->outage_start = time(NULL);
+  d->affected     = 0;
+  d->recovering   = 0;
+  d->next         = e->outages;
+  e->outages         = d;
+  e->num_outages_active++;
+  for (i=0; i<d->num_members; i++)
+    unsettle(e, d->members[i], d->outage_start);
+
+  if (nested_outage(d)) return;
+
+  snprintf(msg, 255, "%s OUTAGE %s, %d of %d dependent hosts unreachable",curr_time(), d->name, d->down, d->num_members);
+  printf("%s\n", msg);
+  (void) fflush(stdout);
+  if (outage_command(e, d)) notify_command(e, outage_command(e, d), d->name, "outage", msg);
+  if (event_start(e, &ev, SUB_OUTAGE, d->parent, d->name)) {
+    ev.count = d->down;
+    ev.value = d->num_members;
+    sub_publish(e->subs, &ev);
+  }
+}
+
+void recover_outage(e, d)
+LS_ENGINE *e; DEP_ENTRY *d;
+{
+  time_t now;
+  int i;
+
+  if (!d->outage_start || d->recovering) return;
+
+  /*
+   * Probe all of the dependents straight away, and give them a couple
+   * of cycles to come back before the outage is closed.
+   */
+  now = time(NULL);
+  d->recovering = RECOVERY_CYCLES;
+  for (i=0; i<d->num_members; i++) {
+    unsettle(e, d->members[i], now);
+    d->members[i]->next_time.tv_sec = now;
+  }
+}
+
+void end_outage(e, d)
+LS_ENGINE *e; DEP_ENTRY *d;
+{
+  static char msg[255];
+  struct timeval start, now;
+  SUB_EVENT ev;
+  DEP_ENTRY **pp;
+
+  for (pp = &e->outages; *pp; pp = &(*pp)->next)
+    if (*pp == d) {
+      *pp = d->next;
+      break;
+    }
+  e->num_outages_active--;
+
+  if (!nested_outage(d)) {
+    start.tv_sec  = d->outage_start;
+    start.tv_usec = 0;
+    gettimeofday(&now,&tz);
+    snprintf(msg, 255, "%s OUTAGE %s is over, after %s (%d state changes rolled up, %d hosts unreachable)",curr_time(), d->name, timeval_diff(start, now), d->affected, d->down);
+    printf("%s\n", msg);
+    (void) fflush(stdout);
+    if (outage_command(e, d)) notify_command(e, outage_command(e, d), d->name, "restored", msg);
+    if (event_start(e, &ev, SUB_RESTORED, d->parent, d->name)) {
+      ev.count = d->down;
+      ev.value = now.tv_sec - d->outage_start;
+      sub_publish(e->subs, &ev);
+    }
+  }
+
+  d->outage_start = 0;
+  d->recovering   = 0;
+}
+
+void check_outages(e)
+LS_ENGINE *e;
+{
+  DEP_ENTRY *d, *next;
+
+  /* Called once a cycle, to close outages that have recovered */
+  for (d = e->outages; d; d = next) {
+    next = d->next;
+    if (d->recovering && (d->down == 0 || --d->recovering == 0))
+      end_outage(e, d);
+  }
+}
+
+int dep_update(e, h, up)
+LS_ENGINE *e; HOST_ENTRY *h; int up;
+{
+  DEP_ENTRY *d = h->dep;
+  int rolled;
+
+  /*
+   * Account for a change of state of a dependent host.  Returns 1
+   * when it is part of an outage, and so should not be logged.
+   */
+  if (!d) return 0;
+
+  rolled = (d->outage_start != 0);
+  d->down += up ? -1 : 1;
+  if (rolled) d->affected++;
+
+  if (!d->parent) {
+    /* Subnet groups are in outage while half of the hosts are down */
+    if (d->num_members >= SUBNET_MIN && d->down * 2 >= d->num_members) {
+      if (!up && !rolled) {
+        /* This host tipped the subnet into an outage */
+        start_outage(e, d);
+        d->affected++;
+        rolled = 1;
+      }
+    } else if (up)
+      recover_outage(e, d);
+  }
+  return rolled;
+}
+
+/*
+ * Record a host going up or down in the history store
+ */
+void history_state(e, h, type, when)
+LS_ENGINE *e; HOST_ENTRY *h; int type; struct timeval *when;
+{
+  HIST_RECORD rec;
+
+  memset(&rec, 0, sizeof(rec));
+  rec.addr = h->saddr.sin_addr;
+  rec.type = type;
+  rec.when = (long long) when->tv_sec * 1000 + when->tv_usec / 1000;
+  hist_event(e->hist, &rec);
+}
+
+/*
+ * Record the RTT and loss of each host since the last summary (made
+ * at each status message), and pass it on to the stream.  Only the
+ * hosts probed since then are looked at, from sent_list.
+ */
+void history_summary(e)
+LS_ENGINE *e;
+{
+  HIST_RECORD rec;
+  SUB_EVENT ev;
+  struct timeval now;
+  HOST_ENTRY *h;
+  int i;
+
+  gettimeofday(&now, &tz);
+  memset(&rec, 0, sizeof(rec));
+  rec.type = HIST_SUMMARY;
+  rec.when = (long long) now.tv_sec * 1000 + now.tv_usec / 1000;
+
+  for (i=0; i<e->num_sent; i++) {
+    h = e->sent_list[i];
+    rec.addr    = h->saddr.sin_addr;
+    rec.sent    = h->hist_sent;
+    rec.recv    = h->hist_recv;
+    rec.rtt_avg = h->hist_recv ? h->hist_rtt / h->hist_recv : 0;
+    rec.rtt_max = h->hist_rtt_max;
+    if (e->hist) hist_event(e->hist, &rec);
+    if (event_start(e, &ev, SUB_RTT, h, NULL)) {
+      ev.count   = rec.sent;
+      ev.value   = rec.recv;
+      ev.rtt_avg = rec.rtt_avg;
+      ev.rtt_max = rec.rtt_max;
+      sub_publish(e->subs, &ev);
+    }
+    h->hist_sent = h->hist_recv = 0;
+    h->hist_rtt  = h->hist_rtt_max = 0;
+  }
+  e->num_sent = 0;
+}
+
+/*
+ * Flap damping, as for BGP routes.  Each time a host goes down it takes
+ * a penalty, which halves every FLAP_HALF_LIFE.  Past FLAP_SUPPRESS its
+ * state changes are held (not logged or notified, bar the one message
+ * that it is flapping) until the penalty decays back under FLAP_REUSE.
+ * Its downtime, SLA windows and history are kept as usual throughout.
+ */
+long flap_decay(h, now)
+HOST_ENTRY *h; time_t now;
+{
+  long secs = now - h->flap_time;
+
+  while (secs >= FLAP_HALF_LIFE && h->flap_penalty) {
+    h->flap_penalty >>= 1;
+    secs -= FLAP_HALF_LIFE;
+  }
+  if (secs > 0) h->flap_penalty -= h->flap_penalty * secs / (2 * FLAP_HALF_LIFE);  /* near enough */
+  h->flap_time = now;
+  return h->flap_penalty;
+}
+
+/*
+ * The host has gone down, returns 1 if its state changes are held.
+ */
+int flap_down(e, h, now)
+LS_ENGINE *e; HOST_ENTRY *h; time_t now;
+{
+  static char msg[255];
+  SUB_EVENT ev;
+
+  if (flap_decay(h, now) + FLAP_PENALTY < FLAP_MAX) h->flap_penalty += FLAP_PENALTY;
+  else h->flap_penalty = FLAP_MAX;
+
+  if (h->flap_pos >= 0) {
+    h->flaps_held++;
+    return 1;
+  }
+  if (h->flap_penalty < FLAP_SUPPRESS) return 0;
+
+  h->flap_pos = e->num_flapping;
+  e->flap_list[e->num_flapping++] = h;
+  h->flaps_held = 0;
+  snprintf(msg, 255, "%s %s is flapping (down %d times), holding its state changes",curr_time(), h->host, h->downtime_cnt);
+  printf("%s\n", msg);
+  (void) fflush(stdout);
+  if (h->group->command) notify_command(e, h->group->command, h->host, "flapping", msg);
+  if (event_start(e, &ev, SUB_FLAPPING, h, NULL)) {
+    ev.count = h->downtime_cnt;
+    sub_publish(e->subs, &ev);
+  }
+  return 1;
+}
+
+void unflap(e, h)
+LS_ENGINE *e; HOST_ENTRY *h;
+{
+  int pos = h->flap_pos;
+
+  if (pos < 0) return;
+  h->flap_pos = -1;
+  if (pos != --e->num_flapping) {
+    e->flap_list[pos] = e->flap_list[e->num_flapping];
+    e->flap_list[pos]->flap_pos = pos;
+  }
+  rollup_update(e, h);
+}
+
+/*
+ * Give the state changes of the flapping hosts that have settled down
+ * again, with the state they are now in.
+ */
+void flap_check(e, now)
+LS_ENGINE *e; time_t now;
+{
+  static char msg[255];
+  SUB_EVENT ev;
+  HOST_ENTRY *h;
+  int j;
+
+  for (j=e->num_flapping-1; j>=0; j--) {
+    h = e->flap_list[j];
+    if (flap_decay(h, now) >= FLAP_REUSE) continue;
+
+    unflap(e, h);
+    snprintf(msg, 255, "%s %s has stopped flapping, %s (%d state change%s held)",curr_time(), h->host, h->alive ? "alive" : "unreachable", h->flaps_held, (h->flaps_held == 1 ? "" : "s"));
+    printf("%s\n", msg);
+    (void) fflush(stdout);
+    if (h->group->command) notify_command(e, h->group->command, h->host, h->alive ? "up" : "down", msg);
+    if (event_start(e, &ev, SUB_SETTLED, h, NULL)) {
+      ev.count = h->flaps_held;
+      ev.flags |= h->alive ? 0 : SUB_F_DOWN;
+      sub_publish(e->subs, &ev);
+    }
+  }
+}
+
+void mark_unreachable(e, h)
+LS_ENGINE *e; HOST_ENTRY *h;
+{
+  static char msg[255];
+  struct timeval now;
+  SUB_EVENT ev;
+  int rolled_up, held;
+
+  if (h->packet_schedule == 0)
+    e->num_local_unreachable++;
+
+  h->down_pos = e->num_down;
+  e->down_list[e->num_down++] = h;
+  if (!h->downtime_cnt)
+    e->outage_list[e->num_outages++] = h;
+
+  h->alive=0;
+  h->downtime_cnt++;
+  rollup_update(e, h);
+  unsettle(e, h, time(NULL));
+  h->hw_dest_ok=0;  /* it may come back with a different MAC */
+  h->syn_src.s_addr=0;  /* or by a different route */
+
+  if (!h->sla && (h->sla = (SLA_ROLLUP *) calloc(1, sizeof(SLA_ROLLUP))) == NULL)
+    crash_and_burn("mark_unreachable: can't malloc SLA rollup");
+  sla_went_down(h->sla, h->last_time.tv_sec ? h->last_time.tv_sec : e->start_time);
+
+  /* Downtime runs from its last answer, as in the SLA report */
+  if (e->hist) {
+    if (h->last_time.tv_sec)
+      history_state(e, h, HIST_DOWN, &h->last_time);
+    else {
+      gettimeofday(&now, &tz);
+      history_state(e, h, HIST_DOWN, &now);
+    }
+  }
+
+  rolled_up = dep_update(e, h, 0);
+  held = flap_down(e, h, time(NULL));
+  if (!held && !rolled_up) {
+    if (h->first_time.tv_sec)
+      snprintf(msg, 255, "%s %s is unreachable, after %s",curr_time(), h->host, timeval_diff(h->first_time, h->last_time));
+    else
+      snprintf(msg, 255, "%s %s is unreachable",curr_time(), h->host);
+    printf("%s\n", msg);
+    (void) fflush(stdout);
+    if (h->group->command) notify_command(e, h->group->command, h->host, "down", msg);
+  }
+  if (event_start(e, &ev, SUB_DOWN, h, NULL)) {
+    ev.flags |= (held ? SUB_F_HELD : 0) | (rolled_up ? SUB_F_OUTAGE : 0);
+    sub_publish(e->subs, &ev);
+  }
+
+  if (h->children) start_outage(e, h->children);
+  if (e->cb.state) (*e->cb.state)(e->cb.arg, h->i, 0);
+  trace_event(e->trace, TR_DOWN, h->i, 0L);
+  if (e->replaying) {
+    gettimeofday(&now, &tz);
+    replay_down(e->replaying, h->saddr.sin_addr, &now);  /* scored against the capture */
+  }
+}
+
+int confirm_budget(e, now, when)
+LS_ENGINE *e; struct timeval *now, *when;
+{
+  struct timeval gap, burst;
+
+  /*
+   * Allow one re-probe every 1/confirm_rate seconds, with bursts
+   * of up to a second's worth.  If the budget is spent, return
+   * when the next re-probe will be allowed.
+   */
+  gap.tv_sec    = 0;
+  gap.tv_usec   = 1000000L / e->confirm_rate;
+  burst.tv_sec  = 0;
+  burst.tv_usec = 1000000L - gap.tv_usec;
+
+  if (timercmp(&e->confirm_tat, now, <)) e->confirm_tat = *now;
+  if (timeval_usec(*now, e->confirm_tat) > burst.tv_usec) {
+    timersub(&e->confirm_tat, &burst, when);
+    return 0;
+  }
+  timeradd(&e->confirm_tat, &gap, &e->confirm_tat);
+  return 1;
+}
+
+void clear_suspect(e, h)
+LS_ENGINE *e; HOST_ENTRY *h;
+{
+  if (!h->suspect) return;
+
+  e->num_suspect--;
+  h->suspect = 0;
+  if (h->reprobe) {
+    h->reprobe = 0;
+    deadline_clear(e, h);
+  }
+  rollup_update(e, h);
+}
+
+void reprobe_host(e, h, now)
+LS_ENGINE *e; HOST_ENTRY *h; struct timeval *now;
+{
+  if (!confirm_budget(e, now, &h->deadline)) {
+    /* Over the re-probe limit, try again when there is budget */
+    h->reprobe = 1;
+    deadline_set(e, h);
+    return;
+  }
+  h->reprobe = 0;
+  send_ping(e, e->sock,h);
+  h->suspect++;
+}
+
+void mark_reachable(e, h)
+LS_ENGINE *e; HOST_ENTRY *h;
+{
+  int pos = h->down_pos;
+
+  if (pos < 0) return;
+  h->down_pos = -1;
+  if (pos != --e->num_down) {
+    e->down_list[pos] = e->down_list[e->num_down];
+    e->down_list[pos]->down_pos = pos;
+  }
+}
+
+/*
+ * Tell the control client that asked for a probe of a host (see
+ * control_command) how it went: answered (with the RTT in usecs, or -1
+ * if not known) or lost.
+ */
+void control_result(e, h, answered, rtt)
+LS_ENGINE *e; HOST_ENTRY *h; int answered; long rtt;
+{
+  static char msg[255];
+
+  if (!answered)
+    snprintf(msg, 255, "%s no answer within %ldms (%s)\n", h->host, probe_wait(h) / 1000, h->alive ? "up" : "down");
+  else if (rtt >= 0)
+    snprintf(msg, 255, "%s answered in %.3fms (%s)\n", h->host, (double) rtt / 1000.0, h->alive ? "up" : "down");
+  else
+    snprintf(msg, 255, "%s answered (%s)\n", h->host, h->alive ? "up" : "down");
+  (void) ctl_send(e->ctl, h->ctl_client, msg);
+  h->ctl_client = 0;
+}
+
+void expire_probes(e)
+LS_ENGINE *e;
+{
+  struct timeval now;
+  HOST_ENTRY *h;
+  int was;
+
+  if (!e->num_deadlines) return;
+  was = trace_phase(e->trace, TR_SWEEP);
+  gettimeofday(&now,&tz);
+
+  /*
+   * Deal with each packet that has passed its deadline.  Any live host
+   * that still has retries left becomes suspect, and is re-probed
+   * straight away rather than waiting for its next turn in the cycle.
+   */
+  while (e->num_deadlines && !timercmp(&now, &e->deadline_heap[0]->deadline, <)) {
+    h = e->deadline_heap[0];
+    deadline_clear(e, h);
+
+    if (h->reprobe) {
+      /* Delayed re-probe of a suspect host */
+      reprobe_host(e, h, &now);
+      continue;
+    }
+
+    h->outstanding = 0;
+#if defined(linux) && defined(TCP_PROBES)
+    if (h->conn_fd >= 0) {
+      close(h->conn_fd);  /* give up on the connect */
+      h->conn_fd = -1;
+    }
+#endif
+    if (h->ctl_client) control_result(e, h, 0, 0L);
+    if (!h->alive) {
+      if (e->cb.loss) (*e->cb.loss)(e->cb.arg, h->i, 0);
+      continue;  /* already down, wait for its next turn */
+    }
+
+    unsettle(e, h, now.tv_sec);
+    if (h->packet_schedule == 0) e->queue_len++;
+    if (h->response) h->response--;
+    if (e->cb.loss) (*e->cb.loss)(e->cb.arg, h->i, h->response);
+
+    if (h->response < 1) {
+      clear_suspect(e, h);
+      mark_unreachable(e, h);
+      continue;
+    }
+
+    if (!h->suspect) {
+      e->num_suspect++;
+      if (e->debug) {
+        printf("%s %s is suspect\n", curr_time(), h->host);
+        (void) fflush(stdout);
+      }
+    }
+    reprobe_host(e, h, &now);
+    rollup_update(e, h);
+  }
+  (void) trace_phase(e->trace, was);
+}
+
+/*
+ * Deal with an answer from host n, to an ICMP or TCP probe.  The
+ * round trip time (usecs) is given if known, otherwise it is -1.
+ */
+int host_answered(e, n, rtt)
+LS_ENGINE *e; int n; long rtt;
+{
+  if (e->table[n]->removed) return n;  /* a late answer, just drop it */
+
+  if (rtt >= 0 && rtt < 60 * 1000000L) {
+    update_rto(e, e->table[n], rtt);
+    rollup_rtt(e->table[n], rtt);
+  }
+
+  /* Only answers in time count towards the history summary */
+  if (e->table[n]->outstanding) {
+    e->table[n]->hist_recv++;
+    if (rtt >= 0) {
+      e->table[n]->hist_rtt += rtt;
+      if ((unsigned long) rtt > e->table[n]->hist_rtt_max) e->table[n]->hist_rtt_max = rtt;
+    }
+  }
+
+  e->table[n]->outstanding = 0;
+  deadline_clear(e, e->table[n]);
+
+  if (e->table[n]->suspect) {
+    /* The host answered a re-probe, so it was a false alarm */
+    if (e->debug) {
+      printf("%s %s is no longer suspect\n", curr_time(), e->table[n]->host);
+      (void) fflush(stdout);
+    }
+    clear_suspect(e, e->table[n]);
+    e->false_suspect++;
+  }
+
+  /*
+   * For the hosts that are using the default number of retries:
+   * Try work out an optimal retry count, then reset the value.
+   *
+   * NOTE: While it is not a biggie... The retry count will be
+   *       one greater than it needs to be, as we are using this
+   *       field for more than one purpose to keep things simple.
+   *       We would need to have another field for the retry
+   *       count if we were to fix this up.
+   */
+   if ((e->table[n]->retry == e->table[n]->group->retry) && (e->optimal_retry < e->table[n]->retry - e->table[n]->response))
+    e->optimal_retry = e->table[n]->retry - e->table[n]->response;
+
+  e->table[n]->response = e->table[n]->retry;
+
+  if (!e->table[n]->alive) {
+    /* At this point the host has only just come up
+       after being down for a period of time
+     */
+
+    static char msg[255];
+    SUB_EVENT ev;
+    long down_for;
+    int rolled_up;
+
+    if (e->table[n]->packet_schedule == 0)
+      e->num_local_unreachable--;
+    mark_reachable(e, e->table[n]);
+
+    /* timestamp the last time the host responded */
+    gettimeofday(&e->current_time,&tz);
+
+/* Removed as MetaFrame application servers are better :) */
+#ifdef WC_MOD
+    /* WC_MOD: This is a mod to correct WinCenter downtime
+     *         It is a little out of the scope of this utility
+     *         but never the less there was a need for it  :)
+     *
+     *         This is required as the server may still be responding
+     *         to pings, but it may have services that have hung.
+     *         We have an external process that check the services
+     *         and creates a file in .../log/status if a server has
+     *         services that have hung.  This information is used
+     *         to "adjust" the downtime of the server.
+     *
+    */
+    if (((e->table[n]->host)[1] == 'i') || ((e->table[n]->host)[1] == 'M')) {
+      struct stat buf;
+      /* This might be a WinCenter server that had hung services */
+      snprintf(msg, 255, "/opt/LinkStat/log/status/%s", e->table[n]->host);
+      if (!stat(msg, &buf)) {
+	/* Check to see that status file was created before system
+	   network connectivity ceased. */
+	if (buf.st_mtime < e->table[n]->last_time.tv_sec) {
+	    e->table[n]->last_time.tv_sec  = buf.st_mtime;
+	    e->table[n]->last_time.tv_usec = 0;
+	}
+	unlink(msg);
+      }
+    }
+#endif
+
+    if (e->table[n]->last_time.tv_sec) {
+      snprintf(msg, 255, "%s %s is alive, after %s",curr_time(), e->table[n]->host, timeval_diff(e->table[n]->last_time, e->current_time));
+      down_for = e->current_time.tv_sec - e->table[n]->last_time.tv_sec;
+    } else {
+      snprintf(msg, 255, "%s %s is alive",curr_time(), e->table[n]->host);
+      down_for = e->current_time.tv_sec - e->start_time;
+    }
+    e->table[n]->downtime += down_for;
+    if (e->table[n]->sla)
+      sla_down(e->table[n]->sla, e->table[n]->last_time.tv_sec ? e->table[n]->last_time.tv_sec : e->start_time, e->current_time.tv_sec);
+
+    e->table[n]->alive = 1;
+    rollup_update(e, e->table[n]);
+    unsettle(e, e->table[n], e->current_time.tv_sec);
+    trace_event(e->trace, TR_UP, n, 0L);
+    if (e->hist) history_state(e, e->table[n], HIST_UP, &e->current_time);
+    rolled_up = dep_update(e, e->table[n], 1);
+    if (!rolled_up && e->table[n]->flap_pos < 0) {
+      printf("%s\n", msg);
+      (void) fflush(stdout);
+    } else {
+      if (e->table[n]->flap_pos >= 0) e->table[n]->flaps_held++;
+      msg[0] = '\0';  /* part of an outage, or flapping */
+    }
+    if (event_start(e, &ev, SUB_UP, e->table[n], NULL)) {
+      ev.value = down_for;
+      ev.flags |= (e->table[n]->flap_pos >= 0 ? SUB_F_HELD : 0) | (rolled_up ? SUB_F_OUTAGE : 0);
+      sub_publish(e->subs, &ev);
+    }
+
+    /* timestamp the first time the host responded */
+    e->table[n]->first_time = e->current_time;
+    e->table[n]->last_time = e->current_time;
+
+    /* Check and execute any Notification commands */
+    if (e->table[n]->group->command && msg[0]) notify_command(e, e->table[n]->group->command, e->table[n]->host, "up", msg);
+
+    if (e->table[n]->children) recover_outage(e, e->table[n]->children);
+    if (e->cb.state) (*e->cb.state)(e->cb.arg, n, 1);
+
+  } else {
+    /* timestamp the last time the host responded */
+    gettimeofday(&e->current_time,&tz);
+    e->table[n]->last_time = e->current_time;
+  }
+
+  if (e->table[n]->ctl_client) control_result(e, e->table[n], 1, rtt);
+  if (e->cb.rtt) (*e->cb.rtt)(e->cb.arg, n, rtt);
+  return n;
+}
+
+char *unreach_name(code)
+int code;
+{
+  switch (code) {
+    case ICMP_UNREACH_NET:
+    case ICMP_UNREACH_NET_UNKNOWN:
+    case ICMP_UNREACH_ISOLATED:
+    case ICMP_UNREACH_TOSNET:         return "network unreachable";
+    case ICMP_UNREACH_HOST:
+    case ICMP_UNREACH_HOST_UNKNOWN:
+    case ICMP_UNREACH_TOSHOST:        return "host unreachable";
+    case ICMP_UNREACH_NET_PROHIB:
+    case ICMP_UNREACH_HOST_PROHIB:
+    case ICMP_UNREACH_FILTER_PROHIB:  return "admin prohibited";
+    default:                          return "unreachable";
+  }
+}
+
+/*
+ * Count an ICMP error against the router it came from.
+ */
+void count_router(e, from, code, when)
+LS_ENGINE *e; struct in_addr from; int code; time_t when;
+{
+  int j;
+
+  for (j=0; j<e->num_routers && e->routers[j].addr.s_addr != from.s_addr; j++) ;
+  if (j == e->num_routers) {
+    if (e->num_routers == e->max_routers) {
+      e->max_routers += ROUTER_CHUNK;
+      e->routers = (ROUTER_ENTRY *) realloc(e->routers, e->max_routers * sizeof(ROUTER_ENTRY));
+      if (!e->routers) crash_and_burn("count_router: can't grow router table");
+    }
+    e->routers[j].addr   = from;
+    e->routers[j].errors = 0;
+    e->num_routers++;
+  }
+  e->routers[j].errors++;
+  e->routers[j].code = code;
+  e->routers[j].last = when;
+}
+
+/*
+ * A router (or the host's own network) says the probe out to host n
+ * can't get there.  That is as good as the probe being lost, without
+ * the wait: the host has failed now, with no retries, as if its
+ * deadline had passed with none left.
+ */
+int host_refused(e, n, code, from)
+LS_ENGINE *e; int n; int code; struct in_addr from;
+{
+  HOST_ENTRY *h = e->table[n];
+
+  e->icmp_errors++;
+  h->icmp_errors++;
+  h->error_from = from;
+  h->error_code = code;
+  count_router(e, from, code, e->current_time.tv_sec);
+
+  if (h->removed || h->paused || !h->outstanding) return n;  /* already given up on */
+
+  h->outstanding = 0;
+  deadline_clear(e, h);
+  if (h->ctl_client) control_result(e, h, 0, 0L);
+  if (e->debug) {
+    printf("%s %s refused, %s from %s\n", curr_time(), h->host, unreach_name(code), inet_ntoa(from));
+    (void) fflush(stdout);
+  }
+
+  h->response = 0;
+  if (e->cb.loss) (*e->cb.loss)(e->cb.arg, h->i, 0);
+  clear_suspect(e, h);
+  if (h->alive) mark_unreachable(e, h);
+  return n;
+}
+
+#if defined(linux) && defined(TCP_PROBES)
+
+/*
+ * Finish off any connects (probe=tcp) that have completed.  Only an
+ * established connection counts as an answer, a refused one is left
+ * to time out like a lost packet.
+ */
+void tcp_complete(e)
+LS_ENGINE *e;
+{
+  struct epoll_event events[64];
+  struct linger lin;
+  HOST_ENTRY *h;
+  socklen_t len;
+  int i, n, err;
+
+  n = epoll_wait(e->conn_poll, events, 64, 0);
+  if (n < 0) return;
+
+  gettimeofday(&e->current_time,&tz);
+  for (i = 0; i < n; i++) {
+    h = (HOST_ENTRY *) events[i].data.ptr;
+    if (h->conn_fd < 0) continue;
+
+    err = 0;
+    len = sizeof(err);
+    if (getsockopt(h->conn_fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0) err = errno;
+
+    /* Reset rather than close, so nothing is left in TIME_WAIT */
+    lin.l_onoff  = 1;
+    lin.l_linger = 0;
+    (void) setsockopt(h->conn_fd, SOL_SOCKET, SO_LINGER, &lin, sizeof(lin));
+    close(h->conn_fd);
+    h->conn_fd = -1;
+
+    if (err == 0 && h->outstanding)
+      (void) host_answered(e, h->i, timeval_usec(h->sent_time, e->current_time));
+  }
+}
+
+/*
+ * Take any answers to our SYNs (probe=syn).  Either a SYN-ACK or a
+ * RST shows the host is alive, and the index comes back in the
+ * acknowledgement number.
+ */
+void syn_replies(e)
+LS_ENGINE *e;
+{
+  static char buffer[4096];
+  struct ip *ip;
+  struct tcphdr *th;
+  HOST_ENTRY *h;
+  unsigned int n;
+  int len, hlen;
+
+  while ((len = recv(e->syn_sock, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0) {
+    ip = (struct ip *) buffer;
+    hlen = ip->ip_hl << 2;
+    if (len < hlen + (int) sizeof(struct tcphdr)) continue;
+    th = (struct tcphdr *) (buffer + hlen);
+
+    if (ntohs(th->th_dport) != e->syn_port) continue;
+    if (!(th->th_flags & TH_RST) &&
+        (th->th_flags & (TH_SYN | TH_ACK)) != (TH_SYN | TH_ACK)) continue;
+
+    n = (ntohl(th->th_ack) - 1) ^ e->syn_secret;
+    if (n >= (unsigned int) e->num_hosts) continue;
+    h = e->table[n];
+    if (h->probe != PROBE_SYN || !h->outstanding ||
+        h->saddr.sin_addr.s_addr != ip->ip_src.s_addr ||
+        ntohs(th->th_sport) != h->port) continue;
+
+    gettimeofday(&e->current_time,&tz);
+    (void) host_answered(e, h->i, timeval_usec(h->sent_time, e->current_time));
+  }
+}
+
+#else
+#define tcp_complete(e)  ((void)0)
+#define syn_replies(e)   ((void)0)
+#endif
+
+/*
+ * Take an ARP reply (for -arp), which also gives us the MAC address
+ * of the host.
+ */
+void arp_answer(arg, addr, mac, stamp)
+void *arg; struct in_addr addr; unsigned char *mac; struct timeval *stamp;
+{
+  LS_ENGINE *e = (LS_ENGINE *) arg;
+  HOST_ENTRY *h;
+  int check_mac();
+
+  if ((h = find_host_by_addr(e, addr.s_addr)) == NULL ||
+      h->probe != PROBE_ARP || !h->outstanding) return;
+
+  if (e->check_hw) check_mac(e, mac, addr.s_addr, h->i);
+
+  gettimeofday(&e->current_time,&tz);
+  (void) host_answered(e, h->i, timeval_usec(h->sent_time, *stamp));
+}
+
+/*
+ * The flight recorder names hosts by index, and sends a trace asked
+ * for by a control client a line at a time.
+ */
+char *trace_host(arg, host)
+void *arg; int host;
+{
+  LS_ENGINE *e = (LS_ENGINE *) arg;
+
+  return (host >= 0 && host < e->num_hosts) ? e->table[host]->host : "?";
+}
+
+void trace_client(arg, line)
+void *arg; char *line;
+{
+  TRACE_TO *to = (TRACE_TO *) arg;
+
+  (void) ctl_send(to->ctl, to->client, line);  /* a client that can't keep up is dropped */
+}
+
+/*
+ * Carry out a command from a control client (-control).  Probes asked
+ * for are sent there and then, ahead of the cycle, and answered by
+ * control_result when the reply arrives or the RTO runs out.
+ */
+void control_command(arg, client, line)
+void *arg; int client; char *line;
+{
+  LS_ENGINE *e = (LS_ENGINE *) arg;
+  static char msg[512];
+  static char *probe_names[] = { "icmp", "tcp", "syn", "arp" };
+  char cmd[32], name[132];
+  struct timeval now;
+  HOST_ENTRY *h = NULL;
+  int j, len;
+  TRACE_TO to;
+
+  name[0] = '\0';
+  if (sscanf(line, "%31s %131s", cmd, name) < 1) return;  /* blank line */
+
+  if (!strcmp(cmd, "trace")) {
+    /* the flight recorder, with the last so many events */
+    trace_event(e->trace, TR_MARK, 0, 0L);
+    to.ctl    = e->ctl;
+    to.client = client;
+    trace_dump(e->trace, name[0] ? atoi(name) : TRACE_CTL_EVENTS, trace_client, &to);
+    return;
+  }
+  if (!strcmp(cmd, "rollup")) {
+    /* a group or prefix (by its a.b.c.d/n name), or the lot */
+    for (j=0, len=0; j<e->num_rollups; j++) {
+      if (name[0] && strcmp(name, e->rollups[j]->name)) continue;
+      rollup_tick(e->rollups[j], time(NULL));
+      (void) rollup_line(e->rollups[j], msg, 511);
+      strcat(msg, "\n");
+      if (ctl_send(e->ctl, client, msg) < 0) return;
+      len++;
+    }
+    if (name[0] && !len)
+      snprintf(msg, 512, "%s: unknown group or prefix\n", name);
+    else
+      snprintf(msg, 512, "%d rollup%s\n", len, (len == 1 ? "" : "s"));
+    (void) ctl_send(e->ctl, client, msg);
+    return;
+  }
+  if (name[0] && (h = find_host(e, name)) == NULL) {
+    snprintf(msg, 512, "%s: unknown host\n", name);
+    (void) ctl_send(e->ctl, client, msg);
+    return;
+  }
+  gettimeofday(&now,&tz);
+
+  if (!strcmp(cmd, "probe") && h) {
+    if (h->ctl_client) {
+      snprintf(msg, 512, "%s is already being probed\n", h->host);
+      (void) ctl_send(e->ctl, client, msg);
+      return;
+    }
+    h->ctl_client = client;
+    if (h->outstanding) return;  /* the probe out now will do */
+    if (h->reprobe) {
+      /* a suspect host waiting on the re-probe budget, this is it */
+      h->reprobe = 0;
+      deadline_clear(e, h);
+      send_ping(e, e->sock,h);
+      h->suspect++;
+    } else
+      send_ping(e, e->sock,h);
+    if (e->debug) {
+      printf("%s %s probed on request\n", curr_time(), h->host);
+      (void) fflush(stdout);
+    }
+
+  } else if (!strcmp(cmd, "show") && h) {
+    len = snprintf(msg, 512, "%s %s %s%s%s, probe %s", h->host, inet_ntoa(h->saddr.sin_addr), h->alive ? "up" : "down", h->suspect ? ", suspect" : "", h->paused ? ", paused" : "", probe_names[h->probe]);
+    if (h->probe == PROBE_TCP || h->probe == PROBE_SYN)
+      len += snprintf(msg + len, 512 - len, ":%d", h->port);
+    if (e->num_groups > 1)
+      len += snprintf(msg + len, 512 - len, ", group %s", h->group->name);
+    len += snprintf(msg + len, 512 - len, ", pri %d", h->pri);
+    if (h->flap_pos >= 0)
+      len += snprintf(msg + len, 512 - len, ", flapping (penalty %ld, %d held)", flap_decay(h, now.tv_sec), h->flaps_held);
+    else if (h->flap_penalty)
+      len += snprintf(msg + len, 512 - len, ", flap penalty %ld", flap_decay(h, now.tv_sec));
+    len += snprintf(msg + len, 512 - len, ", srtt %ldus rttvar %ldus rto %ldus", h->srtt, h->rttvar, h->rto);
+    if (h->last_time.tv_sec)
+      len += snprintf(msg + len, 512 - len, ", last answer %lds ago", (long) (now.tv_sec - h->last_time.tv_sec));
+    if (h->every > h->packet_schedule)
+      len += snprintf(msg + len, 512 - len, ", probed every %ds (stable %lds)", h->every, (long) (now.tv_sec - h->stable_since));
+    if (h->icmp_errors)
+      len += snprintf(msg + len, 512 - len, ", %ld ICMP error%s (last %s from %s)", h->icmp_errors, (h->icmp_errors == 1 ? "" : "s"), unreach_name(h->error_code), inet_ntoa(h->error_from));
+    snprintf(msg + len, 512 - len, ", down %lds %d times\n", h->downtime, h->downtime_cnt);
+    (void) ctl_send(e->ctl, client, msg);
+
+  } else if (!strcmp(cmd, "down") && !h) {
+    for (j=0; j<e->num_down; j++) {
+      h = e->down_list[j];
+      if (h->last_time.tv_sec)
+        snprintf(msg, 512, "%s is unreachable, after %s\n", h->host, timeval_diff(h->last_time, now));
+      else
+        snprintf(msg, 512, "%s is unreachable\n", h->host);
+      if (ctl_send(e->ctl, client, msg) < 0) return;
+    }
+    snprintf(msg, 512, "%d host%s unreachable\n", e->num_down, (e->num_down == 1 ? "" : "s"));
+    (void) ctl_send(e->ctl, client, msg);
+
+  } else if (!strcmp(cmd, "routers") && !h) {
+    for (j=0; j<e->num_routers; j++) {
+      snprintf(msg, 512, "%s sent %ld ICMP error%s, last %s %lds ago\n", inet_ntoa(e->routers[j].addr), e->routers[j].errors, (e->routers[j].errors == 1 ? "" : "s"), unreach_name(e->routers[j].code), (long) (now.tv_sec - e->routers[j].last));
+      if (ctl_send(e->ctl, client, msg) < 0) return;
+    }
+    snprintf(msg, 512, "%d router%s sent ICMP errors\n", e->num_routers, (e->num_routers == 1 ? "" : "s"));
+    (void) ctl_send(e->ctl, client, msg);
+
+  } else if (!strcmp(cmd, "pause") && h) {
+    /*
+     * A paused host keeps its state, it is just left alone (along
+     * with any probe already out) until it is resumed.
+     */
+    if (!h->paused) {
+      h->paused = 1;
+      clear_suspect(e, h);
+      h->outstanding = 0;
+      deadline_clear(e, h);
+#if defined(linux) && defined(TCP_PROBES)
+      if (h->conn_fd >= 0) {
+        close(h->conn_fd);
+        h->conn_fd = -1;
+      }
+#endif
+      printf("%s %s paused\n", curr_time(), h->host);
+      (void) fflush(stdout);
+    }
+    snprintf(msg, 512, "%s paused\n", h->host);
+    (void) ctl_send(e->ctl, client, msg);
+
+  } else if (!strcmp(cmd, "resume") && h) {
+    if (h->paused) {
+      h->paused = 0;
+      h->next_time.tv_sec = now.tv_sec;  /* due straight away */
+      printf("%s %s resumed\n", curr_time(), h->host);
+      (void) fflush(stdout);
+    }
+    snprintf(msg, 512, "%s resumed\n", h->host);
+    (void) ctl_send(e->ctl, client, msg);
+
+  } else
+    (void) ctl_send(e->ctl, client, "commands: probe <host>, show <host>, down, routers, pause <host>, resume <host>, trace [events], rollup [group|prefix]\n");
+}
+
+/*
+ * Get a host ready for its first packet (now)
+ */
+void
+ready_host(e, h)
+LS_ENGINE *e; HOST_ENTRY *h;
+{
+  h->alive = 1;            /* Assume all hosts initially live */
+  h->response = h->retry;  /* Set number of times to retry host */
+  h->rto = h->group->timeout * 1000L; /* Until a round trip is measured */
+
+  /* Set the time to receive its first packet (now) */
+  h->next_time.tv_sec = e->current_time.tv_sec;
+  h->stable_since = e->current_time.tv_sec;
+  set_every(e, h, h->packet_schedule);
+  rollup_update(e, h);
+}
+
+/*
+ * Stop probing a host.  If it is down it is taken as back up (without
+ * the fuss), so its downtime and the outage counts come out right.
+ */
+void
+release_host(e, h)
+LS_ENGINE *e; HOST_ENTRY *h;
+{
+  time_t since;
+
+  clear_suspect(e, h);
+  h->outstanding = 0;
+  deadline_clear(e, h);
+#if defined(linux) && defined(TCP_PROBES)
+  if (h->conn_fd >= 0) {
+    close(h->conn_fd);
+    h->conn_fd = -1;
+  }
+#endif
+  if (h->ctl_client) control_result(e, h, 0, 0L);
+  unflap(e, h);
+  set_every(e, h, h->packet_schedule);
+
+  if (!h->alive) {
+    gettimeofday(&e->current_time, &tz);
+    since = h->last_time.tv_sec ? h->last_time.tv_sec : e->start_time;
+    h->downtime += e->current_time.tv_sec - since;
+    if (h->sla) sla_down(h->sla, since, e->current_time.tv_sec);
+    if (h->packet_schedule == 0)
+      e->num_local_unreachable--;
+    mark_reachable(e, h);
+    h->alive = 1;
+    rollup_update(e, h);
+    (void) dep_update(e, h, 1);
+    if (h->children) recover_outage(e, h->children);
+  }
+}
+
+int by_name(a, b)
+const void *a; const void *b;
+{
+  return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+/*
+ * The aggregator has told us the live nodes of the cluster (see
+ * cluster.c).  Our slice is the hosts that land on us on their ring:
+ * hosts that have come our way are probed from now, those that have
+ * gone to another node are let go.  Until the first word we probe the
+ * lot, so nothing goes unwatched while a node starts up.
+ */
+void
+cluster_members(arg, names, count)
+void *arg; char **names; int count;
+{
+  LS_ENGINE *e = (LS_ENGINE *) arg;
+  char key[CLUSTER_MSG], *me, *owner;
+  int i, len, took = 0, gave = 0;
+  HOST_ENTRY *h;
+
+  qsort(names, count, sizeof(char *), by_name);
+  for (i = 0, len = 0, key[0] = '\0'; i < count && len < (int) sizeof(key); i++)
+    len += snprintf(key + len, sizeof(key) - len, " %s", names[i]);
+  if (e->cluster_last && !strcmp(e->cluster_last, key)) return;  /* no change */
+  free(e->cluster_last);
+  e->cluster_last = strdup(key);
+
+  cluster_ring_free(e->slice_ring);
+  if ((e->slice_ring = cluster_ring(names, count)) == NULL)
+    crash_and_burn("cluster_members: malloc");
+
+  gettimeofday(&e->current_time, &tz);
+  me = cluster_name(e->cluster);
+  e->num_slice = 0;
+  for (i=0; i<e->num_hosts; i++) {
+    h = e->table[i];
+    if (h->removed) continue;
+    owner = cluster_owner(e->slice_ring, h->host);
+    if (!owner || !strcmp(owner, me)) {
+      if (h->slice == SLICE_OTHER) {
+        ready_host(e, h);
+        e->num_released--;
+        h->group->num_other--;
+        h->slice = SLICE_TAKEN;  /* its state goes up once it is known */
+        took++;
+      }
+      e->num_slice++;
+    } else if (h->slice != SLICE_OTHER) {
+      release_host(e, h);
+      h->slice = SLICE_OTHER;
+      e->num_released++;
+      h->group->num_other++;
+      gave++;
+    }
+  }
+  printf("%s Cluster of %d node%s, probing %d of %d hosts (took %d, gave up %d)\n", curr_time(), count, (count == 1 ? "" : "s"), e->num_slice, e->num_hosts, took, gave);
+  (void) fflush(stdout);
+}
+
+/*
+ * Pass state changes up to the aggregator (engine callbacks, -cluster)
+ */
+void
+cluster_state(arg, host, up)
+void *arg; int host; int up;
+{
+  LS_ENGINE *e = (LS_ENGINE *) arg;
+  char msg[CLUSTER_MSG];
+
+  if (!e->cluster) return;
+  if (e->table[host]->slice == SLICE_TAKEN) e->table[host]->slice = SLICE_MINE;
+  snprintf(msg, sizeof(msg), "STATE %s %s %s %ld", cluster_name(e->cluster), e->table[host]->host, (up ? "up" : "down"), (long) time(NULL));
+  (void) cluster_send(e->cluster, msg);
+}
+
+void
+cluster_rtt(arg, host, usecs)
+void *arg; int host; long usecs;
+{
+  LS_ENGINE *e = (LS_ENGINE *) arg;
+
+  (void) usecs;
+  /* the first answer from a host we have taken over settles its state */
+  if (e->cluster && e->table[host]->slice == SLICE_TAKEN)
+    cluster_state(arg, host, 1);
+}
+
+/*
+ * Send the SLA windows of the hosts in our slice that have been down
+ * up to the aggregator, to be merged with those of the other nodes.
+ */
+void
+cluster_windows(e)
+LS_ENGINE *e;
+{
+  char msg[CLUSTER_MSG];
+  long down, period;
+  time_t now = time(NULL), down_since;
+  int j, w, count, len;
+  HOST_ENTRY *h;
+
+  for (j=0; j<e->num_outages; j++) {
+    h = e->outage_list[j];
+    if (!h->sla || h->removed || h->slice == SLICE_OTHER) continue;
+    down_since = 0;
+    if (!h->alive)
+      down_since = h->last_time.tv_sec ? h->last_time.tv_sec : e->start_time;
+
+    len = snprintf(msg, sizeof(msg), "SLA %s %s %s", cluster_name(e->cluster), h->host, (h->alive ? "up" : "down"));
+    for (w = 0; w < SLA_WINDOWS; w++) {
+      down = sla_get(h->sla, w, now, e->start_time, down_since, &period, &count);
+      if (len < (int) sizeof(msg))
+        len += snprintf(msg + len, sizeof(msg) - len, " %ld %d %ld", down, count, period);
+    }
+    (void) cluster_send(e->cluster, msg);
+  }
+}
+
+/*
+ * Add the descriptors of the other probe types to a select set, and
+ * deal with any that are ready.  Any ARP requests still queued are
+ * sent off first, so a whole sweep goes out before we wait, as are
+ * the events waiting for the stream subscribers.
+ */
+int probe_fds(e, set, maxfd)
+LS_ENGINE *e; fd_set *set; int maxfd;
+{
+  if (e->arp) {
+    (void) arp_flush(e->arp);
+    FD_SET(arp_fd(e->arp), set);
+    if (arp_fd(e->arp) > maxfd) maxfd = arp_fd(e->arp);
+  }
+  if (e->conn_poll >= 0) {
+    FD_SET(e->conn_poll, set);
+    if (e->conn_poll > maxfd) maxfd = e->conn_poll;
+  }
+  if (e->syn_sock >= 0) {
+    FD_SET(e->syn_sock, set);
+    if (e->syn_sock > maxfd) maxfd = e->syn_sock;
+  }
+  if (e->ctl) maxfd = ctl_fds(e->ctl, set, maxfd);
+  if (e->subs) {
+    sub_flush(e->subs);
+    maxfd = sub_fds(e->subs, set, maxfd);
+  }
+  if (e->cluster) {
+    if (time(NULL) >= e->cluster_beat) {
+      char msg[CLUSTER_MSG];
+
+      /* a heartbeat, with how long the next one may take */
+      snprintf(msg, sizeof(msg), "HELLO %s %d %d %d %d", cluster_name(e->cluster), (e->timeout > CLUSTER_BEAT * 1000 ? e->timeout : CLUSTER_BEAT * 1000), e->num_hosts, e->num_slice, e->num_local_unreachable);
+      (void) cluster_send(e->cluster, msg);
+      e->cluster_beat = time(NULL) + CLUSTER_BEAT;
+    }
+    FD_SET(cluster_fd(e->cluster), set);
+    if (cluster_fd(e->cluster) > maxfd) maxfd = cluster_fd(e->cluster);
+  }
+  return maxfd;
+}
+
+void probe_fds_ready(e, set)
+LS_ENGINE *e; fd_set *set;
+{
+  if (e->conn_poll >= 0 && FD_ISSET(e->conn_poll, set)) tcp_complete(e);
+  if (e->syn_sock >= 0 && FD_ISSET(e->syn_sock, set))   syn_replies(e);
+  if (e->arp && FD_ISSET(arp_fd(e->arp), set))          (void) arp_read(e->arp, arp_answer, e);
+  if (e->ctl)                                           (void) ctl_ready(e->ctl, set, control_command, e);
+  if (e->subs)                                          sub_ready(e->subs, set);
+  if (e->cluster && FD_ISSET(cluster_fd(e->cluster), set)) (void) cluster_read(e->cluster, cluster_members, e);
+}
+
+/*
+ * Spin checking the descriptors for up to the busy poll time (or *to),
+ * taking the time spent off *to.  Returns as wait_readable.
+ */
+int spin_readable (e, s, t, to)
+LS_ENGINE *e; int s; int t; struct timeval *to;
+{
+  struct timeval start, now, zero;
+  fd_set readset;
+  long spin, spent;
+  int nfound, maxfd, ready;
+
+  spin = to->tv_sec * 1000000L + to->tv_usec;
+  if (spin > e->busy_poll) spin = e->busy_poll;
+
+  gettimeofday(&start,&tz);
+  do {
+    FD_ZERO(&readset);
+    FD_SET(s,&readset);
+    if (t >= 0) FD_SET(t,&readset);
+    maxfd = probe_fds(e, &readset, s > t ? s : t);
+    timerclear(&zero);
+    nfound = select(maxfd+1,&readset,NULL,NULL,&zero);
+    if (nfound<0 && errno != EINTR) errno_crash_and_burn("spin_readable: select");
+    if (nfound>0) {
+      probe_fds_ready(e, &readset);
+      ready = (FD_ISSET(s,&readset) ? 1 : 0) | (t >= 0 && FD_ISSET(t,&readset) ? 2 : 0);
+      if (ready) return ready;
+    }
+    gettimeofday(&now,&tz);
+  } while ((spent = timeval_usec(start, now)) < spin);
+
+  spent = to->tv_sec * 1000000L + to->tv_usec - spent;
+  if (spent < 0) spent = 0;
+  to->tv_sec  = spent / 1000000;
+  to->tv_usec = spent % 1000000;
+  return 0;
+}
+
+/*
+ * Wait for either descriptor (t may be -1) to become readable,
+ * returning 1 for s, 2 for t (or both), or 0 on timeout.
+ */
+int wait_readable (e, s, t, timo)
+LS_ENGINE *e; int s; int t; int timo;
+{
+  int nfound, maxfd, ready, was;
+  struct timeval to, now, until, *deadline;
+  fd_set readset,writeset;
+
+  to.tv_sec  = timo/1000;
+  to.tv_usec = (timo - (to.tv_sec*1000))*1000;
+
+  gettimeofday(&now,&tz);
+  timeradd(&now, &to, &until);
+
+  for (;;) {
+    /*
+     * Wake up early for any packet deadline that falls due
+     * during the wait, so losses are acted on immediately.
+     */
+    expire_probes(e);
+    gettimeofday(&now,&tz);
+    deadline = first_deadline(e);
+    if (deadline && timercmp(deadline, &until, <))
+      to = *deadline;
+    else
+      to = until;
+    if (timercmp(&to, &now, >))
+      timersub(&to, &now, &to);
+    else
+      timerclear(&to);
+
+    was = trace_phase(e->trace, e->cycle_phase == CYCLE_PAUSE ? TR_PAUSE : TR_WAIT);
+    if (e->busy_poll && (nfound = spin_readable(e, s, t, &to)) > 0) {
+      (void) trace_phase(e->trace, was);
+      return nfound;
+    }
+
+    FD_ZERO(&readset);
+    FD_ZERO(&writeset);
+    FD_SET(s,&readset);
+    if (t >= 0) FD_SET(t,&readset);
+    maxfd = probe_fds(e, &readset, s > t ? s : t);
+    nfound = select(maxfd+1,&readset,&writeset,NULL,&to);
+    (void) trace_phase(e->trace, was);
+    /* A signal (such as SIGUSR2) just means another time round */
+    if (nfound<0 && errno != EINTR) errno_crash_and_burn("send_ping: select");
+    if (nfound>0) {
+      /* TCP probes are dealt with here, then carry on waiting */
+      probe_fds_ready(e, &readset);
+      ready = (FD_ISSET(s,&readset) ? 1 : 0) | (t >= 0 && FD_ISSET(t,&readset) ? 2 : 0);
+      if (ready) return ready;
+    }
+
+    gettimeofday(&now,&tz);
+    if (!timercmp(&now, &until, <)) {
+      expire_probes(e);
+      return 0;  /* timeout */
+    }
+  }
+}
+
+/*
+ * Receive a packet, along with the time the kernel received it
+ * (cleared if it was not given).
+ */
+int recv_stamped (s, buf, len, flags, stamp)
+int s; char *buf; int len; int flags; struct timeval *stamp;
+{
+  struct msghdr msg;
+  struct iovec iov;
+  struct cmsghdr *cm;
+  struct timespec *ts;
+  char ctl[CMSG_SPACE(sizeof(struct timespec))];
+  int n;
+
+  iov.iov_base = buf;
+  iov.iov_len  = len;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov        = &iov;
+  msg.msg_iovlen     = 1;
+  msg.msg_control    = ctl;
+  msg.msg_controllen = sizeof(ctl);
+
+  timerclear(stamp);
+  if ((n = recvmsg(s, &msg, flags)) < 0) return n;
+
+  for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm))
+#ifdef SCM_TIMESTAMPNS
+    if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_TIMESTAMPNS) {
+      ts = (struct timespec *) CMSG_DATA(cm);
+      stamp->tv_sec  = ts->tv_sec;
+      stamp->tv_usec = ts->tv_nsec / 1000;
+    }
+#else
+    (void) ts;
+#endif
+  return n;
+}
+
+int recvfrom_wto (e, s,buf,len, stamp, timo)
+LS_ENGINE *e; int s; char *buf; int len; struct timeval *stamp; int timo;
+{
+  int n;
+
+  if (!wait_readable(e, s, -1, timo)) return -1;  /* timeout */
+
+  n=recv_stamped(s,buf,len,0,stamp);
+  if (n<0) errno_crash_and_burn("send_ping: recvfrom");
+  return n;
+}
+
+#ifdef X_WIP_ALLOW_STATUS_FILE
+
+int provide_status ()
+{
+  int fd;
+  char buf[30];
+
+  snprintf(buf, 30, "testCCCCCC\n");
+
+  if ((fd = open("/tmp/pipe", O_NONBLOCK | O_WRONLY)) == -1)
+    return -1;
+
+  /*
+     If here then the fifo exists and somebody is wanting
+     to read from it...  or it is a regular file, which we
+     should check for before running this, or use mkfifo
+     to create the requested status pipe.
+  */
+  if (write(fd, buf, strlen(buf)) < 1)
+    return -1;
+  close(fd);
+  return 0;
+}
+#else
+#define provide_status()        ((void)0)
+#endif
+
+#ifdef CHECK_MAC_ADDR
+
+char *get_ip_from_long(ipaddress)
+u_long ipaddress;
 {
     static char buf[20];
     int a,b,c,d;
@@ -637,498 +3623,2344 @@ u_long ipaddress;
     d = ipaddress;
     #endif
 
-    if ((a<257)&(b<257)&(c<257)&(d<257))
-      snprintf(buf, 20, "%d.%d.%d.%d",a,b,c,d);
-    else
-      snprintf(buf, 20, "Invalid Address");
+    if ((a<257)&(b<257)&(c<257)&(d<257))
+      snprintf(buf, 20, "%d.%d.%d.%d",a,b,c,d);
+    else
+      snprintf(buf, 20, "Invalid Address");
+
+    return buf;
+}
+
+char *get_mac(s, ipaddress)
+int s; u_long ipaddress;
+{
+  static struct arpreq ar;
+  struct sockaddr_in *sin;
+
+#ifdef linux
+  static char ifbuffer[sizeof(struct ifreq) * 64];
+  static struct ifconf ifc;
+  struct ifreq *ifr;
+  int offset;
+#endif
+
+  bzero((caddr_t)&ar, sizeof(ar));  /* ALT: memset(&ar, '\0', sizeof(ar)) */
+  ar.arp_pa.sa_family = AF_INET;
+  sin = (struct sockaddr_in *) &ar.arp_pa;
+  sin->sin_family = AF_INET;
+  sin->sin_addr.s_addr = ipaddress;
+  sin->sin_port = 0;
+
+#ifdef linux
+  /* Linux holds a different arp cache for each interface (must use ar.arp_dev) */
+
+  /*
+   * Get a list of interface names
+   */
+  ifc.ifc_len = (int) sizeof(ifbuffer);
+  ifc.ifc_buf = ifbuffer;
+  if (ioctl(s, SIOCGIFCONF, &ifc) < 0) {return NULL;}
+  if (ifc.ifc_len > (int) sizeof(ifbuffer)) {
+    printf("%s ERROR: Interface list too long - %d\n", curr_time(), ifc.ifc_len); (void) fflush(stdout);
+    return NULL;
+  }
+
+  /*
+   * Attempt an ARP lookup on each interface
+   */
+  offset = 0;
+  while (offset < ifc.ifc_len) {
+    ifr = (struct ifreq *) (ifbuffer + offset);
+    offset += sizeof(*ifr);
+
+    /* Skip loopback and aliased interfaces */
+    if (strncmp(ifr->ifr_name, "lo", 2) == 0) continue;
+    if (strchr(ifr->ifr_name, ':') != NULL)   continue;
+
+    /* Set up the device entry for the ARP lookup */
+    strncpy(ar.arp_dev, ifr->ifr_name, sizeof(ar.arp_dev) - 1);
+    ar.arp_dev[sizeof(ar.arp_dev) - 1] = '\0';
+
+    /* Query ARP table */
+    if (ioctl(s, SIOCGARP, &ar) >= 0) {
+      /* Skip non-ethernet interfaces? */
+      if (ar.arp_ha.sa_family != ARPHRD_ETHER) {
+        printf("%s ERROR: MAC found on non-ethernet interface, IP address=%s, Int=%s\n", curr_time(),get_ip_from_long(ipaddress), ar.arp_dev); (void) fflush(stdout);
+        continue;
+      }
+      break;
+    } else {
+      if (offset >= ifc.ifc_len) {
+        /* This was the last interface to try */
+        return NULL;
+      }
+    }
+  }
+#else
+  /* many systems keep a common arp cache */
+  if (ioctl(s, SIOCGARP, (caddr_t)&ar) < 0) {
+    /* no arp address was found... most likely this
+       is a system that is not on our subnet */
+    return NULL;
+  }
+#endif
+
+  /* Check the address is complete */
+  if (!(ar.arp_flags & ATF_COM)) {
+    printf("%s ERROR: Incomplete MAC address, IP address=%s\n", curr_time(),get_ip_from_long(ipaddress)); (void) fflush(stdout);
+    return NULL;
+  }
+
+  return ar.arp_ha.sa_data;
+}
+
+int check_mac (e, mac, ipaddress, n)
+LS_ENGINE *e; unsigned char *mac; u_long ipaddress; int n;
+{
+  if (e->table[n]->mac_addr == NULL) {
+    e->table[n]->mac_addr = (unsigned char*) malloc(14);
+    if (!e->table[n]->mac_addr) crash_and_burn("check_mac: can't malloc MAC address");
+    memcpy(e->table[n]->mac_addr,mac,14);
+    e->macs_checked++;
+  }
+
+  if (memcmp(mac, e->table[n]->mac_addr, 14) != 0) {
+    /* ODD... Big/Little Endian does not seem to be a problem here... */
+    printf("%s NIDS WARNING received a packet from %02x:%02x:%02x:%02x:%02x:%02x",curr_time(),mac[0],mac[1],mac[2],mac[3],mac[4],mac[5]);
+    printf(" rather than the expected %02x:%02x:%02x:%02x:%02x:%02x (%s)\n",e->table[n]->mac_addr[0],e->table[n]->mac_addr[1],e->table[n]->mac_addr[2],e->table[n]->mac_addr[3],e->table[n]->mac_addr[4],e->table[n]->mac_addr[5],get_ip_from_long(ipaddress));
+    memcpy(e->table[n]->mac_addr,mac,14);
+    if (e->table[n]->group->command) notify_command(e, e->table[n]->group->command, e->table[n]->host, "nids", "MAC address changed");
+    return 2;
+  }
+
+  return 0;
+}
+
+int check_arp (e, s, ipaddress, n)
+LS_ENGINE *e; int s; u_long ipaddress; int n;
+{
+  char *mac;
+
+  if ((mac=get_mac(s, ipaddress)) == NULL) {
+    return 0;
+  }
+
+  return check_mac(e, (unsigned char *) mac, ipaddress, n);
+}
+
+#else
+#define check_mac(e, mac, ipaddress, index)   ((void)0)
+#define check_arp(e, s, ipaddress, index)     ((void)0)
+#endif
+
+char *get_host_by_address(in)
+struct in_addr in;
+{
+  struct hostent *h;
+
+  h=gethostbyaddr((char *) &in,sizeof(struct in_addr),AF_INET);
+  if (h==NULL || h->h_name==NULL) return inet_ntoa(in);
+  else return h->h_name;
+}
+
+/*
+ * An ICMP error (destination unreachable) that may be for one of our
+ * probes.  It holds the IP header of the probe and at least the start
+ * of its ICMP header, so it is ours if that is an echo request with
+ * our ident, and the host is found by the address it was sent to.
+ * It is only taken as the answer to the probe out now if it carries
+ * that host's sequence (as build_ping set it) and the host is waiting
+ * on an echo reply; anything else is late, or forged, and passed over.
+ * Errors that say the host is there (port or protocol unreachable)
+ * or are nothing to do with reaching it are passed over too.
+ */
+int icmp_error(e, icp, len, from)
+LS_ENGINE *e; struct icmp *icp; int len; struct in_addr from;
+{
+  struct ip *orig;
+  struct icmp *probe;
+  HOST_ENTRY *h;
+  int hlen;
+
+  switch (icp->icmp_code) {
+    case ICMP_UNREACH_PROTOCOL:
+    case ICMP_UNREACH_PORT:
+    case ICMP_UNREACH_NEEDFRAG:
+    case ICMP_UNREACH_SRCFAIL:
+      return 1;
+  }
+  if (len < ICMP_MINLEN + (int) sizeof(struct ip)) return 1;  /* too short */
+  orig = &icp->icmp_ip;
+  hlen = orig->ip_hl << 2;
+  if (hlen < (int) sizeof(struct ip) || len < ICMP_MINLEN + hlen + ICMP_MINLEN) return 1;
+  if (orig->ip_p != IPPROTO_ICMP) return 1;
+
+  probe = (struct icmp *) ((unsigned char *) orig + hlen);
+  if (probe->icmp_type != ICMP_ECHO || probe->icmp_id != e->ident) return 1;
+  if ((h = find_host_by_addr(e, orig->ip_dst.s_addr)) == NULL) return 1;
+  if (probe->icmp_seq != (h->i & 0xFFFF) || !h->outstanding || h->probe != PROBE_ICMP) return 1;
+
+  gettimeofday(&e->current_time,&tz);
+  return host_refused(e, h->i, icp->icmp_code, from);
+}
+
+/*
+ * Handle one received packet (from its IP header).  The source MAC
+ * address and receive timestamp are given when the packet came
+ * through the packet ring, otherwise they are NULL.
+ */
+int process_reply(e, buffer, result, mac, stamp)
+LS_ENGINE *e; unsigned char *buffer; int result; unsigned char *mac; struct timeval *stamp;
+{
+  struct ip *ip;
+  int hlen;
+  struct icmp *icp;
+  PROBE_DATA data;
+  long rtt;
+  int n;
+
+  /* How long did it take us to get to the packet */
+  if (stamp) {
+    gettimeofday(&e->current_time,&tz);
+    rtt = timeval_usec(*stamp, e->current_time);
+    if (rtt >= 0 && rtt < 60 * 1000000L) {
+      e->wake_count++;
+      e->wake_total += rtt;
+      if (rtt > e->wake_max) e->wake_max = rtt;
+    }
+  }
+
+  ip = (struct ip *) buffer;
+  if (result < (int) sizeof(struct ip)) { return(1); /* too short */ }
+  hlen = ip->ip_hl << 2;
+  if (result < hlen+ICMP_MINLEN) { return(1); /* too short */ }
+
+  icp = (struct icmp *)(buffer + hlen);
+
+  /* Routers telling us a probe can't get through */
+  if (icp->icmp_type == ICMP_UNREACH)
+    return icmp_error(e, icp, result - hlen, ip->ip_src);
+  
+  if (
+      ( icp->icmp_type != ICMP_ECHOREPLY ) ||
+      ( icp->icmp_id   != e->ident          )
+      ) {
+    /*
+     * This will happen if we use the host that is running
+     * linkstat to ping other hosts on the network.
+     */
+    /*printf("%s Hmm... Not one of our packets (src=%s)\n", curr_time(), get_host_by_address(ip->ip_src)); (void) fflush(stdout);*/
+    return 1; /* packet received, but not the one we are looking for! */
+  }
+
+  /*
+   * Get the index into our table, preferably from the packet
+   * data as that holds all of it.
+   */
+  n=icp->icmp_seq;
+  if (result >= hlen + ICMP_MINLEN + (int) sizeof(data)) {
+    memcpy(&data, icp->icmp_data, sizeof(data));
+    if ((data.i & 0xFFFF) == n) n = data.i;
+    else timerclear(&data.sent);
+  } else
+    timerclear(&data.sent);
+  
+  /*
+   * Better check that the index is within the boundaries
+   */
+  if ((n < 0) || (n >= e->num_hosts)) {
+    printf("%s ERROR: Invalid packet, index=%d (src=%s)\n", curr_time(),n,get_host_by_address(ip->ip_src)); (void) fflush(stdout);
+    return 1; /* Corruption */
+  }
+
+  /*
+   * Check that the Source IP Address is as we expect it, this
+   * pretty much ensures that this is a packet sent by this
+   * process... and not by something else running on this box.
+   */
+  if (e->table[n]->saddr.sin_addr.s_addr != ip->ip_src.s_addr) {
+    printf("%s ERROR: Invalid packet, index=%d, src=%s (exp=%s)\n", curr_time(),n,get_host_by_address(ip->ip_src),get_host_by_address(e->table[n]->saddr.sin_addr)); (void) fflush(stdout);
+    return 1; /* Corruption */
+  }
+
+  if (e->check_hw) {
+    /*
+     * Check that the Hardware address of the source is as expected.
+     * This is a simple attempt at finding duplicate addresses, as
+     * well as checking for arp address poisoning (used with man-in-
+     * the-middle attacks).  The packet ring hands us the address
+     * with the packet, otherwise it is looked up in the ARP cache.
+     */
+    if (mac)
+      check_mac(e, mac, ip->ip_src.s_addr, n);
+    else
+      check_arp(e, e->sock, ip->ip_src.s_addr, n);
+  }
+
+  /*
+   * Time the reply using the transmit time echoed back in the data,
+   * and feed it into the retransmission timeout for the host.
+   */
+  gettimeofday(&e->current_time,&tz);
+  if (e->capture) capture_reply(e->capture, stamp ? stamp : &e->current_time, buffer, result);
+  rtt = -1;
+  if (timerisset(&data.sent))
+    rtt = timeval_usec(data.sent, stamp ? *stamp : e->current_time);
+  return host_answered(e, n, rtt);
+}
+
+static void
+packet_reply(arg, pkt, len, mac, stamp)
+void *arg; unsigned char *pkt; int len; unsigned char *mac; struct timeval *stamp;
+{
+  (void) process_reply((LS_ENGINE *) arg, pkt, len, mac, stamp);
+}
+
+/*
+ * Wait for a reply when replaying a capture.  Rather than sleep, the
+ * clock jumps straight to the next reply, deadline or the end of the
+ * wait, so a day of probes goes by in seconds.
+ */
+int replay_wait(e, wait_time)
+LS_ENGINE *e; int wait_time;
+{
+  static unsigned char buffer[128];
+  struct timeval now, until, to, stamp, *deadline;
+  int len;
+
+  gettimeofday(&now,&tz);
+  to.tv_sec  = wait_time/1000;
+  to.tv_usec = (wait_time - (to.tv_sec*1000))*1000;
+  timeradd(&now, &to, &until);
+
+  for (;;) {
+    expire_probes(e);
+    gettimeofday(&now,&tz);
+    deadline = first_deadline(e);
+    if (deadline && timercmp(deadline, &now, >) && timercmp(deadline, &until, <))
+      to = *deadline;
+    else
+      to = until;
+
+    if ((len = replay_next(e->replaying, &to, buffer, &stamp)) > 0) {
+      replay_advance(e->replaying, &stamp);
+      return process_reply(e, buffer, len, NULL, NULL);
+    }
+    replay_advance(e->replaying, &to);
+    if (!timercmp(&to, &until, <)) {
+      expire_probes(e);
+      return 0;  /* timeout */
+    }
+  }
+}
+
+int wait_for_reply(e, s, wait_time)
+LS_ENGINE *e; int s, wait_time;
+{
+  int result, ready;
+  static char buffer[4096];
+  struct timeval stamp;
+
+  /* Everything in here but the waiting (and the sweep) is taking replies */
+  (void) trace_phase(e->trace, TR_REPLY);
+  if (e->replaying) return replay_wait(e, wait_time);
+
+  if (e->ring) {
+    /*
+     * Everything already in the ring is handled in one go, and
+     * only if it is empty do we wait for the next block.
+     */
+    if ((result = ring_read(e->ring, packet_reply, e)) > 0) return result;
+    if (!wait_readable(e, ring_fd(e->ring), -1, wait_time)) return 0; /* timeout */
+    (void) ring_read(e->ring, packet_reply, e);
+    return 1;
+  }
+
+  if (e->xdp) {
+    /*
+     * Our replies are redirected to the XDP port, but any that
+     * arrive on other receive queues still reach the socket.
+     */
+    if ((result = xdp_read(e->xdp, packet_reply, e)) > 0) return result;
+    if (!(ready = wait_readable(e, xdp_fd(e->xdp), s, wait_time))) return 0; /* timeout */
+    if (ready & 1) (void) xdp_read(e->xdp, packet_reply, e);
+    if (ready & 2) {
+      result = recv_stamped(s, buffer, 4096, MSG_DONTWAIT, &stamp);
+      if (result > 0)
+        (void) process_reply(e, (unsigned char *) buffer, result, NULL,
+                             timerisset(&stamp) ? &stamp : NULL);
+    }
+    return 1;
+  }
+
+  result=recvfrom_wto(e, s,buffer,4096,&stamp,wait_time);
+
+  if (result<0) { return 0; } /* timeout */
+
+  return process_reply(e, (unsigned char *) buffer, result, NULL,
+                       timerisset(&stamp) ? &stamp : NULL);
+}
+
+#if defined(linux) && defined(SO_TXTIME)
+
+/*
+ * Probes paced by the kernel.  Each one is stamped with the time it is
+ * to leave (on the clock of the qdisc), and they are handed over a
+ * batch at a time.
+ */
+int txtime_setup(e, s)
+LS_ENGINE *e; int s;
+{
+  struct sock_txtime cfg;
+
+  if (strcmp(e->txtime, "fq") == 0)
+    e->txtime_clock = CLOCK_MONOTONIC;
+  else if (strcmp(e->txtime, "etf") == 0)
+    e->txtime_clock = CLOCK_TAI;
+  else
+    return -1;
+
+  cfg.clockid = e->txtime_clock;
+  cfg.flags   = 0;
+  if (setsockopt(s, SOL_SOCKET, SO_TXTIME, &cfg, sizeof(cfg)) < 0 ||
+      (e->pace = (PACE *) calloc(1, sizeof(PACE))) == NULL) {
+    e->txtime_clock = -1;
+    return -1;
+  }
+  return 0;
+}
+
+void flush_pings(e, s)
+LS_ENGINE *e; int s;
+{
+  PACE *p = e->pace;
+  int sent = 0, n;
+
+  while (sent < p->queued) {
+    n = sendmmsg(s, p->msg + sent, p->queued - sent, 0);
+    if (n < 0) {
+      /* As send_ping, allow the occasional glitch */
+      if (e->flush_glitch++) errno_crash_and_burn("flush_pings: sendmmsg");
+
+      fprintf(stderr,"%s Glitch? : flush_pings: sendmmsg - %s\n",curr_time(),strerror(errno));
+      sleep(1);
+      break;
+    }
+    e->flush_glitch = 0;
+    sent += n;
+  }
+  p->queued = 0;
+}
+
+void pace_begin(e)
+LS_ENGINE *e;
+{
+  PACE *p = e->pace;
+  struct timespec ts;
+
+  clock_gettime(e->txtime_clock, &ts);
+  gettimeofday(&p->start, &tz);
+  p->clock  = (__u64) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+  p->offset = TXTIME_LEAD;
+}
+
+void queue_ping(e, s, h)
+LS_ENGINE *e; int s; HOST_ENTRY *h;
+{
+  PACE *p = e->pace;
+  struct timeval when, offset;
+  struct cmsghdr *cm;
+  struct msghdr *msg;
+
+  offset.tv_sec  = p->offset / 1000000;
+  offset.tv_usec = p->offset % 1000000;
+  timeradd(&p->start, &offset, &when);
+  build_ping(e, h, p->pkt[p->queued], &when);
+  if (e->capture) capture_probe(e->capture, &when, h->saddr.sin_addr, (unsigned char *) p->pkt[p->queued], 32);
+
+  p->iov[p->queued].iov_base = p->pkt[p->queued];
+  p->iov[p->queued].iov_len  = 32;
+
+  msg = &p->msg[p->queued].msg_hdr;
+  memset(msg, 0, sizeof(*msg));
+  msg->msg_name       = &h->saddr;
+  msg->msg_namelen    = sizeof(struct sockaddr_in);
+  msg->msg_iov        = &p->iov[p->queued];
+  msg->msg_iovlen     = 1;
+  msg->msg_control    = p->ctl[p->queued];
+  msg->msg_controllen = sizeof(p->ctl[p->queued]);
+
+  cm = CMSG_FIRSTHDR(msg);
+  cm->cmsg_level = SOL_SOCKET;
+  cm->cmsg_type  = SCM_TXTIME;
+  cm->cmsg_len   = CMSG_LEN(sizeof(__u64));
+  *(__u64 *) CMSG_DATA(cm) = p->clock + p->offset * 1000ULL;
+
+  p->offset += e->interval * 1000L;
+  if (++p->queued == TXTIME_BATCH) flush_pings(e, s);
+}
+
+/*
+ * Hand over what is left of the cycle, then deal with replies
+ * until the last probe is due to have left.
+ */
+void pace_end(e, s)
+LS_ENGINE *e; int s;
+{
+  PACE *p = e->pace;
+  struct timeval now, offset, until;
+  long left;
+
+  flush_pings(e, s);
+
+  offset.tv_sec  = p->offset / 1000000;
+  offset.tv_usec = p->offset % 1000000;
+  timeradd(&p->start, &offset, &until);
+  for (;;) {
+    gettimeofday(&now,&tz);
+    if ((left = timeval_usec(now, until)) <= 0) break;
+    (void) wait_for_reply(e, s, (int) ((left + 999) / 1000));
+  }
+}
+
+#else
+#define txtime_setup(e, s)    (-1)
+#define pace_begin(e)         ((void)0)
+#define queue_ping(e, s, h)   send_ping(e, s, h)
+#define pace_end(e, s)        ((void)0)
+#endif
+
+/*
+ * Work out how often the lower priority classes are to be probed,
+ * from how long the probes of the last cycle took (msecs, up to the
+ * pause at the end), how many were sent and how many of each class
+ * were due.  Hosts of class 1 are always probed, those of class c
+ * every (c-1) x shed_factor cycles, and the factor is the smallest
+ * that would fit the probes into the planned cycle at their smoothed
+ * cost.  It only comes down with some room to spare.
+ */
+void shed_load(e, took, sent, due)
+LS_ENGINE *e; long took; int sent; int *due;
+{
+  long plan = e->cycle_plan - e->timeout, need = 0;
+  int f, was = e->shed_factor;
+
+  if (sent > 0 && took >= 0)
+    e->shed_cost = e->shed_cost ? (7 * e->shed_cost + took * 1000 / sent) / 8 : took * 1000 / sent;
+  if (!e->shed_cost) return;
+
+  for (f = 1; f < MAX_SHED; f++) {
+    need = e->shed_cost * (due[1] + (due[2] + f - 1) / f + (due[3] + 2*f - 1) / (2*f)) / 1000;
+    if (need <= (f < e->shed_factor ? plan * 7 / 8 : plan)) break;
+  }
+  e->shed_factor = f;
+
+  if (e->shed_factor == was) return;
+  trace_event(e->trace, TR_SHED, e->shed_factor, took);
+  if (e->shed_factor == 1)
+    printf("%s Cycle back within %dms, probing all classes every cycle\n", curr_time(), e->cycle_plan);
+  else
+    printf("%s Cycle %s (%ldms of probes, planned %ldms), probing class 2 every %d cycles, class 3 every %d\n", curr_time(), (e->shed_factor > was ? "overrun" : "easing"), took, plan, e->shed_factor, 2 * e->shed_factor);
+  (void) fflush(stdout);
+}
+
+void
+usage(val)
+int val;
+{
+  printf("usage: linkstat [-help] [-mac_check] [-log <log_file>] [-timeout <delay>]\n");
+  printf("                [-interval <delay>] [-retry <num>] [-update <delay>]\n");
+  printf("                [-rto_min <delay>] [-confirm_rate <num>]\n");
+  printf("                [-subnet <bits>] [-dep_interval <delay>] [-prefix <bits>]\n");
+  printf("                [-ring <interface>] [-xdp <interface>] [-txtime <qdisc>]\n");
+  printf("                [-busy_poll <usecs>] [-cpu <num>] [-arp <interface>]\n");
+  printf("                [-history <dir>] [-query <host>[:days]]\n");
+  printf("                [-control <socket>] [-stream <socket>] [-cycle <delay>]\n");
+  printf("                [-detect <secs>] [-compile <file> -output <image>]\n");
+  printf("                [-cluster <node>@<host>:<port>] [-aggregate [<addr>:]<port>]\n");
+  printf("                [-key <file>]\n");
+  printf("                [-capture <pcap>] [-replay <pcap>]\n");
+  printf("                [-notify <command>] [-file file | hosts...]\n");
+  exit (val);
+}
+
+/*
+ * The value of a numeric option, which must be a number and nothing
+ * else (so "-p eth0" is not taken as -prefix 0), or usage(val).
+ */
+long
+num_arg(arg, val)
+char *arg; int val;
+{
+  char *end;
+  long n;
+
+  errno = 0;
+  n = strtol(arg, &end, 10);
+  if (end == arg || *end || errno) usage(val);
+  return n;
+}
+
+/*
+ * This was replaced with a different system for monitoring the time
+ *
+void
+alarmtout()
+{
+  signal(SIGALRM,(void *)alarmtout);
+  longjmp(Sjbuf,1);
+}
+*/
+
+static int
+by_index(a, b)
+const void *a, *b;
+{
+  return (*(HOST_ENTRY **) a)->i - (*(HOST_ENTRY **) b)->i;
+}
+
+/*
+ * Report the rolling SLA windows (1h, 24h, 7d, 30d) of every host that
+ * has been down, then of the hosts as a whole (those of group g only,
+ * unless it is NULL).  Each figure is kept up to date as hosts go up
+ * and down, so this is quick enough to do at any time (see SIGUSR2).
+ */
+void
+display_windows(e, g)
+LS_ENGINE *e; GROUP_ENTRY *g;
+{
+  static char line[512];
+  static SLA_ROLLUP clean;  /* a host that has never been down */
+  long down, period, total_down[SLA_WINDOWS], total_period[SLA_WINDOWS];
+  time_t now = time(NULL), down_since;
+  int i, j, w, count, len, hosts = g ? g->num_hosts - g->num_other : e->num_hosts - e->num_released, been_down = 0;
+
+  /* only the hosts still probed here */
+  for (j=0; j<e->num_outages; j++)
+    if ((!g || e->outage_list[j]->group == g) && !e->outage_list[j]->removed && e->outage_list[j]->slice != SLICE_OTHER)
+      been_down++;
+  if (g)
+    printf("%s SLA_WIN Rolling windows for %s, %d host%s (%d have been down)\n", curr_time(), g->name, hosts, (hosts == 1 ? "" : "s"), been_down);
+  else
+    printf("%s SLA_WIN Rolling windows for %d host%s (%d have been down)\n", curr_time(), hosts, (hosts == 1 ? "" : "s"), been_down);
+
+  for (w = 0; w < SLA_WINDOWS; w++) {
+    /* hosts never down have a clean sheet over the whole window */
+    (void) sla_get(&clean, w, now, e->start_time, 0, &period, &count);
+    total_down[w]   = 0;
+    total_period[w] = period * hosts;
+  }
+
+  qsort(e->outage_list, e->num_outages, sizeof(HOST_ENTRY *), by_index);
+  for (j=0; j<e->num_outages; j++) {
+    i = e->outage_list[j]->i;
+    if (!e->table[i]->sla || e->table[i]->removed || e->table[i]->slice == SLICE_OTHER || (g && e->table[i]->group != g)) continue;
+    down_since = 0;
+    if (!e->table[i]->alive)
+      down_since = e->table[i]->last_time.tv_sec ? e->table[i]->last_time.tv_sec : e->start_time;
+
+    len = snprintf(line, sizeof(line), "%s SLA_WIN %s", curr_time(), e->table[i]->host);
+    for (w = 0; w < SLA_WINDOWS; w++) {
+      down = sla_get(e->table[i]->sla, w, now, e->start_time, down_since, &period, &count);
+      total_down[w] += down;
+      if (len < (int) sizeof(line))
+        len += snprintf(line + len, sizeof(line) - len, " %s %ld/%d %01.4f", sla_name(w), down, count, period ? (double)(down * 100) / (double)period : 0.0);
+    }
+    printf("%s\n", line);
+  }
+
+  len = snprintf(line, sizeof(line), "%s SLA_WIN all", curr_time());
+  for (w = 0; w < SLA_WINDOWS; w++)
+    if (len < (int) sizeof(line))
+      len += snprintf(line + len, sizeof(line) - len, " %s %ld %01.4f", sla_name(w), total_down[w], total_period[w] ? (double)(total_down[w] * 100) / (double)total_period[w] : 0.0);
+  printf("%s\n", line);
+  (void) fflush(stdout);
+}
+
+void
+display_report(e, g)
+LS_ENGINE *e; GROUP_ENTRY *g;
+{
+  /* Report statistics (of group g only, unless it is NULL) */
+  long int period, offset;
+  int i, j, count_offset;
+  ROLLUP_ENTRY *r;
+
+  period = time(NULL) - e->start_time;
+
+  if (g)
+    printf("%s SLA_REP Reporting Output for %s (period %lds)\n",curr_time(), g->name, period);
+  else
+    printf("%s SLA_REP Reporting Output (period %lds)\n",curr_time(), period);
+
+  /*
+   * Only hosts that have been unreachable at some point have any
+   * downtime to report, and they are all in the outage list.
+   */
+  qsort(e->outage_list, e->num_outages, sizeof(HOST_ENTRY *), by_index);
+#ifdef WC_MOD
+  for (i=0; i<e->num_hosts; i++) {
+#else
+  for (j=0; j<e->num_outages; j++) {
+    i = e->outage_list[j]->i;
+#endif
+    if (g && e->table[i]->group != g) continue;
+    offset = 0;
+    count_offset = 0;
+
+/* Removed as MetaFrame application servers are better :) */
+#ifdef WC_MOD
+    /* WC_MOD: This is a mod to correct Citrix server downtime
+     *         It is a little out of the scope of this utility
+     *         but never the less there was a need for it  :)
+     */
+    if (((e->table[i]->host)[1] == 'i') || ((e->table[i]->host)[1] == 'M')) {
+      struct stat buf;
+      char msg[255];
+      /* This might be a Citrix server that had hung services */
+      snprintf(msg, 255, "/opt/LinkStat/log/status/%s", e->table[i]->host);
+      if (!stat(msg, &buf)) {
+	/* Check to see that status file was created before system
+	   network connectivity ceased. */
+	if (buf.st_mtime < e->table[i]->last_time.tv_sec) {
+	  e->table[i]->last_time.tv_sec  = buf.st_mtime;
+	  e->table[i]->last_time.tv_usec = 0;
+	}
+	if (e->table[i]->alive) {
+	  /* Host is still responding to pings, so must fudge the stats */
+          /* The conditional following this one will handle the case
+           * where the host is currently down */
+	  offset = e->start_time + period - e->table[i]->last_time.tv_sec;
+          count_offset = 1;
+        }
+      }
+    }
+#endif
+
+    if (!e->table[i]->alive) {
+      /* Host is currently down, so need to update stats */
+      if (e->table[i]->last_time.tv_sec)
+	offset = e->start_time + period - e->table[i]->last_time.tv_sec;
+      else
+	offset = period;
+    }
+
+    if (e->table[i]->downtime + offset > period) {
+      /*
+       * Something is wrong here... This is usually the result
+       * of an old Citrix status file left lying around.  The
+       * downtime is held to the period, as the SLA windows are,
+       * and the details only given when debugging.
+       */
+      if (e->debug) {
+        printf("%s DBUG3 %ld %ld\n", curr_time(), period, e->table[i]->downtime + offset);
+        printf("  Host: %s\n", e->table[i]->host);
+        printf("    response: %d\n", e->table[i]->response);
+        printf("    alive:    %d\n", e->table[i]->alive);
+        printf("    index:    %d\n", e->table[i]->i);
+        printf("    first_tm: %s", ctime(&(e->table[i]->first_time.tv_sec)));
+        printf("    last_tm : %s", ctime(&(e->table[i]->last_time.tv_sec)));
+        printf("    downtime: %ld\n", e->table[i]->downtime);
+        printf("    count   : %d\n", e->table[i]->downtime_cnt);
+      }
+      offset = period - e->table[i]->downtime;
+    }
+
+    if (e->table[i]->downtime_cnt + count_offset > 0)
+      printf("%s SLA_REP %s down(sec) %ld count %d percentage %01.4f\n",curr_time(), e->table[i]->host,e->table[i]->downtime + offset, e->table[i]->downtime_cnt + count_offset, (double)((e->table[i]->downtime + offset) * 100) / (double)period);
+
+    (void) fflush(stdout);
+  }
+
+  /* and the same for the rollups, over their hosts taken together */
+  for (j=0; j<e->num_rollups; j++) {
+    r = e->rollups[j];
+    if (g && r->group != g) continue;
+    rollup_tick(r, e->start_time + period);
+    if (r->downtime && rollup_hosts(r))
+      printf("%s SLA_AGG %s hosts %d down(host-sec) %ld percentage %01.4f\n",curr_time(), r->name, rollup_hosts(r), r->downtime, (double)(r->downtime * 100) / ((double)period * rollup_hosts(r)));
+  }
+  (void) fflush(stdout);
+
+  display_windows(e, g);
+}
+
+/*
+ * Print a history record (for -query)
+ */
+void
+history_print(arg, rec)
+void *arg; HIST_RECORD *rec;
+{
+  static char buf[25];
+  time_t when = (time_t) (rec->when / 1000);
+  struct tm *the_time = localtime(&when);
+
+  (void) arg;
+  if (!the_time || strftime(buf, 25, "%a %h %e %H:%M:%S %Y", the_time) == 0)
+    strcpy(buf, "n/a");
 
-    return buf;
+  switch (rec->type) {
+    case HIST_UP:
+      printf("%s %s is alive\n", buf, inet_ntoa(rec->addr));
+      break;
+    case HIST_DOWN:
+      printf("%s %s is unreachable\n", buf, inet_ntoa(rec->addr));
+      break;
+    case HIST_SUMMARY:
+      printf("%s %s sent %lu lost %lu rtt(us) avg %lu max %lu\n", buf, inet_ntoa(rec->addr), rec->sent, rec->sent - (rec->recv < rec->sent ? rec->recv : rec->sent), rec->rtt_avg, rec->rtt_max);
+      break;
+  }
 }
 
-char *get_mac(s, ipaddress)
-int s; u_long ipaddress;
+/*
+ * Report the history of a host (or "all" of them) over the last day,
+ * or the number of days given after a ":".
+ */
+void
+history_report(e, what)
+LS_ENGINE *e; char *what;
 {
-  static struct arpreq ar;
-  struct sockaddr_in *sin;
+  struct in_addr addr;
+  struct hostent *hp;
+  char *p;
+  time_t now = time(NULL);
+  int days = 1, found;
+
+  if ((p = strchr(what, ':')) != NULL) {
+    *p++ = '\0';
+    if ((days = atoi(p)) < 1) days = 1;
+  }
 
-#ifdef linux
-  static char ifbuffer[sizeof(struct ifreq) * 64];
-  static struct ifconf ifc;
-  struct ifreq *ifr;
-  int offset;
+  if (strcmp(what, "all") == 0)
+    addr.s_addr = INADDR_ANY;
+  else if (!inet_aton(what, &addr)) {
+    if ((hp = gethostbyname(what)) == NULL) {
+      printf("%s ERROR: Unknown host %s\n", curr_time(), what);
+      exit(1);
+    }
+    memcpy(&addr, hp->h_addr, sizeof(addr));
+  }
+
+  found = hist_query(e->hist_dir, addr, now - (time_t) days * 86400, now + 1, history_print, NULL);
+  printf("%s %d history record%s for %s over %d day%s\n", curr_time(), found, (found == 1 ? "" : "s"), what, days, (days == 1 ? "" : "s"));
+}
+
+void
+parse_host_options (str, opts)
+     char *str;
+     HOST_OPTS *opts;
+{
+  char *tok, *val;
+  int port;
+
+  /* Only a bracketed list is options, anything else is a comment */
+  while (*str == ' ' || *str == '\t') str++;
+  if (*str++ != '(') return;
+  if ((tok = strchr(str, ')')) != NULL) *tok = '\0';
+
+  for (tok = strtok(str, ", \t\n"); tok; tok = strtok(NULL, ", \t\n")) {
+    if ((val = strchr(tok, '=')) == NULL) continue;
+    *val++ = '\0';
+
+    if (strcmp(tok, "int") == 0) {
+      if ((opts->schedule = atoi(val)) < 0) opts->schedule = 0;
+    } else if (strcmp(tok, "ret") == 0) {
+      if (atoi(val) >= 1) opts->retry = atoi(val);  /* else the group's */
+    } else if (strcmp(tok, "mon") == 0) {
+      if (sscanf(val, "%hd:%hd", &opts->from, &opts->until) != 2)
+        opts->from = opts->until = 0;
+    } else if (strcmp(tok, "dep") == 0) {
+      strncpy(opts->dep, val, sizeof(opts->dep) - 1);
+      opts->dep[sizeof(opts->dep) - 1] = '\0';
+    } else if (strcmp(tok, "pri") == 0) {
+      if ((opts->pri = atoi(val)) < 1 || opts->pri > PRI_CLASSES) {
+        printf("\nInvalid priority class: %s\n", val);
+        opts->pri = DEFAULT_PRI;
+      }
+    } else if (strcmp(tok, "probe") == 0) {
+      port = 0;
+      if (strcmp(val, "icmp") == 0)
+        opts->probe = PROBE_ICMP;
+      else if (sscanf(val, "tcp:%d", &port) == 1 && port > 0 && port < 65536)
+        opts->probe = PROBE_TCP;
+      else if (sscanf(val, "syn:%d", &port) == 1 && port > 0 && port < 65536)
+        opts->probe = PROBE_SYN;
+      else
+        printf("\nInvalid probe type: %s\n", val);
+      opts->port = port;
+    } else
+      printf("\nUnknown host option: %s=%s\n", tok, val);
+  }
+}
+
+#if defined(linux) && defined(TCP_PROBES)
+
+/*
+ * Set up for the TCP probes: an epoll set for the connects (which
+ * can number in the thousands, so the descriptor limit is raised
+ * as far as it goes) and a raw socket for the SYNs, filtered down
+ * to the answers to them.  The SYNs' source port is one the kernel
+ * gives a TCP socket, held bound (and not listening) so it is not
+ * given to anyone else, and the SYN-ACKs to it are still reset.
+ * Either is only set up the once, so this can be called again as
+ * hosts are added.
+ */
+void tcp_setup(e)
+LS_ENGINE *e;
+{
+  struct rlimit rl;
+  struct sock_fprog prog;
+  struct sockaddr_in local;
+  socklen_t len;
+  struct sock_filter filter[] = {
+    BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 0),                  /* IP hlen */
+    BPF_STMT(BPF_LD  | BPF_H | BPF_IND, 2),                  /* dest port */
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0, 0, 1),
+    BPF_STMT(BPF_RET | BPF_K, 0xffff),
+    BPF_STMT(BPF_RET | BPF_K, 0),
+  };
+
+  if (e->num_tcp && e->conn_poll < 0) {
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+      rl.rlim_cur = rl.rlim_max;
+      (void) setrlimit(RLIMIT_NOFILE, &rl);
+    }
+    if ((e->conn_poll = epoll_create1(0)) < 0)
+      errno_crash_and_burn("tcp_setup: epoll_create");
+    printf("%s Probing %d host%s with TCP connects\n", curr_time(), e->num_tcp, (e->num_tcp == 1 ? "" : "s"));
+  }
+
+  if (e->num_syn && e->syn_sock < 0) {
+    if ((e->syn_sock = socket(AF_INET, SOCK_RAW, IPPROTO_TCP)) < 0)
+      errno_crash_and_burn("tcp_setup: socket");
+    memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    len = sizeof(local);
+    if ((e->syn_hold = socket(AF_INET, SOCK_STREAM, 0)) < 0 ||
+        bind(e->syn_hold, (struct sockaddr *) &local, sizeof(local)) < 0 ||
+        getsockname(e->syn_hold, (struct sockaddr *) &local, &len) < 0)
+      errno_crash_and_burn("tcp_setup: can't reserve a port");
+    e->syn_port   = ntohs(local.sin_port);
+    e->syn_secret = ((unsigned int) e->ident << 16) ^ (unsigned int) time(NULL);
+
+    filter[2].k = e->syn_port;
+    prog.len    = sizeof(filter) / sizeof(filter[0]);
+    prog.filter = filter;
+    (void) setsockopt(e->syn_sock, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog));
+    printf("%s Probing %d host%s with TCP SYNs (port %d)\n", curr_time(), e->num_syn, (e->num_syn == 1 ? "" : "s"), e->syn_port);
+  }
+}
+
+#else
+#define tcp_setup(e)    ((void)0)
 #endif
 
-  bzero((caddr_t)&ar, sizeof(ar));  /* ALT: memset(&ar, '\0', sizeof(ar)) */
-  ar.arp_pa.sa_family = AF_INET;
-  sin = (struct sockaddr_in *) &ar.arp_pa;
-  sin->sin_family = AF_INET;
-  sin->sin_addr.s_addr = ipaddress;
-  sin->sin_port = 0;
+/*
+ * Find a group of hosts by name, starting a new one (with the policy
+ * given on the command line) if there is none.
+ */
+GROUP_ENTRY *
+find_group(e, name)
+LS_ENGINE *e; char *name;
+{
+  GROUP_ENTRY *g;
+  int i;
+
+  for (i=0; i<e->num_groups; i++)
+    if (strcmp(e->groups[i]->name, name) == 0) return e->groups[i];
+
+  e->groups = (GROUP_ENTRY **) realloc(e->groups, (e->num_groups+1) * sizeof(GROUP_ENTRY *));
+  g = (GROUP_ENTRY *) calloc(1, sizeof(GROUP_ENTRY));
+  if (!e->groups || !g) crash_and_burn("find_group: can't allocate GROUP_ENTRY");
+  g->name    = strdup(name);
+  g->timeout = e->timeout;
+  g->retry   = e->retry;
+  g->command = e->command;
+  g->report  = -1;
+  e->groups[e->num_groups++] = g;
+  return g;
+}
+
+void
+parse_group_options (str, g)
+     char *str;
+     GROUP_ENTRY *g;
+{
+  char *tok, *val;
+  int n;
+
+  /* The same bracketed list as the options of a host */
+  while (*str == ' ' || *str == '\t') str++;
+  if (*str++ != '(') return;
+  if ((tok = strchr(str, ')')) != NULL) *tok = '\0';
+
+  for (tok = strtok(str, ", \t\n"); tok; tok = strtok(NULL, ", \t\n")) {
+    if ((val = strchr(tok, '=')) == NULL) continue;
+    *val++ = '\0';
+
+    if (strcmp(tok, "timeout") == 0) {
+      if ((g->timeout = atoi(val)) < MIN_TIMEOUT) g->timeout = MIN_TIMEOUT;
+    } else if (strcmp(tok, "retry") == 0) {
+      if ((n = atoi(val)) >= 1) g->retry = n;
+    } else if (strcmp(tok, "notify") == 0) {
+      g->command = strcmp(val, "none") ? strdup(val) : NULL;
+    } else if (strcmp(tok, "report") == 0) {
+      n = atoi(val);
+      if (n >= 0 && n < 2400 && n % 100 < 60)
+        g->report = n;
+      else
+        printf("\nInvalid report time: %s\n", val);
+    } else
+      printf("\nUnknown group option: %s=%s\n", tok, val);
+  }
+}
+
+static void
+set_probe(e, h, opts)
+LS_ENGINE *e; HOST_ENTRY *h; HOST_OPTS *opts;
+{
+#if defined(linux) && defined(TCP_PROBES)
+  h->probe = opts->probe;
+  h->port  = opts->port;
+  if (h->probe == PROBE_TCP) e->num_tcp++;
+  if (h->probe == PROBE_SYN) e->num_syn++;
+#else
+  if (opts->probe != PROBE_ICMP)
+    printf("\nTCP probes not supported, using ICMP for %s\n", h->host);
+#endif
+}
+
+/*
+ * Write the hosts (and groups) just read from a hosts file out as a
+ * compiled image.  Only what was given on the group lines is kept,
+ * so that the command line still applies to the rest when it is used.
+ */
+int
+compile_host_db(e, source, image)
+LS_ENGINE *e; char *source, *image;
+{
+  HOST_DB_BUILD *b;
+  HOSTDB_GROUP rg;
+  HOSTDB_HOST rh;
+  GROUP_ENTRY *g;
+  HOST_ENTRY *h;
+  int i, j;
+
+  if ((b = hostdb_begin(source)) == NULL) return -1;
+
+  for (i=0; i<e->num_groups; i++) {
+    g = e->groups[i];
+    memset(&rg, 0, sizeof(rg));
+    rg.timeout = g->timeout == e->timeout ? -1 : g->timeout;
+    rg.retry   = g->retry == e->retry ? -1 : g->retry;
+    rg.report  = g->report;
+    hostdb_add_group(b, &rg, g->name,
+                     g->command == e->command ? NULL : (g->command ? g->command : ""));
+  }
+
+  for (i=0; i<e->num_hosts; i++) {
+    h = e->table[i];
+    for (j=0; e->groups[j] != h->group; j++);
+    memset(&rh, 0, sizeof(rh));
+    rh.addr     = h->saddr.sin_addr.s_addr;
+    rh.schedule = h->packet_schedule;
+    rh.retry    = h->retry == h->group->retry ? -1 : h->retry;
+    rh.from     = h->monitor_from;
+    rh.until    = h->monitor_until;
+    rh.group    = j;
+    rh.probe    = h->probe;
+    rh.port     = h->port;
+    rh.pri      = h->pri;
+    hostdb_add_host(b, &rh, h->host, h->dep_name);
+  }
+  return hostdb_write(b, image);
+}
+
+/*
+ * Map in a compiled image, and set up its hosts and groups straight
+ * from the records: one allocation for all of the hosts, with their
+ * names left in the image and its own hashes used by find_host.  If
+ * the hosts file it was compiled from has changed since, nothing is
+ * set up and the path of that is returned, to be read instead.
+ */
+char *
+load_host_db(e, image)
+LS_ENGINE *e; char *image;
+{
+  HOST_DB *db;
+  HOSTDB_GROUP *rg;
+  HOSTDB_HOST *rh;
+  GROUP_ENTRY **gmap;
+  HOST_ENTRY *block;
+  HOST_OPTS opts;
+  struct in_addr addr;
+  struct stat st;
+  time_t compiled;
+  char *source;
+  int i, n;
+
+  if ((db = hostdb_open(image)) == NULL) {
+    if (errno == EINVAL) crash_and_burn("load_host_db: not a usable host image, compile it again");
+    errno_crash_and_burn("load_host_db: hostdb_open");
+  }
+
+  source = hostdb_source(db, &compiled);
+  if (stat(source, &st) == 0 && st.st_mtime != compiled) {
+    printf("%s has changed since %s was compiled, recompiling\n", source, image);
+    source = strdup(source);
+    if (!source) crash_and_burn("load_host_db: can't malloc source");
+    hostdb_close(db);
+    return source;
+  }
+
+  n = hostdb_groups(db);
+  gmap = (GROUP_ENTRY **) malloc(n * sizeof(GROUP_ENTRY *));
+  if (!gmap) crash_and_burn("load_host_db: can't allocate group map");
+  for (i=0; i<n; i++) {
+    rg = hostdb_group(db, i);
+    gmap[i] = find_group(e, hostdb_string(db, rg->name));
+    if (rg->timeout >= MIN_TIMEOUT) gmap[i]->timeout = rg->timeout;
+    if (rg->retry >= 1) gmap[i]->retry = rg->retry;
+    if (rg->command != HOSTDB_NONE)
+      gmap[i]->command = *hostdb_string(db, rg->command) ? strdup(hostdb_string(db, rg->command)) : NULL;
+    if (rg->report >= 0 && rg->report < 2400) gmap[i]->report = rg->report;
+  }
+
+  n = hostdb_hosts(db);
+  grow_table(e, n);
+  block = (HOST_ENTRY *) calloc(n ? n : 1, sizeof(HOST_ENTRY));
+  if (!block) crash_and_burn("load_host_db: can't allocate HOST_ENTRY");
+
+  for (i=0; i<n; i++) {
+    rh = hostdb_host(db, i);
+    e->table[i] = &block[i];
+    addr.s_addr = rh->addr;
+    init_host_entry(e->table[i], hostdb_string(db, rh->name), addr, rh->schedule,
+                    (rh->retry >= 1 ? rh->retry : gmap[rh->group]->retry), rh->from, rh->until);
+    e->table[i]->dep_name = hostdb_string(db, rh->dep);
+    opts.probe = rh->probe <= PROBE_SYN ? rh->probe : PROBE_ICMP;
+    opts.port  = rh->port;
+    set_probe(e, e->table[i], &opts);
+    e->table[i]->pri   = (rh->pri >= 1 && rh->pri <= PRI_CLASSES) ? rh->pri : DEFAULT_PRI;
+    e->table[i]->group = gmap[rh->group];
+    e->table[i]->group->num_hosts++;
+    if (!rh->schedule) e->num_local_hosts++;
+  }
+  e->num_hosts  = n;
+  e->num_mapped = n;
+  e->host_db    = db;
+  e->host_image = db;
+  free(gmap);
+
+  printf("Mapped %d hosts from %s (compiled from %s)\n", n, image, source);
+  return NULL;
+}
+
+void
+process_host_list (e, argc, argv, filename)
+     LS_ENGINE *e;
+     int argc;
+     char **argv;
+     char *filename;
+{
+  GROUP_ENTRY *g;
+  char *image = NULL;
+
+  e->num_hosts=0;
+  e->num_local_hosts=0;
+
+  /* Hosts before any group line are under the command line policy */
+  g = find_group(e, "default");
+
+  /* A compiled image is used as it is, unless its hosts file has changed */
+  if (!(argc > 1 && *argv) && filename && hostdb_is_image(filename)) {
+    image    = filename;
+    filename = load_host_db(e, image);
+  }
+
+  if (image && !filename) {
+    /* Mapped in from the image */
+  } else if (argc > 1 && *argv) {
+    printf("Create Table Entries for:");
+    while (*argv) {
+      if (e->num_hosts == e->table_size) grow_table(e, e->num_hosts+1);
+      if ((e->table[e->num_hosts]=create_host_entry(strdup(*argv),NULL,0,e->retry,0,0)) != NULL) {
+        e->table[e->num_hosts]->group = g;
+        g->num_hosts++;
+        printf(" %s", *argv);
+        e->num_hosts++;
+        e->num_local_hosts++;
+      }
+      ++argv;
+    }
+    printf("\n");
+  } else if (filename) {
+    FILE *ping_file;
+    char line[256];
+    char host[256],ip_addr[256],*p;
+    int count,schedule,uniq_retry;
+    short from,until;
+    HOST_OPTS opts;
+
+    if (strcmp(filename,"-")==0) {
+      ping_file=fdopen(0,"r");
+    } else {
+      ping_file=fopen(filename,"r");
+    }
+    if (!ping_file) errno_crash_and_burn("process_host_list: fopen");
+    printf("Create Table Entries for:");
+    while(fgets(line,256,ping_file)) {
+      count=sscanf(line,"%255s %255s",ip_addr,host);
+      if (count > 0) {
+	if (ip_addr[0] == '#') continue;
+	if (count > 1 && strcmp(ip_addr, "group") == 0) {
+	  /* The hosts that follow come under this group */
+	  g = find_group(e, host);
+	  if ((p = strchr(line, '#')) != NULL) parse_group_options(p+1, g);
+	  printf(" [%s]", g->name);
+	  continue;
+	}
+        if (e->num_hosts == e->table_size) grow_table(e, e->num_hosts+1);
+
+	opts.schedule = 0;
+	opts.retry    = g->retry;
+	opts.from     = 0;
+	opts.until    = 0;
+	opts.dep[0]   = '\0';
+	opts.probe    = PROBE_ICMP;
+	opts.port     = 0;
+	opts.pri      = DEFAULT_PRI;
+	if ((p = strchr(line, '#')) != NULL) parse_host_options(p+1, &opts);
+	schedule   = opts.schedule;
+	uniq_retry = opts.retry;
+	from       = opts.from;
+	until      = opts.until;
+
+	if (count > 1 && host[0] != '#') {
+	  /* Assume that we read in a host file entry */
+	  p=(char*)malloc(strlen(host)+1);
+	  if (!p) crash_and_burn("process_host_list: can't malloc host");
+	  strcpy(p,host);
+
+	  if ((e->table[e->num_hosts]=create_host_entry(p,ip_addr,schedule,uniq_retry,from,until)) != NULL) {
+	    if (opts.dep[0]) e->table[e->num_hosts]->dep_name = strdup(opts.dep);
+	    set_probe(e, e->table[e->num_hosts], &opts);
+	    e->table[e->num_hosts]->pri   = opts.pri;
+	    e->table[e->num_hosts]->group = g;
+	    g->num_hosts++;
+	    if (schedule) { 
+	      printf(" %s(%d", p, schedule);
+	      if (uniq_retry != g->retry)
+		printf(",%d", uniq_retry);
+	      if (until)
+		printf(",%hd-%hd", from, until);
+	      printf(")");
+	    } else {
+	      e->num_local_hosts++;
+	      printf(" %s", p);
+	    }
+	    e->num_hosts++;
+	  }
+	} else {
+	  /* Assume we only entered a host name */
+	  p=(char*)malloc(strlen(ip_addr)+1);
+	  if (!p) crash_and_burn("process_host_list: can't malloc host");
+	  strcpy(p,ip_addr);
+	  if ((e->table[e->num_hosts]=create_host_entry(p,NULL,0,g->retry,0,0)) != NULL) {
+	    if (opts.dep[0]) e->table[e->num_hosts]->dep_name = strdup(opts.dep);
+	    set_probe(e, e->table[e->num_hosts], &opts);
+	    e->table[e->num_hosts]->pri   = opts.pri;
+	    e->table[e->num_hosts]->group = g;
+	    g->num_hosts++;
+	    printf(" %s", p);
+	    e->num_hosts++;
+	    e->num_local_hosts++;
+	  }
+	}
+      }
+    }
+    fclose(ping_file);
+    printf("\n");
+  } else usage(7);
+
+  if (e->num_hosts == 0) {
+    printf("No valid hosts!\n");
+    exit(1);
+  }
+
+  if (image && filename && compile_host_db(e, filename, image) < 0)
+    printf("Unable to recompile %s (%s), carrying on without it\n", image, strerror(errno));
+}  
+
+/*
+ * Sanity Check on some parameters
+ */
+void
+sane_params(e)
+LS_ENGINE *e;
+{
+  if (e->interval < MIN_INTERVAL) e->interval = MIN_INTERVAL;
+  e->min_interval = e->interval;
+  if (e->timeout < MIN_TIMEOUT) e->timeout = MIN_TIMEOUT;
+  if (e->retry < 1) e->retry = 1;
+  if (e->rto_min < MIN_RTO) e->rto_min = MIN_RTO;
+  if (e->rto_min > e->timeout) e->rto_min = e->timeout;
+  if (e->confirm_rate > 1000000) e->confirm_rate = 1000000;
+  if (e->busy_poll > MAX_BUSY_POLL) e->busy_poll = MAX_BUSY_POLL;
+}
+
+/*
+ * Unless given, the cycle is planned as the spacing of the local
+ * hosts and the pause at the end, with a quarter to spare.  It is
+ * planned again as hosts are added and removed.
+ */
+void
+plan_cycle(e)
+LS_ENGINE *e;
+{
+  if (!e->cycle_plan || e->cycle_auto) {
+    e->cycle_auto = 1;
+    e->cycle_plan = e->timeout + (e->num_local_hosts * e->min_interval * 5) / 4;
+  }
+  if (e->cycle_plan < e->timeout + e->min_interval) e->cycle_plan = e->timeout + e->min_interval;
+}
+
+/*
+ * The main loop, taken a step at a time so that it can be run from
+ * someone else's event loop (see liblinkstat.h).  A cycle sends to
+ * each host that is due, spaced by "interval" and clearing the replies
+ * every ~10 packets, then pauses for the stragglers.  Whenever there
+ * is a wait, advance_cycle hands back the time it ends.
+ */
+void
+start_cycle(e)
+LS_ENGINE *e;
+{
+  time_t sys_clock;
+  struct tm *the_time;
+
+  /*
+   * Start a new cycle - count the number of times we poll in each
+   * interval.  Keep a track of how many local hosts we are waiting
+   * on for a reponse.
+   */
+
+  trace_cycle(e->trace, e->cycle_no, e->cycle_sent, (long) (e->cycle_plan - e->timeout));
+  e->cycles++;
+  e->cycle_no++;
+  gettimeofday(&e->cycle_start, &tz);
+  memset(e->cycle_due, 0, sizeof(e->cycle_due));
+  e->cycle_sent = 0;
+
+  /*
+   * Update the cycle_time to contain the current system time in 24hr format
+   */
+  sys_clock = time(NULL);
+  the_time = localtime(&sys_clock);
+  e->cycle_time = the_time->tm_hour * 100 + the_time->tm_min;
+
+  if (e->txtime_clock >= 0) pace_begin(e);
+
+  e->cycle_phase = CYCLE_SEND;
+  e->cycle_pos   = 0;
+  e->cycle_wait  = 0;
+}
+
+/*
+ * Send to the hosts that are due, from where we are up to, until one
+ * needs a wait (returning what for, SEND_*).  Returns 0 once they have
+ * all been seen to.
+ */
+int
+send_cycle(e)
+LS_ENGINE *e;
+{
+  int i, wait;
+
+  (void) trace_phase(e->trace, TR_SCAN);
+
+  /*
+   * Start collecting results, one at a time with
+   * a possible pause of "interval" milliseconds.
+   * At the same time, initialize the results table
+   * for each scheduled entry.
+   */
+  while (e->cycle_pos < e->num_hosts) {
+    i = e->cycle_pos++;
+    if (e->table[i]->monitor_until && (e->cycle_time < e->table[i]->monitor_from || e->cycle_time > e->table[i]->monitor_until))
+      continue;
+    if (e->table[i]->paused) continue;   /* by the control socket */
+    if (e->table[i]->removed) continue;  /* by ls_remove_host */
+    if (e->table[i]->slice == SLICE_OTHER) continue;  /* another node's */
+
+    gettimeofday(&e->current_time, &tz);
+
+    /*
+     * Dependents of a host (or subnet) that is down are only
+     * probed now and again, their state is rolled into the
+     * outage anyway.
+     */
+    if (in_outage(e->table[i]) &&
+        e->current_time.tv_sec - e->table[i]->sent_time.tv_sec < e->dep_interval)
+      continue;
+
+    if (e->table[i]->next_time.tv_sec <= e->current_time.tv_sec) {
+      /*
+       * Ready to send the next packet to this host
+       */
+      wait = 0;
+
+      /*
+       * Ship off a packet and wait (a little while) for
+       * one's return.  This gives the network interface
+       * a possible break between probes.  If the host is suspect
+       * then leave it to its re-probes.
+       */
+      if (!e->table[i]->outstanding && !e->table[i]->reprobe) {
+        e->cycle_due[e->table[i]->pri]++;
+
+        /*
+         * When the cycles are overrunning, the lower classes are only
+         * probed every so often (spread over the cycles by index), and
+         * stay due until then.  Not those probed less often (-detect),
+         * as their interval leaves no room for the deferral.
+         */
+        if (e->shed_factor > 1 && e->table[i]->pri > 1 &&
+            e->table[i]->every <= e->table[i]->packet_schedule &&
+            (e->cycle_no + i) % ((e->table[i]->pri - 1) * e->shed_factor)) {
+          e->shed_count++;
+          continue;
+        }
+        e->cycle_sent++;
+        (void) trace_phase(e->trace, TR_SEND);
+        if (e->txtime_clock >= 0 && e->table[i]->probe == PROBE_ICMP)
+          queue_ping(e, e->sock,e->table[i]);  /* the kernel does the spacing */
+        else if (e->table[i]->probe == PROBE_ARP)
+          send_ping(e, e->sock,e->table[i]);   /* swept in batches, no spacing */
+        else {
+          send_ping(e, e->sock,e->table[i]);
+          wait = SEND_SPACED;
+        }
+        (void) trace_phase(e->trace, TR_SCAN);
+      }
+
+      /*
+       * Update schedule for the next packet to this host, further
+       * out if it has been stable for a while
+       */
+      set_every(e, e->table[i], probe_every(e, e->table[i], e->current_time.tv_sec));
+      if (e->table[i]->every > e->table[i]->packet_schedule)
+        e->table[i]->next_time.tv_sec = e->current_time.tv_sec + e->table[i]->every;
+      else
+        e->table[i]->next_time.tv_sec += e->table[i]->packet_schedule;
+
+      /*
+       * For every ~10 packets sent, give any queued packets a
+       * chance to be cleared.  This is required as the above
+       * wait (of interval) will always end straight away
+       * as soon as we get behind in processing traffic.
+       */
+      if (e->txtime_clock < 0 && e->table[i]->probe != PROBE_ARP &&
+          (i % 10 == 9 || i == (e->num_hosts-1)))
+        wait |= SEND_DRAIN;
+
+      if (wait) return wait;
+    }
+  }
+  return 0;
+}
+
+/*
+ * Everything done once the hosts have been sent to: the status
+ * message and reports when they are due, and the interval adjustment.
+ */
+void
+end_cycle(e)
+LS_ENGINE *e;
+{
+  long dropped;
+  int i;
+
+  (void) trace_phase(e->trace, TR_REPORT);
+  if (e->txtime_clock >= 0) pace_end(e, e->sock);
+
+  gettimeofday(&e->current_time, &tz);
+  shed_load(e, timeval_usec(e->cycle_start, e->current_time) / 1000, e->cycle_sent, e->cycle_due);
+  if (e->num_flapping) flap_check(e, e->current_time.tv_sec);
+
+  if (time(NULL) >= (e->baseline + e->update)) {
+    if (!e->check_hw)
+      printf("%s Waiting on %d (%d unreachable), I:%dms R:%d C:%d S:%d F:%d O:%d D:%ld/%d L:%ld/%ldus E:%ld A:%d X:%d\n", curr_time(), e->queue_len, e->num_local_unreachable, e->interval, e->optimal_retry, e->cycles, e->num_suspect, e->false_suspect, e->num_outages_active, e->shed_count, e->shed_factor, e->wake_count ? e->wake_total / e->wake_count : 0, e->wake_max, e->icmp_errors, e->num_stretched, e->num_flapping);
+    else
+      printf("%s Waiting on %d (%d unreachable), I:%dms R:%d C:%d S:%d F:%d O:%d D:%ld/%d L:%ld/%ldus E:%ld A:%d X:%d M:%d\n", curr_time(), e->queue_len, e->num_local_unreachable, e->interval, e->optimal_retry, e->cycles, e->num_suspect, e->false_suspect, e->num_outages_active, e->shed_count, e->shed_factor, e->wake_count ? e->wake_total / e->wake_count : 0, e->wake_max, e->icmp_errors, e->num_stretched, e->num_flapping, e->macs_checked);
+    rollup_status(e, e->current_time.tv_sec);
+
+    if (e->hist || sub_wanted(e->subs, SUB_RTT)) history_summary(e);
+    if (e->hist) {
+      if (hist_dropped(e->hist) > e->hist_lost) {
+        e->hist_lost = hist_dropped(e->hist);
+        printf("%s ERROR: %ld history records lost so far\n", curr_time(), e->hist_lost);
+      }
+    }
+
+    if (e->cluster) cluster_windows(e);
+    if (e->capture) capture_flush(e->capture);
+    if (e->subs && (dropped = sub_dropped(e->subs, &i)) > 0)
+      printf("%s Stream subscribers falling behind, %ld events dropped (%d subscribed)\n", curr_time(), dropped, i);
+
+    (void) fflush(stdout);
+    e->cycles=0;
+    e->optimal_retry=0;
+    e->false_suspect=0;
+    e->shed_count=0;
+    e->icmp_errors=0;
+    e->wake_count=e->wake_total=e->wake_max=0;
+    e->baseline = time(NULL);
+
+    for (i=0; i<e->num_groups; i++)
+      if (e->groups[i]->report_time && e->baseline >= e->groups[i]->report_time) {
+        display_report(e, e->num_groups > 1 ? e->groups[i] : NULL);
+        while (e->groups[i]->report_time <= e->baseline)
+          e->groups[i]->report_time += 24 * 60 * 60;  /* and again tomorrow */
+      }
+  }
+
+  if (report_now) {
+    report_now = 0;
+    display_windows(e, (GROUP_ENTRY *) NULL);
+  }
+
+  /*
+   * Adjust the inter-packet interval if we are not allowing
+   * enough time during the intervals for the packets to return.
+   */
+
+  if (e->queue_len > 0) {
+    /*
+     * If we are still waiting on some hosts then increase the interval
+     * (to let the hosts catch up).  At this point also disable the
+     * negative adjustment of the same interval.  (May like to look into
+     * resetting this timer)
+     */
+    e->interval+=2;        /* add 2ms to the interval between packets */
+    e->queue_len=0;        /* reset the counter */
+    e->adjusting=0;        /* zero adjustment value */
+  } else if ((e->adjusting++ > 9) &&
+             (e->interval > e->min_interval)) {
+    /*
+     * If we are not waiting for any hosts then decrease the interval
+     * timer (to speed up the polling interval), but do not go below
+     * the initially specified interval.
+     */
+    e->interval-=(e->adjusting/10);  /* decrease the interval */
+    if (e->interval < e->min_interval) {
+      /* if we are below the minimum then set the interval to the
+         minimum and hold off adjustment, until the next increment */
+      e->interval = e->min_interval;
+      e->adjusting= -32000;
+    }
+  }
+}
+
+/*
+ * Set the end of the wait (or pause) to msecs from now
+ */
+void
+cycle_wait_for(e, msecs)
+LS_ENGINE *e; int msecs;
+{
+  struct timeval to;
 
-#ifdef linux
-  /* Linux holds a different arp cache for each interface (must use ar.arp_dev) */
+  to.tv_sec  = msecs/1000;
+  to.tv_usec = (msecs - (to.tv_sec*1000))*1000;
+  gettimeofday(&e->cycle_until, &tz);
+  timeradd(&e->cycle_until, &to, &e->cycle_until);
+}
 
-  /*
-   * Get a list of interface names
-   */
-  ifc.ifc_len = (int) sizeof(ifbuffer);
-  ifc.ifc_buf = ifbuffer;
-  if (ioctl(s, SIOCGIFCONF, &ifc) < 0) {return NULL;}
-  if (ifc.ifc_len > (int) sizeof(ifbuffer)) {
-    printf("%s ERROR: Interface list too long - %d\n", curr_time(), ifc.ifc_len); (void) fflush(stdout);
-    return NULL;
-  }
+void
+start_wait(e, wait)
+LS_ENGINE *e; int wait;
+{
+  e->cycle_wait = wait;
+  cycle_wait_for(e, wait & SEND_SPACED ? e->interval : 1);
+}
 
-  /*
-   * Attempt an ARP lookup on each interface
-   */
-  offset = 0;
-  while (offset < ifc.ifc_len) {
-    ifr = (struct ifreq *) (ifbuffer + offset);
-    offset += sizeof(*ifr);
+/*
+ * The wait after a send is over, clear any replies queued up if that
+ * was to follow (1ms at a time, as long as they keep coming).
+ */
+void
+end_wait(e)
+LS_ENGINE *e;
+{
+  e->cycle_wait = (e->cycle_wait == (SEND_SPACED|SEND_DRAIN)) ? SEND_DRAIN : 0;
+  if (e->cycle_wait) cycle_wait_for(e, 1);
+}
 
-    /* Skip loopback and aliased interfaces */
-    if (strncmp(ifr->ifr_name, "lo", 2) == 0) continue;
-    if (strchr(ifr->ifr_name, ':') != NULL)   continue;
+/*
+ * A reply came in.  It ends the wait after a send, while clearing the
+ * replies (or pausing) it is another 1ms (or timeout) before we move on.
+ */
+void
+cycle_reply(e)
+LS_ENGINE *e;
+{
+  if (e->cycle_phase == CYCLE_PAUSE)
+    cycle_wait_for(e, e->timeout);
+  else if (e->cycle_wait & SEND_SPACED)
+    end_wait(e);
+  else if (e->cycle_wait)
+    cycle_wait_for(e, 1);
+}
 
-    /* Set up the device entry for the ARP lookup */
-    strncpy(ar.arp_dev, ifr->ifr_name, sizeof(ar.arp_dev) - 1);
-    ar.arp_dev[sizeof(ar.arp_dev) - 1] = '\0';
+/*
+ * Move the cycle on as far as it goes without waiting, and give the
+ * time the wait it is now in ends.
+ */
+void
+advance_cycle(e, wake)
+LS_ENGINE *e; struct timeval *wake;
+{
+  struct timeval now;
+  int wait;
+
+  for (;;) {
+    gettimeofday(&now, &tz);
+    if (e->cycle_phase == CYCLE_START)
+      start_cycle(e);
+    else if (e->cycle_phase == CYCLE_SEND && e->cycle_wait) {
+      if (timercmp(&now, &e->cycle_until, <)) break;
+      end_wait(e);
+    } else if (e->cycle_phase == CYCLE_SEND) {
+      if ((wait = send_cycle(e)) != 0)
+        start_wait(e, wait);
+      else {
+        end_cycle(e);
 
-    /* Query ARP table */
-    if (ioctl(s, SIOCGARP, &ar) >= 0) {
-      /* Skip non-ethernet interfaces? */
-      if (ar.arp_ha.sa_family != ARPHRD_ETHER) {
-        printf("%s ERROR: MAC found on non-ethernet interface, IP address=%s, Int=%s\n", curr_time(),get_ip_from_long(ipaddress), ar.arp_dev); (void) fflush(stdout);
-        continue;
+        /*
+         * The following will clear any waiting packets and
+         * cause a pause of timeout/1000 seconds.  Hosts that
+         * are no longer reachable are found as their packet
+         * deadlines expire (see expire_probes).
+         */
+        e->cycle_phase = CYCLE_PAUSE;
+        cycle_wait_for(e, e->timeout);
       }
-      break;
     } else {
-      if (offset >= ifc.ifc_len) {
-        /* This was the last interface to try */
-        return NULL;
-      }
+      if (timercmp(&now, &e->cycle_until, <)) break;
+      check_outages(e);
+      e->cycle_phase = CYCLE_START;
     }
   }
-#else
-  /* many systems keep a common arp cache */
-  if (ioctl(s, SIOCGARP, (caddr_t)&ar) < 0) {
-    /* no arp address was found... most likely this
-       is a system that is not on our subnet */
-    return NULL;
-  }
-#endif
+  *wake = e->cycle_until;
+}
 
-  /* Check the address is complete */
-  if (!(ar.arp_flags & ATF_COM)) {
-    printf("%s ERROR: Incomplete MAC address, IP address=%s\n", curr_time(),get_ip_from_long(ipaddress)); (void) fflush(stdout);
-    return NULL;
+/*
+ * A new engine with the default parameters, for ls_open or the command
+ * line to change.  Each has an ICMP id of its own, so the engines in a
+ * process can tell their replies apart.
+ */
+static LS_ENGINE *
+new_engine()
+{
+  static int opened = 0;
+  LS_ENGINE *e;
+
+  if ((e = (LS_ENGINE *) calloc(1, sizeof(LS_ENGINE))) == NULL) return NULL;
+  e->ident        = (getpid() + opened++) & 0xFFFF;
+  e->sock         = -1;
+  e->retry        = DEFAULT_RETRY;
+  e->timeout      = DEFAULT_TIMEOUT;
+  e->interval     = DEFAULT_INTERVAL;
+  e->rto_min      = DEFAULT_RTO_MIN;
+  e->confirm_rate = DEFAULT_CONFIRM;
+  e->dep_interval = DEFAULT_DEP_INT;
+  e->min_interval = DEFAULT_INTERVAL;
+  e->update       = DEFAULT_UPDATE;
+  e->shed_factor  = 1;
+  e->txtime_clock = -1;
+  e->cpu          = -1;
+  e->conn_poll    = -1;
+  e->syn_sock     = -1;
+  e->syn_hold     = -1;
+  e->cycle_phase  = CYCLE_START;
+  return e;
+}
+
+/*
+ * The engine interface (liblinkstat.h).  Each engine keeps its own
+ * hosts, sockets and state, so a process can run several.
+ */
+LS_ENGINE *
+ls_open(params, cb)
+LS_PARAMS *params; LS_CALLBACKS *cb;
+{
+  LS_ENGINE *e;
+
+  if ((e = new_engine()) == NULL) return NULL;
+  if (params) {
+    if (params->timeout > 0)      e->timeout      = params->timeout;
+    if (params->interval > 0)     e->interval     = params->interval;
+    if (params->retry > 0)        e->retry        = params->retry;
+    if (params->rto_min > 0)      e->rto_min      = params->rto_min;
+    if (params->confirm_rate > 0) e->confirm_rate = params->confirm_rate;
+    if (params->cycle > 0)        e->cycle_plan   = params->cycle;
+    if (params->max_detect > 0)   e->max_detect   = params->max_detect;
+    if (params->prefix > 0 && params->prefix <= 32) e->prefix_bits = params->prefix;
   }
+  sane_params(e);
+  (void) find_group(e, "default");  /* for the hosts added */
 
-  return ar.arp_ha.sa_data;
+  if (cb) e->cb = *cb;
+  return e;
 }
 
-int check_arp (s, ipaddress, n)
-int s; u_long ipaddress; int n;
+/*
+ * Hosts added or removed are not in the image, so from then on we
+ * keep our own index of them (the image stays mapped for its names).
+ */
+static void
+own_host_index(e)
+LS_ENGINE *e;
 {
-  char *mac;
+  if (e->host_db) {
+    e->host_db   = NULL;
+    e->hash_size = 0;
+  }
+}
 
-  if ((mac=get_mac(s, ipaddress)) == NULL) {
-    return 0;
+/*
+ * Add a host, as a line of the hosts file would: its address (NULL to
+ * look the name up) and options such as "(ret=5, probe=tcp:80)".  It
+ * comes under the default group.  Returns its number, or -1.
+ */
+int
+ls_add_host(e, name, addr, options)
+LS_ENGINE *e; char *name, *addr, *options;
+{
+  GROUP_ENTRY *g = e->groups[0];
+  HOST_OPTS opts;
+  HOST_ENTRY *h;
+  char buf[256], *p;
+
+  own_host_index(e);
+  if (e->hash_size < (e->num_hosts + 1) * 2) build_host_index(e);
+  if (find_host(e, name)) {
+    errno = EEXIST;
+    return -1;
   }
- 
-  if (table[n]->mac_addr == NULL) {
-    table[n]->mac_addr = (unsigned char*) malloc(14);
-    if (!table[n]->mac_addr) crash_and_burn("check_arp: can't malloc MAC address");
-    memcpy(table[n]->mac_addr,mac,14);
-    macs_checked++;
+
+  opts.schedule = 0;
+  opts.retry    = g->retry;
+  opts.from     = 0;
+  opts.until    = 0;
+  opts.dep[0]   = '\0';
+  opts.probe    = PROBE_ICMP;
+  opts.port     = 0;
+  opts.pri      = DEFAULT_PRI;
+  if (options) {
+    strncpy(buf, options, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = '\0';
+    parse_host_options(buf, &opts);
   }
 
-  if (memcmp(mac, table[n]->mac_addr, 14) != 0) {
-    /* ODD... Big/Little Endian does not seem to be a problem here... */
-    printf("%s NIDS WARNING received a packet from %02x:%02x:%02x:%02x:%02x:%02x",curr_time(),mac[0],mac[1],mac[2],mac[3],mac[4],mac[5]);
-    printf(" rather than the expected %02x:%02x:%02x:%02x:%02x:%02x (%s)\n",table[n]->mac_addr[0],table[n]->mac_addr[1],table[n]->mac_addr[2],table[n]->mac_addr[3],table[n]->mac_addr[4],table[n]->mac_addr[5],get_ip_from_long(ipaddress));
-    memcpy(table[n]->mac_addr,mac,14);
-    if (command) notify_command(table[n]->host, "nids", "MAC address changed");
-    return 2;
+  if ((p = strdup(name)) == NULL) crash_and_burn("ls_add_host: can't malloc host");
+  if ((h = create_host_entry(p, addr, opts.schedule, opts.retry, opts.from, opts.until)) == NULL) {
+    free(p);
+    errno = EINVAL;
+    return -1;
+  }
+  if (opts.dep[0]) h->dep_name = strdup(opts.dep);  /* taken up by ls_start */
+  set_probe(e, h, &opts);
+  h->pri   = opts.pri;
+  h->group = g;
+  g->num_hosts++;
+  if (!opts.schedule) e->num_local_hosts++;
+
+  if (e->num_hosts == e->table_size) grow_table(e, e->num_hosts+1);
+  h->i = e->num_hosts;
+  e->table[e->num_hosts++] = h;
+  index_host(e, h);
+
+  if (e->started) {
+    /* Straight into the cycle, probed as it would have been from the start */
+    gettimeofday(&e->current_time, &tz);
+    ready_host(e, h);
+    rollup_join(e, h);
+    if (e->arp && !h->packet_schedule && h->probe == PROBE_ICMP &&
+        arp_local(e->arp, h->saddr.sin_addr)) {
+      h->probe = PROBE_ARP;
+      e->num_arp++;
+    }
+    if (e->num_tcp || e->num_syn) tcp_setup(e);
+    plan_cycle(e);
   }
+  return h->i;
+}
+
+/*
+ * Stop probing a host.  If it is down it is taken as back up (without
+ * the fuss), so its downtime and the outage counts come out right.
+ * Its number is not used again.
+ */
+int
+ls_remove_host(e, host)
+LS_ENGINE *e; int host;
+{
+  HOST_ENTRY *h;
 
+  if (host < 0 || host >= e->num_hosts || e->table[host]->removed) {
+    errno = ENOENT;
+    return -1;
+  }
+  h = e->table[host];
+  release_host(e, h);
+  rollup_leave(h);
+
+  h->removed = 1;
+  h->group->num_hosts--;
+  if (h->slice == SLICE_OTHER)
+    h->group->num_other--;
+  else
+    e->num_released++;
+  if (!h->packet_schedule) e->num_local_hosts--;
+  own_host_index(e);
+  build_host_index(e);  /* without it */
+  if (e->started) plan_cycle(e);
   return 0;
 }
 
-#else
-#define check_arp(s, ipaddress, index)        ((void)0)
-#endif
-
-char *get_host_by_address(in)
-struct in_addr in;
+int
+ls_find_host(e, name)
+LS_ENGINE *e; char *name;
 {
-  struct hostent *h;
+  HOST_ENTRY *h;
 
-  h=gethostbyaddr((char *) &in,sizeof(struct in_addr),AF_INET);
-  if (h==NULL || h->h_name==NULL) return inet_ntoa(in);
-  else return h->h_name;
+  if (!e->hash_size && !e->host_db) build_host_index(e);  /* not started yet */
+  if ((h = find_host(e, name)) == NULL) {
+    errno = ENOENT;
+    return -1;
+  }
+  return h->i;
 }
 
-int wait_for_reply(s, wait_time)
-int s, wait_time;
+/*
+ * What is known of a host, including its rolling SLA windows (as
+ * reported by display_windows).
+ */
+int
+ls_host_info(e, host, info)
+LS_ENGINE *e; int host; LS_HOST_INFO *info;
 {
-  int result;
-  static char buffer[4096];
-  struct sockaddr_in response_addr;
-  struct ip *ip;
-  int hlen;
-  struct icmp *icp;
-  int n;
-  
-  result=recvfrom_wto(s,buffer,4096,
-		      (struct sockaddr *)&response_addr,wait_time);
+  static SLA_ROLLUP clean;  /* a host that has never been down */
+  time_t now = time(NULL), down_since = 0;
+  HOST_ENTRY *h;
+  int w;
 
-  if (result<0) { return 0; } /* timeout */
-  
-  ip = (struct ip *) buffer;
-  hlen = ip->ip_hl << 2;
-  if (result < hlen+ICMP_MINLEN) { return(1); /* too short */ }
+  if (host < 0 || host >= e->num_hosts || e->table[host]->removed) {
+    errno = ENOENT;
+    return -1;
+  }
+  h = e->table[host];
+
+  memset(info, 0, sizeof(*info));
+  info->name        = h->host;
+  info->addr        = h->saddr.sin_addr;
+  info->up          = h->alive;
+  info->suspect     = h->suspect;
+  info->paused      = h->paused;
+  info->srtt        = h->srtt;
+  info->rttvar      = h->rttvar;
+  info->rto         = h->rto;
+  info->last_answer = h->last_time.tv_sec;
+  info->downtime    = h->downtime;
+  info->down_count  = h->downtime_cnt;
+
+  if (!h->alive)
+    down_since = h->last_time.tv_sec ? h->last_time.tv_sec : e->start_time;
+  for (w = 0; w < SLA_WINDOWS && w < LS_WINDOWS; w++)
+    info->window_down[w] = sla_get(h->sla ? h->sla : &clean, w, now, e->start_time, down_since,
+                                   &info->window_period[w], &info->window_count[w]);
+  return 0;
+}
 
-  icp = (struct icmp *)(buffer + hlen);
-  
-  if (
-      ( icp->icmp_type != ICMP_ECHOREPLY ) ||
-      ( icp->icmp_id   != ident          )
-      ) {
+/*
+ * Open the socket and everything that goes with it, and get ready to
+ * probe the hosts.  Returns -1 (with errno) if there is no socket.
+ */
+int
+ls_start(e)
+LS_ENGINE *e;
+{
+  int i, report, left_out, num_pri[PRI_CLASSES+1];
+  GROUP_ENTRY *g;
+  struct protoent *proto;
+  struct tm *timeptr;
+  REPLAY_STATS stats;
+
+  if (e->started) {
+    errno = EALREADY;
+    return -1;
+  }
+  if (e->replaying) {
     /*
-     * This will happen if we use the host that is running
-     * linkstat to ping other hosts on the network.
+     * No sockets, the capture stands in for the network.  Hosts it
+     * has no echo requests for are left out, and the rest are pinged
+     * whatever their probe= type.
      */
-    /*printf("%s Hmm... Not one of our packets (src=%s)\n", curr_time(), get_host_by_address(response_addr.sin_addr)); (void) fflush(stdout);*/
-    return 1; /* packet received, but not the one we are looking for! */
+    for (i=0; i<e->num_hosts; i++) {
+      e->table[i]->probe = PROBE_ICMP;
+      if (!replay_known(e->replaying, e->table[i]->saddr.sin_addr)) e->table[i]->paused = 1;
+    }
+    e->num_tcp = e->num_syn = 0;
+    e->sock = -1;
+  } else {
+    if ((proto = getprotobyname("icmp")) == NULL) {
+      errno = EPROTONOSUPPORT;
+      return -1;
+    }
+
+    e->sock = socket(AF_INET, SOCK_RAW, proto->p_proto);
+    if (e->sock<0) return -1;
+
+#ifdef SO_TIMESTAMPNS
+    /* Have the kernel time each reply as it arrives */
+    i = 1;
+    (void) setsockopt(e->sock, SOL_SOCKET, SO_TIMESTAMPNS, &i, sizeof(i));
+#endif
   }
 
-  /*
-   * Get the index into our table
-   */
-  n=icp->icmp_seq;
-  
-  /*
-   * Better check that the index is within the boundaries
-   */
-  if ((n < 0) || (n >= num_hosts)) {
-    printf("%s ERROR: Invalid packet, index=%d (src=%s)\n", curr_time(),n,get_host_by_address(response_addr.sin_addr)); (void) fflush(stdout);
-    return 1; /* Corruption */
+  /* Initialize Index Entries */
+  gettimeofday(&e->current_time, &tz);
+  for( i=0; i < e->num_hosts; i++ ) {
+    e->table[i]->i = i;                /* Quick index into table */
+    ready_host(e, e->table[i]);
   }
 
   /*
-   * Check that the Source IP Address is as we expect it, this
-   * pretty much ensures that this is a packet sent by this
-   * process... and not by something else running on this box.
+   * Changed the following signal-based status updates to a time
+   * base system.  The signals were interupting processing causing
+   * errors in the displayed data.
    */
-  if (table[n]->saddr.sin_addr.s_addr != response_addr.sin_addr.s_addr) {
-    printf("%s ERROR: Invalid packet, index=%d, src=%s (exp=%s)\n", curr_time(),n,get_host_by_address(response_addr.sin_addr),get_host_by_address(table[n]->saddr.sin_addr)); (void) fflush(stdout);
-    return 1; /* Corruption */
-  }
-
-  if (check_hw) {
-    /*
-     * Check that the Hardware address of the source is as expected.
-     * This is a simple attempt at finding duplicate addresses, as
-     * well as checking for arp address poisoning (used with man-in-
-     * the-middle attacks).
-     */
-    check_arp(s, response_addr.sin_addr.s_addr, n);
-  }
 
   /*
-   * For the hosts that are using the default number of retries:
-   * Try work out an optimal retry count, then reset the value.
+   * The following is a little like alarm() but will send the first signal
+   * after 5 seconds and then every "update" seconds after that
+   *
+  interval_timer.it_value.tv_sec  = 5;
+  interval_timer.it_value.tv_usec = 0;
+  interval_timer.it_interval.tv_sec  = update;
+  interval_timer.it_interval.tv_usec = 0;
+  signal(SIGALRM,alarmtout);
+  setitimer(ITIMER_REAL, &interval_timer, NULL);
    *
-   * NOTE: While it is not a biggie... The retry count will be
-   *       one greater than it needs to be, as we are using this
-   *       field for more than one purpose to keep things simple.
-   *       We would need to have another field for the retry
-   *       count if we were to fix this up.
    */
-   if ((table[n]->retry == retry) && (optimal_retry < retry - table[n]->response))
-    optimal_retry = retry - table[n]->response;
 
-  table[n]->response = table[n]->retry;
+  plan_cycle(e);
+  if (!e->trace) e->trace = trace_open(trace_host, e);
 
-  if (!table[n]->alive) {
-    /* At this point the host has only just come up
-       after being down for a period of time
-     */
+  e->baseline = time(NULL) - e->update + 5;  /* first display after 5 seconds */
+  e->start_time = time(NULL);
 
-    static char msg[255];
+  for (i=0; i<e->num_groups; i++) {
+    g = e->groups[i];
+    if (!g->num_hosts) continue;  /* no report */
 
-    if (table[n]->packet_schedule == 0)
-      num_local_unreachable--;
+    /*
+     * Default: If started before 5pm then a SLA report will be
+     *          produced at, or near after, 5pm.  The exact time
+     *          that the SLA report will be produced will depend
+     *          on the time between updates (value of update).
+     *          A group can have its own time (report= option).
+     */
+    if (g->report < 0 && e->slarep) {
+      g->report_time = e->start_time + e->slarep;
+      continue;
+    }
+    report = g->report < 0 ? 1700 : g->report;
+    timeptr = localtime(&e->start_time);
+    if (timeptr->tm_hour * 100 + timeptr->tm_min >= report)
+      timeptr->tm_mday++;   /* too late today, so tomorrow */
+    timeptr->tm_hour = report / 100;
+    timeptr->tm_min = report % 100;
+    timeptr->tm_sec = 0;
+    g->report_time = mktime(timeptr);
+  }
 
-    /* timestamp the last time the host responded */
-    gettimeofday(&current_time,&tz);
+  printf("%s LinkStat v%s (%s)\n", curr_time(),version_get_str(),version_get_rel_date());
 
-/* Removed as MetaFrame application servers are better :) */
-#ifdef WC_MOD
-    /* WC_MOD: This is a mod to correct WinCenter downtime
-     *         It is a little out of the scope of this utility
-     *         but never the less there was a need for it  :)
-     *
-     *         This is required as the server may still be responding
-     *         to pings, but it may have services that have hung.
-     *         We have an external process that check the services
-     *         and creates a file in .../log/status if a server has
-     *         services that have hung.  This information is used
-     *         to "adjust" the downtime of the server.
-     *
-    */
-    if (((table[n]->host)[1] == 'i') || ((table[n]->host)[1] == 'M')) {
-      struct stat buf;
-      /* This might be a WinCenter server that had hung services */
-      snprintf(msg, 255, "/opt/LinkStat/log/status/%s", table[n]->host);
-      if (!stat(msg, &buf)) {
-	/* Check to see that status file was created before system
-	   network connectivity ceased. */
-	if (buf.st_mtime < table[n]->last_time.tv_sec) {
-	    table[n]->last_time.tv_sec  = buf.st_mtime;
-	    table[n]->last_time.tv_usec = 0;
-	}
-	unlink(msg);
+  /*printf("%s Polling %d hosts with a %ds timeout, %d retries, %ds updates, %d ident\n", curr_time(),num_hosts,timeout/1000,retry,update,ident);*/
+  printf("%s Loaded %d host%s, using %ds updates, %d ident\n", curr_time(),e->num_hosts,(e->num_hosts == 1 ? "" : "s"),e->update,e->ident);
+  printf("%s Polling %d host%s with a %ds timeout, %d retries\n", curr_time(),e->num_local_hosts,(e->num_local_hosts == 1 ? "" : "s"),e->timeout/1000,e->retry);
+
+  if (e->num_hosts - e->num_local_hosts > 0)
+    printf("%s Polling %d remote hosts with various timeouts\n", curr_time(),e->num_hosts-e->num_local_hosts);
+  printf("%s Confirming suspect hosts within %ds, at up to %d re-probes/s\n", curr_time(),(e->retry*e->timeout+999)/1000,e->confirm_rate);
+  memset(num_pri, 0, sizeof(num_pri));
+  for (i=0; i<e->num_hosts; i++)
+    if (!e->table[i]->removed) num_pri[e->table[i]->pri]++;
+  printf("%s Planning %dms cycles, %d/%d/%d hosts in priority classes 1/2/3\n", curr_time(), e->cycle_plan, num_pri[1], num_pri[2], num_pri[3]);
+  if (e->max_detect)
+    printf("%s Probing stable hosts less often, detecting failures within %ds\n", curr_time(), e->max_detect);
+  if (e->ring_if) {
+    /*
+     * Take replies from a packet ring if we can, and stop the raw
+     * socket from queueing its own copy of each one.  Otherwise just
+     * carry on with the socket.
+     */
+    if ((e->ring = ring_open(e->ring_if, e->ident)) != NULL) {
+      (void) ring_divert(e->sock);
+      printf("%s Receiving replies through a packet ring on %s\n", curr_time(), e->ring_if);
+    } else
+      printf("%s ERROR: No packet ring on %s (%s), using the socket\n", curr_time(), e->ring_if, strerror(errno));
+  }
+  if (e->xdp_if) {
+    if ((e->xdp = xdp_open(e->xdp_if, e->ident)) != NULL)
+      printf("%s Sending and receiving through AF_XDP on %s (queue 0)\n", curr_time(), e->xdp_if);
+    else
+      printf("%s ERROR: No AF_XDP socket on %s (%s), using the socket\n", curr_time(), e->xdp_if, strerror(errno));
+  }
+  if (e->arp_if) {
+    /*
+     * Local hosts on the subnet of the interface are probed by ARP,
+     * everything else carries on with ICMP (or its own probe= type).
+     */
+    if ((e->arp = arp_open(e->arp_if)) != NULL) {
+      for (i=0; i<e->num_hosts; i++)
+        if (e->table[i]->packet_schedule == 0 && e->table[i]->probe == PROBE_ICMP &&
+            arp_local(e->arp, e->table[i]->saddr.sin_addr)) {
+          e->table[i]->probe = PROBE_ARP;
+          e->num_arp++;
+        }
+      printf("%s Probing %d host%s with ARP on %s\n", curr_time(), e->num_arp, (e->num_arp == 1 ? "" : "s"), e->arp_if);
+      if (!e->num_arp) {
+        arp_close(e->arp);
+        e->arp = NULL;
       }
-    }
-#endif
+    } else
+      printf("%s ERROR: No ARP probing on %s (%s), using ICMP\n", curr_time(), e->arp_if, strerror(errno));
+  }
+#ifdef linux
+  if (e->cpu >= 0) {
+    cpu_set_t set;
 
-    if (table[n]->last_time.tv_sec) {
-      snprintf(msg, 255, "%s %s is alive, after %s",curr_time(), table[n]->host, timeval_diff(table[n]->last_time, current_time));
-      table[n]->downtime += current_time.tv_sec - table[n]->last_time.tv_sec;
-    } else {
-      snprintf(msg, 255, "%s %s is alive",curr_time(), table[n]->host);
-      table[n]->downtime += current_time.tv_sec - start_time;
-    }
+    CPU_ZERO(&set);
+    CPU_SET(e->cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) < 0)
+      printf("%s ERROR: Can't run on CPU %d (%s)\n", curr_time(), e->cpu, strerror(errno));
+  }
+#endif
+  if (e->busy_poll) {
+    /*
+     * Have the socket busy poll the device as well, where the driver
+     * supports it.  Our own spinning works regardless.
+     */
+#ifdef SO_PREFER_BUSY_POLL
+    int on = 1;
 
-    table[n]->alive = 1;
-    printf("%s\n", msg);
-    (void) fflush(stdout);
+    (void) setsockopt(e->sock, SOL_SOCKET, SO_BUSY_POLL, &e->busy_poll, sizeof(e->busy_poll));
+    (void) setsockopt(e->sock, SOL_SOCKET, SO_PREFER_BUSY_POLL, &on, sizeof(on));
+#endif
+    printf("%s Busy polling for replies for up to %dus%s\n", curr_time(), e->busy_poll, (e->cpu >= 0 ? " (pinned)" : ""));
+  }
+  if (e->txtime) {
+    if (txtime_setup(e, e->sock) == 0)
+      printf("%s Pacing probes in the kernel (%s qdisc), %d at a time\n", curr_time(), e->txtime, TXTIME_BATCH);
+    else
+      printf("%s ERROR: No kernel pacing (%s), pacing probes ourselves\n", curr_time(), strerror(errno));
+  }
+  if (e->num_tcp || e->num_syn) tcp_setup(e);
+  if (e->hist_dir) {
+    if ((e->hist = hist_open(e->hist_dir, e->num_hosts)) != NULL)
+      printf("%s Recording history in %s\n", curr_time(), e->hist_dir);
+    else
+      printf("%s ERROR: Can't record history in %s (%s)\n", curr_time(), e->hist_dir, strerror(errno));
+  }
+  build_host_index(e);
+  build_dependencies(e);
+  build_rollups(e);
+  if (e->ctl_path) {
+    if ((e->ctl = ctl_open(e->ctl_path)) != NULL)
+      printf("%s Taking commands on %s\n", curr_time(), e->ctl_path);
+    else
+      printf("%s ERROR: No control socket at %s (%s)\n", curr_time(), e->ctl_path, strerror(errno));
+  }
+  if (e->sub_path) {
+    if ((e->subs = sub_open(e->sub_path)) != NULL)
+      printf("%s Streaming events to subscribers on %s\n", curr_time(), e->sub_path);
+    else
+      printf("%s ERROR: No event stream at %s (%s)\n", curr_time(), e->sub_path, strerror(errno));
+  }
+  if (e->capture_file) {
+    if ((e->capture = capture_open(e->capture_file)) != NULL)
+      printf("%s Capturing the probes and replies in %s\n", curr_time(), e->capture_file);
+    else
+      printf("%s ERROR: Can't capture in %s (%s)\n", curr_time(), e->capture_file, strerror(errno));
+  }
+  if (e->replaying) {
+    replay_stats(e->replaying, &stats);
+    for (i=0, left_out=0; i<e->num_hosts; i++)
+      if (e->table[i]->paused) left_out++;
+    printf("%s Replaying %ld echo requests (%ld answered) to %d hosts over %lds from %s\n", curr_time(), stats.packets, stats.answered, stats.hosts, stats.span, e->replay_file);
+    if (left_out)
+      printf("%s %d host%s not in the capture, left out\n", curr_time(), left_out, (left_out == 1 ? " is" : "s are"));
+  }
+  if (e->cluster_spec) {
+    e->num_slice = e->num_hosts;  /* all of them, until we hear from the aggregator */
+    if ((e->cluster = cluster_join(e->cluster_spec)) != NULL)
+      printf("%s Cluster node %s, reporting to %s\n", curr_time(), cluster_name(e->cluster), strchr(e->cluster_spec, '@') + 1);
+    else
+      printf("%s ERROR: Can't join the cluster at %s (%s)\n", curr_time(), e->cluster_spec, strerror(errno));
+  }
+  for (i=0; i<e->num_groups; i++) {
+    g = e->groups[i];
+    if (e->num_groups > 1 && g->num_hosts)
+      printf("%s Group %s: %d host%s with a %dms timeout, %d retries, notifying %s\n", curr_time(), g->name, g->num_hosts, (g->num_hosts == 1 ? "" : "s"), g->timeout, g->retry, g->command ? g->command : "no one");
+    if (g->report_time)
+      printf("%s Service Level Report%s%s will be produced on %s", curr_time(), (e->num_groups > 1 ? " for " : ""), (e->num_groups > 1 ? g->name : ""), ctime(&g->report_time));
+  }
+  (void) fflush(stdout);
 
-    /* timestamp the first time the host responded */
-    table[n]->first_time = current_time;
-    table[n]->last_time = current_time;
+  e->started = 1;
+  return 0;
+}
 
-    /* Check and execute any Notification commands */
-    if (command) notify_command(table[n]->host, "up", msg);
+/*
+ * Add the descriptors the engine reads from to a select set.  Returns
+ * the highest of them (or maxfd).
+ */
+int
+ls_fds(e, set, maxfd)
+LS_ENGINE *e; fd_set *set; int maxfd;
+{
+  int fd;
 
-  } else {
-    /* timestamp the last time the host responded */
-    gettimeofday(&current_time,&tz);
-    table[n]->last_time = current_time;
+  if (!e->started) return maxfd;
+  fd = e->ring ? ring_fd(e->ring) : e->sock;
+  FD_SET(fd, set);
+  if (fd > maxfd) maxfd = fd;
+  if (e->xdp) {
+    FD_SET(xdp_fd(e->xdp), set);
+    if (xdp_fd(e->xdp) > maxfd) maxfd = xdp_fd(e->xdp);
   }
-  return n;
+  return probe_fds(e, set, maxfd);
 }
 
-void
-usage(val)
-int val;
+/*
+ * Msecs until the engine next needs a step, whether or not any of its
+ * descriptors are ready (0=now, -1=not started).
+ */
+long
+ls_timeout(e)
+LS_ENGINE *e;
 {
-  printf("usage: linkstat [-help] [-mac_check] [-log <log_file>] [-timeout <delay>]\n");
-  printf("                [-interval <delay>] [-retry <num>] [-update <delay>]\n");
-  printf("                [-notify <command>] [-file file | hosts...]\n");
-  exit (val);
+  struct timeval now, wake, *deadline;
+
+  if (!e->started) return -1;
+  if (e->cycle_phase == CYCLE_START || (e->cycle_phase == CYCLE_SEND && !e->cycle_wait))
+    return 0;
+  wake = e->cycle_until;
+  deadline = first_deadline(e);
+  if (deadline && timercmp(deadline, &wake, <)) wake = *deadline;
+
+  gettimeofday(&now, &tz);
+  if (!timercmp(&wake, &now, >)) return 0;
+  return (timeval_usec(now, wake) + 999) / 1000;
 }
 
 /*
- * This was replaced with a different system for monitoring the time
- *
+ * Run the engine for msecs (0=just what is due now, -1=for ever),
+ * sending the probes as they fall due and dealing with the replies.
+ */
 void
-alarmtout()
+ls_step(e, msecs)
+LS_ENGINE *e; int msecs;
 {
-  signal(SIGALRM,(void *)alarmtout);
-  longjmp(Sjbuf,1);
+  struct timeval now, until, wake, to;
+
+  if (!e->started) return;
+  to.tv_sec  = msecs/1000;
+  to.tv_usec = (msecs - (to.tv_sec*1000))*1000;
+  gettimeofday(&now, &tz);
+  timeradd(&now, &to, &until);
+
+  for (;;) {
+    advance_cycle(e, &wake);
+    if (msecs >= 0 && timercmp(&until, &wake, <)) wake = until;
+
+    gettimeofday(&now, &tz);
+    if (wait_for_reply(e, e->sock, timercmp(&wake, &now, >) ? (int) ((timeval_usec(now, wake) + 999) / 1000) : 0))
+      cycle_reply(e);
+    if (e->replaying && replay_over(e->replaying)) break;  /* the capture has run out */
+    if (hangup_now) break;  /* to report and exit, outside the handler */
+
+    if (msecs >= 0) {
+      gettimeofday(&now, &tz);
+      if (!timercmp(&now, &until, <)) break;
+    }
+  }
+  (void) trace_phase(e->trace, TR_OTHER);  /* back to whoever called us */
 }
-*/
 
-void
-display_report()
+/*
+ * Free the hosts, their groups and everything built on them.  Hosts
+ * mapped from an image are in one block, with their names in the image.
+ */
+static void
+free_hosts(e)
+LS_ENGINE *e;
 {
-  /* Report statistics */
-  long int period, offset;
-  int i, count_offset;
-
-  report_time = 0;  /* do not report again */
-  period = time(NULL) - start_time;
-
-  printf("%s SLA_REP Reporting Output (period %lds)\n",curr_time(), period);
-  for (i=0; i<num_hosts; i++) {
-    offset = 0;
-    count_offset = 0;
-
-/* Removed as MetaFrame application servers are better :) */
-#ifdef WC_MOD
-    /* WC_MOD: This is a mod to correct Citrix server downtime
-     *         It is a little out of the scope of this utility
-     *         but never the less there was a need for it  :)
-     */
-    if (((table[i]->host)[1] == 'i') || ((table[i]->host)[1] == 'M')) {
-      struct stat buf;
-      char msg[255];
-      /* This might be a Citrix server that had hung services */
-      snprintf(msg, 255, "/opt/LinkStat/log/status/%s", table[i]->host);
-      if (!stat(msg, &buf)) {
-	/* Check to see that status file was created before system
-	   network connectivity ceased. */
-	if (buf.st_mtime < table[i]->last_time.tv_sec) {
-	  table[i]->last_time.tv_sec  = buf.st_mtime;
-	  table[i]->last_time.tv_usec = 0;
-	}
-	if (table[i]->alive) {
-	  /* Host is still responding to pings, so must fudge the stats */
-          /* The conditional following this one will handle the case
-           * where the host is currently down */
-	  offset = start_time + period - table[i]->last_time.tv_sec;
-          count_offset = 1;
-        }
-      }
+  HOST_ENTRY *h;
+  DEP_ENTRY *d;
+  int i;
+
+  /* A subnet group goes with its last member, as the others look at it */
+  for (i=0; i<e->num_hosts; i++) {
+    h = e->table[i];
+    if ((d = h->dep) != NULL && !d->parent && d->members[d->num_members-1] == h) {
+      free(d->name);
+      free(d->members);
+      free(d);
     }
-#endif
-
-    if (!table[i]->alive) {
-      /* Host is currently down, so need to update stats */
-      if (table[i]->last_time.tv_sec)
-	offset = start_time + period - table[i]->last_time.tv_sec;
-      else
-	offset = period;
+  }
+  for (i=0; i<e->num_hosts; i++) {
+    h = e->table[i];
+    if (h->conn_fd >= 0) close(h->conn_fd);
+    if (h->children) {
+      free(h->children->members);
+      free(h->children);
     }
-
-    if (table[i]->downtime + offset > period) {
-      /*
-       * Something is wrong here... This is usually the result
-       * of an old Citrix status file left lying around.
-       */
-      printf("%s DBUG3 %ld %ld\n", curr_time(), period, table[i]->downtime + offset);
-      printf("  Host: %s\n", table[i]->host);
-      printf("    response: %d\n", table[i]->response);
-      printf("    alive:    %d\n", table[i]->alive);
-      printf("    index:    %d\n", table[i]->i);
-      printf("    first_tm: %s", ctime(&(table[i]->first_time.tv_sec)));
-      printf("    last_tm : %s", ctime(&(table[i]->last_time.tv_sec)));
-      printf("    downtime: %ld\n", table[i]->downtime);
-      printf("    count   : %d\n", table[i]->downtime_cnt);
+    free(h->mac_addr);
+    free(h->sla);
+    if (i >= e->num_mapped) {
+      free(h->host);
+      free(h->dep_name);
+      free(h);
     }
-
-    if (table[i]->downtime_cnt + count_offset > 0)
-      printf("%s SLA_REP %s down(sec) %ld count %d percentage %01.4f\n",curr_time(), table[i]->host,table[i]->downtime + offset, table[i]->downtime_cnt + count_offset, (double)((table[i]->downtime + offset) * 100) / (double)period);
-
-    (void) fflush(stdout);
   }
+  if (e->num_mapped) free(e->table[0]);
+  hostdb_close(e->host_image);
+  e->host_image = e->host_db = NULL;
+  e->num_mapped = 0;
+
+  for (i=0; i<e->num_rollups; i++) {
+    if (!e->rollups[i]->group) free(e->rollups[i]->name);  /* a group's is its own */
+    free(e->rollups[i]);
+  }
+  for (i=0; i<e->num_groups; i++) {
+    free(e->groups[i]->name);
+    if (e->groups[i]->command != e->command) free(e->groups[i]->command);
+    free(e->groups[i]);
+  }
+  free(e->rollups);
+  free(e->prefix_hash);
+  free(e->groups);
+  free(e->routers);
+  free(e->table);
+  free(e->deadline_heap);
+  free(e->down_list);
+  free(e->outage_list);
+  free(e->flap_list);
+  free(e->sent_list);
+  free(e->name_hash);
+  free(e->addr_hash);
 }
 
+/*
+ * Close everything ls_start opened, and free the hosts and the engine.
+ */
 void
-hangup()
+ls_close(e)
+LS_ENGINE *e;
 {
-  printf("%s SIGHUP received\n", curr_time());
+  hist_close(e->hist);  /* writes out what is still queued */
+  ctl_close(e->ctl);
+  sub_close(e->subs);
+  cluster_leave(e->cluster);  /* the others take over our slice */
+  cluster_ring_free(e->slice_ring);
+  capture_close(e->capture);
+  ring_close(e->ring);
+  xdp_close(e->xdp);
+  arp_close(e->arp);
+  trace_close(e->trace);
+  free(e->pace);
+  if (e->conn_poll >= 0) close(e->conn_poll);
+  if (e->syn_sock >= 0)  close(e->syn_sock);
+  if (e->syn_hold >= 0)  close(e->syn_hold);
+  if (e->sock >= 0)      close(e->sock);
+  free_hosts(e);
+  free(e->cluster_last);
+  free(e);
+}
 
-  /* Display downtime report */
-  display_report();
+#ifndef LIBLINKSTAT
 
-  close(sock);
-  exit(0);
-}
+static LS_ENGINE *the_engine = NULL;  /* main's, for SIGUSR1 */
 
 void
-process_host_list (argc, argv, filename)
-     int argc;
-     char **argv;
-     char *filename;
+usr2()
 {
-  num_hosts=0;
-  num_local_hosts=0;
-
-  if (argc > 1 && *argv) {
-    printf("Create Table Entries for:");
-    while (*argv) {
-      if ((table[num_hosts]=create_host_entry(*argv,NULL,0,retry,0,0)) != NULL) {
-        printf(" %s", *argv);
-        num_hosts++;
-        num_local_hosts++;
-        if (num_hosts == MAX_HOSTS)
-	  crash_and_burn("process_host_list: MAX_HOSTS reached !");
-      }
-      ++argv;
-    }
-    printf("\n");
-  } else if (filename) {
-    FILE *ping_file;
-    char line[132];
-    char host[132],ip_addr[132],*p;
-    int count,schedule,uniq_retry;
-    short from,until;
+  report_now = 1;  /* picked up by the main loop */
+  signal(SIGUSR2,usr2);
+}
 
-    if (strcmp(filename,"-")==0) {
-      ping_file=fdopen(0,"r");
-    } else {
-      ping_file=fopen(filename,"r");
-    }
-    if (!ping_file) errno_crash_and_burn("process_host_list: fopen");
-    printf("Create Table Entries for:");
-    while(fgets(line,132,ping_file)) {
-      count=sscanf(line,"%131s %131s # (int=%d,ret=%d,mon=%hd:%hd",ip_addr,host,&schedule,&uniq_retry,&from,&until);
-      if (count > 0) {
-	if (ip_addr[0] == '#') continue;
-	if (count > 1) {
-	  /* Assume that we read in a host file entry */
-	  p=(char*)malloc(strlen(host)+1);
-	  if (!p) crash_and_burn("process_host_list: can't malloc host");
-	  strcpy(p,host);
+/*
+ * The flight recorder is dumped there and then, even if the main loop
+ * is stuck, so it is written straight to the log without stdio.
+ */
+void
+trace_log(arg, line)
+void *arg; char *line;
+{
+  (void) arg;
+  if (write(1, line, strlen(line)) < 0) return;  /* nowhere to say */
+}
 
-	  if (count <3) schedule=0;
-	  if (count <4) uniq_retry=retry;
-	  if (count <6) {from=0;until=0;}
+void
+usr1()
+{
+  if (the_engine) trace_dump(the_engine->trace, TRACE_EVENTS, trace_log, NULL);
+  signal(SIGUSR1,usr1);
+}
 
-	  if ((table[num_hosts]=create_host_entry(p,ip_addr,schedule,uniq_retry,from,until)) != NULL) {
-	    if (schedule) { 
-	      printf(" %s(%d", p, schedule);
-	      if (uniq_retry != retry)
-		printf(",%d", uniq_retry);
-	      if (until)
-		printf(",%hd-%hd", from, until);
-	      printf(")");
-	    } else {
-	      num_local_hosts++;
-	      printf(" %s", p);
-	    }
-	    num_hosts++;
-	  }
-	} else {
-	  /* Assume we only entered a host name */
-	  p=(char*)malloc(strlen(ip_addr)+1);
-	  if (!p) crash_and_burn("process_host_list: can't malloc host");
-	  strcpy(p,ip_addr);
-	  if ((table[num_hosts]=create_host_entry(p,NULL,0,retry,0,0)) != NULL) {
-	    printf(" %s", p);
-	    num_hosts++;
-	    num_local_hosts++;
-	  }
-	}
-        if (num_hosts == MAX_HOSTS)
-	  crash_and_burn("process_host_list: MAX_HOSTS reached !");
-      }
-    }
-    fclose(ping_file);
-    printf("\n");
-  } else usage(7);
+/*
+ * The capture has been replayed: how quickly the hosts going down were
+ * picked up and how many of them were false alarms, then the report.
+ */
+void
+replay_done(e)
+LS_ENGINE *e;
+{
+  REPLAY_STATS s;
+  int real;
+
+  replay_stats(e->replaying, &s);
+  real = s.downs - s.false_downs;
+  printf("%s Replayed %lds of probes in %.2fs (%.0fx), sending %ld\n", curr_time(), s.span, s.wall, s.wall > 0 ? s.span / s.wall : 0.0, s.probes);
+  printf("%s Hosts went down %d time%s, %d false alarm%s, detected in %ldms on average (%ldms at worst)\n", curr_time(), s.downs, (s.downs == 1 ? "" : "s"), s.false_downs, (s.false_downs == 1 ? "" : "s"), real > 0 ? s.latency_total / real : 0L, s.latency_max);
+  display_report(e, (GROUP_ENTRY *) NULL);
+}
 
-  if (num_hosts == 0) {
-    printf("No valid hosts!\n");
-    exit(1);
-  }
-}  
+void
+hangup()
+{
+  hangup_now = 1;  /* picked up by the main loop */
+  signal(SIGHUP,hangup);
+}
 
 void
-process_command_line (argc, argv)
+process_command_line (e, argc, argv)
+     LS_ENGINE *e;
      int argc;
      char **argv;
 {
   extern char *optarg;
   char *filename = NULL;
   char *progname;             /* The name of this program. */
-  char  option;
+  int   option;
   char *log_file = NULL;
+  char *p;
 
   static struct option long_options[] =
   {
@@ -1142,6 +5974,30 @@ process_command_line (argc, argv)
     {"log",         1,   0,  'l'},
     {"notify",      1,   0,  'n'},
     {"mac_check",   0,   0,  'm'},
+    {"rto_min",     1,   0,  'o'},
+    {"confirm_rate",1,   0,  'c'},
+    {"subnet",      1,   0,  'g'},
+    {"dep_interval",1,   0,  'k'},
+    {"ring",        1,   0,  'p'},
+    {"xdp",         1,   0,  'x'},
+    {"txtime",      1,   0,  'e'},
+    {"busy_poll",   1,   0,  'b'},
+    {"cpu",         1,   0,  'a'},
+    {"arp",         1,   0,  'y'},
+    {"history",     1,   0,  'j'},
+    {"query",       1,   0,  'q'},
+    {"control",     1,   0,  'z'},
+    {"cycle",       1,   0,  'w'},
+    {"compile",     1,   0,  'K'},
+    {"output",      1,   0,  'O'},
+    {"cluster",     1,   0,  'C'},
+    {"aggregate",   1,   0,  'A'},
+    {"key",         1,   0,  'Y'},
+    {"capture",     1,   0,  'W'},
+    {"replay",      1,   0,  'R'},
+    {"detect",      1,   0,  'D'},
+    {"prefix",      1,   0,  'P'},
+    {"stream",      1,   0,  'S'},
     {"help",        0,   0,  'h'},
     {"version",     0,   0,  'v'},
     {0, 0, 0, 0}
@@ -1158,33 +6014,97 @@ process_command_line (argc, argv)
   while ((option = _getopt_internal(argc, argv, "n:t:i:r:u:f:s:l:d:mhv", long_options, 0, 1)) != -1)
 **/
   int option_index=0;
-  while ((option = getopt_long(argc, argv, "n:t:i:r:u:f:s:l:d:mhv", long_options, &option_index)) != (char)-1)
+  while ((option = getopt_long_only(argc, argv, "n:t:i:r:u:f:s:l:d:mhv", long_options, &option_index)) != -1)
     switch (option) {
-      case 't': if ((timeout=atoi(optarg)) <0) usage(1);  break;
-      case 'i': if ((interval=atoi(optarg)) <0) usage(2); break;
-      case 'r': if ((retry=atoi(optarg)) <1) usage(3);    break;
-      case 'u': if ((update=atoi(optarg)) <1) usage(4);   break;
-      case 's': if ((slarep=atol(optarg)) <1) usage(5);   break;
-      case 'd': if ((debug=atoi(optarg)) <0) usage(6);    break;
+      case 't': if ((e->timeout=num_arg(optarg, 1)) <0) usage(1);  break;
+      case 'i': if ((e->interval=num_arg(optarg, 2)) <0) usage(2); break;
+      case 'r': if ((e->retry=num_arg(optarg, 3)) <1) usage(3);    break;
+      case 'u': if ((e->update=num_arg(optarg, 4)) <1) usage(4);   break;
+      case 's': if ((e->slarep=num_arg(optarg, 5)) <1) usage(5);   break;
+      case 'd': if ((e->debug=num_arg(optarg, 6)) <0) usage(6);    break;
       case 'f': filename= optarg;                         break;
       case 'l': log_file= optarg;                         break;
-      case 'n': command= optarg;                          break;
-      case 'm': check_hw=1;                               break;
+      case 'n': e->command= optarg;                          break;
+      case 'm': e->check_hw=1;                               break;
+      case 'o': if ((e->rto_min=num_arg(optarg, 9)) <1) usage(9);  break;
+      case 'c': if ((e->confirm_rate=num_arg(optarg, 10)) <1) usage(10); break;
+      case 'g': if ((e->subnet=num_arg(optarg, 11)) <0 || e->subnet >32) usage(11); break;
+      case 'k': if ((e->dep_interval=num_arg(optarg, 12)) <1) usage(12); break;
+      case 'p': e->ring_if= optarg;                          break;
+      case 'x': e->xdp_if= optarg;                           break;
+      case 'e': e->txtime= optarg;                           break;
+      case 'b': if ((e->busy_poll=num_arg(optarg, 15)) <0) usage(15); break;
+      case 'a': if ((e->cpu=num_arg(optarg, 16)) <0) usage(16);     break;
+      case 'y': e->arp_if= optarg;                           break;
+      case 'j': e->hist_dir= optarg;                         break;
+      case 'q': query= optarg;                            break;
+      case 'z': e->ctl_path= optarg;                         break;
+      case 'S': e->sub_path= optarg;                         break;
+      case 'w': if ((e->cycle_plan=num_arg(optarg, 18)) <0) usage(18); break;
+      case 'K': compile_src= optarg;                      break;
+      case 'O': compile_out= optarg;                      break;
+      case 'C': e->cluster_spec= optarg;                     break;
+      case 'A': if ((p = strrchr(optarg, ':')) != NULL) {
+                  *p++ = '\0';
+                  aggregate_addr = optarg;
+                } else
+                  p = optarg;
+                if ((aggregate_port=num_arg(p, 20)) <1 || aggregate_port >65535) usage(20);
+                break;
+      case 'Y': cluster_keyfile= optarg;                  break;
+      case 'W': e->capture_file= optarg;                     break;
+      case 'R': e->replay_file= optarg;                      break;
+      case 'D': if ((e->max_detect=num_arg(optarg, 22)) <0) usage(22); break;
+      case 'P': if ((e->prefix_bits=num_arg(optarg, 23)) <0 || e->prefix_bits >32) usage(23); break;
       case 'v': version_display_info(2); exit(0);
       case 'h':
             printf("usage: %s [-help] [-mac_check] [-log <log_file>] [-timeout <delay>]\n", progname);
             printf("                [-interval <delay>] [-retry <num>] [-update <delay>]\n");
+            printf("                [-rto_min <delay>] [-confirm_rate <num>]\n");
+            printf("                [-subnet <bits>] [-dep_interval <delay>] [-prefix <bits>]\n");
+            printf("                [-ring <interface>] [-xdp <interface>] [-txtime <qdisc>]\n");
+            printf("                [-busy_poll <usecs>] [-cpu <num>] [-arp <interface>]\n");
+            printf("                [-history <dir>] [-query <host>[:days]]\n");
+            printf("                [-control <socket>] [-stream <socket>] [-cycle <delay>]\n");
+            printf("                [-detect <secs>] [-compile <file> -output <image>]\n");
+            printf("                [-cluster <node>@<host>:<port>] [-aggregate [<addr>:]<port>]\n");
+            printf("                [-key <file>]\n");
+            printf("                [-capture <pcap>] [-replay <pcap>]\n");
             printf("                [-notify <command>] [-file file | hosts...]\n\n");
             printf("    -mac_check\t\tcheck hardware (MAC) addresses of responding hosts\n");
             printf("    -timeout #\t\tdelay between polls (default %d msecs)\n", DEFAULT_TIMEOUT);
             printf("    -interval #\t\tdelay between packets (default %d msecs)\n", DEFAULT_INTERVAL);
             printf("    -retry #\t\tnumber of retries to a host (default %d)\n", DEFAULT_RETRY);
+            printf("    -rto_min #\t\tminimum retransmission timeout (default %d msecs)\n", DEFAULT_RTO_MIN);
+            printf("    -confirm_rate #\tmax re-probes of suspect hosts (default %d/sec)\n", DEFAULT_CONFIRM);
+            printf("    -subnet #\t\tgroup hosts by subnet prefix length (default off)\n");
+            printf("    -dep_interval #\tprobe interval during an outage (default %d secs)\n", DEFAULT_DEP_INT);
+            printf("    -prefix #\t\troll the hosts up by prefix length for the status (default off)\n");
+            printf("    -ring interface\treceive replies through a packet ring (TPACKET_V3)\n");
+            printf("    -xdp interface\tsend and receive through an AF_XDP socket\n");
+            printf("    -txtime qdisc\tpace probes in the kernel (qdisc is fq or etf)\n");
+            printf("    -busy_poll #\tspin for replies before sleeping (usecs)\n");
+            printf("    -cpu #\t\trun on this CPU (for use with busy_poll)\n");
+            printf("    -arp interface\tprobe local hosts on its subnets by ARP\n");
+            printf("    -history dir\trecord state changes and RTT/loss summaries\n");
+            printf("    -query host\t\treport the history of a host (or all) and exit\n");
+            printf("    -control socket\ttake commands on this Unix domain socket\n");
+            printf("    -stream socket\tstream state changes to subscribers on this Unix domain socket\n");
+            printf("    -cycle #\t\tplanned cycle time, lower pri= classes shed beyond it (msecs)\n");
+            printf("    -detect #\t\tprobe stable hosts less often, detecting failures within it (secs)\n");
+            printf("    -cluster node@host:port\tprobe this node's slice, reporting to the aggregator\n");
+            printf("    -aggregate [addr:]#\tmerge the reports of the cluster nodes on this UDP port (addr default 127.0.0.1)\n");
+            printf("    -key file\t\tsign and check the cluster messages with the shared key in it\n");
+            printf("    -capture pcap\tcapture the probes and replies in a pcap file\n");
+            printf("    -replay pcap\treplay a capture through the engine at full speed, and exit\n");
             printf("    -update #\t\tfrequency of statistical updates (default %d secs)\n", DEFAULT_UPDATE);
             printf("    -notify command\tcommand to run during state changes\n");
             printf("    -slarep #\t\tdelay (sec) before SLA Report is run (default 5pm)\n");
-            printf("    -file file\t\tfile to read list of hosts\n");
+            printf("    -file file\t\tfile to read list of hosts (or a compiled image)\n");
+            printf("    -compile file\tcompile a hosts file into an image (-output), and exit\n");
             printf("    -log file\t\tfile to log output when detached from terminal\n\n");
-            printf("note: only the first letter of each argument is required.\n\n");
+            printf("note: an option may be shortened to any part of it that is unambiguous,\n");
+            printf("      -t -i -r -u -s -d -f -l -n -m -h and -v are single letters as before.\n\n");
             printf("examples:\n");
             printf("    %s -l log -f /etc/hosts\n", progname);
             exit(-1);
@@ -1195,19 +6115,51 @@ process_command_line (argc, argv)
 
   argv = &argv[optind];
   if (*argv && filename)   { usage(8); }
+  if (e->ring_if && e->xdp_if)   { usage(13); }
+  if (e->txtime && e->xdp_if)    { usage(14); }
+  if (e->txtime && strcmp(e->txtime, "fq") && strcmp(e->txtime, "etf")) { usage(14); }
+  if (query && !e->hist_dir)  { usage(17); }
+  if (query)               { history_report(e, query); exit(0); }
+  if (!compile_src != !compile_out || (compile_src && (*argv || filename))) { usage(19); }
+  if (e->cluster_spec && (aggregate_port || !strchr(e->cluster_spec, '@') || !strchr(e->cluster_spec, ':'))) { usage(20); }
+  if (cluster_keyfile && !e->cluster_spec && !aggregate_port) { usage(20); }
+  if (cluster_keyfile && cluster_key(cluster_keyfile) < 0) {
+    printf("Unable to read the cluster key from %s (%s)\n", cluster_keyfile, strerror(errno));
+    exit(20);
+  }
+  if (e->replay_file && (e->ring_if || e->xdp_if || e->txtime || e->arp_if || e->busy_poll || e->hist_dir || e->ctl_path || e->sub_path ||
+                      e->cluster_spec || aggregate_port || e->capture_file || e->check_hw)) { usage(21); }
+  if (aggregate_port) {
+    /* No hosts of our own, just the merged view of the nodes */
+    if (log_file) detachFromTTY(log_file);
+    exit(cluster_aggregate(aggregate_addr, aggregate_port, e->update));
+  }
   if (!*argv && !filename) { filename = "-"; }
+  /* Once a capture is open for replay, the clock runs from it */
+  if (e->replay_file && (e->replaying = replay_open(e->replay_file)) == NULL) {
+    printf("Unable to replay %s (%s)\n", e->replay_file, errno == ENODATA ? "no echo requests in it" :
+           (errno == EINVAL ? "not a pcap file" : strerror(errno)));
+    exit(21);
+  }
   
   /*
    * Sanity Check on some parameters
    */
-  if (interval < MIN_INTERVAL) interval = MIN_INTERVAL;
-  min_interval = interval;
-  if (timeout < MIN_TIMEOUT) timeout = MIN_TIMEOUT;
-  if (retry < 1) retry = 1;
+  sane_params(e);
+
+  if (compile_src) {
+    /* Parse and resolve it as usual, then write out the image */
+    if (hostdb_is_image(compile_src)) crash_and_burn("process_command_line: already compiled");
+    process_host_list (e, 0, (char **) NULL, compile_src);
+    if (compile_host_db(e, compile_src, compile_out) < 0)
+      errno_crash_and_burn("process_command_line: compile_host_db");
+    printf("Compiled %d hosts (%d groups) into %s\n", e->num_hosts, e->num_groups, compile_out);
+    exit(0);
+  }
 
-  process_host_list (argc, argv, filename);
+  process_host_list (e, argc, argv, filename);
 
-  printf("Done!  %d hosts (%d local)\n",num_hosts,num_local_hosts);
+  printf("Done!  %d hosts (%d local)\n",e->num_hosts,e->num_local_hosts);
   (void) fflush(stdout);
 
   if (log_file) detachFromTTY(log_file);
@@ -1218,234 +6170,39 @@ main(argc,argv)
      int argc;
      char ** argv;
 {
-  int i, cycles;
-  struct protoent *proto;
-  struct tm *timeptr;
-  time_t sys_clock;
-  short  sys_time;
-  struct tm *the_time;
-  ident = getpid() & 0xFFFF;
-
-  process_command_line(argc, argv);
-
-  if ((proto = getprotobyname("icmp")) == NULL) {
-    printf("icmp: unknown protocol\n");
-    exit(-1);
-  }
-  
-  sock = socket(AF_INET, SOCK_RAW, proto->p_proto);
-  if (sock<0) errno_crash_and_burn("main: socket");
+  LS_ENGINE *e;
 
-  /* Initialize Index Entries */
-  gettimeofday(&current_time, &tz);
-  for( i=0; i < num_hosts; i++ ) {
-    table[i]->alive = 1;            /* Assume all hosts initially live */
-    table[i]->response = retry;     /* Set number of times to retry host */
-    table[i]->i = i;                /* Quick index into table */
+  /* The command line sets up the engine, and adds the hosts to it */
+  if ((e = new_engine()) == NULL) errno_crash_and_burn("main: calloc");
+  process_command_line(e, argc, argv);
 
-    /* Set the time to receive its first packet (now) */
-    table[i]->next_time.tv_sec = current_time.tv_sec;
+  /* Nodes of a cluster pass their state changes up to the aggregator */
+  if (e->cluster_spec) {
+    e->cb.state = cluster_state;
+    e->cb.rtt   = cluster_rtt;
+    e->cb.arg   = e;
   }
 
+  the_engine = e;
   signal(SIGHUP,hangup);
+  signal(SIGUSR1,usr1);
+  signal(SIGUSR2,usr2);
 
-  /*
-   * Changed the following signal-based status updates to a time
-   * base system.  The signals were interupting processing causing
-   * errors in the displayed data.
-   */
-
-  /*
-   * The following is a little like alarm() but will send the first signal
-   * after 5 seconds and then every "update" seconds after that
-   *
-  interval_timer.it_value.tv_sec  = 5;
-  interval_timer.it_value.tv_usec = 0;
-  interval_timer.it_interval.tv_sec  = update;
-  interval_timer.it_interval.tv_usec = 0;
-  signal(SIGALRM,alarmtout);
-  setitimer(ITIMER_REAL, &interval_timer, NULL);
-   *
-   */
-
-  cycles = 0;
-  baseline = time(NULL) - update + 5;  /* first display after 5 seconds */
-  start_time = time(NULL);
-
-  if (slarep)
-    report_time = time(NULL) + slarep;
-  else {
-    /*
-     * Default: If started before 5pm then a SLA report will be
-     *          produced at, or near after, 5pm.  The exact time
-     *          that the SLA report will be produced will depend
-     *          on the time between updates (value of update).
-     */
-    timeptr = localtime(&start_time);
-    if (timeptr->tm_hour < 17) {
-      timeptr->tm_hour = 17;
-      timeptr->tm_min = 0;
-      timeptr->tm_sec = 0;
-      report_time = mktime(timeptr);
-    } else {
-      report_time = 0;
-    }
-  }
-
-  printf("%s LinkStat v%s (%s)\n", curr_time(),version_get_str(),version_get_rel_date());
-
-  /*printf("%s Polling %d hosts with a %ds timeout, %d retries, %ds updates, %d ident\n", curr_time(),num_hosts,timeout/1000,retry,update,ident);*/
-  printf("%s Loaded %d host%s, using %ds updates, %d ident\n", curr_time(),num_hosts,(num_hosts == 1 ? "" : "s"),update,ident);
-  printf("%s Polling %d host%s with a %ds timeout, %d retries\n", curr_time(),num_local_hosts,(num_local_hosts == 1 ? "" : "s"),timeout/1000,retry);
-
-  if (num_hosts - num_local_hosts > 0)
-    printf("%s Polling %d remote hosts with various timeouts\n", curr_time(),num_hosts-num_local_hosts);
-  if (report_time)
-    printf("%s Service Level Report will be produced on %s", curr_time(), ctime(&report_time));
-  (void) fflush(stdout);
-
-  while (1) {
-    /*
-     * Start a new cycle - count the number of times we poll in each
-     * interval.  Keep a track of how many local hosts we are waiting
-     * on for a reponse.
-     */
-
-    cycles++;
-
-    /*
-     * Update the sys_time to contain the current system time in 24hr format
-     */
-    sys_clock = time(NULL);
-    the_time = localtime(&sys_clock);
-    sys_time = the_time->tm_hour * 100 + the_time->tm_min;
-
-    /*
-     * Start collecting results, one at a time with
-     * a possible pause of "interval" milliseconds.
-     * At the same time, initialize the results table
-     * for each scheduled entry.
-     */
-    for (i=0; i<num_hosts; i++) {
-      if (table[i]->monitor_until && (sys_time < table[i]->monitor_from || sys_time > table[i]->monitor_until))
-	continue;
-
-      gettimeofday(&current_time, &tz);
-      if (table[i]->next_time.tv_sec <= current_time.tv_sec) {
-        /*
-         * Ready to send the next packet to this host
-         */
-
-	if ((table[i]->response != table[i]->retry) &&
-	    (table[i]->alive) &&
-	    (table[i]->packet_schedule == 0)) {
-	  /*
-	   * We have been around a full cycle with no response
-           * from this (local) host - lets re-evalutate the interval.
-	   */
-	  queue_len++;
-	}
-	if (table[i]->response) table[i]->response--;
-
-        /*
-         * Ship off a packet and wait (a little while) for
-         * one's return.  This gives the network interface
-         * a possible break between probes.
-         */
-	send_ping(sock,table[i]);
-	wait_for_reply(sock,interval);
-
-        /*
-         * Update schedule for the next packet to this host
-	 */
-        table[i]->next_time.tv_sec += table[i]->packet_schedule;
-
-	/*
-	 * For every ~10 packets sent, give any queued packets a
-         * chance to be cleared.  This is required as the above
-         * wait_for_reply(s,interval) will always return immediately
-         * as soon as we get behind in processing traffic.
-	 */
-	if (i % 10 == 9 || i == (num_hosts-1)) while (wait_for_reply(sock,1));
-
-      }
-    }
-
-    if (time(NULL) >= (baseline + update)) {
-      if (!check_hw)
-        printf("%s Waiting on %d (%d unreachable), I:%dms R:%d C:%d\n", curr_time(), queue_len, num_local_unreachable, interval, optimal_retry, cycles);
-      else
-        printf("%s Waiting on %d (%d unreachable), I:%dms R:%d C:%d M:%d\n", curr_time(), queue_len, num_local_unreachable, interval, optimal_retry, cycles, macs_checked);
-
-      (void) fflush(stdout);
-      cycles=0;
-      optimal_retry=0;
-      baseline = time(NULL);
-
-      if (report_time && baseline >= report_time) {
-        display_report();
-      }
-    }
-
-    /*
-     * Adjust the inter-packet interval if we are not allowing
-     * enough time during the intervals for the packets to return.
-     */
-
-    if (queue_len > 0) {
-      /*
-       * If we are still waiting on some hosts then increase the interval
-       * (to let the hosts catch up).  At this point also disable the
-       * negative adjustment of the same interval.  (May like to look into
-       * resetting this timer)
-       */
-      interval+=2;        /* add 2ms to the interval between packets */
-      queue_len=0;        /* reset the counter */
-      adjusting=0;        /* zero adjustment value */
-    } else if ((adjusting++ > 9) &&
-	       (interval > min_interval)) {
-      /*
-       * If we are not waiting for any hosts then decrease the interval
-       * timer (to speed up the polling interval), but do not go below
-       * the initially specified interval.
-       */
-      interval-=(adjusting/10);  /* decrease the interval */
-      if (interval < min_interval) {
-	/* if we are below the minimum then set the interval to the
-	   minimum and hold off adjustment, until the next increment */
-	interval = min_interval;
-	adjusting= -32000;
-      }
-    }
+  if (ls_start(e) < 0) errno_crash_and_burn("main: socket");
 
-    /*
-     * The following will clear any waiting packets and
-     * cause a pause of timeout/1000 seconds
-     */
-    while (wait_for_reply(sock,timeout));
+  /* Probe the hosts, cycle after cycle, until we get a SIGHUP */
+  ls_step(e, -1);
+  if (hangup_now) {
+    printf("%s SIGHUP received\n", curr_time());
 
-    /*
-     * Find all hosts that are no longer reachable
-     */
-    for( i=0; i < num_hosts; i++ ) {
-      static char msg[255];
-      if ((table[i]->response < 1) && table[i]->alive) {
-	if (table[i]->packet_schedule == 0)
-	  num_local_unreachable++;
-	if (table[i]->first_time.tv_sec)
-	  snprintf(msg, 255, "%s %s is unreachable, after %s",curr_time(), table[i]->host, timeval_diff(table[i]->first_time, table[i]->last_time));
-	else
-	  snprintf(msg, 255, "%s %s is unreachable",curr_time(), table[i]->host);
-	printf("%s\n", msg);
-	(void) fflush(stdout);
-        table[i]->alive=0;
-	table[i]->downtime_cnt++;
-	if (command) notify_command(table[i]->host, "down", msg);
-      }
-    }
-  }
+    /* Display downtime report */
+    display_report(e, (GROUP_ENTRY *) NULL);
+  } else if (e->replaying)
+    replay_done(e);  /* or the capture runs out */
 
-  /* should not get here as the previous is a loop forever */
-  close(sock);
+  the_engine = NULL;
+  ls_close(e);
   return 0;
 }
+
+#endif /* LIBLINKSTAT */
@@ -0,0 +1,520 @@
+
+/*
+ * Memory mapped (TPACKET_V3) receive ring for ICMP echo replies
+ * (and ARP replies, for the ARP prober).
+ *
+ * The kernel fills blocks of packets in a ring shared with us, so
+ * replies are processed in place, a block at a time, rather than
+ * being copied out by a recvfrom() per packet.  A BPF filter keeps
+ * everything but our own echo replies out of the ring, and the link
+ * layer header comes for free (for MAC address checking).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "ring.h"
+
+#if defined(linux) && defined(PACKET_MMAP)
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <netinet/ip_icmp.h>
+#include <netinet/if_ether.h>
+#include <arpa/inet.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#include <linux/filter.h>
+
+#define RING_BLOCK_SIZE  (1 << 17)  /* bytes in each block of the ring */
+#define RING_BLOCK_NR         32    /* number of blocks in the ring */
+#define RING_FRAME_SIZE     2048    /* nominal frame size */
+#define RING_BLOCK_TOV         1    /* msecs before a partial block is seen */
+
+struct packet_ring {
+  int                 fd;               /* AF_PACKET socket */
+  unsigned char      *map;              /* the mapped ring */
+  size_t              map_len;          /* size of the mapped ring */
+  unsigned int        current;          /* next block to look at */
+};
+
+/****************************************************************************
+* Function Name      :   ring_setup
+* Module ID          :   R(1)
+*
+* Purpose            :   To set up a receive ring behind a BPF filter.
+*
+* Method             :   Opens an AF_PACKET socket using TPACKET_V3, attaches
+*                        the filter, maps its receive ring and binds it to
+*                        the interface.
+*
+* Usage              :   ring_open (R1), ring_open_arp (R1)
+*
+* External References:   (none)
+*
+* Arguments          :   ifname: (data_in)
+*                                The interface to receive on ("any" for all).
+*                        proto:  (data_in)
+*                                The ethertype to receive.
+*                        filter: (data_in)
+*                                The BPF filter program.
+*                        len:    (data_in)
+*                                The number of instructions in the filter.
+*
+* Return Value       :   PACKET_RING *
+*                                The ring, or NULL (with errno set).
+*
+* Input Assertions   :   Must be running with CAP_NET_RAW.
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   (none)
+\***************************************************************************/
+static PACKET_RING *
+ring_setup(ifname, proto, filter, len)
+char *ifname; int proto; struct sock_filter *filter; int len;
+{
+  PACKET_RING *ring;
+  struct tpacket_req3 req;
+  struct sockaddr_ll addr;
+  struct sock_fprog prog;
+  int version = TPACKET_V3, err;
+
+  ring = (PACKET_RING *) calloc(1, sizeof(PACKET_RING));
+  if (!ring) return NULL;
+
+  if ((ring->fd = socket(AF_PACKET, SOCK_RAW, htons(proto))) < 0)
+    goto fail;
+
+  /*
+   * The filter goes on before the socket is bound, so that nothing
+   * else can sneak into the ring in between.
+   */
+  prog.len    = len;
+  prog.filter = filter;
+  if (setsockopt(ring->fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) < 0)
+    goto fail;
+
+  if (setsockopt(ring->fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0)
+    goto fail;
+
+  memset(&req, 0, sizeof(req));
+  req.tp_block_size       = RING_BLOCK_SIZE;
+  req.tp_block_nr         = RING_BLOCK_NR;
+  req.tp_frame_size       = RING_FRAME_SIZE;
+  req.tp_frame_nr         = (RING_BLOCK_SIZE / RING_FRAME_SIZE) * RING_BLOCK_NR;
+  req.tp_retire_blk_tov   = RING_BLOCK_TOV;
+  req.tp_feature_req_word = 0;
+  if (setsockopt(ring->fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0)
+    goto fail;
+
+  ring->map_len = (size_t) RING_BLOCK_SIZE * RING_BLOCK_NR;
+  ring->map = mmap(NULL, ring->map_len, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_LOCKED, ring->fd, 0);
+  if (ring->map == MAP_FAILED) {
+    /* MAP_LOCKED can fail on a tight RLIMIT_MEMLOCK, it is only a hint */
+    ring->map = mmap(NULL, ring->map_len, PROT_READ | PROT_WRITE,
+                     MAP_SHARED, ring->fd, 0);
+    if (ring->map == MAP_FAILED) {
+      ring->map = NULL;
+      goto fail;
+    }
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sll_family   = AF_PACKET;
+  addr.sll_protocol = htons(proto);
+  if (strcmp(ifname, "any") != 0 &&
+      (addr.sll_ifindex = if_nametoindex(ifname)) == 0)
+    goto fail;
+  if (bind(ring->fd, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+    goto fail;
+
+  return ring;
+
+fail:
+  err = errno;
+  ring_close(ring);
+  errno = err;
+  return NULL;
+}
+
+/****************************************************************************
+* Function Name      :   ring_open
+* Module ID          :   R(1)
+*
+* Purpose            :   To set up a receive ring for our ICMP echo replies.
+*
+* Method             :   Opens an AF_PACKET socket using TPACKET_V3, maps
+*                        its receive ring and attaches a BPF filter that
+*                        only passes echo replies carrying our ident, and
+*                        destination unreachables (which are few, the
+*                        caller checks whose probe they hold).
+*
+* Usage              :   main (M1)
+*
+* External References:   (none)
+*
+* Arguments          :   ifname: (data_in)
+*                                The interface to receive on ("any" for all).
+*                        ident:  (data_in)
+*                                The ICMP identifier of our echo requests.
+*
+* Return Value       :   PACKET_RING *
+*                                The ring, or NULL (with errno set).
+*
+* Input Assertions   :   Must be running with CAP_NET_RAW.
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   Linux only.
+\***************************************************************************/
+PACKET_RING *
+ring_open(ifname, ident)
+char *ifname; int ident;
+{
+  struct sock_filter filter[] = {
+    BPF_STMT(BPF_LD  | BPF_H | BPF_ABS, 12),                 /* ethertype */
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETH_P_IP, 0, 11),
+    BPF_STMT(BPF_LD  | BPF_B | BPF_ABS, 23),                 /* protocol */
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_ICMP, 0, 9),
+    BPF_STMT(BPF_LD  | BPF_H | BPF_ABS, 20),                 /* fragment */
+    BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x1fff, 7, 0),
+    BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 14),                 /* IP hlen */
+    BPF_STMT(BPF_LD  | BPF_B | BPF_IND, 14),                 /* ICMP type */
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ICMP_UNREACH, 3, 0),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ICMP_ECHOREPLY, 0, 3),
+    BPF_STMT(BPF_LD  | BPF_H | BPF_IND, 18),                 /* ICMP id */
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, htons((u_short) ident), 0, 1),
+    BPF_STMT(BPF_RET | BPF_K, 0xffff),                       /* accept */
+    BPF_STMT(BPF_RET | BPF_K, 0),                            /* drop */
+  };
+
+  return ring_setup(ifname, ETH_P_IP, filter, sizeof(filter) / sizeof(filter[0]));
+}
+
+/****************************************************************************
+* Function Name      :   ring_open_arp
+* Module ID          :   R(1)
+*
+* Purpose            :   To set up a receive ring for ARP replies.
+*
+* Method             :   As ring_open, with a BPF filter that only passes
+*                        ARP replies (the caller checks who they are for).
+*
+* Usage              :   arp_open (A1)
+*
+* External References:   (none)
+*
+* Arguments          :   ifname: (data_in)
+*                                The interface to receive on.
+*
+* Return Value       :   PACKET_RING *
+*                                The ring, or NULL (with errno set).
+*
+* Input Assertions   :   Must be running with CAP_NET_RAW.
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   Linux only.
+\***************************************************************************/
+PACKET_RING *
+ring_open_arp(ifname)
+char *ifname;
+{
+  struct sock_filter filter[] = {
+    BPF_STMT(BPF_LD  | BPF_H | BPF_ABS, 12),                 /* ethertype */
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETH_P_ARP, 0, 3),
+    BPF_STMT(BPF_LD  | BPF_H | BPF_ABS, 20),                 /* opcode */
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ARPOP_REPLY, 0, 1),
+    BPF_STMT(BPF_RET | BPF_K, 0xffff),                       /* accept */
+    BPF_STMT(BPF_RET | BPF_K, 0),                            /* drop */
+  };
+
+  return ring_setup(ifname, ETH_P_ARP, filter, sizeof(filter) / sizeof(filter[0]));
+}
+
+/****************************************************************************
+* Function Name      :   ring_fd
+* Module ID          :   R(1)
+*
+* Purpose            :   To return the descriptor to wait on for replies.
+*
+* Method             :   The AF_PACKET socket polls readable as soon as a
+*                        block of the ring has been handed over to us.
+*
+* Usage              :   wait_for_reply (M1)
+*
+* External References:   (none)
+*
+* Arguments          :   ring: (data_in)
+*                                The ring.
+*
+* Return Value       :   int
+*                                The file descriptor.
+*
+* Input Assertions   :   ring was returned by ring_open.
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   (none)
+\***************************************************************************/
+int
+ring_fd(ring)
+PACKET_RING *ring;
+{
+  return ring->fd;
+}
+
+/****************************************************************************
+* Function Name      :   ring_read
+* Module ID          :   R(1)
+*
+* Purpose            :   To process all of the replies waiting in the ring.
+*
+* Method             :   Walks each block the kernel has handed over, calls
+*                        the handler for every packet in place, and then
+*                        hands the block back to the kernel.
+*
+* Usage              :   wait_for_reply (M1)
+*
+* External References:   (none)
+*
+* Arguments          :   ring:    (data_in)
+*                                 The ring.
+*                        handler: (data_in)
+*                                 Called with each packet (from the network
+*                                 header), its source MAC (NULL if there is
+*                                 none) and timestamp.
+*                        arg:     (data_in)
+*                                 Passed through to the handler.
+*
+* Return Value       :   int
+*                                The number of packets handled.
+*
+* Input Assertions   :   ring was returned by ring_open.
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   Packets we sent ourselves (seen on loopback) are
+*                        skipped.
+\***************************************************************************/
+int
+ring_read(ring, handler, arg)
+PACKET_RING *ring; ring_handler handler; void *arg;
+{
+  struct tpacket_block_desc *block;
+  struct tpacket3_hdr *pkt;
+  struct sockaddr_ll *sll;
+  struct timeval stamp;
+  static unsigned char zero_mac[ETH_ALEN];
+  unsigned char mac[14];
+  unsigned int i;
+  int count = 0, has_mac;
+
+  for (;;) {
+    block = (struct tpacket_block_desc *)
+            (ring->map + (size_t) ring->current * RING_BLOCK_SIZE);
+    if (!(block->hdr.bh1.block_status & TP_STATUS_USER))
+      break;
+
+    pkt = (struct tpacket3_hdr *)
+          ((unsigned char *) block + block->hdr.bh1.offset_to_first_pkt);
+    for (i = 0; i < block->hdr.bh1.num_pkts; i++) {
+      sll = (struct sockaddr_ll *)
+            ((unsigned char *) pkt + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+
+      if (sll->sll_pkttype != PACKET_OUTGOING &&
+          pkt->tp_net > pkt->tp_mac) {
+        /*
+         * Source MAC, padded out the same as an ARP cache entry.  The
+         * loopback interface has an all zero one, which is no use.
+         */
+        memset(mac, 0, sizeof(mac));
+        if (pkt->tp_net - pkt->tp_mac >= ETH_HLEN)
+          memcpy(mac, (unsigned char *) pkt + pkt->tp_mac + ETH_ALEN, ETH_ALEN);
+        has_mac = memcmp(mac, zero_mac, ETH_ALEN) != 0;
+
+        stamp.tv_sec  = pkt->tp_sec;
+        stamp.tv_usec = pkt->tp_nsec / 1000;
+
+        handler(arg, (unsigned char *) pkt + pkt->tp_net,
+                (int) pkt->tp_snaplen - (pkt->tp_net - pkt->tp_mac),
+                has_mac ? mac : NULL, &stamp);
+        count++;
+      }
+      pkt = (struct tpacket3_hdr *) ((unsigned char *) pkt + pkt->tp_next_offset);
+    }
+
+    /* Hand the block back */
+    __sync_synchronize();
+    block->hdr.bh1.block_status = TP_STATUS_KERNEL;
+    ring->current = (ring->current + 1) % RING_BLOCK_NR;
+  }
+  return count;
+}
+
+/****************************************************************************
+* Function Name      :   ring_close
+* Module ID          :   R(1)
+*
+* Purpose            :   To release a receive ring.
+*
+* Method             :   Unmaps the ring and closes the socket.
+*
+* Usage              :   ring_open (R1)
+*
+* External References:   (none)
+*
+* Arguments          :   ring: (data_in)
+*                                The ring.
+*
+* Return Value       :   (none)
+*
+* Input Assertions   :   (none)
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   (none)
+\***************************************************************************/
+void
+ring_close(ring)
+PACKET_RING *ring;
+{
+  if (!ring) return;
+  if (ring->map) munmap(ring->map, ring->map_len);
+  if (ring->fd >= 0) close(ring->fd);
+  free(ring);
+}
+
+/****************************************************************************
+* Function Name      :   ring_divert
+* Module ID          :   R(1)
+*
+* Purpose            :   To stop a raw socket from receiving replies that
+*                        are being taken from the ring.
+*
+* Method             :   Attaches a BPF filter that drops every packet, so
+*                        the kernel no longer queues a copy of each reply
+*                        on a socket that is never read.
+*
+* Usage              :   main (M1)
+*
+* External References:   (none)
+*
+* Arguments          :   s: (data_in)
+*                                The raw socket used to send probes.
+*
+* Return Value       :   int
+*                                0 on success, -1 on failure.
+*
+* Input Assertions   :   (none)
+*
+* Output Assertions  :   The socket can still be used to send.
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   (none)
+\***************************************************************************/
+int
+ring_divert(s)
+int s;
+{
+  struct sock_filter filter[] = {
+    BPF_STMT(BPF_RET | BPF_K, 0),
+  };
+  struct sock_fprog prog;
+
+  prog.len    = 1;
+  prog.filter = filter;
+  return setsockopt(s, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog));
+}
+
+#else
+
+/*
+ * Without TPACKET_V3 support the ring can never be opened, and the
+ * normal raw socket receive path is used.
+ */
+PACKET_RING *
+ring_open(ifname, ident)
+char *ifname; int ident;
+{
+  (void) ifname; (void) ident;
+  errno = ENOSYS;
+  return NULL;
+}
+
+PACKET_RING *
+ring_open_arp(ifname)
+char *ifname;
+{
+  (void) ifname;
+  errno = ENOSYS;
+  return NULL;
+}
+
+int
+ring_fd(ring)
+PACKET_RING *ring;
+{
+  (void) ring;
+  return -1;
+}
+
+int
+ring_read(ring, handler, arg)
+PACKET_RING *ring; ring_handler handler; void *arg;
+{
+  (void) ring; (void) handler; (void) arg;
+  return 0;
+}
+
+void
+ring_close(ring)
+PACKET_RING *ring;
+{
+  (void) ring;
+}
+
+int
+ring_divert(s)
+int s;
+{
+  (void) s;
+  return -1;
+}
+
+#endif
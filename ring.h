@@ -0,0 +1,16 @@
+
+#include <sys/time.h>
+
+typedef struct packet_ring PACKET_RING;
+
+/* called for each packet: network header, length, source MAC (or NULL),
+   and receive timestamp */
+typedef void (*ring_handler)(void *arg, unsigned char *pkt, int len,
+                             unsigned char *mac, struct timeval *stamp);
+
+extern PACKET_RING *ring_open(char *ifname, int ident);
+extern PACKET_RING *ring_open_arp(char *ifname);
+extern int ring_fd(PACKET_RING *ring);
+extern int ring_read(PACKET_RING *ring, ring_handler handler, void *arg);
+extern void ring_close(PACKET_RING *ring);
+extern int ring_divert(int s);
@@ -0,0 +1,253 @@
+
+/*
+ * Rolling SLA windows (1h, 24h, 7d and 30d) for a host.
+ *
+ * Each window is a ring of buckets (12 x 5 minutes, 24 x 1 hour,
+ * 28 x 6 hours and 30 x 1 day) holding the downtime and the number of
+ * times the host went down in that bucket.  Buckets are cleared as
+ * time moves past them, so an update touches at most one ring's worth
+ * of buckets, whatever the history, and a report just adds them up.
+ * A window covers the start of its oldest bucket up to now (a little
+ * less than its full length), and the figures are always over exactly
+ * that span, so downtime can never come out more than the period.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "sla.h"
+
+static struct {
+  char               *name;             /* for reports */
+  long                width;            /* secs per bucket */
+  int                 n;                /* buckets in the ring */
+  int                 base;             /* first bucket in SLA_ROLLUP */
+} window[SLA_WINDOWS] = {
+  { "1h",      300, 12,  0 },
+  { "24h",    3600, 24, 12 },
+  { "7d",    21600, 28, 36 },
+  { "30d",   86400, 30, 64 },
+};
+
+/*
+ * Move a window on to the bucket of time t, clearing the buckets it
+ * passes over
+ */
+static void
+advance(r, w, t)
+SLA_ROLLUP *r; int w; time_t t;
+{
+  u_int32_t s = (u_int32_t) (t / window[w].width);
+  int i, b;
+
+  if (s <= r->serial[w]) return;  /* already there (or the clock went back) */
+  if (s - r->serial[w] >= (u_int32_t) window[w].n) {
+    memset(&r->down[window[w].base], 0, window[w].n * sizeof(r->down[0]));
+    memset(&r->count[window[w].base], 0, window[w].n * sizeof(r->count[0]));
+  } else
+    for (i = r->serial[w] + 1; i <= (int) s; i++) {
+      b = window[w].base + i % window[w].n;
+      r->down[b]  = 0;
+      r->count[b] = 0;
+    }
+  r->serial[w] = s;
+}
+
+/****************************************************************************
+* Function Name      :   sla_name
+* Module ID          :   S(1)
+*
+* Purpose            :   To name a window for reports.
+*
+* Method             :   Looks it up.
+*
+* Usage              :   display_windows (M1)
+*
+* External References:   (none)
+*
+* Arguments          :   w: (data_in)
+*                                The window (0 to SLA_WINDOWS - 1).
+*
+* Return Value       :   char *
+*                                Its name, such as "24h".
+*
+* Input Assertions   :   (none)
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   (none)
+\***************************************************************************/
+char *
+sla_name(w)
+int w;
+{
+  return window[w].name;
+}
+
+/****************************************************************************
+* Function Name      :   sla_went_down
+* Module ID          :   S(1)
+*
+* Purpose            :   To count a host going down.
+*
+* Method             :   Adds one to the bucket of that time in each window.
+*
+* Usage              :   mark_unreachable (M1)
+*
+* External References:   (none)
+*
+* Arguments          :   r:    (data_in/out)
+*                                The rollup of the host.
+*                        when: (data_in)
+*                                When it went down.
+*
+* Return Value       :   (none)
+*
+* Input Assertions   :   (none)
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   The downtime itself is added by sla_down once the
+*                        host is back.
+\***************************************************************************/
+void
+sla_went_down(r, when)
+SLA_ROLLUP *r; time_t when;
+{
+  u_int32_t s;
+  int w, b;
+
+  for (w = 0; w < SLA_WINDOWS; w++) {
+    advance(r, w, when);
+    s = (u_int32_t) (when / window[w].width);
+    if (r->serial[w] - s >= (u_int32_t) window[w].n) continue;  /* too old */
+    b = window[w].base + s % window[w].n;
+    if (r->count[b] < 0xffff) r->count[b]++;
+  }
+}
+
+/****************************************************************************
+* Function Name      :   sla_down
+* Module ID          :   S(1)
+*
+* Purpose            :   To add a period of downtime.
+*
+* Method             :   Splits it over the buckets it covers in each
+*                        window, skipping any part too old to be in it.
+*
+* Usage              :   host_answered (M1)
+*
+* External References:   (none)
+*
+* Arguments          :   r:     (data_in/out)
+*                                 The rollup of the host.
+*                        from:  (data_in)
+*                                 Start of the downtime.
+*                        until: (data_in)
+*                                 End of the downtime.
+*
+* Return Value       :   (none)
+*
+* Input Assertions   :   (none)
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   At most SLA_BUCKETS buckets are touched.
+\***************************************************************************/
+void
+sla_down(r, from, until)
+SLA_ROLLUP *r; time_t from, until;
+{
+  time_t t, oldest, end;
+  int w;
+
+  for (w = 0; w < SLA_WINDOWS; w++) {
+    advance(r, w, until);
+    oldest = (time_t) (r->serial[w] - window[w].n + 1) * window[w].width;
+    for (t = (from > oldest ? from : oldest); t < until; t = end) {
+      end = (t / window[w].width + 1) * window[w].width;
+      if (end > until) end = until;
+      r->down[window[w].base + (t / window[w].width) % window[w].n] += end - t;
+    }
+  }
+}
+
+/****************************************************************************
+* Function Name      :   sla_get
+* Module ID          :   S(1)
+*
+* Purpose            :   To report the downtime of a host over a window.
+*
+* Method             :   Moves the window on to now, then adds up its
+*                        buckets, and the current downtime if the host is
+*                        down.
+*
+* Usage              :   display_windows (M1)
+*
+* External References:   (none)
+*
+* Arguments          :   r:          (data_in/out)
+*                                    The rollup of the host.
+*                        w:          (data_in)
+*                                    The window (0 to SLA_WINDOWS - 1).
+*                        now:        (data_in)
+*                                    The current time.
+*                        since:      (data_in)
+*                                    When monitoring started.
+*                        down_since: (data_in)
+*                                    When the host went down, if it is
+*                                    down now, otherwise 0.
+*                        period:     (data_out)
+*                                    The span the figures cover (secs).
+*                        count:      (data_out)
+*                                    Times the host went down in the span.
+*
+* Return Value       :   long
+*                                The downtime in the span (secs).
+*
+* Input Assertions   :   (none)
+*
+* Output Assertions  :   The downtime is no more than the period.
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   (none)
+\***************************************************************************/
+long
+sla_get(r, w, now, since, down_since, period, count)
+SLA_ROLLUP *r; int w; time_t now, since, down_since; long *period; int *count;
+{
+  time_t oldest;
+  long down = 0;
+  int i;
+
+  advance(r, w, now);
+  oldest = (time_t) (r->serial[w] - window[w].n + 1) * window[w].width;
+  if (oldest < since) oldest = since;
+
+  *count = 0;
+  for (i = window[w].base; i < window[w].base + window[w].n; i++) {
+    down   += r->down[i];
+    *count += r->count[i];
+  }
+  if (down_since && down_since < now)
+    down += now - (down_since > oldest ? down_since : oldest);
+
+  *period = now - oldest;
+  if (down > *period) down = *period;
+  return down;
+}
@@ -0,0 +1,18 @@
+
+#include <sys/types.h>
+#include <time.h>
+
+#define SLA_WINDOWS   4   /* 1h, 24h, 7d and 30d */
+#define SLA_BUCKETS  94   /* buckets of all the windows together */
+
+typedef struct sla_rollup {
+  u_int32_t           down[SLA_BUCKETS];    /* secs down in each bucket */
+  u_int16_t           count[SLA_BUCKETS];   /* times gone down in each */
+  u_int32_t           serial[SLA_WINDOWS];  /* newest bucket of each window */
+} SLA_ROLLUP;
+
+extern char *sla_name(int w);
+extern void sla_went_down(SLA_ROLLUP *r, time_t when);
+extern void sla_down(SLA_ROLLUP *r, time_t from, time_t until);
+extern long sla_get(SLA_ROLLUP *r, int w, time_t now, time_t since,
+                    time_t down_since, long *period, int *count);
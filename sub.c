@@ -0,0 +1,719 @@
+
+/*
+ * Event stream, for other programs to follow the state changes as
+ * they happen, without tailing the log or being forked as the notify
+ * command.
+ *
+ * A Unix domain stream socket that subscribers connect to and send a
+ * subscribe line, giving the format (JSON lines, or binary SUB_EVENT
+ * records) and which events, hosts and groups they want:
+ *
+ *   subscribe json events=down,up,outage hosts=web1,web2 groups=core
+ *
+ * Each subscriber has a ring of events waiting to go out, which are
+ * written (without blocking) before each wait of the main loop.  A
+ * subscriber that does not keep up is never waited on: once its ring
+ * is full further events are dropped, and it is told how many (a
+ * "dropped" event) as soon as there is room again.
+ *
+ * The socket is set up, and the subscribe lines read, as the control
+ * socket's commands are (ctl_listen etc. in ctl.c).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sub.h"
+#include "ctl.h"
+
+#define SUB_CLIENTS      8     /* subscribers at once */
+#define SUB_RING      4096     /* events waiting for each (a power of 2) */
+#define SUB_OUT      16384     /* bytes formatted ready to send */
+#define SUB_EVENT_MAX 1024     /* most an event can take, formatted */
+#define SUB_BACKLOG      8     /* connections waiting to be accepted */
+
+static char *type_names[SUB_TYPES] = {
+  "subscribed", "dropped", "down", "up", "rtt", "outage", "restored", "flapping", "settled"
+};
+
+typedef struct sub_client {
+  CTL_CONN           *conn;             /* its connection (fd -1=slot free) */
+  int                 json;             /* format, 1=JSON lines, 0=binary */
+  unsigned int        mask;             /* types wanted (1 << SUB_*), 0=not subscribed */
+  char               *hosts;            /* ",a,b," wanted, NULL=all */
+  char               *groups;           /* ",a,b," wanted, NULL=all */
+  SUB_EVENT          *ring;             /* events waiting */
+  unsigned int        head;             /* next in (free running) */
+  unsigned int        tail;             /* next out */
+  long                lost;             /* dropped since it was last told */
+  int                 out_pos;          /* bytes of out sent */
+  int                 out_len;          /* and formatted */
+  char                out[SUB_OUT];
+} SUB_CLIENT;
+
+struct sub_port {
+  CTL_LISTENER        l;                /* the socket and its subscribers */
+  unsigned int        wanted;           /* types any subscriber wants */
+  long                dropped;          /* events dropped since sub_dropped */
+  SUB_CLIENT          client[SUB_CLIENTS];
+  CTL_CONN            conn[SUB_CLIENTS];
+};
+
+/*
+ * The types that any subscriber wants, after one has come or gone
+ */
+static void
+want(s)
+SUB_PORT *s;
+{
+  int i;
+
+  s->wanted = 0;
+  for (i = 0; i < SUB_CLIENTS; i++)
+    if (s->conn[i].fd >= 0) s->wanted |= s->client[i].mask;
+}
+
+/*
+ * Disconnect a subscriber
+ */
+static void
+drop(s, c)
+SUB_PORT *s; SUB_CLIENT *c;
+{
+  CTL_CONN *conn = c->conn;
+
+  ctl_hangup(conn);
+  free(c->hosts);
+  free(c->groups);
+  free(c->ring);
+  memset(c, 0, sizeof(SUB_CLIENT));
+  c->conn = conn;
+  want(s);
+}
+
+static void
+push(c, ev)
+SUB_CLIENT *c; SUB_EVENT *ev;
+{
+  c->ring[c->head++ & (SUB_RING - 1)] = *ev;
+}
+
+/*
+ * A name list (a,b,c) for filtering on, kept as ",a,b,c," so a name
+ * can be matched whole with strstr.  Each name must fit the event
+ * (shorter than size), or it could never be matched: returns NULL with
+ * errno ENAMETOOLONG if one does not.
+ */
+static char *
+name_list(names, size)
+char *names; int size;
+{
+  char *list, *p, *q;
+
+  for (p = names; (q = strchr(p, ',')) != NULL || *p; p = q + 1) {
+    if ((q ? q - p : (long) strlen(p)) >= size) {
+      errno = ENAMETOOLONG;
+      return NULL;
+    }
+    if (!q) break;
+  }
+  if ((list = (char *) malloc(strlen(names) + 3)) == NULL) return NULL;
+  sprintf(list, ",%s,", names);
+  return list;
+}
+
+/*
+ * Is a name on the list (NULL=all)?  One cut short in the event can't
+ * be, as every name listed fits.
+ */
+static int
+listed(list, name, cut)
+char *list, *name; int cut;
+{
+  char *p;
+  int len = strlen(name);
+
+  if (!list) return 1;
+  if (!len || cut) return 0;
+  for (p = list + 1; (p = strstr(p, name)) != NULL; p++)
+    if (p[-1] == ',' && p[len] == ',') return 1;
+  return 0;
+}
+
+/*
+ * Take a subscribe line, returns 0, or -1 with why in msg.  A second
+ * one replaces the first (the events already waiting still go out).
+ */
+static int
+subscribe(c, line, msg, len)
+SUB_CLIENT *c; char *line, *msg; int len;
+{
+  char *word, *names, *p, *save, *save_types;
+  unsigned int mask = 0;
+  int i, json = 1;
+
+  if ((word = strtok_r(line, " \t", &save)) == NULL || strcmp(word, "subscribe")) {
+    snprintf(msg, len, "expected: subscribe [json|binary] [events=<types>] [hosts=<hosts>] [groups=<groups>]\n");
+    return -1;
+  }
+  free(c->hosts);
+  free(c->groups);
+  c->hosts = c->groups = NULL;
+
+  while ((word = strtok_r(NULL, " \t", &save)) != NULL) {
+    if (!strcmp(word, "json"))
+      json = 1;
+    else if (!strcmp(word, "binary"))
+      json = 0;
+    else if (!strncmp(word, "events=", 7)) {
+      for (p = strtok_r(word + 7, ",", &save_types); p; p = strtok_r(NULL, ",", &save_types)) {
+        for (i = 0; i < SUB_TYPES && strcmp(p, type_names[i]); i++);
+        if (i == SUB_TYPES) {
+          snprintf(msg, len, "unknown event %s (down, up, rtt, outage, restored, flapping, settled)\n", p);
+          return -1;
+        }
+        mask |= 1 << i;
+      }
+    } else if (!strncmp(word, "hosts=", 6) || !strncmp(word, "groups=", 7)) {
+      names = strchr(word, '=') + 1;
+      i = word[0] == 'h' ? SUB_HOST : SUB_GROUP;
+      if ((p = name_list(names, i)) == NULL) {
+        if (errno == ENAMETOOLONG)
+          snprintf(msg, len, "%s names are at most %d long\n", (word[0] == 'h' ? "host" : "group"), i - 1);
+        else
+          snprintf(msg, len, "out of memory\n");
+        return -1;
+      }
+      if (word[0] == 'h') {
+        free(c->hosts);
+        c->hosts = p;
+      } else {
+        free(c->groups);
+        c->groups = p;
+      }
+    } else {
+      snprintf(msg, len, "unknown option %s\n", word);
+      return -1;
+    }
+  }
+
+  if (!mask) mask = ~0U;  /* everything */
+  c->mask = mask | (1 << SUB_HELLO) | (1 << SUB_DROPPED);
+  c->json = json;
+  return 0;
+}
+
+/*
+ * Write a string as JSON, returns its length
+ */
+static int
+json_string(buf, len, str)
+char *buf; int len; char *str;
+{
+  int n = 0;
+
+  for (buf[n++] = '"'; *str && n < len - 8; str++) {
+    if (*str == '"' || *str == '\\') {
+      buf[n++] = '\\';
+      buf[n++] = *str;
+    } else if ((unsigned char) *str < ' ')
+      n += sprintf(buf + n, "\\u%04x", (unsigned char) *str);
+    else
+      buf[n++] = *str;
+  }
+  buf[n++] = '"';
+  return n;
+}
+
+/*
+ * Format an event for a subscriber, returns its length
+ */
+static int
+format(c, ev, buf, len)
+SUB_CLIENT *c; SUB_EVENT *ev; char *buf; int len;
+{
+  struct in_addr in;
+  int n;
+
+  if (!c->json) {
+    memcpy(buf, ev, sizeof(SUB_EVENT));
+    return sizeof(SUB_EVENT);
+  }
+
+  n = snprintf(buf, len, "{\"event\":\"%s\",\"time\":%u.%06u", type_names[ev->type], ev->sec, ev->usec);
+  if (ev->host[0]) {
+    n += snprintf(buf + n, len - n, ",\"host\":");
+    n += json_string(buf + n, len - n, ev->host);
+  }
+  if (ev->addr) {
+    in.s_addr = ev->addr;
+    n += snprintf(buf + n, len - n, ",\"addr\":\"%s\"", inet_ntoa(in));
+  }
+  if (ev->group[0]) {
+    n += snprintf(buf + n, len - n, ",\"group\":");
+    n += json_string(buf + n, len - n, ev->group);
+  }
+
+  switch (ev->type) {
+    case SUB_HELLO:    n += snprintf(buf + n, len - n, ",\"version\":%u", ev->count); break;
+    case SUB_DROPPED:  n += snprintf(buf + n, len - n, ",\"dropped\":%u", ev->count); break;
+    case SUB_UP:       n += snprintf(buf + n, len - n, ",\"down_secs\":%u", ev->value); break;
+    case SUB_RTT:      n += snprintf(buf + n, len - n, ",\"sent\":%u,\"answered\":%u,\"rtt_avg\":%u,\"rtt_max\":%u", ev->count, ev->value, ev->rtt_avg, ev->rtt_max); break;
+    case SUB_OUTAGE:   n += snprintf(buf + n, len - n, ",\"down\":%u,\"hosts\":%u", ev->count, ev->value); break;
+    case SUB_RESTORED: n += snprintf(buf + n, len - n, ",\"down\":%u,\"secs\":%u", ev->count, ev->value); break;
+    case SUB_FLAPPING: n += snprintf(buf + n, len - n, ",\"times_down\":%u", ev->count); break;
+    case SUB_SETTLED:  n += snprintf(buf + n, len - n, ",\"held\":%u,\"state\":\"%s\"", ev->count, (ev->flags & SUB_F_DOWN ? "down" : "up")); break;
+  }
+  if (ev->flags & SUB_F_HELD)   n += snprintf(buf + n, len - n, ",\"held\":true");
+  if (ev->flags & SUB_F_HOST_CUT)  n += snprintf(buf + n, len - n, ",\"host_cut\":true");
+  if (ev->flags & SUB_F_GROUP_CUT) n += snprintf(buf + n, len - n, ",\"group_cut\":true");
+  if (ev->flags & SUB_F_OUTAGE) n += snprintf(buf + n, len - n, ",\"outage\":true");
+  n += snprintf(buf + n, len - n, "}\n");
+  return n;
+}
+
+/*
+ * Send what a subscriber has waiting, for as long as its socket will
+ * take it.  One that has gone is dropped.
+ */
+static void
+flush(s, c)
+SUB_PORT *s; SUB_CLIENT *c;
+{
+  int n;
+
+  for (;;) {
+    if (c->out_pos) {
+      c->out_len -= c->out_pos;
+      memmove(c->out, c->out + c->out_pos, c->out_len);
+      c->out_pos = 0;
+    }
+    while (c->tail != c->head && SUB_OUT - c->out_len >= SUB_EVENT_MAX) {
+      c->out_len += format(c, &c->ring[c->tail & (SUB_RING - 1)], c->out + c->out_len, SUB_OUT - c->out_len);
+      c->tail++;
+    }
+    if (!c->out_len) return;
+
+    n = send(c->conn->fd, c->out, c->out_len, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return;
+    if (n <= 0) {
+      drop(s, c);  /* gone */
+      return;
+    }
+    c->out_pos = n;
+  }
+}
+
+/****************************************************************************
+* Function Name      :   sub_open
+* Module ID          :   E(1)
+*
+* Purpose            :   To set up the event stream socket.
+*
+* Method             :   Listens on a Unix domain stream socket there
+*                        (ctl_listen), readable by its owner only.
+*
+* Usage              :   ls_start (M1)
+*
+* External References:   (none)
+*
+* Arguments          :   path: (data_in)
+*                                Where to put the socket.
+*
+* Return Value       :   SUB_PORT *
+*                                The event stream, or NULL (with errno set).
+*
+* Input Assertions   :   (none)
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   The rings are only allocated as subscribers come.
+\***************************************************************************/
+SUB_PORT *
+sub_open(path)
+char *path;
+{
+  SUB_PORT *s;
+  int i, err;
+
+  if ((s = (SUB_PORT *) calloc(1, sizeof(SUB_PORT))) == NULL) return NULL;
+  for (i = 0; i < SUB_CLIENTS; i++) s->client[i].conn = &s->conn[i];
+  if (ctl_listen(&s->l, path, s->conn, SUB_CLIENTS, SUB_BACKLOG) < 0) {
+    err = errno;
+    free(s);
+    errno = err;
+    return NULL;
+  }
+  return s;
+}
+
+/****************************************************************************
+* Function Name      :   sub_fds
+* Module ID          :   E(1)
+*
+* Purpose            :   To add the event stream socket and its
+*                        subscribers to a select set.
+*
+* Method             :   Adds each descriptor in use (subscribers are read
+*                        for their subscribe lines, and to see them go).
+*
+* Usage              :   probe_fds (M1)
+*
+* External References:   (none)
+*
+* Arguments          :   s:     (data_in)
+*                                The event stream.
+*                        set:   (data_in/out)
+*                                The select set.
+*                        maxfd: (data_in)
+*                                The highest descriptor in the set so far.
+*
+* Return Value       :   int
+*                                The highest descriptor in the set now.
+*
+* Input Assertions   :   (none)
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   (none)
+\***************************************************************************/
+int
+sub_fds(s, set, maxfd)
+SUB_PORT *s; fd_set *set; int maxfd;
+{
+  return ctl_listen_fds(&s->l, set, maxfd);
+}
+
+/****************************************************************************
+* Function Name      :   sub_ready
+* Module ID          :   E(1)
+*
+* Purpose            :   To take new subscribers and their subscribe lines.
+*
+* Method             :   Accepts any waiting connections, then reads what
+*                        each ready subscriber has sent.  A subscribe line
+*                        sets its filter (and sends it a "subscribed"
+*                        event), anything else gets it dropped with the
+*                        reason, as does hanging up.
+*
+* Usage              :   probe_fds_ready (M1)
+*
+* External References:   (none)
+*
+* Arguments          :   s:   (data_in/out)
+*                                The event stream.
+*                        set: (data_in)
+*                                The select set, as returned by select.
+*
+* Return Value       :   (none)
+*
+* Input Assertions   :   (none)
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   (none)
+\***************************************************************************/
+void
+sub_ready(s, set)
+SUB_PORT *s; fd_set *set;
+{
+  static char msg[256];
+  SUB_EVENT hello;
+  SUB_CLIENT *c;
+  struct timeval now;
+  char *p, *line;
+  int i, n;
+
+  ctl_accept(&s->l, set, "too many subscribers\n");
+
+  for (i = 0; i < SUB_CLIENTS; i++) {
+    c = &s->client[i];
+    if (c->conn->fd < 0 || !FD_ISSET(c->conn->fd, set)) continue;
+
+    if ((n = ctl_recv(c->conn)) == 0) continue;
+    if (n < 0) {
+      drop(s, c);  /* hung up */
+      continue;
+    }
+
+    for (p = c->conn->line; (line = ctl_line(c->conn, &p)) != NULL; ) {
+      if (!c->ring && (c->ring = (SUB_EVENT *) malloc(SUB_RING * sizeof(SUB_EVENT))) == NULL)
+        snprintf(msg, sizeof(msg), "out of memory\n");
+      else if (subscribe(c, line, msg, sizeof(msg)) == 0)
+        continue;
+      (void) send(c->conn->fd, msg, strlen(msg), MSG_NOSIGNAL | MSG_DONTWAIT);
+      drop(s, c);
+      break;
+    }
+    if (c->conn->fd < 0) continue;
+    want(s);
+
+    n = p > c->conn->line;  /* a (new) subscription */
+    if (ctl_keep(c->conn, p) < 0) {
+      drop(s, c);  /* not a subscribe line */
+      continue;
+    }
+
+    if (n) {
+      /* the (new) subscription starts here */
+      memset(&hello, 0, sizeof(hello));
+      gettimeofday(&now, NULL);
+      hello.type  = SUB_HELLO;
+      hello.sec   = now.tv_sec;
+      hello.usec  = now.tv_usec;
+      hello.count = SUB_VERSION;
+      if (c->head - c->tail < SUB_RING) push(c, &hello);
+    }
+  }
+}
+
+/****************************************************************************
+* Function Name      :   sub_wanted
+* Module ID          :   E(1)
+*
+* Purpose            :   To tell whether any subscriber wants a type of
+*                        event.
+*
+* Method             :   Checks it against the types wanted by any of them.
+*
+* Usage              :   event_start, end_cycle (M1)
+*
+* External References:   (none)
+*
+* Arguments          :   s:    (data_in)
+*                                The event stream (may be NULL).
+*                        type: (data_in)
+*                                SUB_DOWN etc.
+*
+* Return Value       :   int
+*                                1 if wanted, otherwise 0.
+*
+* Input Assertions   :   (none)
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   So events no one wants are not even made up.
+\***************************************************************************/
+int
+sub_wanted(s, type)
+SUB_PORT *s; int type;
+{
+  return s && (s->wanted & (1 << type)) != 0;
+}
+
+/****************************************************************************
+* Function Name      :   sub_publish
+* Module ID          :   E(1)
+*
+* Purpose            :   To pass an event on to the subscribers.
+*
+* Method             :   Copies it into the ring of each subscriber whose
+*                        filter it passes.  If a ring is full the event is
+*                        counted as lost for that subscriber instead, and
+*                        the count goes into its ring (as a "dropped"
+*                        event) ahead of the next event that fits.
+*
+* Usage              :   event_start callers (M1)
+*
+* External References:   (none)
+*
+* Arguments          :   s:  (data_in/out)
+*                                The event stream.
+*                        ev: (data_in)
+*                                The event.
+*
+* Return Value       :   (none)
+*
+* Input Assertions   :   (none)
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   Nothing is sent here, that is left to sub_flush,
+*                        so a burst of events costs no system calls.
+\***************************************************************************/
+void
+sub_publish(s, ev)
+SUB_PORT *s; SUB_EVENT *ev;
+{
+  SUB_EVENT lost;
+  SUB_CLIENT *c;
+  int i;
+
+  for (i = 0; i < SUB_CLIENTS; i++) {
+    c = &s->client[i];
+    if (c->conn->fd < 0 || !(c->mask & (1 << ev->type)) ||
+        !listed(c->hosts, ev->host, ev->flags & SUB_F_HOST_CUT) ||
+        !listed(c->groups, ev->group, ev->flags & SUB_F_GROUP_CUT)) continue;
+
+    if (c->head - c->tail > (unsigned int) (c->lost ? SUB_RING - 2 : SUB_RING - 1)) {
+      c->lost++;
+      s->dropped++;
+      continue;
+    }
+    if (c->lost) {
+      memset(&lost, 0, sizeof(lost));
+      lost.type  = SUB_DROPPED;
+      lost.sec   = ev->sec;
+      lost.usec  = ev->usec;
+      lost.count = c->lost;
+      push(c, &lost);
+      c->lost = 0;
+    }
+    push(c, ev);
+  }
+}
+
+/****************************************************************************
+* Function Name      :   sub_flush
+* Module ID          :   E(1)
+*
+* Purpose            :   To send the subscribers their events.
+*
+* Method             :   Formats what is waiting for each subscriber and
+*                        sends as much as its socket will take without
+*                        blocking, leaving the rest for next time.
+*
+* Usage              :   probe_fds (M1)
+*
+* External References:   (none)
+*
+* Arguments          :   s: (data_in/out)
+*                                The event stream.
+*
+* Return Value       :   (none)
+*
+* Input Assertions   :   (none)
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   Called before each wait of the main loop.
+\***************************************************************************/
+void
+sub_flush(s)
+SUB_PORT *s;
+{
+  int i;
+
+  for (i = 0; i < SUB_CLIENTS; i++)
+    if (s->conn[i].fd >= 0 && s->client[i].mask)
+      flush(s, &s->client[i]);
+}
+
+/****************************************************************************
+* Function Name      :   sub_dropped
+* Module ID          :   E(1)
+*
+* Purpose            :   To report on the subscribers.
+*
+* Method             :   Counts them, and takes the number of events
+*                        dropped since the last call.
+*
+* Usage              :   end_cycle (M1)
+*
+* External References:   (none)
+*
+* Arguments          :   s:           (data_in/out)
+*                                The event stream.
+*                        subscribers: (data_out)
+*                                How many are subscribed.
+*
+* Return Value       :   long
+*                                The events dropped since the last call.
+*
+* Input Assertions   :   (none)
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   (none)
+\***************************************************************************/
+long
+sub_dropped(s, subscribers)
+SUB_PORT *s; int *subscribers;
+{
+  long dropped = s->dropped;
+  int i;
+
+  for (i = 0, *subscribers = 0; i < SUB_CLIENTS; i++)
+    if (s->conn[i].fd >= 0 && s->client[i].mask) (*subscribers)++;
+  s->dropped = 0;
+  return dropped;
+}
+
+/****************************************************************************
+* Function Name      :   sub_close
+* Module ID          :   E(1)
+*
+* Purpose            :   To shut down the event stream.
+*
+* Method             :   Sends the subscribers what they can take of what
+*                        is waiting, disconnects them, closes the socket
+*                        and removes it.
+*
+* Usage              :   ls_close (M1)
+*
+* External References:   (none)
+*
+* Arguments          :   s: (data_in)
+*                                The event stream (may be NULL).
+*
+* Return Value       :   (none)
+*
+* Input Assertions   :   (none)
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   (none)
+\***************************************************************************/
+void
+sub_close(s)
+SUB_PORT *s;
+{
+  int i;
+
+  if (!s) return;
+  sub_flush(s);
+  for (i = 0; i < SUB_CLIENTS; i++)
+    if (s->conn[i].fd >= 0) drop(s, &s->client[i]);
+  ctl_unlisten(&s->l);
+  free(s);
+}
@@ -0,0 +1,52 @@
+
+#include <sys/types.h>
+#include <sys/time.h>
+
+typedef struct sub_port SUB_PORT;
+
+/* event types (subscribed to by the names in sub.c) */
+#define SUB_HELLO      0   /* subscribed, or the filter changed (count=SUB_VERSION) */
+#define SUB_DROPPED    1   /* events lost as the subscriber fell behind (count) */
+#define SUB_DOWN       2   /* a host is unreachable */
+#define SUB_UP         3   /* a host is alive again (value=secs down) */
+#define SUB_RTT        4   /* since the last status message (count=sent, value=answered) */
+#define SUB_OUTAGE     5   /* an outage (host=parent or subnet, count=down, value=hosts) */
+#define SUB_RESTORED   6   /* the outage is over (count=still down, value=secs) */
+#define SUB_FLAPPING   7   /* a host's state changes are held (count=times down) */
+#define SUB_SETTLED    8   /* and given again (count=changes held) */
+#define SUB_TYPES      9
+
+#define SUB_F_HELD     1   /* the change is held, as the host is flapping */
+#define SUB_F_OUTAGE   2   /* the change is rolled into an outage */
+#define SUB_F_DOWN     4   /* the host is down (SUB_SETTLED) */
+#define SUB_F_HOST_CUT 8   /* host is cut short, the name is too long for it */
+#define SUB_F_GROUP_CUT 16 /* as is group */
+
+#define SUB_HOST      64   /* bytes for a name in an event (with its NUL) */
+#define SUB_GROUP     32
+
+#define SUB_VERSION    1
+
+/* an event, as sent to binary subscribers (in host byte order, bar addr) */
+typedef struct sub_event {
+  u_int16_t           type;             /* SUB_HELLO etc. */
+  u_int16_t           flags;            /* SUB_F_* */
+  u_int32_t           addr;             /* host address (network order), 0=none */
+  u_int32_t           sec;              /* when */
+  u_int32_t           usec;
+  u_int32_t           count;            /* by type, as above */
+  u_int32_t           value;
+  u_int32_t           rtt_avg;          /* SUB_RTT, of the answers (usecs) */
+  u_int32_t           rtt_max;
+  char                host[SUB_HOST];   /* host, or outage parent or subnet */
+  char                group[SUB_GROUP]; /* its group, ""=none */
+} SUB_EVENT;
+
+extern SUB_PORT *sub_open(char *path);
+extern int sub_fds(SUB_PORT *s, fd_set *set, int maxfd);
+extern void sub_ready(SUB_PORT *s, fd_set *set);
+extern int sub_wanted(SUB_PORT *s, int type);
+extern void sub_publish(SUB_PORT *s, SUB_EVENT *ev);
+extern void sub_flush(SUB_PORT *s);
+extern long sub_dropped(SUB_PORT *s, int *subscribers);
+extern void sub_close(SUB_PORT *s);
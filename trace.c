@@ -0,0 +1,568 @@
+/*
+ * The flight recorder.
+ *
+ * The time spent in each phase of the main loop is added up cycle by
+ * cycle, from the TSC (or the monotonic clock where there is none),
+ * and the last TRACE_CYCLES cycles are kept along with the last
+ * TRACE_EVENTS notable events, in rings that are simply written over.
+ * There is only the one writer, and a dump (from a signal handler, in
+ * the middle of a stall) only reads what is behind the head, so no
+ * locks are needed.  The dump itself does no allocation or stdio.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <sys/types.h>
+
+#include "trace.h"
+
+typedef struct trace_event {
+  u_int64_t           tick;
+  int                 type;
+  int                 arg;
+  long                value;
+} TRACE_EVENT;
+
+typedef struct trace_cyc {
+  unsigned long       cycle;
+  u_int64_t           start;            /* tick it started */
+  u_int64_t           phase[TR_PHASES]; /* ticks spent in each phase */
+  int                 sent;             /* probes sent */
+} TRACE_CYC;
+
+struct trace {
+  TRACE_EVENT         ev[TRACE_EVENTS];
+  volatile unsigned long num_ev;        /* events ever recorded */
+  TRACE_CYC           cyc[TRACE_CYCLES];
+  volatile unsigned long num_cyc;       /* cycles ever recorded */
+  TRACE_CYC           cur;              /* the cycle under way */
+  int                 phase;            /* the phase under way */
+  u_int64_t           since;            /* and the tick it started */
+  u_int64_t           tick0;            /* tick of... */
+  struct timespec     mono0;            /* ...this time, for the rate */
+  double              per_usec;         /* ticks per usec, 0=not worked out */
+  u_int64_t           stall;            /* TRACE_STALL in ticks */
+  trace_namer         name;
+  void               *name_arg;         /* passed to it */
+};
+
+static char *phase_names[TR_PHASES] = {
+  "other", "scan", "send", "replies", "wait", "pause", "sweep", "report"
+};
+
+static u_int64_t
+ticks()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __builtin_ia32_rdtsc();
+#else
+  struct timespec ts;
+
+  (void) clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (u_int64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+/* the tick rate, from the ticks since we opened */
+static double
+rate(t)
+TRACE *t;
+{
+  struct timespec now;
+  double usecs;
+
+  (void) clock_gettime(CLOCK_MONOTONIC, &now);
+  usecs = (now.tv_sec - t->mono0.tv_sec) * 1e6 + (now.tv_nsec - t->mono0.tv_nsec) / 1e3;
+  if (usecs < 1e6) return t->per_usec;  /* not long enough to tell */
+  return (double) (ticks() - t->tick0) / usecs;
+}
+
+/****************************************************************************
+* Function Name      :   trace_open
+* Module ID          :   T(1)
+*
+* Purpose            :   To start the flight recorder.
+*
+* Method             :   Allocates the rings, and notes the tick and the
+*                        time to work out the tick rate from later.
+*
+* Usage              :   ls_start (M1)
+*
+* External References:   (none)
+*
+* Arguments          :   name: (data_in)
+*                                Gives the name of a host in an event.
+*                        arg: (data_in)
+*                                Passed to name.
+*
+* Return Value       :   TRACE *
+*                                The recorder, or NULL.
+*
+* Input Assertions   :   (none)
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   The rest of the functions take a NULL recorder,
+*                        and do nothing.
+\***************************************************************************/
+TRACE *
+trace_open(name, arg)
+trace_namer name; void *arg;
+{
+  TRACE *t;
+
+  if ((t = (TRACE *) calloc(1, sizeof(TRACE))) == NULL) return NULL;
+  t->name  = name;
+  t->name_arg = arg;
+  t->tick0 = ticks();
+  (void) clock_gettime(CLOCK_MONOTONIC, &t->mono0);
+  t->since = t->cur.start = t->tick0;
+  return t;
+}
+
+/****************************************************************************
+* Function Name      :   trace_phase
+* Module ID          :   T(1)
+*
+* Purpose            :   To move to another phase of the main loop.
+*
+* Method             :   Adds the ticks since the last move to the phase
+*                        that is ending, noting a stall if it ran on for
+*                        TRACE_STALL in one go (waiting aside).
+*
+* Usage              :   send_ping, process_reply, expire_probes, etc (M1)
+*
+* External References:   (none)
+*
+* Arguments          :   t:     (data_in)
+*                                The recorder.
+*                        phase: (data_in)
+*                                The phase starting, TR_*.
+*
+* Return Value       :   int
+*                                The phase that was under way, to go back
+*                                to afterwards.
+*
+* Input Assertions   :   (none)
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   Called around every packet, so kept to a read of
+*                        the TSC and an add.
+\***************************************************************************/
+int
+trace_phase(t, phase)
+TRACE *t; int phase;
+{
+  u_int64_t now, spent;
+  int was;
+
+  if (!t) return TR_OTHER;
+  now   = ticks();
+  spent = now - t->since;
+  t->cur.phase[t->phase] += spent;
+  if (t->stall && spent > t->stall && t->phase != TR_WAIT && t->phase != TR_PAUSE)
+    trace_event(t, TR_STALL, t->phase, (long) (spent / t->per_usec));
+  t->since = now;
+  was = t->phase;
+  t->phase = phase;
+  return was;
+}
+
+/****************************************************************************
+* Function Name      :   trace_cycle
+* Module ID          :   T(1)
+*
+* Purpose            :   To close off a cycle, as the next one starts.
+*
+* Method             :   Puts its phase times in the ring of cycles, and
+*                        notes it as an event if it ran over its plan.  The
+*                        pause at the end runs on as long as replies come
+*                        in, so it doesn't count.
+*
+* Usage              :   start_cycle (M1)
+*
+* External References:   (none)
+*
+* Arguments          :   t:     (data_in)
+*                                The recorder.
+*                        cycle: (data_in)
+*                                The number of the cycle ending.
+*                        sent:  (data_in)
+*                                The probes it sent.
+*                        plan:  (data_in)
+*                                The time its probes were planned to take
+*                                (msecs), up to the pause.
+*
+* Return Value       :   (none)
+*
+* Input Assertions   :   (none)
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   The tick rate is worked out (again) here too,
+*                        once we have been going for a second.
+\***************************************************************************/
+void
+trace_cycle(t, cycle, sent, plan)
+TRACE *t; unsigned long cycle; int sent; long plan;
+{
+  u_int64_t total = 0;
+  int p;
+
+  if (!t) return;
+  (void) trace_phase(t, t->phase);
+  if (cycle) {
+    t->cur.cycle = cycle;
+    t->cur.sent  = sent;
+    for (p = 0; p < TR_PHASES; p++) if (p != TR_PAUSE) total += t->cur.phase[p];
+    if (t->per_usec > 0 && total / t->per_usec > plan * 1000.0)
+      trace_event(t, TR_SLOW, (int) cycle, (long) (total / t->per_usec));
+    t->cyc[t->num_cyc % TRACE_CYCLES] = t->cur;
+    __atomic_store_n(&t->num_cyc, t->num_cyc + 1, __ATOMIC_RELEASE);
+  }
+  memset(&t->cur, 0, sizeof(t->cur));
+  t->cur.start = t->since;
+
+  if ((t->per_usec = rate(t)) > 0)
+    t->stall = (u_int64_t) (t->per_usec * TRACE_STALL);
+}
+
+/****************************************************************************
+* Function Name      :   trace_event
+* Module ID          :   T(1)
+*
+* Purpose            :   To record a notable event.
+*
+* Method             :   Writes it over the oldest in the ring.
+*
+* Usage              :   mark_unreachable, host_answered, shed_load (M1)
+*
+* External References:   (none)
+*
+* Arguments          :   t:     (data_in)
+*                                The recorder.
+*                        type:  (data_in)
+*                                What happened, TR_*.
+*                        arg:   (data_in)
+*                        value: (data_in)
+*                                As for the type.
+*
+* Return Value       :   (none)
+*
+* Input Assertions   :   (none)
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   (none)
+\***************************************************************************/
+void
+trace_event(t, type, arg, value)
+TRACE *t; int type; int arg; long value;
+{
+  TRACE_EVENT *e;
+
+  if (!t) return;
+  e = &t->ev[t->num_ev % TRACE_EVENTS];
+  e->tick  = ticks();
+  e->type  = type;
+  e->arg   = arg;
+  e->value = value;
+  __atomic_store_n(&t->num_ev, t->num_ev + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Building up the lines of a dump, without stdio (it may be called
+ * from a signal handler).
+ */
+typedef struct line {
+  char                buf[256];
+  int                 len;
+} LINE;
+
+static void
+put_s(l, s)
+LINE *l; char *s;
+{
+  while (*s && l->len < (int) sizeof(l->buf) - 2) l->buf[l->len++] = *s++;
+}
+
+static void
+put_u(l, n)
+LINE *l; unsigned long n;
+{
+  char digits[24];
+  int i = 0;
+
+  do {
+    digits[i++] = '0' + n % 10;
+    n /= 10;
+  } while (n);
+  while (i && l->len < (int) sizeof(l->buf) - 2) l->buf[l->len++] = digits[--i];
+}
+
+/* usecs, as msecs to a decimal place */
+static void
+put_ms(l, usecs)
+LINE *l; double usecs;
+{
+  unsigned long tenths = (unsigned long) (usecs / 100.0 + 0.5);
+
+  put_u(l, tenths / 10);
+  put_s(l, ".");
+  put_u(l, tenths % 10);
+}
+
+/* usecs before now, as -secs to the msec */
+static void
+put_ago(l, usecs)
+LINE *l; double usecs;
+{
+  unsigned long ms = usecs > 0 ? (unsigned long) (usecs / 1000.0 + 0.5) : 0;
+
+  put_s(l, "-");
+  put_u(l, ms / 1000);
+  put_s(l, ".");
+  put_u(l, ms % 1000 / 100);
+  put_u(l, ms % 100 / 10);
+  put_u(l, ms % 10);
+  put_s(l, "s");
+}
+
+static void
+put_line(l, out, arg)
+LINE *l; trace_writer out; void *arg;
+{
+  l->buf[l->len++] = '\n';
+  l->buf[l->len] = '\0';
+  (*out)(arg, l->buf);
+  l->len = 0;
+  put_s(l, "TRACE ");
+}
+
+static void
+put_phases(l, per_usec, phase)
+LINE *l; double per_usec; u_int64_t *phase;
+{
+  int p;
+
+  for (p = 1; p <= TR_PHASES; p++) {
+    put_s(l, p > 1 ? ", " : "");
+    put_s(l, phase_names[p % TR_PHASES]);  /* other last */
+    put_s(l, " ");
+    put_ms(l, phase[p % TR_PHASES] / per_usec);
+  }
+}
+
+/****************************************************************************
+* Function Name      :   trace_dump
+* Module ID          :   T(1)
+*
+* Purpose            :   To dump the flight recorder.
+*
+* Method             :   Reports the phase under way, the average and worst
+*                        time in each phase over the cycles kept, the
+*                        slowest of those cycles (by the time up to the
+*                        pause), phase by phase, and then
+*                        the events, oldest first.  Times are given as
+*                        seconds before the dump.
+*
+* Usage              :   usr1, control_command (M1)
+*
+* External References:   (none)
+*
+* Arguments          :   t:      (data_in)
+*                                The recorder.
+*                        events: (data_in)
+*                                The most events to give, 0 for none.
+*                        out:    (data_in)
+*                                Called with each line (with its newline).
+*                        arg:    (data_in)
+*                                Passed on to it.
+*
+* Return Value       :   (none)
+*
+* Input Assertions   :   (none)
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   Safe to call from a signal handler, provided out
+*                        is.
+\***************************************************************************/
+void
+trace_dump(t, events, out, arg)
+TRACE *t; int events; trace_writer out; void *arg;
+{
+  static LINE l;
+  static u_int64_t sum[TR_PHASES], most[TR_PHASES];
+  TRACE_CYC *c, *slowest[TRACE_SLOWEST];
+  TRACE_EVENT *e;
+  u_int64_t now, total, best;
+  unsigned long n_cyc, n_ev, i, first;
+  double per_usec;
+  int p, s, k, taken;
+
+  if (!t) return;
+  now   = ticks();
+  n_cyc = __atomic_load_n(&t->num_cyc, __ATOMIC_ACQUIRE);
+  n_ev  = __atomic_load_n(&t->num_ev, __ATOMIC_ACQUIRE);
+  if ((per_usec = t->per_usec) <= 0 && (per_usec = rate(t)) <= 0)
+    per_usec = 1.0;  /* too early to tell, call them usecs */
+
+  l.len = 0;
+  put_s(&l, "TRACE Flight recorder, ");
+  put_u(&l, n_cyc);
+  put_s(&l, " cycles and ");
+  put_u(&l, n_ev);
+  put_s(&l, " events recorded, in ");
+  put_s(&l, phase_names[t->phase]);
+  put_s(&l, " for ");
+  put_ms(&l, (now - t->since) / per_usec);
+  put_s(&l, "ms");
+  put_line(&l, out, arg);
+
+  if (n_cyc) {
+    /* average and worst of each phase */
+    first = n_cyc > TRACE_CYCLES ? n_cyc - TRACE_CYCLES : 0;
+    memset(sum, 0, sizeof(sum));
+    memset(most, 0, sizeof(most));
+    for (i = first; i < n_cyc; i++)
+      for (p = 0; p < TR_PHASES; p++) {
+        sum[p] += t->cyc[i % TRACE_CYCLES].phase[p];
+        if (t->cyc[i % TRACE_CYCLES].phase[p] > most[p]) most[p] = t->cyc[i % TRACE_CYCLES].phase[p];
+      }
+    for (p = 0; p < TR_PHASES; p++) sum[p] /= (n_cyc - first);
+    put_s(&l, "Average of the last ");
+    put_u(&l, n_cyc - first);
+    put_s(&l, " cycles (ms): ");
+    put_phases(&l, per_usec, sum);
+    put_line(&l, out, arg);
+    put_s(&l, "Worst of them (ms): ");
+    put_phases(&l, per_usec, most);
+    put_line(&l, out, arg);
+
+    /* the slowest, picked out one at a time */
+    for (s = taken = 0; s < TRACE_SLOWEST; s++) {
+      slowest[s] = NULL;
+      best = 0;
+      for (i = first; i < n_cyc; i++) {
+        c = &t->cyc[i % TRACE_CYCLES];
+        for (k = 0; k < taken && slowest[k] != c; k++) ;
+        if (k < taken) continue;
+        for (p = 0, total = 0; p < TR_PHASES; p++) if (p != TR_PAUSE) total += c->phase[p];
+        if (!slowest[s] || total > best) {
+          slowest[s] = c;
+          best = total;
+        }
+      }
+      if (!slowest[s]) break;
+      taken++;
+
+      c = slowest[s];
+      put_s(&l, "Slow cycle ");
+      put_u(&l, c->cycle);
+      put_s(&l, " at ");
+      put_ago(&l, (now - c->start) / per_usec);
+      put_s(&l, ", ");
+      put_ms(&l, best / per_usec);
+      put_s(&l, "ms of probes (");
+      put_u(&l, c->sent);
+      put_s(&l, " sent): ");
+      put_phases(&l, per_usec, c->phase);
+      put_line(&l, out, arg);
+    }
+  }
+
+  first = n_ev > TRACE_EVENTS ? n_ev - TRACE_EVENTS : 0;
+  if (events > 0 && n_ev - first > (unsigned long) events) first = n_ev - events;
+  for (i = first; events > 0 && i < n_ev; i++) {
+    e = &t->ev[i % TRACE_EVENTS];
+    put_ago(&l, (now - e->tick) / per_usec);
+    switch (e->type) {
+      case TR_DOWN:
+      case TR_UP:
+        put_s(&l, " ");
+        put_s(&l, t->name ? (*t->name)(t->name_arg, e->arg) : "host");
+        put_s(&l, e->type == TR_DOWN ? " went down" : " came back");
+        break;
+      case TR_SHED:
+        put_s(&l, " shed factor now ");
+        put_u(&l, e->arg);
+        break;
+      case TR_STALL:
+        put_s(&l, " stalled in ");
+        put_s(&l, phase_names[e->arg % TR_PHASES]);
+        put_s(&l, " for ");
+        put_ms(&l, (double) e->value);
+        put_s(&l, "ms");
+        break;
+      case TR_SLOW:
+        put_s(&l, " cycle ");
+        put_u(&l, (unsigned long) e->arg);
+        put_s(&l, " took ");
+        put_ms(&l, (double) e->value);
+        put_s(&l, "ms of probes, over its plan");
+        break;
+      case TR_MARK:
+        put_s(&l, " dump asked for");
+        break;
+    }
+    put_line(&l, out, arg);
+  }
+}
+
+/****************************************************************************
+* Function Name      :   trace_close
+* Module ID          :   T(1)
+*
+* Purpose            :   To stop the flight recorder.
+*
+* Method             :   Frees the rings.
+*
+* Usage              :   ls_close (M1)
+*
+* External References:   (none)
+*
+* Arguments          :   t: (data_in)
+*                                The recorder, or NULL.
+*
+* Return Value       :   (none)
+*
+* Input Assertions   :   (none)
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   (none)
+\***************************************************************************/
+void
+trace_close(t)
+TRACE *t;
+{
+  free(t);
+}
@@ -0,0 +1,38 @@
+
+#include <sys/types.h>
+
+typedef struct trace TRACE;
+
+/* phases of the main loop, timed in each cycle */
+#define TR_OTHER      0   /* none of the below */
+#define TR_SCAN       1   /* going through the schedule for hosts due */
+#define TR_SEND       2   /* sending probes */
+#define TR_REPLY      3   /* taking replies (and the other descriptors) */
+#define TR_WAIT       4   /* waiting between sends */
+#define TR_PAUSE      5   /* the pause at the end of the cycle */
+#define TR_SWEEP      6   /* expiring probes (the unreachable sweep) */
+#define TR_REPORT     7   /* status messages and reports */
+#define TR_PHASES     8
+
+/* notable events */
+#define TR_DOWN       1   /* a host went down (arg=host) */
+#define TR_UP         2   /* a host came back (arg=host) */
+#define TR_SHED       3   /* the shed factor changed (arg=factor) */
+#define TR_STALL      4   /* one phase ran on (arg=phase, value=usecs) */
+#define TR_SLOW       5   /* a cycle's probes ran over (arg=cycle, value=usecs) */
+#define TR_MARK       6   /* a dump was asked for (over the control socket) */
+
+#define TRACE_EVENTS  4096    /* events kept */
+#define TRACE_CYCLES  256     /* cycles kept */
+#define TRACE_STALL   100000  /* usecs in one phase (other than waiting) for a stall */
+#define TRACE_SLOWEST 5       /* cycles in the summary */
+
+typedef char *(*trace_namer)(void *arg, int host);
+typedef void (*trace_writer)(void *arg, char *line);
+
+extern TRACE *trace_open(trace_namer name, void *arg);
+extern int trace_phase(TRACE *t, int phase);
+extern void trace_cycle(TRACE *t, unsigned long cycle, int sent, long plan);
+extern void trace_event(TRACE *t, int type, int arg, long value);
+extern void trace_dump(TRACE *t, int events, trace_writer out, void *arg);
+extern void trace_close(TRACE *t);
@@ -7,9 +7,9 @@
  * But I digress.
  */
 
-#define VERSION "2.0.0"            /* Version string    */
+#define VERSION "2.25.0"            /* Version string    */
 #define RELEASE 'a'                /* Release character */
-#define RELEASE_DATE "07-AUG-10"   /* Release date      */
+#define RELEASE_DATE "18-OCT-26"   /* Release date      */
 
 #include <stdio.h>
 
@@ -18,8 +18,8 @@
 #ifdef __STDC__
 static
 #endif /* __STDC__ */
-char fs_str[] = "@(#)LinkStat Server v2.00a+\n";
-#define HDR_VERSION "2.00a+"
+char fs_str[] = "@(#)LinkStat Server v2.250a+\n";
+#define HDR_VERSION "2.250a+"
 
 #ifdef __STDC__
 static
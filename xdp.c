@@ -0,0 +1,689 @@
+
+/*
+ * AF_XDP probe engine for ICMP echo requests and replies.
+ *
+ * Echo requests are written straight into a UMEM frame and queued on
+ * the TX ring of an AF_XDP socket, and our echo replies are pulled
+ * from its RX ring.  A small XDP program (assembled here, so neither
+ * clang nor libbpf is needed) redirects only echo replies carrying
+ * our ident into the socket, everything else carries on up the stack.
+ *
+ * The program is attached in generic (SKB) mode and the socket bound
+ * in copy mode, so this works on any interface, veth pairs included,
+ * without driver support.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "xdp.h"
+
+#if defined(linux) && defined(XDP_SOCKETS)
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/ip_icmp.h>
+#include <arpa/inet.h>
+#include <linux/if_ether.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+#include <linux/bpf.h>
+
+#define XDP_FRAME_SIZE  2048    /* bytes in each UMEM frame */
+#define XDP_NUM_FRAMES  4096    /* frames in the UMEM */
+#define XDP_RING_SIZE   2048    /* entries in each ring */
+#define XDP_MAX_QUEUES    64    /* entries in the socket map */
+
+/* the first half of the UMEM is used for receiving, the rest to send */
+#define XDP_RX_FRAMES   XDP_RING_SIZE
+
+/* a ring shared with the kernel */
+struct xdp_queue {
+  unsigned int       *producer;
+  unsigned int       *consumer;
+  void               *desc;
+  void               *map;
+  size_t              map_len;
+};
+
+struct xdp_port {
+  int                 fd;               /* AF_XDP socket */
+  int                 ctl;              /* socket for interface ioctls */
+  int                 map_fd;           /* socket map of the program */
+  int                 prog_fd;          /* XDP program */
+  int                 link_fd;          /* program attached to interface */
+  char                ifname[IFNAMSIZ]; /* interface we are on */
+  unsigned char       mac[ETH_ALEN];    /* its MAC address */
+  struct in_addr      addr;             /* and its IP address */
+  unsigned char      *umem;             /* frames shared with the kernel */
+  struct xdp_queue    rx, tx, fill, comp;
+  unsigned long long  free[XDP_NUM_FRAMES - XDP_RX_FRAMES];
+  int                 num_free;         /* send frames not in use */
+  unsigned short      ip_id;            /* IP id of the next packet */
+};
+
+static int
+bpf(cmd, attr)
+int cmd; union bpf_attr *attr;
+{
+  return (int) syscall(SYS_bpf, cmd, attr, sizeof(*attr));
+}
+
+static unsigned short
+ip_cksum(p, n)
+unsigned short *p; int n;
+{
+  unsigned long sum = 0;
+
+  while (n > 1) { sum += *p++; n -= 2; }
+  if (n == 1) sum += *(unsigned char *) p;
+  sum = (sum >> 16) + (sum & 0xffff);
+  sum += (sum >> 16);
+  return (unsigned short) ~sum;
+}
+
+static int
+map_queue(fd, q, off, size, entry, pgoff)
+int fd; struct xdp_queue *q; struct xdp_ring_offset *off;
+unsigned int size; size_t entry; off_t pgoff;
+{
+  q->map_len = off->desc + size * entry;
+  q->map = mmap(NULL, q->map_len, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, fd, pgoff);
+  if (q->map == MAP_FAILED) {
+    q->map = NULL;
+    return -1;
+  }
+  q->producer = (unsigned int *) ((char *) q->map + off->producer);
+  q->consumer = (unsigned int *) ((char *) q->map + off->consumer);
+  q->desc     = (char *) q->map + off->desc;
+  return 0;
+}
+
+#define XDP_PROG_PASS  30   /* index of the "pass" instructions below */
+#define TO_PASS(pc)    (XDP_PROG_PASS - (pc) - 1)
+
+#define INSN(code, dst, src, off, imm)  { (code), (dst), (src), (off), (imm) }
+
+/*
+ * Redirect IPv4 ICMP echo replies carrying our ident to the socket
+ * bound to the receive queue, and pass everything else.  Loads are
+ * in host byte order, hence the htons() on the constants.
+ */
+static int
+load_program(map_fd, ident)
+int map_fd; int ident;
+{
+  union bpf_attr attr;
+  struct bpf_insn prog[] = {
+    INSN(BPF_LDX | BPF_MEM | BPF_W,   2, 1, 0, 0),            /* data */
+    INSN(BPF_LDX | BPF_MEM | BPF_W,   3, 1, 4, 0),            /* data_end */
+    INSN(BPF_ALU64 | BPF_MOV | BPF_X, 4, 2, 0, 0),
+    INSN(BPF_ALU64 | BPF_ADD | BPF_K, 4, 0, 0, ETH_HLEN + 20),
+    INSN(BPF_JMP | BPF_JGT | BPF_X,   4, 3, TO_PASS(4), 0),
+    INSN(BPF_LDX | BPF_MEM | BPF_H,   5, 2, 12, 0),           /* ethertype */
+    INSN(BPF_JMP | BPF_JNE | BPF_K,   5, 0, TO_PASS(6), htons(ETH_P_IP)),
+    INSN(BPF_LDX | BPF_MEM | BPF_B,   5, 2, 23, 0),           /* protocol */
+    INSN(BPF_JMP | BPF_JNE | BPF_K,   5, 0, TO_PASS(8), IPPROTO_ICMP),
+    INSN(BPF_LDX | BPF_MEM | BPF_H,   5, 2, 20, 0),           /* fragment */
+    INSN(BPF_ALU64 | BPF_AND | BPF_K, 5, 0, 0, htons(0x1fff)),
+    INSN(BPF_JMP | BPF_JNE | BPF_K,   5, 0, TO_PASS(11), 0),
+    INSN(BPF_LDX | BPF_MEM | BPF_B,   5, 2, 14, 0),           /* IP hlen */
+    INSN(BPF_ALU64 | BPF_AND | BPF_K, 5, 0, 0, 0x0f),
+    INSN(BPF_ALU64 | BPF_LSH | BPF_K, 5, 0, 0, 2),
+    INSN(BPF_JMP | BPF_JLT | BPF_K,   5, 0, TO_PASS(15), 20),
+    INSN(BPF_ALU64 | BPF_ADD | BPF_X, 2, 5, 0, 0),            /* ICMP - 14 */
+    INSN(BPF_ALU64 | BPF_MOV | BPF_X, 4, 2, 0, 0),
+    INSN(BPF_ALU64 | BPF_ADD | BPF_K, 4, 0, 0, ETH_HLEN + 8),
+    INSN(BPF_JMP | BPF_JGT | BPF_X,   4, 3, TO_PASS(19), 0),
+    INSN(BPF_LDX | BPF_MEM | BPF_B,   5, 2, 14, 0),           /* ICMP type */
+    INSN(BPF_JMP | BPF_JNE | BPF_K,   5, 0, TO_PASS(21), ICMP_ECHOREPLY),
+    INSN(BPF_LDX | BPF_MEM | BPF_H,   5, 2, 18, 0),           /* ICMP id */
+    INSN(BPF_JMP | BPF_JNE | BPF_K,   5, 0, TO_PASS(23), ident & 0xffff),
+    INSN(BPF_LDX | BPF_MEM | BPF_W,   2, 1, 16, 0),           /* rx queue */
+    INSN(BPF_LD | BPF_DW | BPF_IMM,   1, BPF_PSEUDO_MAP_FD, 0, map_fd),
+    INSN(0,                           0, 0, 0, 0),
+    INSN(BPF_ALU64 | BPF_MOV | BPF_K, 3, 0, 0, XDP_PASS),     /* if unbound */
+    INSN(BPF_JMP | BPF_CALL,          0, 0, 0, BPF_FUNC_redirect_map),
+    INSN(BPF_JMP | BPF_EXIT,          0, 0, 0, 0),
+    INSN(BPF_ALU64 | BPF_MOV | BPF_K, 0, 0, 0, XDP_PASS),     /* pass */
+    INSN(BPF_JMP | BPF_EXIT,          0, 0, 0, 0),
+  };
+
+  memset(&attr, 0, sizeof(attr));
+  attr.prog_type = BPF_PROG_TYPE_XDP;
+  attr.expected_attach_type = BPF_XDP;
+  attr.insn_cnt  = sizeof(prog) / sizeof(prog[0]);
+  attr.insns     = (unsigned long) prog;
+  attr.license   = (unsigned long) "GPL";
+  strncpy(attr.prog_name, "linkstat", sizeof(attr.prog_name) - 1);
+  return bpf(BPF_PROG_LOAD, &attr);
+}
+
+/****************************************************************************
+* Function Name      :   xdp_open
+* Module ID          :   X(1)
+*
+* Purpose            :   To set up an AF_XDP socket for sending our echo
+*                        requests and receiving their replies.
+*
+* Method             :   Registers a UMEM with the socket, maps its four
+*                        rings, binds it to queue 0 of the interface in
+*                        copy mode, and attaches an XDP program (generic
+*                        mode) that redirects our replies into it.
+*
+* Usage              :   main (M1)
+*
+* External References:   (none)
+*
+* Arguments          :   ifname: (data_in)
+*                                The interface to send and receive on.
+*                        ident:  (data_in)
+*                                The ICMP identifier of our echo requests.
+*
+* Return Value       :   XDP_PORT *
+*                                The port, or NULL (with errno set).
+*
+* Input Assertions   :   Must be running with CAP_NET_ADMIN, CAP_NET_RAW
+*                        and CAP_BPF (or as root).
+*
+* Output Assertions  :   The program is detached again when the process
+*                        exits.
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   Linux 5.9 or later (for BPF links).
+\***************************************************************************/
+XDP_PORT *
+xdp_open(ifname, ident)
+char *ifname; int ident;
+{
+  XDP_PORT *x;
+  struct xdp_umem_reg reg;
+  struct xdp_mmap_offsets off;
+  struct sockaddr_xdp sxdp;
+  struct ifreq ifr;
+  union bpf_attr attr;
+  socklen_t optlen;
+  unsigned int ifindex, size = XDP_RING_SIZE, i;
+  int key = 0, err;
+
+  x = (XDP_PORT *) calloc(1, sizeof(XDP_PORT));
+  if (!x) return NULL;
+  x->fd = x->ctl = x->map_fd = x->prog_fd = x->link_fd = -1;
+
+  strncpy(x->ifname, ifname, IFNAMSIZ - 1);
+  if ((ifindex = if_nametoindex(ifname)) == 0)
+    goto fail;
+
+  /*
+   * Our own addresses, as the packets are built from scratch
+   */
+  if ((x->ctl = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+    goto fail;
+  memset(&ifr, 0, sizeof(ifr));
+  strncpy(ifr.ifr_name, x->ifname, IFNAMSIZ - 1);
+  if (ioctl(x->ctl, SIOCGIFHWADDR, &ifr) < 0)
+    goto fail;
+  if (ifr.ifr_hwaddr.sa_family != ARPHRD_ETHER) {
+    errno = EPFNOSUPPORT;
+    goto fail;
+  }
+  memcpy(x->mac, ifr.ifr_hwaddr.sa_data, ETH_ALEN);
+  if (ioctl(x->ctl, SIOCGIFADDR, &ifr) < 0)
+    goto fail;
+  x->addr = ((struct sockaddr_in *) &ifr.ifr_addr)->sin_addr;
+
+  /*
+   * The UMEM and its rings
+   */
+  x->umem = mmap(NULL, (size_t) XDP_NUM_FRAMES * XDP_FRAME_SIZE,
+                 PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (x->umem == MAP_FAILED) {
+    x->umem = NULL;
+    goto fail;
+  }
+
+  if ((x->fd = socket(AF_XDP, SOCK_RAW, 0)) < 0)
+    goto fail;
+
+  memset(&reg, 0, sizeof(reg));
+  reg.addr       = (unsigned long) x->umem;
+  reg.len        = (unsigned long long) XDP_NUM_FRAMES * XDP_FRAME_SIZE;
+  reg.chunk_size = XDP_FRAME_SIZE;
+  if (setsockopt(x->fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) < 0 ||
+      setsockopt(x->fd, SOL_XDP, XDP_UMEM_FILL_RING, &size, sizeof(size)) < 0 ||
+      setsockopt(x->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &size, sizeof(size)) < 0 ||
+      setsockopt(x->fd, SOL_XDP, XDP_RX_RING, &size, sizeof(size)) < 0 ||
+      setsockopt(x->fd, SOL_XDP, XDP_TX_RING, &size, sizeof(size)) < 0)
+    goto fail;
+
+  optlen = sizeof(off);
+  if (getsockopt(x->fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) < 0)
+    goto fail;
+  if (map_queue(x->fd, &x->rx, &off.rx, size, sizeof(struct xdp_desc),
+                XDP_PGOFF_RX_RING) < 0 ||
+      map_queue(x->fd, &x->tx, &off.tx, size, sizeof(struct xdp_desc),
+                XDP_PGOFF_TX_RING) < 0 ||
+      map_queue(x->fd, &x->fill, &off.fr, size, sizeof(unsigned long long),
+                XDP_UMEM_PGOFF_FILL_RING) < 0 ||
+      map_queue(x->fd, &x->comp, &off.cr, size, sizeof(unsigned long long),
+                XDP_UMEM_PGOFF_COMPLETION_RING) < 0)
+    goto fail;
+
+  /* Hand the receive frames to the kernel, keep the rest for sending */
+  for (i = 0; i < XDP_RX_FRAMES; i++)
+    ((unsigned long long *) x->fill.desc)[i] = (unsigned long long) i * XDP_FRAME_SIZE;
+  __atomic_store_n(x->fill.producer, XDP_RX_FRAMES, __ATOMIC_RELEASE);
+  for (i = XDP_RX_FRAMES; i < XDP_NUM_FRAMES; i++)
+    x->free[x->num_free++] = (unsigned long long) i * XDP_FRAME_SIZE;
+
+  memset(&sxdp, 0, sizeof(sxdp));
+  sxdp.sxdp_family   = AF_XDP;
+  sxdp.sxdp_ifindex  = ifindex;
+  sxdp.sxdp_queue_id = 0;
+  sxdp.sxdp_flags    = XDP_COPY;
+  if (bind(x->fd, (struct sockaddr *) &sxdp, sizeof(sxdp)) < 0)
+    goto fail;
+
+  /*
+   * The program, its socket map and the attachment.  Replies that
+   * arrive on other queues are passed up the stack as normal.
+   */
+  memset(&attr, 0, sizeof(attr));
+  attr.map_type    = BPF_MAP_TYPE_XSKMAP;
+  attr.key_size    = sizeof(int);
+  attr.value_size  = sizeof(int);
+  attr.max_entries = XDP_MAX_QUEUES;
+  if ((x->map_fd = bpf(BPF_MAP_CREATE, &attr)) < 0)
+    goto fail;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.map_fd = x->map_fd;
+  attr.key    = (unsigned long) &key;
+  attr.value  = (unsigned long) &x->fd;
+  if (bpf(BPF_MAP_UPDATE_ELEM, &attr) < 0)
+    goto fail;
+
+  if ((x->prog_fd = load_program(x->map_fd, ident)) < 0)
+    goto fail;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.link_create.prog_fd        = x->prog_fd;
+  attr.link_create.target_ifindex = ifindex;
+  attr.link_create.attach_type    = BPF_XDP;
+  attr.link_create.flags          = XDP_FLAGS_SKB_MODE;
+  if ((x->link_fd = bpf(BPF_LINK_CREATE, &attr)) < 0)
+    goto fail;
+
+  return x;
+
+fail:
+  err = errno;
+  xdp_close(x);
+  errno = err;
+  return NULL;
+}
+
+/****************************************************************************
+* Function Name      :   xdp_fd
+* Module ID          :   X(1)
+*
+* Purpose            :   To return the descriptor to wait on for replies.
+*
+* Method             :   The AF_XDP socket polls readable while its RX ring
+*                        holds packets.
+*
+* Usage              :   wait_for_reply (M1)
+*
+* External References:   (none)
+*
+* Arguments          :   x: (data_in)
+*                                The port.
+*
+* Return Value       :   int
+*                                The file descriptor.
+*
+* Input Assertions   :   x was returned by xdp_open.
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   (none)
+\***************************************************************************/
+int
+xdp_fd(x)
+XDP_PORT *x;
+{
+  return x->fd;
+}
+
+/****************************************************************************
+* Function Name      :   xdp_resolve
+* Module ID          :   X(1)
+*
+* Purpose            :   To find the MAC address to send to a host with.
+*
+* Method             :   Looks the host up in the ARP cache of the
+*                        interface.
+*
+* Usage              :   send_ping (M1)
+*
+* External References:   (none)
+*
+* Arguments          :   x:   (data_in)
+*                                The port.
+*                        dst: (data_in)
+*                                The host's IP address.
+*                        mac: (data_out)
+*                                Its MAC address (6 bytes).
+*
+* Return Value       :   int
+*                                0 if found, -1 if not.
+*
+* Input Assertions   :   x was returned by xdp_open.
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   Only directly connected hosts are found, anything
+*                        else has to be sent through the socket (which will
+*                        also get the kernel to ARP for it).
+\***************************************************************************/
+int
+xdp_resolve(x, dst, mac)
+XDP_PORT *x; struct in_addr dst; unsigned char *mac;
+{
+  struct arpreq ar;
+
+  memset(&ar, 0, sizeof(ar));
+  ar.arp_pa.sa_family = AF_INET;
+  ((struct sockaddr_in *) &ar.arp_pa)->sin_addr = dst;
+  strncpy(ar.arp_dev, x->ifname, sizeof(ar.arp_dev) - 1);
+
+  if (ioctl(x->ctl, SIOCGARP, &ar) < 0) return -1;
+  if (!(ar.arp_flags & ATF_COM) || ar.arp_ha.sa_family != ARPHRD_ETHER)
+    return -1;
+
+  memcpy(mac, ar.arp_ha.sa_data, ETH_ALEN);
+  return 0;
+}
+
+/****************************************************************************
+* Function Name      :   xdp_send
+* Module ID          :   X(1)
+*
+* Purpose            :   To send an ICMP message to a host.
+*
+* Method             :   Builds the ethernet and IP headers around the
+*                        message in a free UMEM frame, queues it on the TX
+*                        ring and kicks the kernel.  Frames that have been
+*                        sent are first reclaimed from the completion ring.
+*
+* Usage              :   send_ping (M1)
+*
+* External References:   (none)
+*
+* Arguments          :   x:    (data_in)
+*                                The port.
+*                        mac:  (data_in)
+*                                The MAC address to send to.
+*                        dst:  (data_in)
+*                                The IP address to send to.
+*                        icmp: (data_in)
+*                                The ICMP message (with its checksum).
+*                        len:  (data_in)
+*                                Its length.
+*
+* Return Value       :   int
+*                                0 if queued, -1 if the ring is full.
+*
+* Input Assertions   :   x was returned by xdp_open.
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   (none)
+\***************************************************************************/
+int
+xdp_send(x, mac, dst, icmp, len)
+XDP_PORT *x; unsigned char *mac; struct in_addr dst; unsigned char *icmp; int len;
+{
+  unsigned int cons, prod;
+  unsigned long long addr;
+  struct xdp_desc *desc;
+  unsigned char *frame;
+  struct ip *ip;
+
+  /* Take back the frames the kernel has finished with */
+  cons = *x->comp.consumer;
+  prod = __atomic_load_n(x->comp.producer, __ATOMIC_ACQUIRE);
+  while (cons != prod)
+    x->free[x->num_free++] =
+      ((unsigned long long *) x->comp.desc)[cons++ & (XDP_RING_SIZE - 1)];
+  __atomic_store_n(x->comp.consumer, cons, __ATOMIC_RELEASE);
+
+  prod = *x->tx.producer;
+  if (!x->num_free ||
+      prod - __atomic_load_n(x->tx.consumer, __ATOMIC_ACQUIRE) >= XDP_RING_SIZE ||
+      ETH_HLEN + (int) sizeof(struct ip) + len > XDP_FRAME_SIZE)
+    return -1;
+
+  addr  = x->free[--x->num_free];
+  frame = x->umem + addr;
+
+  memcpy(frame, mac, ETH_ALEN);
+  memcpy(frame + ETH_ALEN, x->mac, ETH_ALEN);
+  frame[12] = ETH_P_IP >> 8;
+  frame[13] = ETH_P_IP & 0xff;
+
+  ip = (struct ip *) (frame + ETH_HLEN);
+  memset(ip, 0, sizeof(struct ip));
+  ip->ip_v   = 4;
+  ip->ip_hl  = sizeof(struct ip) >> 2;
+  ip->ip_len = htons(sizeof(struct ip) + len);
+  ip->ip_id  = htons(x->ip_id++);
+  ip->ip_ttl = 64;
+  ip->ip_p   = IPPROTO_ICMP;
+  ip->ip_src = x->addr;
+  ip->ip_dst = dst;
+  ip->ip_sum = ip_cksum((unsigned short *) ip, sizeof(struct ip));
+  memcpy(frame + ETH_HLEN + sizeof(struct ip), icmp, len);
+
+  desc = &((struct xdp_desc *) x->tx.desc)[prod & (XDP_RING_SIZE - 1)];
+  desc->addr    = addr;
+  desc->len     = ETH_HLEN + sizeof(struct ip) + len;
+  desc->options = 0;
+  __atomic_store_n(x->tx.producer, prod + 1, __ATOMIC_RELEASE);
+
+  /* Copy mode always needs a kick, a busy ring will be picked up later */
+  (void) sendto(x->fd, NULL, 0, MSG_DONTWAIT, NULL, 0);
+  return 0;
+}
+
+/****************************************************************************
+* Function Name      :   xdp_read
+* Module ID          :   X(1)
+*
+* Purpose            :   To process all of the replies waiting on the RX
+*                        ring.
+*
+* Method             :   Calls the handler for every packet in place, then
+*                        returns the frames to the fill ring.
+*
+* Usage              :   wait_for_reply (M1)
+*
+* External References:   (none)
+*
+* Arguments          :   x:       (data_in)
+*                                 The port.
+*                        handler: (data_in)
+*                                 Called with each packet (from the network
+*                                 header) and its source MAC.
+*                        arg:     (data_in)
+*                                 Passed through to the handler.
+*
+* Return Value       :   int
+*                                The number of packets handled.
+*
+* Input Assertions   :   x was returned by xdp_open.
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   (none)
+\***************************************************************************/
+int
+xdp_read(x, handler, arg)
+XDP_PORT *x; xdp_handler handler; void *arg;
+{
+  unsigned int cons, prod, fill;
+  struct xdp_desc *desc;
+  unsigned char *pkt;
+  int count = 0;
+
+  cons = *x->rx.consumer;
+  prod = __atomic_load_n(x->rx.producer, __ATOMIC_ACQUIRE);
+  fill = *x->fill.producer;
+
+  while (cons != prod) {
+    desc = &((struct xdp_desc *) x->rx.desc)[cons++ & (XDP_RING_SIZE - 1)];
+    pkt  = x->umem + desc->addr;
+    if (desc->len > ETH_HLEN)
+      handler(arg, pkt + ETH_HLEN, (int) desc->len - ETH_HLEN, pkt + ETH_ALEN, NULL);
+    count++;
+
+    /* The fill ring has room for every receive frame */
+    ((unsigned long long *) x->fill.desc)[fill++ & (XDP_RING_SIZE - 1)] =
+      desc->addr & ~((unsigned long long) XDP_FRAME_SIZE - 1);
+  }
+
+  __atomic_store_n(x->rx.consumer, cons, __ATOMIC_RELEASE);
+  __atomic_store_n(x->fill.producer, fill, __ATOMIC_RELEASE);
+  return count;
+}
+
+/****************************************************************************
+* Function Name      :   xdp_close
+* Module ID          :   X(1)
+*
+* Purpose            :   To release an AF_XDP port.
+*
+* Method             :   Detaches the program and frees everything.
+*
+* Usage              :   xdp_open (X1)
+*
+* External References:   (none)
+*
+* Arguments          :   x: (data_in)
+*                                The port.
+*
+* Return Value       :   (none)
+*
+* Input Assertions   :   (none)
+*
+* Output Assertions  :   (none)
+*
+* Variables          :   (none)
+*
+* Authors(s)         :   Kevin Clark
+*
+* Remarks            :   (none)
+\***************************************************************************/
+void
+xdp_close(x)
+XDP_PORT *x;
+{
+  if (!x) return;
+  if (x->link_fd >= 0) close(x->link_fd);
+  if (x->prog_fd >= 0) close(x->prog_fd);
+  if (x->map_fd >= 0)  close(x->map_fd);
+  if (x->rx.map)   munmap(x->rx.map, x->rx.map_len);
+  if (x->tx.map)   munmap(x->tx.map, x->tx.map_len);
+  if (x->fill.map) munmap(x->fill.map, x->fill.map_len);
+  if (x->comp.map) munmap(x->comp.map, x->comp.map_len);
+  if (x->fd >= 0)  close(x->fd);
+  if (x->umem) munmap(x->umem, (size_t) XDP_NUM_FRAMES * XDP_FRAME_SIZE);
+  if (x->ctl >= 0) close(x->ctl);
+  free(x);
+}
+
+#else
+
+/*
+ * Without AF_XDP support the port can never be opened, and the
+ * normal socket paths are used.
+ */
+XDP_PORT *
+xdp_open(ifname, ident)
+char *ifname; int ident;
+{
+  (void) ifname; (void) ident;
+  errno = ENOSYS;
+  return NULL;
+}
+
+int
+xdp_fd(x)
+XDP_PORT *x;
+{
+  (void) x;
+  return -1;
+}
+
+int
+xdp_resolve(x, dst, mac)
+XDP_PORT *x; struct in_addr dst; unsigned char *mac;
+{
+  (void) x; (void) dst; (void) mac;
+  return -1;
+}
+
+int
+xdp_send(x, mac, dst, icmp, len)
+XDP_PORT *x; unsigned char *mac; struct in_addr dst; unsigned char *icmp; int len;
+{
+  (void) x; (void) mac; (void) dst; (void) icmp; (void) len;
+  return -1;
+}
+
+int
+xdp_read(x, handler, arg)
+XDP_PORT *x; xdp_handler handler; void *arg;
+{
+  (void) x; (void) handler; (void) arg;
+  return 0;
+}
+
+void
+xdp_close(x)
+XDP_PORT *x;
+{
+  (void) x;
+}
+
+#endif
@@ -0,0 +1,18 @@
+
+#include <sys/time.h>
+#include <netinet/in.h>
+
+typedef struct xdp_port XDP_PORT;
+
+/* called for each packet: network header, length, source MAC (or NULL),
+   and receive timestamp (NULL, AF_XDP does not provide one) */
+typedef void (*xdp_handler)(void *arg, unsigned char *pkt, int len,
+                            unsigned char *mac, struct timeval *stamp);
+
+extern XDP_PORT *xdp_open(char *ifname, int ident);
+extern int xdp_fd(XDP_PORT *x);
+extern int xdp_resolve(XDP_PORT *x, struct in_addr dst, unsigned char *mac);
+extern int xdp_send(XDP_PORT *x, unsigned char *mac, struct in_addr dst,
+                    unsigned char *icmp, int len);
+extern int xdp_read(XDP_PORT *x, xdp_handler handler, void *arg);
+extern void xdp_close(XDP_PORT *x);